@@ -0,0 +1,315 @@
+#include "bsp.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <glm/gtc/type_ptr.hpp>
+
+template<typename T>
+static bool ReadSection(const std::vector<uint8_t>& data, uint32_t offset, uint32_t count, std::vector<T>* out)
+{
+	if ( offset > data.size() || (uint64_t)count * sizeof(T) > data.size() - offset ) {
+		return false;
+	}
+	out->resize(count);
+	if ( count > 0 ) {
+		memcpy(out->data(), &data[offset], count * sizeof(T));
+	}
+
+	return true;
+}
+
+bool BSPTree::Load(std::string fileName)
+{
+	FILE* file = fopen(fileName.c_str(), "rb");
+	if ( !file ) {
+		printf("unable to open file: %s\n", fileName.c_str());
+		return false;
+	}
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	std::vector<uint8_t> data(size > 0 ? size : 0);
+	bool isRead = size > 0 && fread(data.data(), 1, data.size(), file) == data.size();
+	fclose(file);
+
+	BSPHeader header;
+	if ( !isRead || data.size() < sizeof(header) ) {
+		printf("unable to read BSP: %s\n", fileName.c_str());
+		return false;
+	}
+	memcpy(&header, data.data(), sizeof(header));
+	if ( header.magic != BSP_MAGIC || header.version != BSP_VERSION
+		|| !ReadSection(data, header.planesOffset, header.planeCount, &m_Planes)
+		|| !ReadSection(data, header.nodesOffset, header.nodeCount, &m_Nodes)
+		|| !ReadSection(data, header.leavesOffset, header.leafCount, &m_Leaves)
+		|| !ReadSection(data, header.facesOffset, header.faceCount, &m_Faces)
+		|| !ReadSection(data, header.visOffset, header.visSize, &m_Vis)
+		|| !ReadSection(data, header.hullsOffset, header.hullCount, &m_Hulls)
+		|| !ReadSection(data, header.brushesOffset, header.brushCount, &m_Brushes)
+		|| !ReadSection(data, header.brushPlanesOffset, header.brushPlaneCount, &m_BrushPlanes)
+		|| !ReadSection(data, header.leafBrushesOffset, header.leafBrushCount, &m_LeafBrushes) ) {
+		printf("invalid BSP: %s\n", fileName.c_str());
+		return false;
+	}
+
+	// FindLeaf trusts the indices, so check them once here.
+	for ( size_t i = 0; i < m_Nodes.size(); i++ ) {
+		if ( m_Nodes[i].plane < 0 || (uint32_t)m_Nodes[i].plane >= header.planeCount ) {
+			printf("invalid BSP: %s\n", fileName.c_str());
+			return false;
+		}
+		for ( int c = 0; c < 2; c++ ) {
+			int32_t child = m_Nodes[i].children[c];
+			// Children come after their parent, so walking the tree always ends in a leaf.
+			if ( (child >= 0 && (child <= (int32_t)i || (uint32_t)child >= header.nodeCount))
+				|| (child < 0 && (uint32_t)(-(child + 1)) >= header.leafCount) ) {
+				printf("invalid BSP: %s\n", fileName.c_str());
+				return false;
+			}
+		}
+	}
+	for ( size_t i = 0; i < m_Leaves.size(); i++ ) {
+		if ( (uint64_t)m_Leaves[i].firstFace + m_Leaves[i].faceCount > header.faceCount
+			|| (m_Leaves[i].visOffset != BSP_NO_VIS && m_Leaves[i].visOffset >= header.visSize)
+			|| (uint64_t)m_Leaves[i].firstBrush + m_Leaves[i].brushCount > header.leafBrushCount ) {
+			printf("invalid BSP: %s\n", fileName.c_str());
+			return false;
+		}
+	}
+	// Every hull has the same brushes, m_LeafBrushes indexes into any of them.
+	for ( size_t i = 0; i < m_Hulls.size(); i++ ) {
+		if ( (uint64_t)m_Hulls[i].firstBrush + m_Hulls[i].brushCount > header.brushCount
+			|| m_Hulls[i].brushCount != m_Hulls[0].brushCount ) {
+			printf("invalid BSP: %s\n", fileName.c_str());
+			return false;
+		}
+	}
+	for ( size_t i = 0; i < m_Brushes.size(); i++ ) {
+		if ( (uint64_t)m_Brushes[i].firstPlane + m_Brushes[i].planeCount > header.brushPlaneCount ) {
+			printf("invalid BSP: %s\n", fileName.c_str());
+			return false;
+		}
+	}
+	for ( size_t i = 0; i < m_LeafBrushes.size(); i++ ) {
+		if ( m_Hulls.empty() || m_LeafBrushes[i] >= m_Hulls[0].brushCount ) {
+			printf("invalid BSP: %s\n", fileName.c_str());
+			return false;
+		}
+	}
+	if ( m_Leaves.empty() ) {
+		printf("invalid BSP: %s\n", fileName.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+// One plane test per level of the tree.
+uint32_t BSPTree::FindLeaf(glm::vec3 pos) const
+{
+	if ( m_Nodes.empty() ) {
+		return 0;
+	}
+
+	int32_t child = 0;
+	while ( child >= 0 ) {
+		const BSPNode&	node	= m_Nodes[child];
+		const BSPPlane& plane	= m_Planes[node.plane];
+		child = node.children[glm::dot(plane.n, pos) + plane.d >= 0.0f ? 0 : 1];
+	}
+
+	return (uint32_t)(-(child + 1));
+}
+
+bool BSPTree::IsSolid(glm::vec3 pos) const
+{
+	return m_Leaves[FindLeaf(pos)].contents == BSP_SOLID;
+}
+
+struct BSPTracer
+{
+	const BSPTree*	tree;
+	const BSPHull*	hull;
+	glm::vec3		start;
+	glm::vec3		end;
+	glm::vec3		offset;		// Of the box's center from the traced point
+	glm::vec3		extents;	// Half the box
+	BSPTrace		trace;
+};
+
+// Keeps the nearest entry into the brush.
+static void ClipBrush(BSPTracer* tracer, const BSPBrush& brush)
+{
+	const glm::vec3& start	= tracer->start;
+	const glm::vec3& end	= tracer->end;
+	if ( glm::any(glm::greaterThan(glm::min(start, end), glm::make_vec3(brush.max)))
+		|| glm::any(glm::lessThan(glm::max(start, end), glm::make_vec3(brush.min))) ) {
+		return;
+	}
+
+	float enter = -1.0f, exit = 1.0f;
+	glm::vec3 enterNormal(0.0f);
+	bool startsOutside = false;
+	for ( uint32_t p = brush.firstPlane; p < brush.firstPlane + brush.planeCount; p++ ) {
+		const BSPPlane& plane = tracer->tree->m_BrushPlanes[p];
+		float d0 = glm::dot(plane.n, start) + plane.d;
+		float d1 = glm::dot(plane.n, end) + plane.d;
+		startsOutside |= d0 > 0.0f;
+		if ( d0 > 0.0f && (d1 >= BSP_DIST_EPSILON || d1 >= d0) ) {
+			return; // In front of the plane all the way
+		}
+		else if ( d0 <= 0.0f && d1 <= 0.0f ) {
+			continue; // Behind it all the way, the other planes decide
+		}
+		else if ( d0 > d1 ) {
+			float f = (d0 - BSP_DIST_EPSILON) / (d0 - d1);
+			if ( f > enter ) {
+				enter		= f;
+				enterNormal	= plane.n;
+			}
+		}
+		else {
+			exit = glm::min(exit, (d0 + BSP_DIST_EPSILON) / (d0 - d1));
+		}
+	}
+
+	if ( !startsOutside ) {
+		tracer->trace.startSolid	= true;
+		tracer->trace.fraction		= 0.0f;
+	}
+	else if ( enter < exit && enter > -1.0f && enter < tracer->trace.fraction ) {
+		tracer->trace.fraction	= glm::max(enter, 0.0f);
+		tracer->trace.normal	= enterNormal;
+	}
+}
+
+// s0 .. s1: the part of the trace in the node's region. The box is kept
+// around the trace by widening every plane by the box's extent along it.
+static void TraceNode(BSPTracer* tracer, int32_t child, float s0, float s1)
+{
+	const BSPTree& tree = *tracer->tree;
+	if ( s0 >= tracer->trace.fraction ) {
+		return; // Something nearer was hit already
+	}
+
+	if ( child < 0 ) {
+		const BSPLeaf& leaf = tree.m_Leaves[-(child + 1)];
+		for ( uint32_t i = leaf.firstBrush; i < leaf.firstBrush + leaf.brushCount; i++ ) {
+			ClipBrush(tracer, tree.m_Brushes[tracer->hull->firstBrush + tree.m_LeafBrushes[i]]);
+		}
+		return;
+	}
+
+	const BSPNode&	node	= tree.m_Nodes[child];
+	const BSPPlane& plane	= tree.m_Planes[node.plane];
+	glm::vec3 delta = tracer->end - tracer->start;
+	float t0 = glm::dot(plane.n, tracer->start + s0 * delta + tracer->offset) + plane.d;
+	float t1 = glm::dot(plane.n, tracer->start + s1 * delta + tracer->offset) + plane.d;
+	float radius = glm::dot(glm::abs(plane.n), tracer->extents) + 1.0f;
+	if ( t0 >= radius && t1 >= radius ) {
+		TraceNode(tracer, node.children[0], s0, s1);
+	}
+	else if ( t0 < -radius && t1 < -radius ) {
+		TraceNode(tracer, node.children[1], s0, s1);
+	}
+	else if ( t0 == t1 ) {
+		TraceNode(tracer, node.children[0], s0, s1);
+		TraceNode(tracer, node.children[1], s0, s1);
+	}
+	else {
+		// The parts with t >= -radius and t <= radius, near side first.
+		float front	= glm::clamp((t0 + radius) / (t0 - t1), 0.0f, 1.0f);
+		float back	= glm::clamp((t0 - radius) / (t0 - t1), 0.0f, 1.0f);
+		if ( t0 >= t1 ) {
+			TraceNode(tracer, node.children[0], s0, s0 + (s1 - s0) * front);
+			TraceNode(tracer, node.children[1], s0 + (s1 - s0) * back, s1);
+		}
+		else {
+			TraceNode(tracer, node.children[1], s0, s0 + (s1 - s0) * back);
+			TraceNode(tracer, node.children[0], s0 + (s1 - s0) * front, s1);
+		}
+	}
+}
+
+BSPTrace BSPTree::TraceBox(uint32_t hull, glm::vec3 start, glm::vec3 end) const
+{
+	BSPTracer tracer	= { };
+	tracer.tree			= this;
+	tracer.start		= start;
+	tracer.end			= end;
+	tracer.trace		= { 1.0f, end, glm::vec3(0.0f), false };
+	if ( hull >= m_Hulls.size() ) {
+		return tracer.trace; // Maps without hulls collide with nothing
+	}
+
+	tracer.hull		= &m_Hulls[hull];
+	glm::vec3 mins	= glm::make_vec3(tracer.hull->mins);
+	glm::vec3 maxs	= glm::make_vec3(tracer.hull->maxs);
+	tracer.offset	= 0.5f * (mins + maxs);
+	tracer.extents	= 0.5f * (maxs - mins);
+	TraceNode(&tracer, m_Nodes.empty() ? -1 : 0, 0.0f, 1.0f);
+	tracer.trace.endPos = start + tracer.trace.fraction * (end - start);
+
+	return tracer.trace;
+}
+
+void BSPTree::DecompressVis(uint32_t leaf, std::vector<uint8_t>* row) const
+{
+	size_t rowSize = (m_Leaves.size() + 7) / 8;
+	uint32_t visOffset = m_Leaves[leaf].visOffset;
+	if ( visOffset == BSP_NO_VIS ) {
+		row->assign(rowSize, 0xFF);
+		return;
+	}
+
+	// A broken row must not read past m_Vis, whatever is missing stays visible.
+	row->assign(rowSize, 0xFF);
+	size_t in = visOffset;
+	for ( size_t i = 0; i < rowSize && in < m_Vis.size(); ) {
+		if ( m_Vis[in] ) {
+			(*row)[i++] = m_Vis[in++];
+		}
+		else if ( in + 1 < m_Vis.size() ) {
+			size_t end = i + m_Vis[in + 1] < rowSize ? i + m_Vis[in + 1] : rowSize;
+			for ( ; i < end; i++ ) {
+				(*row)[i] = 0;
+			}
+			in += 2;
+		}
+		else {
+			break;
+		}
+	}
+}
+
+// Walks down both sides of every plane the box straddles, like FindLeaf for a point.
+static bool IsBoxNodeVisible(const BSPTree& tree, int32_t child, const std::vector<uint8_t>& pvs, glm::vec3 center, glm::vec3 extents)
+{
+	while ( child >= 0 ) {
+		const BSPNode&	node	= tree.m_Nodes[child];
+		const BSPPlane& plane	= tree.m_Planes[node.plane];
+		float t			= glm::dot(plane.n, center) + plane.d;
+		float radius	= glm::dot(glm::abs(plane.n), extents);
+		if ( t >= radius ) {
+			child = node.children[0];
+		}
+		else if ( t < -radius ) {
+			child = node.children[1];
+		}
+		else {
+			if ( IsBoxNodeVisible(tree, node.children[0], pvs, center, extents) ) {
+				return true;
+			}
+			child = node.children[1];
+		}
+	}
+
+	uint32_t leaf = (uint32_t)(-(child + 1));
+	return (pvs[leaf >> 3] & (1 << (leaf & 7))) != 0;
+}
+
+bool BSPTree::IsBoxVisible(const std::vector<uint8_t>& pvs, glm::vec3 mins, glm::vec3 maxs) const
+{
+	return IsBoxNodeVisible(*this, m_Nodes.empty() ? -1 : 0, pvs, 0.5f * (mins + maxs), 0.5f * (maxs - mins));
+}
@@ -0,0 +1,73 @@
+#ifndef _BSP_H_
+#define _BSP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "bspfile.h"
+
+// world.bsp as written by the polysoup tool (-bsp). The file's structs come
+// from src/tools/polysoup/bspfile.h, only the planes are read as glm vectors.
+
+#define BSP_DIST_EPSILON	(0.03125f) // Traces stop this far in front of a brush
+
+// Boxes the collision hulls are built for, see src/tools/polysoup/hull.h.
+enum BSPHullType
+{
+	BSP_HULL_POINT,		// 0 0 0
+	BSP_HULL_PLAYER,	// -16 -16 -24 .. 16 16 32
+	BSP_HULL_LARGE		// -32 -32 -24 .. 32 32 64
+};
+
+// BSPFilePlane with n as a glm::vec3.
+struct BSPPlane
+{
+	glm::vec3	n;
+	float		d;	// Distance of p to the plane = n dot p + d
+};
+
+static_assert(sizeof(BSPPlane) == sizeof(BSPFilePlane) && offsetof(BSPPlane, d) == offsetof(BSPFilePlane, d),
+	"BSPPlane must match BSPFilePlane");
+
+struct BSPTrace
+{
+	float		fraction;	// Of the way to end, 1: nothing hit
+	glm::vec3	endPos;
+	glm::vec3	normal;		// Of the plane that was hit
+	bool		startSolid;
+};
+
+class BSPTree
+{
+public:
+	bool		Load(std::string fileName);
+	uint32_t	FindLeaf(glm::vec3 pos) const;
+	bool		IsSolid(glm::vec3 pos) const;
+
+	// Moves the box of the hull from start to end, it stops at the first brush
+	// in its way. The box is placed relative to its position as in BSPHull.
+	BSPTrace	TraceBox(uint32_t hull, glm::vec3 start, glm::vec3 end) const;
+
+	// PVS row of a leaf, one bit per leaf. Rows are run-length compressed:
+	// a zero byte is followed by the number of zero bytes it stands for.
+	void		DecompressVis(uint32_t leaf, std::vector<uint8_t>* row) const;
+
+	// Whether pvs (a row from DecompressVis) has any of the leaves the box touches.
+	bool		IsBoxVisible(const std::vector<uint8_t>& pvs, glm::vec3 mins, glm::vec3 maxs) const;
+
+	std::vector<BSPPlane>	m_Planes;
+	std::vector<BSPNode>	m_Nodes;	// Empty: the whole world is leaf 0
+	std::vector<BSPLeaf>	m_Leaves;
+	std::vector<BSPFace>	m_Faces;
+	std::vector<uint8_t>	m_Vis;
+	std::vector<BSPHull>	m_Hulls;
+	std::vector<BSPBrush>	m_Brushes;
+	std::vector<BSPPlane>	m_BrushPlanes;
+	std::vector<uint32_t>	m_LeafBrushes;	// Brushes touching a leaf, + BSPHull::firstBrush
+};
+
+#endif
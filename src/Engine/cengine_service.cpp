@@ -22,6 +22,7 @@ Player * CEngineService::CreatePlayer(glm::vec3 startPos, std::string model)
     AnimatedModel modelData = m_Renderer->RegisterModel(model);
     
     player.animModel = modelData;
+    player.aabb      = modelData.bounds;
     player.modelName = model;
     player.pos = startPos;
     m_Players.push_back(player);
@@ -41,3 +42,10 @@ void CEngineService::RenderFrame()
 {
     m_Renderer->RenderFrame(m_Players, m_ActiveCamera);
 }
+
+e3Trace CEngineService::Trace(glm::vec3 start, glm::vec3 end, uint32_t hull)
+{
+    BSPTrace trace = m_Renderer->m_World.TraceBox(hull, start, end);
+
+    return { trace.fraction, trace.endPos, trace.normal, trace.startSolid };
+}
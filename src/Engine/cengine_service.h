@@ -28,6 +28,7 @@ public:
 	Player *					CreatePlayer(glm::vec3 startPos, std::string model);
 	Camera*						CreateCamera(glm::vec3 pos);
 	void						RenderFrame();
+	e3Trace						Trace(glm::vec3 start, glm::vec3 end, uint32_t hull);
 
 	Renderer *					m_Renderer;
     std::string					m_ExePath;
@@ -26,6 +26,15 @@ struct e3Input
     bool mouseButtonID[ 256 ];
 };
 
+// Hulls: 0 point, 1 player (-16 -16 -24 .. 16 16 32), 2 large (-32 -32 -24 .. 32 32 64)
+struct e3Trace
+{
+    float     fraction; // 1: nothing in the way
+    glm::vec3 endPos;
+    glm::vec3 normal;
+    bool      startSolid;
+};
+
 class IEngineService
 {
   public:
@@ -33,6 +42,7 @@ class IEngineService
     virtual Player* CreatePlayer(glm::vec3 startPos, std::string model) = 0;
     virtual Camera* CreateCamera(glm::vec3 pos)                         = 0;
     virtual void    RenderFrame()                                       = 0;
+    virtual e3Trace Trace(glm::vec3 start, glm::vec3 end, uint32_t hull) = 0;
 };
 
 // GameDLL must implement this, so the engine can call into
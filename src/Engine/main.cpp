@@ -86,6 +86,22 @@ int main(int argc, char** argv)
 
     // TODO: Pipelinecreation somewhere else and more 'generic'?
     renderer->CreateAnimatedModelPipeline("shaders/animatedModel_vert.spv", "shaders/animatedModel_frag.spv");
+    renderer->CreateWorldPipeline("shaders/world_vert.spv", "shaders/world_frag.spv");
+
+    // A .map on the command line gets compiled while the engine is already running.
+    // world.bsp and navmesh.bin belong to some other map then, so they stay unloaded.
+    std::string mapFile = argc > 1 ? argv[ 1 ] : "";
+    if ( mapFile.size() > 4 && mapFile.compare(mapFile.size() - 4, 4, ".map") == 0 )
+    {
+        renderer->CompileWorld(mapFile);
+    }
+    else
+    {
+        // Optional: without a compiled world nothing gets culled.
+        renderer->LoadWorld("world.bsp");
+        renderer->LoadWorldMesh("world.mesh");
+        renderer->LoadNavMesh("navmesh.bin");
+    }
 
     IEngineService* engineService = new CEngineService("../data/", renderer);
     IGameClient*    gameClient    = GetGameClient(engineService);
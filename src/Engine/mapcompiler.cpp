@@ -0,0 +1,51 @@
+#include "mapcompiler.h"
+
+#include <stdio.h>
+#include <algorithm>
+
+// Only the polysoup library's own headers in here: some of them have the same
+// names as the engine's (bsp.h, worldmesh.h, navmesh.h).
+#include <libpolysoup.h>
+
+MapCompiler::~MapCompiler()
+{
+	Finish();
+}
+
+// One hardware thread is left to the renderer.
+bool MapCompiler::Start(std::string mapFile, std::string worldMeshFile)
+{
+	if ( m_Thread.joinable() ) {
+		return false;
+	}
+
+	PolysoupOptions options = defaultPolysoupOptions;
+	options.threadCount = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+	m_IsDone = false;
+	m_IsCompiled = false;
+	m_Thread = std::thread([this, mapFile, worldMeshFile, options]() {
+		m_IsCompiled = compileWorldMesh(mapFile.c_str(), worldMeshFile.c_str(), options);
+		if ( !m_IsCompiled ) {
+			printf("unable to compile map: %s\n", mapFile.c_str());
+		}
+		m_IsDone = true;
+	});
+
+	return true;
+}
+
+bool MapCompiler::IsDone() const
+{
+	return m_IsDone;
+}
+
+bool MapCompiler::Finish()
+{
+	if ( !m_Thread.joinable() ) {
+		return false;
+	}
+	m_Thread.join();
+	m_IsDone = false;
+
+	return m_IsCompiled;
+}
@@ -0,0 +1,26 @@
+#ifndef _MAPCOMPILER_H_
+#define _MAPCOMPILER_H_
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+// Compiles a .map into a world.mesh with the polysoup library, on a thread of
+// its own: the engine keeps rendering while a mapper's raw .map gets built.
+// Start it, check IsDone every frame and Finish once it is.
+class MapCompiler
+{
+public:
+	MapCompiler() : m_IsDone(false), m_IsCompiled(false) {}
+	~MapCompiler();
+
+	bool				Start(std::string mapFile, std::string worldMeshFile);
+	bool				IsDone() const;		// The thread has finished and Finish was not called yet
+	bool				Finish();			// Waits for the thread. True if the world.mesh was written.
+
+	std::thread			m_Thread;
+	std::atomic<bool>	m_IsDone;
+	bool				m_IsCompiled;		// Written by the thread, read after it was joined
+};
+
+#endif
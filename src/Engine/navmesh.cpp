@@ -0,0 +1,126 @@
+#include "navmesh.h"
+
+#include <math.h>
+#include <stdio.h>
+
+static uint64_t AlignNavMeshOffset(uint64_t offset)
+{
+	return (offset + NAVMESH_ALIGNMENT - 1) & ~(uint64_t)(NAVMESH_ALIGNMENT - 1);
+}
+
+bool NavMesh::Load(std::string fileName)
+{
+	Unload();
+	if ( atp_map_file(fileName.c_str(), &m_File) != ATP_SUCCESS ) {
+		return false;
+	}
+
+	const NavMeshHeader* header = (const NavMeshHeader*)m_File.data;
+	bool isValid = m_File.size >= sizeof(NavMeshHeader)
+		&& header->magic == NAVMESH_MAGIC && header->version == NAVMESH_VERSION
+		&& header->maxPolyVertices == NAVMESH_MAX_POLY_VERTICES
+		&& header->tileCells > 0 && header->cellSize > 0.0f && header->cellHeight > 0.0f
+		&& (uint64_t)header->tileCount * sizeof(NavMeshTileHeader) <= m_File.size - sizeof(NavMeshHeader)
+		&& (uint64_t)header->tilesX * header->tilesY >= header->tileCount;
+
+	// The tiles' positions and where they lie in the file, not what is in them.
+	const NavMeshTileHeader* tiles = (const NavMeshTileHeader*)(m_File.data + sizeof(NavMeshHeader));
+	if ( isValid ) {
+		m_TileGrid.assign((size_t)header->tilesX * header->tilesY, -1);
+	}
+	for ( uint32_t i = 0; isValid && i < header->tileCount; i++ ) {
+		const NavMeshTileHeader& tile = tiles[i];
+		isValid = tile.x >= 0 && (uint32_t)tile.x < header->tilesX
+			&& tile.y >= 0 && (uint32_t)tile.y < header->tilesY
+			&& m_TileGrid[(size_t)tile.y * header->tilesX + tile.x] < 0
+			&& tile.size == AlignNavMeshOffset((uint64_t)tile.vertexCount * sizeof(NavMeshVertex)) + (uint64_t)tile.polyCount * sizeof(NavMeshPoly)
+			&& tile.offset % NAVMESH_ALIGNMENT == 0
+			&& tile.offset <= m_File.size && tile.size <= m_File.size - tile.offset;
+		if ( isValid ) {
+			m_TileGrid[(size_t)tile.y * header->tilesX + tile.x] = (int32_t)i;
+		}
+	}
+	if ( !isValid ) {
+		printf("invalid navmesh: %s\n", fileName.c_str());
+		Unload();
+		return false;
+	}
+
+	m_Header	= header;
+	m_Tiles		= tiles;
+	m_TileCount	= header->tileCount;
+	m_TileState.assign(m_TileCount, 0);
+
+	return true;
+}
+
+void NavMesh::Unload()
+{
+	if ( m_File.data ) {
+		atp_unmap_file(&m_File);
+	}
+	*this = NavMesh();
+}
+
+int32_t NavMesh::FindTile(glm::vec3 pos) const
+{
+	if ( !m_Header ) {
+		return -1;
+	}
+	float tileSize = m_Header->tileCells * m_Header->cellSize;
+	float x = floorf((pos.x - m_Header->origin[0]) / tileSize);
+	float y = floorf((pos.y - m_Header->origin[1]) / tileSize);
+	if ( x < 0.0f || y < 0.0f || x >= (float)m_Header->tilesX || y >= (float)m_Header->tilesY ) {
+		return -1;
+	}
+
+	return m_TileGrid[(size_t)y * m_Header->tilesX + (size_t)x];
+}
+
+// A polygon's vertices must be in its tile and its neighbors a polygon of the
+// tile, a wall or a portal. A tile that fails is left out, not the whole mesh.
+bool NavMesh::GetTile(int32_t tile, NavMeshTileData* data)
+{
+	if ( tile < 0 || (uint32_t)tile >= m_TileCount || m_TileState[tile] == 2 ) {
+		return false;
+	}
+
+	const NavMeshTileHeader& header = m_Tiles[tile];
+	data->vertices		= (const NavMeshVertex*)(m_File.data + header.offset);
+	data->vertexCount	= header.vertexCount;
+	data->polys			= (const NavMeshPoly*)(m_File.data + header.offset + AlignNavMeshOffset((uint64_t)header.vertexCount * sizeof(NavMeshVertex)));
+	data->polyCount		= header.polyCount;
+	if ( m_TileState[tile] == 1 ) {
+		return true;
+	}
+
+	bool isValid = true;
+	for ( uint32_t i = 0; isValid && i < data->vertexCount; i++ ) {
+		isValid = data->vertices[i].x <= m_Header->tileCells && data->vertices[i].y <= m_Header->tileCells;
+	}
+	for ( uint32_t i = 0; isValid && i < data->polyCount; i++ ) {
+		const NavMeshPoly& poly = data->polys[i];
+		isValid = poly.vertexCount >= 3 && poly.vertexCount <= NAVMESH_MAX_POLY_VERTICES;
+		for ( uint32_t j = 0; isValid && j < poly.vertexCount; j++ ) {
+			uint16_t neighbor = poly.neighbors[j];
+			isValid = poly.vertices[j] < data->vertexCount
+				&& (neighbor == NAVMESH_NO_NEIGHBOR
+					|| (neighbor & NAVMESH_PORTAL ? (neighbor & ~NAVMESH_PORTAL) <= NAVMESH_SIDE_MIN_Y : neighbor < data->polyCount));
+		}
+	}
+	m_TileState[tile] = isValid ? 1 : 2;
+	if ( !isValid ) {
+		printf("invalid navmesh tile: %d, %d\n", header.x, header.y);
+	}
+
+	return isValid;
+}
+
+glm::vec3 NavMesh::GetVertex(int32_t tile, const NavMeshVertex& vertex) const
+{
+	const NavMeshTileHeader& header = m_Tiles[tile];
+	return glm::vec3(
+		m_Header->origin[0] + (float)(header.x * m_Header->tileCells + vertex.x) * m_Header->cellSize,
+		m_Header->origin[1] + (float)(header.y * m_Header->tileCells + vertex.y) * m_Header->cellSize,
+		m_Header->origin[2] + (float)vertex.h * m_Header->cellHeight);
+}
@@ -0,0 +1,111 @@
+#ifndef _NAVMESH_H_
+#define _NAVMESH_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "platform.h"
+
+// navmesh.bin as written by polysoup -nav: convex polygons an agent of the
+// player's size can walk on, in square tiles. Must match
+// src/tools/polysoup/navmesh.h.
+
+#define NAVMESH_MAGIC				(0x4D56414E) // 'NAVM'
+#define NAVMESH_VERSION				(1)
+#define NAVMESH_ALIGNMENT			(16)
+#define NAVMESH_MAX_POLY_VERTICES	(6)
+#define NAVMESH_NO_NEIGHBOR			(0xFFFF)
+#define NAVMESH_PORTAL				(0x8000)	// | side: the neighbor is in the next tile that way
+
+enum NavMeshSide
+{
+	NAVMESH_SIDE_MIN_X,
+	NAVMESH_SIDE_MAX_Y,
+	NAVMESH_SIDE_MAX_X,
+	NAVMESH_SIDE_MIN_Y
+};
+
+struct NavMeshHeader
+{
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	tileCount;
+	uint32_t	tileCells;
+	float		origin[3];
+	float		cellSize;
+	float		cellHeight;
+	float		agentHeight;
+	float		agentRadius;
+	float		agentClimb;
+	uint32_t	tilesX;
+	uint32_t	tilesY;
+	uint32_t	maxPolyVertices;
+	uint32_t	reserved;
+};
+
+// Sorted by y, then x. Tiles without polygons are not in the file.
+struct NavMeshTileHeader
+{
+	int32_t		x;
+	int32_t		y;
+	uint32_t	vertexCount;
+	uint32_t	polyCount;
+	uint64_t	offset;
+	uint64_t	size;
+};
+
+// x, y: cells from the tile's corner. h: cell heights above the origin.
+struct NavMeshVertex
+{
+	uint16_t	x;
+	uint16_t	h;
+	uint16_t	y;
+};
+
+// Convex and counter-clockwise seen from above. neighbors[ i ] is across the
+// edge from vertices[ i ] to the next one.
+struct NavMeshPoly
+{
+	uint16_t	vertices[NAVMESH_MAX_POLY_VERTICES];
+	uint16_t	neighbors[NAVMESH_MAX_POLY_VERTICES];
+	uint8_t		vertexCount;
+	uint8_t		area;
+	uint16_t	region;
+};
+
+struct NavMeshTileData
+{
+	const NavMeshVertex*	vertices;
+	uint32_t				vertexCount;
+	const NavMeshPoly*		polys;
+	uint32_t				polyCount;
+};
+
+// A mapped navmesh.bin. Load only checks the header and the tile table, a
+// tile's polygons are checked the first time GetTile hands them out, so only
+// the pages of the tiles in use get read. The pointers point into the mapping
+// and are valid until Unload.
+class NavMesh
+{
+public:
+	NavMesh() : m_File(), m_Header(nullptr), m_Tiles(nullptr), m_TileCount(0) {}
+
+	bool					Load(std::string fileName);
+	void					Unload();
+
+	int32_t					FindTile(glm::vec3 pos) const;	// -1 if there is no tile there
+	bool					GetTile(int32_t tile, NavMeshTileData* data);
+	glm::vec3				GetVertex(int32_t tile, const NavMeshVertex& vertex) const;
+
+	ATP_MappedFile				m_File;
+	const NavMeshHeader*		m_Header;
+	const NavMeshTileHeader*	m_Tiles;
+	uint32_t					m_TileCount;
+	std::vector<int32_t>		m_TileGrid;		// tilesX * tilesY, the tile at x, y or -1
+	std::vector<uint8_t>		m_TileState;	// 0: not checked yet, 1: valid, 2: invalid
+};
+
+#endif
@@ -101,8 +101,108 @@ std::string atp_get_exe_path(void)
     return std::string(out_buffer);
 }
 
-#elif __APPLE__
+ATP_Status atp_map_file(char const * filename, ATP_MappedFile * out_File)
+{
+    *out_File = { };
+    HANDLE fileHandle = CreateFile(
+		filename,
+		GENERIC_READ,
+		FILE_SHARE_READ,
+		NULL,
+		OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL,
+		NULL);
+    if (fileHandle == INVALID_HANDLE_VALUE) {
+		printf("unable to open file: %s\n", filename);
+		return ATP_ERROR_READ_FILE;
+    }
 
-#elif __linux__
+    LARGE_INTEGER filesize;
+    if (!GetFileSizeEx(fileHandle, &filesize) || filesize.QuadPart == 0) {
+		CloseHandle(fileHandle);
+		return ATP_ERROR_MAP_FILE;
+    }
+
+    HANDLE mapping = CreateFileMapping(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+    void * data = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+    if (data == NULL) {
+		if (mapping) {
+			CloseHandle(mapping);
+		}
+		CloseHandle(fileHandle);
+		printf("unable to map file: %s\n", filename);
+		return ATP_ERROR_MAP_FILE;
+    }
+
+    out_File->data    = (uint8_t const *)data;
+    out_File->size    = (uint64_t)filesize.QuadPart;
+    out_File->handle  = fileHandle;
+    out_File->mapping = mapping;
+
+    return ATP_SUCCESS;
+}
+
+ATP_Status atp_unmap_file(ATP_MappedFile * file)
+{
+    if (file->data == NULL) {
+		return ATP_ERROR_NO_FILE;
+    }
+
+    UnmapViewOfFile(file->data);
+    CloseHandle((HANDLE)file->mapping);
+    CloseHandle((HANDLE)file->handle);
+    *file = { };
+
+    return ATP_SUCCESS;
+}
+
+#elif __APPLE__ || __linux__
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+ATP_Status atp_map_file(char const * filename, ATP_MappedFile * out_File)
+{
+    *out_File = { };
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+		printf("unable to open file: %s\n", filename);
+		return ATP_ERROR_READ_FILE;
+    }
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0) {
+		close(fd);
+		return ATP_ERROR_MAP_FILE;
+    }
+
+    // The mapping keeps the file alive, the descriptor is not needed anymore.
+    void * data = mmap(NULL, (size_t)fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+		printf("unable to map file: %s\n", filename);
+		return ATP_ERROR_MAP_FILE;
+    }
+
+    out_File->data = (uint8_t const *)data;
+    out_File->size = (uint64_t)fileStat.st_size;
+
+    return ATP_SUCCESS;
+}
+
+ATP_Status atp_unmap_file(ATP_MappedFile * file)
+{
+    if (file->data == NULL) {
+		return ATP_ERROR_NO_FILE;
+    }
+
+    munmap((void *)file->data, (size_t)file->size);
+    *file = { };
+
+    return ATP_SUCCESS;
+}
 
 #endif
@@ -8,7 +8,8 @@ enum ATP_Status
 {
     ATP_SUCCESS,
     ATP_ERROR_READ_FILE,
-    ATP_ERROR_NO_FILE
+    ATP_ERROR_NO_FILE,
+    ATP_ERROR_MAP_FILE
 };
 
 struct ATP_File
@@ -17,9 +18,20 @@ struct ATP_File
     uint32_t   size;
 };
 
+// Read only view of a whole file, the pages get loaded when they are touched.
+struct ATP_MappedFile
+{
+    uint8_t const * data;
+    uint64_t        size;
+    void          * handle;   // File (Windows) or nothing
+    void          * mapping;  // Mapping object (Windows) or nothing
+};
+
 
 ATP_Status  atp_read_file(char const * filename, ATP_File * out_File);
 ATP_Status  atp_destroy_file(ATP_File * file);
 std::string atp_get_exe_path(void);
+ATP_Status  atp_map_file(char const * filename, ATP_MappedFile * out_File);
+ATP_Status  atp_unmap_file(ATP_MappedFile * file);
 
 #endif
@@ -13,6 +13,11 @@
 #include <glm/ext.hpp>
 
 
+struct AABB {
+	glm::vec3 minXYZ;
+	glm::vec3 maxXYZ;
+};
+
 struct AnimatedModel {
 	VkPipeline       pipeline;
 	VkPipelineLayout pipelineLayout;
@@ -21,18 +26,15 @@ struct AnimatedModel {
 	uint64_t vertexOffset;
 	uint64_t indexOffset;
 	uint64_t indexCount;
-};
 
-struct AABB {
-	glm::vec3 minXYZ;
-	glm::vec3 maxXYZ;
+	AABB     bounds; // Of the vertices, in model space
 };
 
 struct Player {
 	std::string modelName;
 	glm::vec3 pos;
 	glm::quat orientation;
-	AABB aabb;
+	AABB aabb; // Relative to pos
 	AnimatedModel animModel;
 };
 
@@ -1,7 +1,9 @@
 #include <fstream>
 #include <iostream>
 #include <sstream>
+#include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -159,6 +161,70 @@ void Renderer::CreateAnimatedModelPipeline(std::string vertShaderFile, std::stri
     vkal_update_descriptor_set_uniform(m_DescriptorSets[ 0 ], m_AnimatedModelUB, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
 }
 
+// world.mesh comes with plain or quantized vertices, there is a pipeline for each.
+// Both use world.vert, the push constants scale quantized positions into the bounds.
+// Needs m_ViewProjUniform, so it has to come after CreateAnimatedModelPipeline.
+void Renderer::CreateWorldPipeline(std::string vertShaderFile, std::string fragShaderFile)
+{
+    std::vector<uint8_t> vertShader = loadBinaryFile(m_ExePath + m_relAssetPath + vertShaderFile);
+    std::vector<uint8_t> fragShader = loadBinaryFile(m_ExePath + m_relAssetPath + fragShaderFile);
+    ShaderStageSetup     shaderStageSetup
+        = vkal_create_shaders(&vertShader[ 0 ], vertShader.size(), &fragShader[ 0 ], fragShader.size());
+
+    VkDescriptorSetLayoutBinding set_layout[]
+        = { { 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, VK_SHADER_STAGE_VERTEX_BIT, 0 } };
+    VkDescriptorSetLayout descriptor_set_layout = vkal_create_descriptor_set_layout(set_layout, 1);
+    VkDescriptorSet*      descriptor_set        = &m_WorldDescriptorSet;
+    vkal_allocate_descriptor_sets(m_VkalInfo->default_descriptor_pool, &descriptor_set_layout, 1, &descriptor_set);
+    vkal_update_descriptor_set_uniform(m_WorldDescriptorSet, m_ViewProjUniform, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+
+    VkPushConstantRange push_constant_range = { VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(WorldBounds_PC) };
+    m_WorldLayout = vkal_create_pipeline_layout(&descriptor_set_layout, 1, &push_constant_range, 1);
+
+    VkVertexInputBindingDescription   vertex_input_bindings[] = { { 0, sizeof(WorldMeshVertex), VK_VERTEX_INPUT_RATE_VERTEX } };
+    VkVertexInputAttributeDescription vertex_attributes[]     = {
+        { 0, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(WorldMeshVertex, pos) },
+        { 1, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(WorldMeshVertex, normal) },
+        { 2, 0, VK_FORMAT_R32G32_SFLOAT, offsetof(WorldMeshVertex, uv) }
+    };
+    VkVertexInputBindingDescription   quantized_input_bindings[]
+        = { { 0, sizeof(WorldMeshQuantizedVertex), VK_VERTEX_INPUT_RATE_VERTEX } };
+    VkVertexInputAttributeDescription quantized_attributes[] = {
+        { 0, 0, VK_FORMAT_R16G16B16A16_UNORM, offsetof(WorldMeshQuantizedVertex, pos) },
+        { 1, 0, VK_FORMAT_R8G8B8A8_SNORM, offsetof(WorldMeshQuantizedVertex, normal) },
+        { 2, 0, VK_FORMAT_R32G32_SFLOAT, offsetof(WorldMeshQuantizedVertex, uv) }
+    };
+    uint32_t vertex_attribute_count = sizeof(vertex_attributes) / sizeof(*vertex_attributes);
+
+    // Brush faces get drawn from both sides, their winding is not flipped along with y in world.vert.
+    m_WorldPipeline          = vkal_create_graphics_pipeline(vertex_input_bindings,
+                                                    1,
+                                                    vertex_attributes,
+                                                    vertex_attribute_count,
+                                                    shaderStageSetup,
+                                                    VK_TRUE,
+                                                    VK_COMPARE_OP_LESS_OR_EQUAL,
+                                                    VK_CULL_MODE_NONE,
+                                                    VK_POLYGON_MODE_FILL,
+                                                    VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+                                                    VK_FRONT_FACE_CLOCKWISE,
+                                                    m_VkalInfo->render_pass,
+                                                    m_WorldLayout);
+    m_WorldQuantizedPipeline = vkal_create_graphics_pipeline(quantized_input_bindings,
+                                                             1,
+                                                             quantized_attributes,
+                                                             vertex_attribute_count,
+                                                             shaderStageSetup,
+                                                             VK_TRUE,
+                                                             VK_COMPARE_OP_LESS_OR_EQUAL,
+                                                             VK_CULL_MODE_NONE,
+                                                             VK_POLYGON_MODE_FILL,
+                                                             VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+                                                             VK_FRONT_FACE_CLOCKWISE,
+                                                             m_VkalInfo->render_pass,
+                                                             m_WorldLayout);
+}
+
 static std::string loadTextFile(std::string file)
 {
     std::ifstream     iFileStream;
@@ -248,6 +314,13 @@ AnimatedModel Renderer::RegisterModel(std::string model) // TODO: check if model
         }
     }
 
+    animModel.bounds = { glm::vec3(0.0f), glm::vec3(0.0f) };
+    for ( rapidjson::SizeType i = 0; i < vertexCount; i++ )
+    {
+        animModel.bounds.minXYZ = i ? glm::min(animModel.bounds.minXYZ, vertices[ i ].pos) : vertices[ i ].pos;
+        animModel.bounds.maxXYZ = i ? glm::max(animModel.bounds.maxXYZ, vertices[ i ].pos) : vertices[ i ].pos;
+    }
+
     animModel.vertexOffset = vkal_vertex_buffer_add(&vertices[ 0 ], sizeof(VertexFormatAnimatedModel), vertexCount);
     animModel.indexOffset
         = vkal_index_buffer_add(&indices[ 0 ], indexCount); // VKAL's default index buffer expects uint16_t!
@@ -260,10 +333,97 @@ AnimatedModel Renderer::RegisterModel(std::string model) // TODO: check if model
     return animModel;
 }
 
+// world.bsp as compiled by polysoup -vis. Without it RenderFrame draws everything.
+bool Renderer::LoadWorld(std::string bspFile)
+{
+    if ( !m_World.Load(m_ExePath + m_relAssetPath + bspFile) )
+    {
+        m_World = BSPTree();
+        return false;
+    }
+
+    return true;
+}
+
+// navmesh.bin as compiled by polysoup -nav, for the game to move its enemies on.
+// It stays mapped, tiles get checked when they are first used.
+bool Renderer::LoadNavMesh(std::string navMeshFile)
+{
+    return m_NavMesh.Load(m_ExePath + m_relAssetPath + navMeshFile);
+}
+
+// world.mesh as compiled by polysoup. The sections go from the mapped file into
+// VKAL's buffers without being looked at or copied, only the draws and names are kept.
+// A world that gets loaded again (after every CompileWorld) overwrites the ranges
+// of the last one if it fits, a bigger one gets new ranges.
+bool Renderer::LoadWorldMesh(std::string meshFile)
+{
+    WorldMesh mesh;
+    if ( !mesh.Load(m_ExePath + m_relAssetPath + meshFile) )
+    {
+        return false;
+    }
+
+    uint32_t vertexSize  = mesh.m_Header->vertexSize;
+    uint64_t vertexBytes = (uint64_t)mesh.m_VertexCount * vertexSize;
+    if ( vertexBytes <= m_WorldVertexCapacity && mesh.m_IndexCount <= m_WorldIndexCapacity )
+    {
+        vkal_vertex_buffer_update((void*)mesh.m_Vertices, mesh.m_VertexCount, vertexSize, m_WorldVertexOffset);
+        vkal_index_buffer_update((uint16_t*)mesh.m_Indices, mesh.m_IndexCount, m_WorldIndexOffset);
+    }
+    else
+    {
+        m_WorldVertexOffset   = vkal_vertex_buffer_add((void*)mesh.m_Vertices, vertexSize, mesh.m_VertexCount);
+        m_WorldIndexOffset    = vkal_index_buffer_add((uint16_t*)mesh.m_Indices, mesh.m_IndexCount);
+        m_WorldVertexCapacity = vertexBytes;
+        m_WorldIndexCapacity  = mesh.m_IndexCount;
+    }
+    m_WorldVertexSize   = vertexSize;
+    m_WorldIsQuantized  = (mesh.m_Header->flags & WORLDMESH_QUANTIZED) != 0;
+    m_WorldBoundsMin    = glm::vec3(mesh.m_Header->boundsMin[ 0 ], mesh.m_Header->boundsMin[ 1 ], mesh.m_Header->boundsMin[ 2 ]);
+    m_WorldBoundsMax    = glm::vec3(mesh.m_Header->boundsMax[ 0 ], mesh.m_Header->boundsMax[ 1 ], mesh.m_Header->boundsMax[ 2 ]);
+    m_WorldDraws.assign(mesh.m_Draws, mesh.m_Draws + mesh.m_DrawCount);
+    m_WorldMaterials.clear();
+    for ( uint32_t i = 0; i < mesh.m_MaterialCount; i++ )
+    {
+        const WorldMeshMaterial& material = mesh.m_Materials[ i ];
+        m_WorldMaterials.push_back(std::string(material.name, strnlen(material.name, WORLDMESH_NAME_LENGTH)));
+    }
+    mesh.Unload();
+
+    return true;
+}
+
+// A raw .map, compiled by the polysoup library while frames keep being rendered.
+// The world.mesh ends up next to it and gets loaded by the first RenderFrame
+// after the compile is done. Until then whatever world mesh was loaded stays,
+// but the BSP and navmesh are dropped: the compile builds neither, and culling
+// or tracing against another map's tree would be wrong.
+bool Renderer::CompileWorld(std::string mapFile)
+{
+    m_World = BSPTree();
+    m_CameraPVS.clear();
+    m_NavMesh.Unload();
+    m_CompiledWorldMesh = mapFile.substr(0, mapFile.find_last_of('.')) + ".mesh";
+
+    return m_MapCompiler.Start(m_ExePath + m_relAssetPath + mapFile, m_ExePath + m_relAssetPath + m_CompiledWorldMesh);
+}
+
 // TODO: Renderer gets a refresh definition with all the stuff that needs to be done.
 //       For now just the player.
 void Renderer::RenderFrame(std::vector<Player> players, Camera* camera)
 {
+    if ( m_MapCompiler.IsDone() && m_MapCompiler.Finish() )
+    {
+        LoadWorldMesh(m_CompiledWorldMesh);
+    }
+
+    // Decompressed once per frame, after that every player costs a walk down the tree with its box.
+    m_CameraPVS.clear();
+    if ( !m_World.m_Leaves.empty() )
+    {
+        m_World.DecompressVis(m_World.FindLeaf(camera->m_Pos), &m_CameraPVS);
+    }
 
     int width, height;
     SDL_GetWindowSize(m_Window, &width, &height);
@@ -288,6 +448,27 @@ void Renderer::RenderFrame(std::vector<Player> players, Camera* camera)
 
         vkal_begin_render_pass(image_id, m_VkalInfo->render_pass);
 
+        if ( !m_WorldDraws.empty() )
+        {
+            VkPipeline worldPipeline = m_WorldIsQuantized ? m_WorldQuantizedPipeline : m_WorldPipeline;
+            WorldBounds_PC bounds;
+            bounds.min    = glm::vec4(m_WorldIsQuantized ? m_WorldBoundsMin : glm::vec3(0.0f), 0.0f);
+            bounds.extent = glm::vec4(m_WorldIsQuantized ? m_WorldBoundsMax - m_WorldBoundsMin : glm::vec3(1.0f), 0.0f);
+            vkCmdBindPipeline(currentCmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, worldPipeline);
+            vkal_bind_descriptor_set(image_id, &m_WorldDescriptorSet, m_WorldLayout);
+            vkCmdPushConstants(currentCmdBuffer, m_WorldLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(bounds), &bounds);
+            // One draw per material, indices are relative to the draw's first vertex.
+            for ( size_t i = 0; i < m_WorldDraws.size(); ++i )
+            {
+                const WorldMeshDraw& draw = m_WorldDraws[ i ];
+                vkal_draw_indexed(image_id,
+                                  worldPipeline,
+                                  m_WorldIndexOffset + (uint64_t)draw.firstIndex * sizeof(uint16_t),
+                                  draw.indexCount,
+                                  m_WorldVertexOffset + (uint64_t)draw.baseVertex * m_WorldVertexSize);
+            }
+        }
+
         vkCmdBindPipeline(currentCmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_animatedModelPipeline);
         vkal_bind_descriptor_set(image_id, &m_DescriptorSets[ 0 ], m_animatedModelLayout);
         for ( int i = 0; i < players.size(); ++i )
@@ -295,6 +476,13 @@ void Renderer::RenderFrame(std::vector<Player> players, Camera* camera)
 
             Player player = players[ i ];
 
+            // A player standing in a doorway is in more than one leaf, any of them may be visible.
+            if ( !m_CameraPVS.empty()
+                 && !m_World.IsBoxVisible(m_CameraPVS, player.pos + player.aabb.minXYZ, player.pos + player.aabb.maxXYZ) )
+            {
+                continue;
+            }
+
             AnimatedModel_UB onTheFlyBuffer;
             onTheFlyBuffer.modelMat = glm::translate(glm::mat4(1), player.pos);
             vkal_update_uniform(
@@ -4,6 +4,7 @@
 #include <string>
 #include <stdint.h>
 #include <unordered_map>
+#include <vector>
 
 #include <SDL.h>
 #include <glm/glm.hpp>
@@ -11,6 +12,10 @@
 
 #include "player.h"
 #include "camera.h"
+#include "bsp.h"
+#include "worldmesh.h"
+#include "navmesh.h"
+#include "mapcompiler.h"
 
 struct VertexFormatAnimatedModel 
 {
@@ -36,6 +41,13 @@ struct AnimatedModel_UB
 	glm::mat4 modelMat;
 };
 
+// Quantized world.mesh positions are UNORM, pos = min + position * extent.
+struct WorldBounds_PC
+{
+	glm::vec4 min;
+	glm::vec4 extent;
+};
+
 struct ViewProj
 {
 	glm::mat4 viewMat;
@@ -46,14 +58,19 @@ class Renderer
 {
 public:
 	Renderer(std::string relAssetPath) 
-		: m_relAssetPath(relAssetPath)
+		: m_relAssetPath(relAssetPath), m_WorldVertexOffset(0), m_WorldIndexOffset(0), m_WorldVertexCapacity(0), m_WorldIndexCapacity(0)
 	{
 		m_ExePath = SDL_GetBasePath();
 	}
 
 	void											Init(SDL_Window* window);
 	void											CreateAnimatedModelPipeline(std::string vertShaderFile, std::string fragShaderFile);
+	void											CreateWorldPipeline(std::string vertShaderFile, std::string fragShaderFile);
 	AnimatedModel									RegisterModel(std::string model);
+	bool											LoadWorld(std::string bspFile);
+	bool											LoadWorldMesh(std::string meshFile);
+	bool											LoadNavMesh(std::string navMeshFile);
+	bool											CompileWorld(std::string mapFile);
 	void											RenderFrame(std::vector<Player> players, Camera * camera);
 
 	SDL_Window*										m_Window;
@@ -69,6 +86,33 @@ public:
 	std::unordered_map<std::string, AnimatedModel>	m_AnimatedModels;
 	UniformBuffer									m_AnimatedModelUB;
 
+	BSPTree											m_World;		// No leaves: nothing gets culled
+	std::vector<uint8_t>							m_CameraPVS;	// Leaves the camera's leaf can see
+	NavMesh											m_NavMesh;		// Mapped, empty without navmesh.bin
+
+	// world.mesh in VKAL's buffers. A draw's indices start at m_WorldIndexOffset + firstIndex * 2,
+	// its vertices at m_WorldVertexOffset + baseVertex * m_WorldVertexSize.
+	// VKAL can not free parts of its buffers, the next world.mesh goes into the same
+	// ranges if it fits into their capacity.
+	VkPipeline										m_WorldPipeline;
+	VkPipeline										m_WorldQuantizedPipeline;
+	VkPipelineLayout								m_WorldLayout;
+	VkDescriptorSet									m_WorldDescriptorSet;
+	uint64_t										m_WorldVertexOffset;
+	uint64_t										m_WorldIndexOffset;
+	uint64_t										m_WorldVertexCapacity;	// Bytes, 0: no range yet
+	uint32_t										m_WorldIndexCapacity;
+	uint32_t										m_WorldVertexSize;
+	bool											m_WorldIsQuantized;
+	glm::vec3										m_WorldBoundsMin;	// Quantized positions are relative to these
+	glm::vec3										m_WorldBoundsMax;
+	std::vector<WorldMeshDraw>						m_WorldDraws;
+	std::vector<std::string>						m_WorldMaterials;
+
+	// A .map given to CompileWorld, being compiled into m_CompiledWorldMesh.
+	MapCompiler										m_MapCompiler;
+	std::string										m_CompiledWorldMesh;
+
 	ViewProj										m_ViewProj;
 	UniformBuffer									m_ViewProjUniform; // TODO: type should be called VkalUniformBuffer
 };
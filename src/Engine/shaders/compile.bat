@@ -2,4 +2,6 @@
 
 %VULKAN_SDK%/bin/glslc animatedModel.vert -o ../../../bin/data/shaders/animatedModel_vert.spv
 %VULKAN_SDK%/bin/glslc animatedModel.frag -o ../../../bin/data/shaders/animatedModel_frag.spv
+%VULKAN_SDK%/bin/glslc world.vert -o ../../../bin/data/shaders/world_vert.spv
+%VULKAN_SDK%/bin/glslc world.frag -o ../../../bin/data/shaders/world_frag.spv
 
@@ -2,4 +2,6 @@
 
 glslc animatedModel.vert -o ../../../bin/data/shaders/animatedModel_vert.spv
 glslc animatedModel.frag -o ../../../bin/data/shaders/animatedModel_frag.spv
+glslc world.vert -o ../../../bin/data/shaders/world_vert.spv
+glslc world.frag -o ../../../bin/data/shaders/world_frag.spv
 
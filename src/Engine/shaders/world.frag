@@ -0,0 +1,14 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(location = 0) in vec2  in_uv;
+layout(location = 1) in vec3  in_normal;
+
+layout(location = 0) out vec4 outColor;
+
+
+void main() 
+{
+	// No textures yet, the normal tells the faces apart.
+	outColor = vec4(0.5 + 0.5 * normalize(in_normal), 1.0);
+}
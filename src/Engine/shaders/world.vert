@@ -0,0 +1,32 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Both world.mesh vertex formats. Quantized positions come in as UNORM and get
+// scaled into the bounds, plain ones get bounds of 0 and 1.
+layout (location = 0) in vec3    position;
+layout (location = 1) in vec3    normal;
+layout (location = 2) in vec2    uv;
+
+layout (location = 0) out vec2  out_uv;
+layout (location = 1) out vec3  out_normal;
+
+layout (set = 0, binding = 0) uniform ViewProj_t
+{
+    mat4  view;
+    mat4  proj;
+} u_view_proj;
+
+layout (push_constant) uniform Bounds_t
+{
+    vec4  min;
+    vec4  extent;
+} u_bounds;
+
+void main()
+{
+    out_uv = uv;
+    out_normal = normal;
+    vec3 pos = u_bounds.min.xyz + position * u_bounds.extent.xyz;
+	gl_Position = u_view_proj.proj * u_view_proj.view * vec4(pos, 1.0);
+    gl_Position.y = -gl_Position.y; // Hack: vulkan's y is down
+}
@@ -0,0 +1,77 @@
+#include "worldmesh.h"
+
+#include <stdio.h>
+
+// Nothing gets copied: the sections are checked to lie inside the file and
+// the draws to stay inside their sections. The indices themselves are not
+// read, that would touch every page of them.
+bool WorldMesh::Load(std::string fileName)
+{
+	Unload();
+	if ( atp_map_file(fileName.c_str(), &m_File) != ATP_SUCCESS ) {
+		return false;
+	}
+
+	const WorldMeshHeader* header = (const WorldMeshHeader*)m_File.data;
+	bool isValid = m_File.size >= sizeof(WorldMeshHeader)
+		&& header->magic == WORLDMESH_MAGIC && header->version == WORLDMESH_VERSION
+		&& (uint64_t)header->sectionCount * sizeof(WorldMeshSection) <= m_File.size - sizeof(WorldMeshHeader)
+		&& header->vertexSize == ((header->flags & WORLDMESH_QUANTIZED) ? sizeof(WorldMeshQuantizedVertex) : sizeof(WorldMeshVertex));
+
+	// Sections of unknown types are skipped, so newer files still load.
+	const uint32_t strides[WORLDMESH_SECTION_COUNT] = { isValid ? header->vertexSize : 0, sizeof(uint16_t), sizeof(WorldMeshDraw), sizeof(WorldMeshMaterial) };
+	const WorldMeshSection* found[WORLDMESH_SECTION_COUNT] = { };
+	const WorldMeshSection* sections = (const WorldMeshSection*)(m_File.data + sizeof(WorldMeshHeader));
+	for ( uint32_t i = 0; isValid && i < header->sectionCount; i++ ) {
+		const WorldMeshSection& section = sections[i];
+		if ( section.type >= WORLDMESH_SECTION_COUNT ) {
+			continue;
+		}
+		isValid = !found[section.type]
+			&& section.stride == strides[section.type]
+			&& section.size == (uint64_t)section.count * section.stride
+			&& section.offset % WORLDMESH_ALIGNMENT == 0
+			&& section.offset <= m_File.size && section.size <= m_File.size - section.offset;
+		found[section.type] = &section;
+	}
+	for ( int i = 0; isValid && i < WORLDMESH_SECTION_COUNT; i++ ) {
+		isValid = found[i] != nullptr;
+	}
+	if ( !isValid ) {
+		printf("invalid world mesh: %s\n", fileName.c_str());
+		Unload();
+		return false;
+	}
+
+	m_Header		= header;
+	m_Vertices		= m_File.data + found[WORLDMESH_VERTICES]->offset;
+	m_VertexCount	= found[WORLDMESH_VERTICES]->count;
+	m_Indices		= (const uint16_t*)(m_File.data + found[WORLDMESH_INDICES]->offset);
+	m_IndexCount	= found[WORLDMESH_INDICES]->count;
+	m_Draws			= (const WorldMeshDraw*)(m_File.data + found[WORLDMESH_DRAWS]->offset);
+	m_DrawCount		= found[WORLDMESH_DRAWS]->count;
+	m_Materials		= (const WorldMeshMaterial*)(m_File.data + found[WORLDMESH_MATERIALS]->offset);
+	m_MaterialCount	= found[WORLDMESH_MATERIALS]->count;
+
+	for ( uint32_t i = 0; i < m_DrawCount; i++ ) {
+		const WorldMeshDraw& draw = m_Draws[i];
+		if ( (uint64_t)draw.firstIndex + draw.indexCount > m_IndexCount
+			|| (uint64_t)draw.baseVertex + draw.vertexCount > m_VertexCount
+			|| draw.vertexCount > WORLDMESH_MAX_VERTICES
+			|| draw.material >= m_MaterialCount ) {
+			printf("invalid world mesh: %s\n", fileName.c_str());
+			Unload();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void WorldMesh::Unload()
+{
+	if ( m_File.data ) {
+		atp_unmap_file(&m_File);
+	}
+	*this = WorldMesh();
+}
@@ -0,0 +1,106 @@
+#ifndef _WORLDMESH_H_
+#define _WORLDMESH_H_
+
+#include <stdint.h>
+#include <string>
+
+#include "platform.h"
+
+// world.mesh as written by the polysoup tool. Every section starts on a
+// 16 byte boundary, so the mapped file can be handed to VKAL as it is.
+// Must match src/tools/polysoup/worldmesh.h.
+
+#define WORLDMESH_MAGIC			(0x48534D57) // 'WMSH'
+#define WORLDMESH_VERSION		(1)
+#define WORLDMESH_ALIGNMENT		(16)
+#define WORLDMESH_QUANTIZED		(1 << 0)
+#define WORLDMESH_MAX_VERTICES	(65536)
+#define WORLDMESH_NAME_LENGTH	(64)
+
+enum WorldMeshSectionType
+{
+	WORLDMESH_VERTICES,
+	WORLDMESH_INDICES,
+	WORLDMESH_DRAWS,
+	WORLDMESH_MATERIALS,
+	WORLDMESH_SECTION_COUNT
+};
+
+struct WorldMeshHeader
+{
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	flags;
+	uint32_t	sectionCount;
+	float		boundsMin[3];
+	uint32_t	vertexSize;
+	float		boundsMax[3];
+	uint32_t	reserved;
+};
+
+struct WorldMeshSection
+{
+	uint32_t	type;
+	uint32_t	count;
+	uint32_t	stride;
+	uint32_t	reserved;
+	uint64_t	offset;
+	uint64_t	size;
+};
+
+struct WorldMeshVertex
+{
+	float		pos[3];
+	float		normal[3];
+	float		uv[2];		// In texels
+};
+
+// pos: UNORM across the bounds of the header, normal: SNORM. w = 0 for both.
+struct WorldMeshQuantizedVertex
+{
+	uint16_t	pos[4];
+	int8_t		normal[4];
+	float		uv[2];
+};
+
+// Indices are relative to baseVertex, so every draw binds the vertex buffer at its own offset.
+struct WorldMeshDraw
+{
+	uint32_t	material;
+	uint32_t	firstIndex;
+	uint32_t	indexCount;
+	uint32_t	baseVertex;
+	float		boundsMin[3];
+	uint32_t	vertexCount;
+	float		boundsMax[3];
+	uint32_t	reserved;
+};
+
+struct WorldMeshMaterial
+{
+	char		name[WORLDMESH_NAME_LENGTH];
+};
+
+// A mapped world.mesh. The pointers point into the mapping and are valid until Unload.
+class WorldMesh
+{
+public:
+	WorldMesh() : m_File(), m_Header(nullptr), m_Vertices(nullptr), m_VertexCount(0), m_Indices(nullptr), m_IndexCount(0),
+		m_Draws(nullptr), m_DrawCount(0), m_Materials(nullptr), m_MaterialCount(0) {}
+
+	bool		Load(std::string fileName);
+	void		Unload();
+
+	ATP_MappedFile				m_File;
+	const WorldMeshHeader*		m_Header;
+	const uint8_t*				m_Vertices;	// m_Header->vertexSize bytes each
+	uint32_t					m_VertexCount;
+	const uint16_t*				m_Indices;
+	uint32_t					m_IndexCount;
+	const WorldMeshDraw*		m_Draws;
+	uint32_t					m_DrawCount;
+	const WorldMeshMaterial*	m_Materials;
+	uint32_t					m_MaterialCount;
+};
+
+#endif
@@ -0,0 +1,418 @@
+/*
+* Compiled binary form of a parsed .map (.bmap).
+*
+* The text parser is fast, but a map that did not change since the last run
+* does not have to be tokenized at all. A .bmap holds the columns of the
+* MapSoA (mapsoa.h) the map parses into and is keyed by a hash of the .map's
+* text. It is memory mapped and used in place: getBMapView points a MapSoAView
+* at the sections, nothing gets copied or allocated per face.
+*
+* Layout (all offsets relative to the start of the file, sections 8 byte aligned,
+* native byte order):
+* ----------------------------------------------------------------
+* BMapHeader
+* Plane           planes[ faceCount ]
+* uint32_t        textureIds[ faceCount ]
+* double          xOffset[ faceCount ] ... yScale[ faceCount ]
+* MapTextureAxis  uAxis[ faceCount ], vAxis[ faceCount ]  (Valve 220 only)
+* MapRange        brushes[ brushCount ]
+* MapEntityRanges entities[ entityCount ]
+* BMapProperty    properties[ propertyCount ]
+* BMapString      textures[ textureCount ]
+* char            strings[ stringsSize ]  (keys, values and texture names)
+*/
+
+#ifndef _BMAP_H_
+#define _BMAP_H_
+
+#include <string>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "parser.h"
+#include "mapsoa.h"
+#include "mappedfile.h"
+
+#define BMAP_MAGIC		(0x50414D42) // 'BMAP'
+#define BMAP_VERSION	(2)
+
+enum BMapSection
+{
+	BMAP_PLANES,
+	BMAP_TEXTURE_IDS,
+	BMAP_X_OFFSET,
+	BMAP_Y_OFFSET,
+	BMAP_ROTATION,
+	BMAP_X_SCALE,
+	BMAP_Y_SCALE,
+	BMAP_U_AXIS,
+	BMAP_V_AXIS,
+	BMAP_BRUSHES,
+	BMAP_ENTITIES,
+	BMAP_PROPERTIES,
+	BMAP_TEXTURES,
+	BMAP_STRINGS,
+	BMAP_SECTION_COUNT
+};
+
+struct BMapString
+{
+	uint32_t offset;	// Into the strings section
+	uint32_t length;
+};
+
+struct BMapHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t sourceHash;
+	uint32_t mapVersion;
+	uint32_t faceCount;
+	uint32_t brushCount;
+	uint32_t entityCount;
+	uint32_t propertyCount;
+	uint32_t textureCount;
+	uint32_t stringsSize;
+	uint32_t pad;
+	uint64_t sectionOffsets[BMAP_SECTION_COUNT];
+};
+
+struct BMapProperty
+{
+	BMapString key;
+	BMapString value;
+};
+
+/*
+* A validated, memory mapped .bmap. The pointers point into the mapping.
+*/
+struct BMap
+{
+	MappedFile			file;
+	const BMapHeader*	header;
+	const BMapProperty*	properties;
+	const BMapString*	textures;
+	const char*			strings;
+};
+
+/*
+* 64 bit hash of the .map text. Works on 8 bytes at a time so hashing a 1 MB
+* map costs a fraction of a millisecond.
+*/
+uint64_t			hashMapSource(const char* data, size_t length);
+
+/*
+* Returns the file name of the cache file of a map: 'maps/e1m1.map' -> 'maps/e1m1.bmap'.
+*/
+std::string			getBMapFileName(const std::string& mapFile);
+
+/*
+* map.mapVersion gets stored with the columns. Writes to a temporary file first
+* and renames it, so a run that maps the .bmap meanwhile never sees half of it.
+*/
+bool				writeBMap(const char* fileName, const MapSoA& map, uint64_t sourceHash);
+
+/*
+* Maps the .bmap and checks it against sourceHash and mapVersion. Returns false
+* if the file does not exist, is corrupt or is out of date.
+*/
+bool				openBMap(const char* fileName, uint64_t sourceHash, MapVersion mapVersion, BMap* bmap);
+void				closeBMap(BMap* bmap);
+
+/*
+* Points view at the sections of the mapping, only the property and texture
+* strings get a string_view each. The view is valid until closeBMap.
+*/
+void				getBMapView(const BMap* bmap, MapSoAView* view);
+
+static inline std::string_view getBMapString(const BMap* bmap, BMapString s)
+{
+	return std::string_view(bmap->strings + s.offset, s.length);
+}
+
+
+
+/*
+*
+* IMPLEMENTATION
+*
+*/
+
+
+
+#if defined(BMAP_IMPLEMENTATION)
+
+#include <filesystem>
+#include <vector>
+#include <string.h>
+#include <stdio.h>
+
+uint64_t hashMapSource(const char* data, size_t length)
+{
+	const uint64_t prime = 0x100000001B3ull;
+	uint64_t hash = 0xCBF29CE484222325ull ^ (length * prime);
+
+	size_t i = 0;
+	for (; i + 8 <= length; i += 8) {
+		uint64_t word;
+		memcpy(&word, data + i, 8);
+		hash = (hash ^ word) * prime;
+		hash ^= hash >> 32;
+	}
+	for (; i < length; i++) {
+		hash = (hash ^ (uint8_t)data[i]) * prime;
+	}
+	hash ^= hash >> 29;
+	hash *= 0xBF58476D1CE4E5B9ull;
+	hash ^= hash >> 32;
+
+	return hash;
+}
+
+std::string getBMapFileName(const std::string& mapFile)
+{
+	size_t dot = mapFile.find_last_of('.');
+	size_t slash = mapFile.find_last_of("/\\");
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+		return mapFile + ".bmap";
+	}
+
+	return mapFile.substr(0, dot) + ".bmap";
+}
+
+static inline uint64_t alignBMapOffset(uint64_t offset)
+{
+	return (offset + 7) & ~(uint64_t)7;
+}
+
+static BMapString addBMapString(std::string* strings, std::string_view s)
+{
+	BMapString result = { (uint32_t)strings->size(), (uint32_t)s.length() };
+	strings->append(s);
+
+	return result;
+}
+
+static const size_t bmapElementSizes[BMAP_SECTION_COUNT] = {
+	sizeof(Plane), sizeof(uint32_t),
+	sizeof(double), sizeof(double), sizeof(double), sizeof(double), sizeof(double),
+	sizeof(MapTextureAxis), sizeof(MapTextureAxis),
+	sizeof(MapRange), sizeof(MapEntityRanges), sizeof(BMapProperty), sizeof(BMapString), 1
+};
+
+static uint64_t getBMapSectionCount(const BMapHeader* header, int section)
+{
+	switch (section) {
+	case BMAP_U_AXIS:
+	case BMAP_V_AXIS:		return header->mapVersion == VALVE_220 ? header->faceCount : 0;
+	case BMAP_BRUSHES:		return header->brushCount;
+	case BMAP_ENTITIES:		return header->entityCount;
+	case BMAP_PROPERTIES:	return header->propertyCount;
+	case BMAP_TEXTURES:		return header->textureCount;
+	case BMAP_STRINGS:		return header->stringsSize;
+	default:				return header->faceCount;
+	}
+}
+
+bool writeBMap(const char* fileName, const MapSoA& map, uint64_t sourceHash)
+{
+	std::vector<BMapProperty>	properties;
+	std::vector<BMapString>		textures;
+	std::string					strings;
+	for (auto p = map.properties.begin(); p != map.properties.end(); p++) {
+		BMapProperty property;
+		property.key = addBMapString(&strings, p->key);
+		property.value = addBMapString(&strings, p->value);
+		properties.push_back(property);
+	}
+	for (auto t = map.textures.begin(); t != map.textures.end(); t++) {
+		textures.push_back(addBMapString(&strings, *t));
+	}
+
+	BMapHeader header = { };
+	header.magic = BMAP_MAGIC;
+	header.version = BMAP_VERSION;
+	header.sourceHash = sourceHash;
+	header.mapVersion = (uint32_t)map.mapVersion;
+	header.faceCount = (uint32_t)map.planes.size();
+	header.brushCount = (uint32_t)map.brushes.size();
+	header.entityCount = (uint32_t)map.entities.size();
+	header.propertyCount = (uint32_t)properties.size();
+	header.textureCount = (uint32_t)textures.size();
+	header.stringsSize = (uint32_t)strings.size();
+
+	const void* sections[BMAP_SECTION_COUNT] = {
+		map.planes.data(), map.textureIds.data(),
+		map.xOffset.data(), map.yOffset.data(), map.rotation.data(), map.xScale.data(), map.yScale.data(),
+		map.uAxis.data(), map.vAxis.data(),
+		map.brushes.data(), map.entities.data(), properties.data(), textures.data(), strings.data()
+	};
+	uint64_t size = sizeof(BMapHeader);
+	for (int i = 0; i < BMAP_SECTION_COUNT; i++) {
+		header.sectionOffsets[i] = alignBMapOffset(size);
+		size = header.sectionOffsets[i] + getBMapSectionCount(&header, i) * bmapElementSizes[i];
+	}
+
+	std::vector<uint8_t> data(size);
+	memcpy(&data[0], &header, sizeof(header));
+	for (int i = 0; i < BMAP_SECTION_COUNT; i++) {
+		uint64_t sectionSize = getBMapSectionCount(&header, i) * bmapElementSizes[i];
+		if (sectionSize > 0) {
+			memcpy(&data[header.sectionOffsets[i]], sections[i], sectionSize);
+		}
+	}
+
+	std::string tempFileName = std::string(fileName) + ".tmp";
+	FILE* file = fopen(tempFileName.c_str(), "wb");
+	if (!file) {
+		return false;
+	}
+	bool isWritten = fwrite(&data[0], 1, data.size(), file) == data.size();
+	isWritten &= fclose(file) == 0;
+
+	std::error_code error;
+	if (isWritten) {
+		std::filesystem::rename(tempFileName, fileName, error);
+	}
+	else {
+		std::filesystem::remove(tempFileName, error);
+	}
+
+	return isWritten && !error;
+}
+
+static const void* getBMapSection(const BMap* bmap, int section)
+{
+	return bmap->file.data + bmap->header->sectionOffsets[section];
+}
+
+static bool isBMapSectionValid(const BMap* bmap, int section)
+{
+	uint64_t offset = bmap->header->sectionOffsets[section];
+	uint64_t count = getBMapSectionCount(bmap->header, section);
+
+	return (offset % 8) == 0 && offset <= bmap->file.size && count * bmapElementSizes[section] <= bmap->file.size - offset;
+}
+
+static bool isBMapRangeValid(MapRange range, uint64_t count)
+{
+	return (uint64_t)range.first + range.count <= count;
+}
+
+/*
+* Makes sure that every index in the file stays within its section, so a
+* damaged file can never make a consumer of the view read outside the mapping.
+*/
+static bool areBMapIndicesValid(const BMap* bmap)
+{
+	const BMapHeader* header = bmap->header;
+	const MapRange* brushes = (const MapRange*)getBMapSection(bmap, BMAP_BRUSHES);
+	const MapEntityRanges* entities = (const MapEntityRanges*)getBMapSection(bmap, BMAP_ENTITIES);
+	const uint32_t* textureIds = (const uint32_t*)getBMapSection(bmap, BMAP_TEXTURE_IDS);
+	for (uint32_t i = 0; i < header->entityCount; i++) {
+		if (!isBMapRangeValid(entities[i].brushes, header->brushCount)
+			|| !isBMapRangeValid(entities[i].properties, header->propertyCount)) {
+			return false;
+		}
+	}
+	for (uint32_t i = 0; i < header->brushCount; i++) {
+		if (!isBMapRangeValid(brushes[i], header->faceCount)) {
+			return false;
+		}
+	}
+	for (uint32_t i = 0; i < header->faceCount; i++) {
+		if (textureIds[i] >= header->textureCount) {
+			return false;
+		}
+	}
+	for (uint32_t i = 0; i < header->propertyCount; i++) {
+		const BMapProperty* p = &bmap->properties[i];
+		if ((uint64_t)p->key.offset + p->key.length > header->stringsSize
+			|| (uint64_t)p->value.offset + p->value.length > header->stringsSize) {
+			return false;
+		}
+	}
+	for (uint32_t i = 0; i < header->textureCount; i++) {
+		if ((uint64_t)bmap->textures[i].offset + bmap->textures[i].length > header->stringsSize) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool openBMap(const char* fileName, uint64_t sourceHash, MapVersion mapVersion, BMap* bmap)
+{
+	*bmap = { };
+	if (!openMappedFile(fileName, &bmap->file)) {
+		return false;
+	}
+
+	const BMapHeader* header = (const BMapHeader*)bmap->file.data;
+	bmap->header = header;
+	bool isValid = bmap->file.size >= sizeof(BMapHeader)
+		&& header->magic == BMAP_MAGIC
+		&& header->version == BMAP_VERSION
+		&& header->sourceHash == sourceHash
+		&& header->mapVersion == (uint32_t)mapVersion;
+	for (int i = 0; isValid && i < BMAP_SECTION_COUNT; i++) {
+		isValid = isBMapSectionValid(bmap, i);
+	}
+	if (!isValid) {
+		closeBMap(bmap);
+		return false;
+	}
+
+	bmap->properties = (const BMapProperty*)getBMapSection(bmap, BMAP_PROPERTIES);
+	bmap->textures = (const BMapString*)getBMapSection(bmap, BMAP_TEXTURES);
+	bmap->strings = (const char*)getBMapSection(bmap, BMAP_STRINGS);
+
+	if (!areBMapIndicesValid(bmap)) {
+		closeBMap(bmap);
+		return false;
+	}
+
+	return true;
+}
+
+void closeBMap(BMap* bmap)
+{
+	closeMappedFile(&bmap->file);
+	*bmap = { };
+}
+
+void getBMapView(const BMap* bmap, MapSoAView* view)
+{
+	const BMapHeader* header = bmap->header;
+	view->mapVersion = (MapVersion)header->mapVersion;
+	view->faceCount = header->faceCount;
+	view->brushCount = header->brushCount;
+	view->entityCount = header->entityCount;
+	view->propertyCount = header->propertyCount;
+	view->planes = (const Plane*)getBMapSection(bmap, BMAP_PLANES);
+	view->textureIds = (const uint32_t*)getBMapSection(bmap, BMAP_TEXTURE_IDS);
+	view->xOffset = (const double*)getBMapSection(bmap, BMAP_X_OFFSET);
+	view->yOffset = (const double*)getBMapSection(bmap, BMAP_Y_OFFSET);
+	view->rotation = (const double*)getBMapSection(bmap, BMAP_ROTATION);
+	view->xScale = (const double*)getBMapSection(bmap, BMAP_X_SCALE);
+	view->yScale = (const double*)getBMapSection(bmap, BMAP_Y_SCALE);
+	view->uAxis = (const MapTextureAxis*)getBMapSection(bmap, BMAP_U_AXIS);
+	view->vAxis = (const MapTextureAxis*)getBMapSection(bmap, BMAP_V_AXIS);
+	view->brushes = (const MapRange*)getBMapSection(bmap, BMAP_BRUSHES);
+	view->entities = (const MapEntityRanges*)getBMapSection(bmap, BMAP_ENTITIES);
+
+	view->keys.resize(header->propertyCount);
+	view->values.resize(header->propertyCount);
+	for (uint32_t i = 0; i < header->propertyCount; i++) {
+		view->keys[i] = getBMapString(bmap, bmap->properties[i].key);
+		view->values[i] = getBMapString(bmap, bmap->properties[i].value);
+	}
+	view->textures.resize(header->textureCount);
+	for (uint32_t i = 0; i < header->textureCount; i++) {
+		view->textures[i] = getBMapString(bmap, bmap->textures[i]);
+	}
+}
+
+#endif
+
+#endif
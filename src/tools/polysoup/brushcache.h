@@ -0,0 +1,484 @@
+/*
+* Brush cache: the polygons of every brush built so far, on disk, keyed by the
+* brush's shape. Prefabs and map series repeat the same brushes over and over,
+* often just moved somewhere else. Looking a brush up is a hash of its planes,
+* building it clips every face against every other plane.
+*
+* A brush's key is the normal of every plane and the point that defines the
+* plane relative to the brush's anchor, the point of its first plane. Both
+* come out with the same bits for a copy of the brush that was moved by whole
+* units, so the copy finds the entry and only moves the cached vertices by
+* the difference of the anchors. Textures are not in the cache, they depend on
+* where the brush is and get computed for every brush as before.
+*
+* A hit must give the exact polygons createPlanePolys would have built. A new
+* entry is only a hit for a brush at its own anchor, ie. an unchanged map or
+* a copy at the same place. The first copy at another anchor gets built, as
+* it would have been without the cache: if that gives the entry's polygons,
+* moved, the entry is a hit at any anchor from then on. Otherwise (vertices
+* that are not on the snap grid, eg. of rotated brushes) it stays at its own.
+* No brush ever gets built twice to find out.
+*
+* Within one run identical brushes are grouped by their key, so the cache
+* works for the copies of a brush in the same map too.
+*
+* The cache only grows. Delete the file to start over.
+*
+* File layout (native byte order):
+* ----------------------------------------------------------------
+* BrushCacheHeader
+* per entry, sorted by hash:
+*   BrushCacheEntryHeader
+*   double      key[ planeCount * 6 ]
+*   uint32_t    polyFaces[ polyCount ]
+*   uint32_t    polyVertexCounts[ polyCount ]
+*   double      vertices[ vertexCount * 3 ]
+*/
+
+#ifndef _BRUSHCACHE_H_
+#define _BRUSHCACHE_H_
+
+#include <vector>
+#include <unordered_map>
+#include <stdint.h>
+
+#include <glm/glm.hpp>
+
+#include "polysoup.h"
+
+#define BRUSHCACHE_MAGIC	(0x48435242) // 'BRCH'
+#define BRUSHCACHE_VERSION	(2)
+
+/*
+* Whether an entry is a hit for a brush at another anchor than its own.
+*/
+enum BrushCacheMobility
+{
+	BRUSHCACHE_UNCHECKED,		// Not built at another anchor yet
+	BRUSHCACHE_TRANSLATABLE,	// A hit at any anchor on the snap grid
+	BRUSHCACHE_FIXED			// Only a hit at its own anchor
+};
+
+struct BrushCacheHeader
+{
+	uint32_t	magic;
+	uint32_t	version;
+	uint64_t	entryCount;
+};
+
+struct BrushCacheEntryHeader
+{
+	uint64_t	hash;
+	double		anchor[3];
+	uint32_t	planeCount;
+	uint32_t	polyCount;
+	uint32_t	vertexCount;
+	uint32_t	mobility;
+};
+
+struct BrushCacheEntry
+{
+	glm::f64vec3				anchor;				// Where the brush was built
+	uint32_t					mobility;			// BrushCacheMobility
+	std::vector<double>			key;				// n, p0 - anchor of every plane
+	std::vector<uint32_t>		polyFaces;			// The plane every polygon is on
+	std::vector<uint32_t>		polyVertexCounts;
+	std::vector<glm::f64vec3>	vertices;			// As built at anchor
+};
+
+struct BrushCache
+{
+	std::unordered_map<uint64_t, BrushCacheEntry>	entries;
+	size_t											hitCount = 0;
+	size_t											missCount = 0;
+	bool											isChanged = false;	// Has entries that are not in the file
+};
+
+/*
+* A missing file is an empty cache. Returns false (and leaves the cache empty)
+* if the file is damaged or of another version.
+*/
+bool	loadBrushCache(const char* fileName, BrushCache* cache);
+
+/*
+* Writes to a temporary file first and renames it, so a compile running at the
+* same time never reads half a cache.
+*/
+bool	writeBrushCache(const char* fileName, const BrushCache& cache);
+
+/*
+* createPlanePolys for every brush through the cache: brushPolys[i] gets the
+* polygons of brushPlanes[i], with brushTextures[i] on them. Brushes that
+* were not in the cache get added. The brushes that have to be built are
+* built on threadCount threads (0 = all hardware threads).
+*/
+void	createCachedBrushPolys(BrushCache* cache, const std::vector<std::vector<Plane>>& brushPlanes,
+			const std::vector<std::vector<PolygonTexture>>& brushTextures, unsigned int threadCount,
+			std::vector<std::vector<Polygon>>* brushPolys);
+
+#ifdef BRUSHCACHE_IMPLEMENTATION
+
+#include <algorithm>
+#include <filesystem>
+#include <string>
+#include <stdio.h>
+#include <string.h>
+
+#include "bmap.h"
+#include "parallel.h"
+
+#define PS_BRUSH_KEY_STRIDE	(6)
+
+static void getBrushKey(const Plane* planes, int planeCount, const glm::f64vec3& anchor, std::vector<double>* key)
+{
+	key->resize((size_t)planeCount * PS_BRUSH_KEY_STRIDE);
+	for (int i = 0; i < planeCount; i++) {
+		glm::f64vec3 p0 = planes[i].p0 - anchor;
+		double* k = &(*key)[(size_t)i * PS_BRUSH_KEY_STRIDE];
+		k[0] = planes[i].n.x; k[1] = planes[i].n.y; k[2] = planes[i].n.z;
+		k[3] = p0.x; k[4] = p0.y; k[5] = p0.z;
+	}
+}
+
+static inline uint64_t hashBrushKey(const std::vector<double>& key)
+{
+	return hashMapSource((const char*)key.data(), key.size() * sizeof(double));
+}
+
+/*
+* Moving vertices on the snap grid by the difference of two anchors on it is
+* exact, so a translatable entry gives the same bits at every anchor.
+*/
+static inline bool isOnSnapGrid(const glm::f64vec3& p)
+{
+	glm::f64vec3 scaled = p * PS_SNAP_GRID;
+	return glm::round(scaled) == scaled;
+}
+
+/*
+* The material of every polygon built for the cache is the plane it came
+* from, the real textures go on after.
+*/
+static void buildCachedBrush(const std::vector<Plane>& planes, std::vector<Polygon>* polys)
+{
+	std::vector<PolygonTexture> faces(planes.size());
+	for (size_t i = 0; i < planes.size(); i++) {
+		faces[i].material = (uint32_t)i;
+	}
+	createPlanePolys(planes.data(), (int)planes.size(), polys, faces.data());
+}
+
+static void setBrushCacheEntry(const std::vector<Polygon>& polys, const glm::f64vec3& anchor, BrushCacheEntry* entry)
+{
+	entry->anchor = anchor;
+	entry->mobility = isOnSnapGrid(anchor) ? BRUSHCACHE_UNCHECKED : BRUSHCACHE_FIXED;
+	for (auto p = polys.begin(); p != polys.end(); p++) {
+		entry->polyFaces.push_back(p->texture.material);
+		entry->polyVertexCounts.push_back((uint32_t)p->vertices.size());
+		entry->vertices.insert(entry->vertices.end(), p->vertices.begin(), p->vertices.end());
+	}
+}
+
+/*
+* polys, built at anchor, are the polygons of entry moved there.
+*/
+static bool isBrushCacheEntryMoved(const std::vector<Polygon>& polys, const glm::f64vec3& anchor, const BrushCacheEntry& entry)
+{
+	if (polys.size() != entry.polyFaces.size()) {
+		return false;
+	}
+	const glm::f64vec3* v = entry.vertices.data();
+	for (size_t i = 0; i < polys.size(); i++) {
+		if (polys[i].texture.material != entry.polyFaces[i] || polys[i].vertices.size() != entry.polyVertexCounts[i]) {
+			return false;
+		}
+		for (auto p = polys[i].vertices.begin(); p != polys[i].vertices.end(); p++) {
+			if (*p != *v++ - entry.anchor + anchor) {
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+static void copyBrushCacheEntry(const BrushCacheEntry& entry, const std::vector<Plane>& planes, const std::vector<PolygonTexture>& textures,
+	std::vector<Polygon>* polys)
+{
+	const glm::f64vec3 anchor = planes[0].p0;
+	const bool isMoved = anchor != entry.anchor;
+	const glm::f64vec3* v = entry.vertices.data();
+	polys->resize(entry.polyFaces.size());
+	for (size_t i = 0; i < entry.polyFaces.size(); i++) {
+		Polygon& poly = (*polys)[i];
+		poly.normal = planes[entry.polyFaces[i]].n;
+		poly.texture = textures.empty() ? PolygonTexture() : textures[entry.polyFaces[i]];
+		poly.vertices.resize(entry.polyVertexCounts[i]);
+		for (auto p = poly.vertices.begin(); p != poly.vertices.end(); p++, v++) {
+			*p = isMoved ? *v - entry.anchor + anchor : *v;
+		}
+	}
+}
+
+/*
+* Identical brushes of a run. entry is the cache's (or, after the first
+* brush of the group was built, the new one), checker the first brush at
+* another anchor, which gets built to find out whether entry moves.
+*/
+struct BrushCacheGroup
+{
+	BrushCacheEntry*	entry = nullptr;
+	size_t				first = 0;
+	size_t				checker = SIZE_MAX;
+};
+
+/*
+* A brush can be taken from entry. If not, and it is the group's checker,
+* or the entry is not known to move, it gets built.
+*/
+static bool isBrushCacheHit(const BrushCacheEntry& entry, const glm::f64vec3& anchor)
+{
+	return anchor == entry.anchor || (entry.mobility == BRUSHCACHE_TRANSLATABLE && isOnSnapGrid(anchor));
+}
+
+void createCachedBrushPolys(BrushCache* cache, const std::vector<std::vector<Plane>>& brushPlanes,
+	const std::vector<std::vector<PolygonTexture>>& brushTextures, unsigned int threadCount,
+	std::vector<std::vector<Polygon>>* brushPolys)
+{
+	const size_t brushCount = brushPlanes.size();
+	std::vector<std::vector<double>> keys(brushCount);
+	std::vector<uint64_t> hashes(brushCount);
+	parallelFor(brushCount, threadCount, [&](size_t i) {
+		if (!brushPlanes[i].empty()) {
+			getBrushKey(brushPlanes[i].data(), (int)brushPlanes[i].size(), brushPlanes[i][0].p0, &keys[i]);
+			hashes[i] = hashBrushKey(keys[i]);
+		}
+	});
+
+	// What every brush comes from: built, or copied from the entry of its group.
+	// New entries go into the cache after the first round, their group points
+	// to where the entry will be.
+	enum { BUILD, COPY, DEFER };
+	std::vector<uint8_t> actions(brushCount, BUILD);
+	std::vector<BrushCacheGroup*> brushGroups(brushCount, nullptr);
+	std::unordered_map<uint64_t, BrushCacheGroup> groups;
+	for (size_t i = 0; i < brushCount; i++) {
+		if (keys[i].empty()) {
+			continue;
+		}
+		const glm::f64vec3 anchor = brushPlanes[i][0].p0;
+		auto found = groups.find(hashes[i]);
+		if (found == groups.end()) {
+			BrushCacheGroup& group = groups[hashes[i]];
+			group.first = i;
+			auto entry = cache->entries.find(hashes[i]);
+			if (entry != cache->entries.end() && entry->second.key == keys[i]) {
+				group.entry = &entry->second;
+			}
+			else if (entry != cache->entries.end()) {
+				continue; // Another brush with the same hash, this one does not get cached.
+			}
+			brushGroups[i] = &group;
+			if (group.entry && isBrushCacheHit(*group.entry, anchor)) {
+				actions[i] = COPY;
+			}
+			else if (group.entry && group.entry->mobility == BRUSHCACHE_UNCHECKED && isOnSnapGrid(anchor)) {
+				group.checker = i;
+			}
+			continue;
+		}
+
+		BrushCacheGroup& group = found->second;
+		if (keys[i] != keys[group.first] || (!group.entry && brushGroups[group.first] == nullptr)) {
+			continue;
+		}
+		brushGroups[i] = &group;
+		if (group.entry && isBrushCacheHit(*group.entry, anchor)) {
+			actions[i] = COPY;
+		}
+		else if (group.entry && group.entry->mobility == BRUSHCACHE_FIXED) {
+			actions[i] = BUILD;
+		}
+		else if (group.checker == SIZE_MAX && isOnSnapGrid(anchor) && (group.entry || anchor != brushPlanes[group.first][0].p0)) {
+			group.checker = i;
+		}
+		else {
+			actions[i] = DEFER;
+		}
+	}
+
+	std::vector<size_t> builds;
+	for (size_t i = 0; i < brushCount; i++) {
+		if (actions[i] == BUILD) {
+			builds.push_back(i);
+		}
+	}
+	parallelFor(builds.size(), threadCount, [&](size_t b) {
+		buildCachedBrush(brushPlanes[builds[b]], &(*brushPolys)[builds[b]]);
+	});
+
+	for (auto g = groups.begin(); g != groups.end(); g++) {
+		BrushCacheGroup& group = g->second;
+		if (!group.entry && brushGroups[group.first] == &group) {
+			BrushCacheEntry& entry = cache->entries[g->first];
+			entry.key = keys[group.first];
+			setBrushCacheEntry((*brushPolys)[group.first], brushPlanes[group.first][0].p0, &entry);
+			group.entry = &entry;
+			cache->isChanged = true;
+		}
+		if (group.checker != SIZE_MAX && group.entry->mobility == BRUSHCACHE_UNCHECKED) {
+			bool isMoved = isBrushCacheEntryMoved((*brushPolys)[group.checker], brushPlanes[group.checker][0].p0, *group.entry);
+			group.entry->mobility = isMoved ? BRUSHCACHE_TRANSLATABLE : BRUSHCACHE_FIXED;
+			cache->isChanged = true;
+		}
+	}
+
+	builds.clear();
+	for (size_t i = 0; i < brushCount; i++) {
+		if (actions[i] == DEFER) {
+			actions[i] = isBrushCacheHit(*brushGroups[i]->entry, brushPlanes[i][0].p0) ? COPY : BUILD;
+			if (actions[i] == BUILD) {
+				builds.push_back(i);
+			}
+		}
+	}
+	parallelFor(builds.size(), threadCount, [&](size_t b) {
+		buildCachedBrush(brushPlanes[builds[b]], &(*brushPolys)[builds[b]]);
+	});
+
+	parallelFor(brushCount, threadCount, [&](size_t i) {
+		if (actions[i] == COPY) {
+			copyBrushCacheEntry(*brushGroups[i]->entry, brushPlanes[i], brushTextures[i], &(*brushPolys)[i]);
+			return;
+		}
+		for (auto p = (*brushPolys)[i].begin(); p != (*brushPolys)[i].end(); p++) {
+			p->texture = brushTextures[i].empty() ? PolygonTexture() : brushTextures[i][p->texture.material];
+		}
+	});
+	for (size_t i = 0; i < brushCount; i++) {
+		cache->hitCount += actions[i] == COPY;
+		cache->missCount += actions[i] != COPY;
+	}
+}
+
+template<typename T>
+static bool readBrushCacheArray(const std::vector<uint8_t>& data, size_t* offset, size_t count, std::vector<T>* out)
+{
+	if (count > (data.size() - *offset) / sizeof(T)) {
+		return false;
+	}
+	out->resize(count);
+	if (count > 0) {
+		memcpy(out->data(), &data[*offset], count * sizeof(T));
+	}
+	*offset += count * sizeof(T);
+
+	return true;
+}
+
+bool loadBrushCache(const char* fileName, BrushCache* cache)
+{
+	*cache = BrushCache();
+	FILE* file = fopen(fileName, "rb");
+	if (!file) {
+		return true;
+	}
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	std::vector<uint8_t> data(size > 0 ? size : 0);
+	size_t read = size > 0 ? fread(&data[0], 1, size, file) : 0;
+	fclose(file);
+
+	BrushCacheHeader header;
+	bool isValid = read == data.size() && data.size() >= sizeof(header);
+	if (isValid) {
+		memcpy(&header, &data[0], sizeof(header));
+		isValid = header.magic == BRUSHCACHE_MAGIC && header.version == BRUSHCACHE_VERSION;
+	}
+	size_t offset = sizeof(header);
+	for (uint64_t i = 0; isValid && i < header.entryCount; i++) {
+		BrushCacheEntryHeader entryHeader;
+		isValid = data.size() - offset >= sizeof(entryHeader);
+		if (!isValid) {
+			break;
+		}
+		memcpy(&entryHeader, &data[offset], sizeof(entryHeader));
+		offset += sizeof(entryHeader);
+
+		BrushCacheEntry entry;
+		entry.anchor = glm::f64vec3(entryHeader.anchor[0], entryHeader.anchor[1], entryHeader.anchor[2]);
+		entry.mobility = entryHeader.mobility;
+		isValid = readBrushCacheArray(data, &offset, (size_t)entryHeader.planeCount * PS_BRUSH_KEY_STRIDE, &entry.key)
+			&& readBrushCacheArray(data, &offset, entryHeader.polyCount, &entry.polyFaces)
+			&& readBrushCacheArray(data, &offset, entryHeader.polyCount, &entry.polyVertexCounts)
+			&& readBrushCacheArray(data, &offset, entryHeader.vertexCount, &entry.vertices);
+
+		// Indices stay within the brush, so a damaged file can not make a hit read past an entry.
+		uint64_t vertexCount = 0;
+		for (uint32_t p = 0; isValid && p < entryHeader.polyCount; p++) {
+			isValid = entry.polyFaces[p] < entryHeader.planeCount;
+			vertexCount += entry.polyVertexCounts[p];
+		}
+		isValid = isValid && vertexCount == entryHeader.vertexCount && hashBrushKey(entry.key) == entryHeader.hash
+			&& entryHeader.mobility <= BRUSHCACHE_FIXED;
+		if (isValid) {
+			cache->entries[entryHeader.hash] = std::move(entry);
+		}
+	}
+	if (!isValid) {
+		*cache = BrushCache();
+	}
+
+	return isValid;
+}
+
+bool writeBrushCache(const char* fileName, const BrushCache& cache)
+{
+	std::vector<uint64_t> hashes;
+	hashes.reserve(cache.entries.size());
+	for (auto e = cache.entries.begin(); e != cache.entries.end(); e++) {
+		hashes.push_back(e->first);
+	}
+	std::sort(hashes.begin(), hashes.end());
+
+	std::string tempFileName = std::string(fileName) + ".tmp";
+	FILE* file = fopen(tempFileName.c_str(), "wb");
+	if (!file) {
+		return false;
+	}
+	BrushCacheHeader header = { BRUSHCACHE_MAGIC, BRUSHCACHE_VERSION, hashes.size() };
+	bool isWritten = fwrite(&header, sizeof(header), 1, file) == 1;
+	for (auto h = hashes.begin(); h != hashes.end() && isWritten; h++) {
+		const BrushCacheEntry& entry = cache.entries.at(*h);
+		BrushCacheEntryHeader entryHeader = { };
+		entryHeader.hash = *h;
+		entryHeader.anchor[0] = entry.anchor.x;
+		entryHeader.anchor[1] = entry.anchor.y;
+		entryHeader.anchor[2] = entry.anchor.z;
+		entryHeader.planeCount = (uint32_t)(entry.key.size() / PS_BRUSH_KEY_STRIDE);
+		entryHeader.polyCount = (uint32_t)entry.polyFaces.size();
+		entryHeader.vertexCount = (uint32_t)entry.vertices.size();
+		entryHeader.mobility = entry.mobility;
+		isWritten &= fwrite(&entryHeader, sizeof(entryHeader), 1, file) == 1;
+		isWritten &= fwrite(entry.key.data(), sizeof(double), entry.key.size(), file) == entry.key.size();
+		isWritten &= fwrite(entry.polyFaces.data(), sizeof(uint32_t), entry.polyFaces.size(), file) == entry.polyFaces.size();
+		isWritten &= fwrite(entry.polyVertexCounts.data(), sizeof(uint32_t), entry.polyVertexCounts.size(), file) == entry.polyVertexCounts.size();
+		isWritten &= fwrite(entry.vertices.data(), sizeof(glm::f64vec3), entry.vertices.size(), file) == entry.vertices.size();
+	}
+	isWritten &= fclose(file) == 0;
+
+	std::error_code error;
+	if (isWritten) {
+		std::filesystem::rename(tempFileName, fileName, error);
+	}
+	else {
+		std::filesystem::remove(tempFileName, error);
+	}
+
+	return isWritten && !error;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,678 @@
+/*
+* Node/leaf BSP tree over the solids of the world (the solid world brushes).
+*
+* Every inner node splits space by the plane of one of the faces of the
+* solids. Faces that span the plane are cut in two. Faces that lie in the
+* plane are used up and go to the side they face. Once a side has no unused
+* faces left it becomes a leaf: a convex region of space that is either
+* completely inside the solids or completely outside of them, so a point in
+* the region tells its contents.
+*
+* Faces buried in other solids are not on the border between solid and empty
+* and are left out (see cullHiddenFaces in csg.h). The polygons of the
+* polysoup do not split either, they are pushed down the finished tree and
+* listed in the leaves they end up in. Both would only break the empty space
+* into more leaves and make vis (vis.h) slower.
+*
+* The splitter is the candidate with the lowest
+*   splitWeight * spans + | front - back |
+* a high weight avoids cutting faces, a low one keeps the tree shallow.
+* Large nodes only test a spread of PS_BSP_MAX_CANDIDATES faces.
+*
+* The two sides of a node are independent, so the first levels hand them to
+* two threads each. The tree is flattened afterwards in depth first order, so
+* the result does not depend on the thread count.
+*
+* The file (world.bsp) is laid out as in bspfile.h, which the engine shares.
+*/
+
+#ifndef _BSP_H_
+#define _BSP_H_
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <glm/glm.hpp>
+
+#include "polysoup.h"
+#include "bspfile.h"
+
+#define PS_BSP_SPLIT_WEIGHT		(8)
+#define PS_BSP_MAX_CANDIDATES	(32)
+
+struct BSPSolid
+{
+	const Plane*				planes;
+	int							planeCount;
+	const std::vector<Polygon>*	faces;	// The parts of its faces not buried in other solids
+};
+
+struct BSPBounds
+{
+	glm::f64vec3 min;
+	glm::f64vec3 max;
+};
+
+struct BSPTree
+{
+	std::vector<Plane>		planes;
+	std::vector<BSPNode>	nodes;	// Empty: the whole world is leaf 0
+	std::vector<BSPLeaf>	leaves;
+	std::vector<BSPFace>	faces;
+	std::vector<uint8_t>	vis;
+	std::vector<BSPHull>	hulls;
+	std::vector<BSPBrush>	brushes;
+	std::vector<Plane>		brushPlanes;
+	std::vector<uint32_t>	leafBrushes;	// Brushes touching a leaf, + BSPHull::firstBrush
+	BSPBounds				bounds;		// Region of the root node
+	uint32_t				splitCount;	// Faces and polygons that got cut
+};
+
+/*
+* polys is the polysoup as createPolysoup returns it (convex polygons, before
+* triangulation). threadCount 0 = all hardware threads.
+*/
+BSPTree		buildBSP(const std::vector<Polygon>& polys, const std::vector<BSPSolid>& solids,
+				unsigned int threadCount = 1, int splitWeight = PS_BSP_SPLIT_WEIGHT);
+
+/*
+* The six planes around bounds, pointing out.
+*/
+void		getBSPBoundsPlanes(const BSPBounds& bounds, std::vector<Plane>* planes);
+
+/*
+* Index of the leaf p is in. Walks one node per level.
+*/
+uint32_t	findBSPLeaf(const BSPTree& tree, const glm::f64vec3& p);
+
+void		getBSPDepth(const BSPTree& tree, int* maxDepth, double* averageDepth);
+bool		writeBSP(const char* fileName, const BSPTree& tree);
+
+
+
+/*
+*
+* IMPLEMENTATION
+*
+*/
+
+
+
+#if defined(BSP_IMPLEMENTATION)
+
+#include <algorithm>
+#include <memory>
+#include <unordered_map>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "parallel.h"
+
+struct BSPBuildPoly
+{
+	Polygon		poly;
+	double		d;			// Plane of the polygon: poly.normal, d
+	bool		isSplitter;	// Lies in the plane of a node above
+};
+
+struct BSPBuildNode
+{
+	glm::f64vec3					n;
+	double							d;
+	std::unique_ptr<BSPBuildNode>	children[2];
+	bool							isLeaf;
+	uint32_t						contents;
+	uint32_t						splitCount;
+};
+
+struct BSPBuilder
+{
+	const std::vector<BSPSolid>*	solids;
+	std::vector<BSPBounds>			solidBounds;
+	int								splitWeight;
+};
+
+enum BSPSide
+{
+	BSP_SIDE_FRONT,
+	BSP_SIDE_BACK,
+	BSP_SIDE_ON,
+	BSP_SIDE_SPANNING
+};
+
+static BSPSide classifyBSPPolygon(const Polygon& poly, const glm::f64vec3& n, double d)
+{
+	bool hasFront = false, hasBack = false;
+	for (auto v = poly.vertices.begin(); v != poly.vertices.end(); v++) {
+		double distance = glm::dot(n, *v) + d;
+		hasFront |= distance > PS_FLOAT_EPSILON;
+		hasBack |= distance < -PS_FLOAT_EPSILON;
+	}
+
+	if (hasFront && hasBack) return BSP_SIDE_SPANNING;
+	if (hasFront) return BSP_SIDE_FRONT;
+	if (hasBack) return BSP_SIDE_BACK;
+
+	return BSP_SIDE_ON;
+}
+
+/*
+* Cuts a polygon that spans the plane. Vertices on the plane go to both parts.
+*/
+static void splitBSPPolygon(const Polygon& poly, const glm::f64vec3& n, double d, Polygon* front, Polygon* back)
+{
+	front->normal = poly.normal;
+	back->normal = poly.normal;
+	front->texture = poly.texture;
+	back->texture = poly.texture;
+
+	size_t count = poly.vertices.size();
+	for (size_t i = 0; i < count; i++) {
+		const glm::f64vec3& a = poly.vertices[i];
+		const glm::f64vec3& b = poly.vertices[(i + 1) % count];
+		double da = glm::dot(n, a) + d;
+		double db = glm::dot(n, b) + d;
+
+		if (da >= -PS_FLOAT_EPSILON) front->vertices.push_back(a);
+		if (da <= PS_FLOAT_EPSILON) back->vertices.push_back(a);
+		if ((da > PS_FLOAT_EPSILON && db < -PS_FLOAT_EPSILON) || (da < -PS_FLOAT_EPSILON && db > PS_FLOAT_EPSILON)) {
+			glm::f64vec3 v = a + (da / (da - db)) * (b - a);
+			front->vertices.push_back(v);
+			back->vertices.push_back(v);
+		}
+	}
+}
+
+/*
+* Returns the unused polygon whose plane scores best, -1 if all are used.
+*/
+static int selectBSPSplitter(const std::vector<BSPBuildPoly>& polys, int splitWeight)
+{
+	std::vector<int> candidates;
+	for (size_t i = 0; i < polys.size(); i++) {
+		if (!polys[i].isSplitter) {
+			candidates.push_back((int)i);
+		}
+	}
+	if (candidates.empty()) {
+		return -1;
+	}
+
+	size_t stride = candidates.size() / PS_BSP_MAX_CANDIDATES + 1;
+	int best = -1;
+	int64_t bestScore = INT64_MAX;
+	for (size_t c = 0; c < candidates.size(); c += stride) {
+		const BSPBuildPoly& splitter = polys[candidates[c]];
+		int64_t front = 0, back = 0, spans = 0;
+		for (auto p = polys.begin(); p != polys.end(); p++) {
+			switch (classifyBSPPolygon(p->poly, splitter.poly.normal, splitter.d)) {
+			case BSP_SIDE_FRONT: front++; break;
+			case BSP_SIDE_BACK: back++; break;
+			case BSP_SIDE_SPANNING: spans++; break;
+			case BSP_SIDE_ON: glm::dot(p->poly.normal, splitter.poly.normal) > 0.0 ? front++ : back++; break;
+			}
+		}
+
+		int64_t score = splitWeight * spans + (front > back ? front - back : back - front);
+		if (score < bestScore) {
+			bestScore = score;
+			best = candidates[c];
+		}
+	}
+
+	return best;
+}
+
+static BSPBounds getBSPBounds(const std::vector<Polygon>& polys)
+{
+	BSPBounds bounds = { glm::f64vec3(INFINITY), glm::f64vec3(-INFINITY) };
+	for (auto p = polys.begin(); p != polys.end(); p++) {
+		for (auto v = p->vertices.begin(); v != p->vertices.end(); v++) {
+			bounds.min = glm::min(bounds.min, *v);
+			bounds.max = glm::max(bounds.max, *v);
+		}
+	}
+
+	return bounds;
+}
+
+/*
+* cell: planes around the leaf's region, pointing out of it. The last one is
+* the plane of the parent node. The part of it inside the cell is a face of
+* the region, a point just behind its center is inside the region.
+* Cells too thin to get a point from keep the contents their side suggests.
+*/
+static uint32_t getBSPLeafContents(const BSPBuilder& builder, const std::vector<Plane>& cell, int side)
+{
+	const double inset = 0.01;
+
+	if (cell.empty()) {
+		return BSP_EMPTY; // No polygons at all
+	}
+	std::vector<glm::f64vec3> winding, clipped;
+	createBaseWinding(cell.back(), &winding);
+	for (size_t i = 0; i + 1 < cell.size() && winding.size() >= 3; i++) {
+		clipWinding(winding, cell[i], &clipped);
+		winding.swap(clipped);
+	}
+	if (winding.size() < 3) {
+		return side == BSP_SIDE_BACK ? BSP_SOLID : BSP_EMPTY;
+	}
+
+	glm::f64vec3 center(0.0);
+	for (auto v = winding.begin(); v != winding.end(); v++) {
+		center += *v;
+	}
+	center = center / (double)winding.size() - inset * cell.back().n;
+
+	const std::vector<BSPSolid>& solids = *builder.solids;
+	for (size_t i = 0; i < solids.size(); i++) {
+		const BSPBounds& bounds = builder.solidBounds[i];
+		if (center.x < bounds.min.x || center.y < bounds.min.y || center.z < bounds.min.z
+			|| center.x > bounds.max.x || center.y > bounds.max.y || center.z > bounds.max.z) {
+			continue;
+		}
+		bool isInside = true;
+		for (int p = 0; p < solids[i].planeCount && isInside; p++) {
+			isInside = glm::dot(solids[i].planes[p].n, center) + solids[i].planes[p].d <= PS_FLOAT_EPSILON;
+		}
+		if (isInside) {
+			return BSP_SOLID;
+		}
+	}
+
+	return BSP_EMPTY;
+}
+
+/*
+* side: which side of its parent the node is on.
+* forkDepth: the next that many levels build their two sides on two threads.
+*/
+static std::unique_ptr<BSPBuildNode> buildBSPNode(const BSPBuilder& builder, std::vector<BSPBuildPoly>* polys,
+	const std::vector<Plane>& cell, int side, int forkDepth)
+{
+	std::unique_ptr<BSPBuildNode> node(new BSPBuildNode());
+	node->splitCount = 0;
+
+	int splitter = selectBSPSplitter(*polys, builder.splitWeight);
+	if (splitter < 0) {
+		node->isLeaf = true;
+		node->contents = getBSPLeafContents(builder, cell, side);
+		return node;
+	}
+
+	node->isLeaf = false;
+	node->n = (*polys)[splitter].poly.normal;
+	node->d = (*polys)[splitter].d;
+
+	std::vector<BSPBuildPoly> sides[2];
+	for (auto p = polys->begin(); p != polys->end(); p++) {
+		switch (classifyBSPPolygon(p->poly, node->n, node->d)) {
+		case BSP_SIDE_FRONT:
+			sides[0].push_back(std::move(*p));
+			break;
+		case BSP_SIDE_BACK:
+			sides[1].push_back(std::move(*p));
+			break;
+		case BSP_SIDE_ON:
+			p->isSplitter = true;
+			sides[glm::dot(p->poly.normal, node->n) > 0.0 ? 0 : 1].push_back(std::move(*p));
+			break;
+		case BSP_SIDE_SPANNING: {
+			BSPBuildPoly front = { { }, p->d, p->isSplitter };
+			BSPBuildPoly back = front;
+			splitBSPPolygon(p->poly, node->n, node->d, &front.poly, &back.poly);
+			sides[0].push_back(std::move(front));
+			sides[1].push_back(std::move(back));
+			node->splitCount++;
+			break;
+		}
+		}
+	}
+	// Only the children's lists are needed from here on.
+	std::vector<BSPBuildPoly>().swap(*polys);
+
+	parallelFor(2, forkDepth > 0 ? 2 : 1, [&](size_t i) {
+		// The front side is in front of the plane, so the plane bounding it points the other way.
+		std::vector<Plane> childCell = cell;
+		double sign = i == 0 ? -1.0 : 1.0;
+		childCell.push_back({ sign * node->n, -node->d * node->n, sign * node->d });
+		node->children[i] = buildBSPNode(builder, &sides[i], childCell, i == 0 ? BSP_SIDE_FRONT : BSP_SIDE_BACK, forkDepth - 1);
+	});
+
+	return node;
+}
+
+struct BSPPlaneKey
+{
+	double n[3];
+	double d;
+
+	bool operator==(const BSPPlaneKey& other) const
+	{
+		return !memcmp(this, &other, sizeof(BSPPlaneKey));
+	}
+};
+
+struct BSPPlaneKeyHash
+{
+	size_t operator()(const BSPPlaneKey& key) const
+	{
+		uint64_t bits[4];
+		memcpy(bits, &key, sizeof(bits));
+
+		return (size_t)(bits[0] * 0x9E3779B97F4A7C15ull ^ bits[1] * 0xC2B2AE3D27D4EB4Full
+			^ bits[2] * 0x165667B19E3779F9ull ^ bits[3]);
+	}
+};
+
+struct BSPFlattener
+{
+	BSPTree*												tree;
+	std::unordered_map<BSPPlaneKey, int32_t, BSPPlaneKeyHash>	planeIndices;
+};
+
+static int32_t getBSPPlaneIndex(BSPFlattener* flattener, const glm::f64vec3& n, double d)
+{
+	BSPPlaneKey key = { { n.x, n.y, n.z }, d };
+	auto plane = flattener->planeIndices.find(key);
+	if (plane != flattener->planeIndices.end()) {
+		return plane->second;
+	}
+
+	int32_t planeIndex = (int32_t)flattener->tree->planes.size();
+	flattener->tree->planes.push_back({ n, -d * n, d });
+	flattener->planeIndices[key] = planeIndex;
+
+	return planeIndex;
+}
+
+/*
+* Depth first, front before back: a node's front child usually sits right
+* behind it in the array.
+*/
+static int32_t flattenBSPNode(BSPFlattener* flattener, const BSPBuildNode* node)
+{
+	BSPTree* tree = flattener->tree;
+	tree->splitCount += node->splitCount;
+
+	if (node->isLeaf) {
+		int32_t leafIndex = (int32_t)tree->leaves.size();
+		BSPLeaf leaf = { };
+		leaf.contents = node->contents;
+		leaf.visOffset = BSP_NO_VIS;
+		tree->leaves.push_back(leaf);
+		return -(leafIndex + 1);
+	}
+
+	int32_t nodeIndex = (int32_t)tree->nodes.size();
+	tree->nodes.push_back({ getBSPPlaneIndex(flattener, node->n, node->d), { 0, 0 } });
+	int32_t front = flattenBSPNode(flattener, node->children[0].get());
+	int32_t back = flattenBSPNode(flattener, node->children[1].get());
+	tree->nodes[nodeIndex].children[0] = front;
+	tree->nodes[nodeIndex].children[1] = back;
+
+	return nodeIndex;
+}
+
+void getBSPBoundsPlanes(const BSPBounds& bounds, std::vector<Plane>* planes)
+{
+	for (int axis = 0; axis < 3; axis++) {
+		glm::f64vec3 n(0.0);
+		n[axis] = 1.0;
+		planes->push_back({ n, bounds.max, -bounds.max[axis] });
+		planes->push_back({ -n, bounds.min, bounds.min[axis] });
+	}
+}
+
+/*
+* Pushes a polygon of the polysoup down the finished tree and lists the leaves
+* the pieces end up in, in tree order. Pieces in a node's plane go to the side
+* they face, like the splitters did.
+*/
+static void filterBSPPolygon(const BSPTree& tree, const Polygon& poly, std::vector<uint32_t>* leaves, uint32_t* splitCount)
+{
+	if (tree.nodes.empty()) {
+		leaves->push_back(0);
+		return;
+	}
+
+	std::vector<std::pair<int32_t, Polygon>> stack;
+	stack.push_back({ 0, poly });
+	while (!stack.empty()) {
+		int32_t child = stack.back().first;
+		Polygon piece = std::move(stack.back().second);
+		stack.pop_back();
+
+		if (child < 0) {
+			leaves->push_back((uint32_t)(-(child + 1)));
+			continue;
+		}
+
+		const BSPNode& node = tree.nodes[child];
+		const Plane& plane = tree.planes[node.plane];
+		// Back is pushed first so the front side is finished first.
+		switch (classifyBSPPolygon(piece, plane.n, plane.d)) {
+		case BSP_SIDE_FRONT:
+			stack.push_back({ node.children[0], std::move(piece) });
+			break;
+		case BSP_SIDE_BACK:
+			stack.push_back({ node.children[1], std::move(piece) });
+			break;
+		case BSP_SIDE_ON:
+			stack.push_back({ node.children[glm::dot(piece.normal, plane.n) > 0.0 ? 0 : 1], std::move(piece) });
+			break;
+		case BSP_SIDE_SPANNING: {
+			Polygon front, back;
+			splitBSPPolygon(piece, plane.n, plane.d, &front, &back);
+			stack.push_back({ node.children[1], std::move(back) });
+			stack.push_back({ node.children[0], std::move(front) });
+			(*splitCount)++;
+			break;
+		}
+		}
+	}
+}
+
+/*
+* Fills in the faces of the leaves. A polygon cut by the tree is listed once
+* in every leaf a piece of it is in.
+*/
+static void filterBSPFaces(BSPTree* tree, const std::vector<Polygon>& polys, unsigned int threadCount)
+{
+	std::vector<std::vector<uint32_t>> polyLeaves(polys.size());
+	std::vector<uint32_t> polySplits(polys.size(), 0);
+	parallelFor(polys.size(), threadCount, [&](size_t i) {
+		if (polys[i].vertices.size() >= 3) {
+			filterBSPPolygon(*tree, polys[i], &polyLeaves[i], &polySplits[i]);
+			std::sort(polyLeaves[i].begin(), polyLeaves[i].end());
+			polyLeaves[i].erase(std::unique(polyLeaves[i].begin(), polyLeaves[i].end()), polyLeaves[i].end());
+		}
+	});
+
+	// Count, then place every face at its leaf's next free slot. Polygons are
+	// visited in order, so the faces of a leaf stay in polysoup order.
+	std::vector<uint32_t> leafFaceCounts(tree->leaves.size(), 0);
+	for (size_t i = 0; i < polys.size(); i++) {
+		tree->splitCount += polySplits[i];
+		for (auto l = polyLeaves[i].begin(); l != polyLeaves[i].end(); l++) {
+			leafFaceCounts[*l]++;
+		}
+	}
+	uint32_t faceCount = 0;
+	for (size_t l = 0; l < tree->leaves.size(); l++) {
+		tree->leaves[l].firstFace = faceCount;
+		faceCount += leafFaceCounts[l];
+	}
+
+	tree->faces.resize(faceCount);
+	uint32_t triangleCount = 0;
+	for (size_t i = 0; i < polys.size(); i++) {
+		uint32_t polyTriangles = polys[i].vertices.size() >= 3 ? (uint32_t)polys[i].vertices.size() - 2 : 0;
+		for (auto l = polyLeaves[i].begin(); l != polyLeaves[i].end(); l++) {
+			BSPLeaf& leaf = tree->leaves[*l];
+			tree->faces[leaf.firstFace + leaf.faceCount++] = { triangleCount, polyTriangles };
+		}
+		triangleCount += polyTriangles;
+	}
+}
+
+BSPTree buildBSP(const std::vector<Polygon>& polys, const std::vector<BSPSolid>& solids, unsigned int threadCount, int splitWeight)
+{
+	BSPBuilder builder;
+	builder.solids = &solids;
+	builder.splitWeight = splitWeight;
+	std::vector<BSPBuildPoly> buildPolys;
+	std::vector<Polygon> solidPolys;
+	for (auto s = solids.begin(); s != solids.end(); s++) {
+		solidPolys.clear();
+		createPlanePolys(s->planes, s->planeCount, &solidPolys);
+		BSPBounds bounds = getBSPBounds(solidPolys);
+		builder.solidBounds.push_back({ bounds.min - glm::f64vec3(PS_FLOAT_EPSILON), bounds.max + glm::f64vec3(PS_FLOAT_EPSILON) });
+		for (auto p = s->faces->begin(); p != s->faces->end(); p++) {
+			if (p->vertices.size() >= 3) {
+				buildPolys.push_back({ *p, -glm::dot(p->normal, p->vertices[0]), false });
+			}
+		}
+	}
+
+	// Leaves outside of the map still need a region to find a center in, so start
+	// with a box a bit bigger than the map.
+	BSPBounds bounds = getBSPBounds(polys);
+	for (auto p = buildPolys.begin(); p != buildPolys.end(); p++) {
+		for (auto v = p->poly.vertices.begin(); v != p->poly.vertices.end(); v++) {
+			bounds.min = glm::min(bounds.min, *v);
+			bounds.max = glm::max(bounds.max, *v);
+		}
+	}
+	std::vector<Plane> cell;
+	if (bounds.min.x <= bounds.max.x) {
+		bounds.min -= glm::f64vec3(1.0);
+		bounds.max += glm::f64vec3(1.0);
+		getBSPBoundsPlanes(bounds, &cell);
+	}
+
+	// Two more levels than needed to keep every thread busy, the sides are rarely the same size.
+	int forkDepth = 0;
+	for (unsigned int threads = getThreadCount(threadCount); threads > 1; threads = (threads + 1) / 2) {
+		forkDepth++;
+	}
+	if (forkDepth > 0) {
+		forkDepth += 2;
+	}
+	std::unique_ptr<BSPBuildNode> root = buildBSPNode(builder, &buildPolys, cell, BSP_SIDE_FRONT, forkDepth);
+
+	BSPTree tree = { };
+	tree.bounds = bounds;
+	BSPFlattener flattener = { };
+	flattener.tree = &tree;
+	flattenBSPNode(&flattener, root.get());
+	root.reset();
+	filterBSPFaces(&tree, polys, threadCount);
+
+	return tree;
+}
+
+uint32_t findBSPLeaf(const BSPTree& tree, const glm::f64vec3& p)
+{
+	if (tree.nodes.empty()) {
+		return 0;
+	}
+
+	int32_t child = 0;
+	while (child >= 0) {
+		const BSPNode& node = tree.nodes[child];
+		const Plane& plane = tree.planes[node.plane];
+		child = node.children[glm::dot(plane.n, p) + plane.d >= 0.0 ? 0 : 1];
+	}
+
+	return (uint32_t)(-(child + 1));
+}
+
+void getBSPDepth(const BSPTree& tree, int* maxDepth, double* averageDepth)
+{
+	*maxDepth = 0;
+	*averageDepth = 0.0;
+	if (tree.nodes.empty()) {
+		return;
+	}
+
+	// Nodes come before their children, so every node's depth is known when it is reached.
+	std::vector<int> depths(tree.nodes.size(), 0);
+	double depthSum = 0.0;
+	for (size_t i = 0; i < tree.nodes.size(); i++) {
+		for (int c = 0; c < 2; c++) {
+			int32_t child = tree.nodes[i].children[c];
+			if (child >= 0) {
+				depths[child] = depths[i] + 1;
+			}
+			else {
+				*maxDepth = std::max(*maxDepth, depths[i] + 1);
+				depthSum += depths[i] + 1;
+			}
+		}
+	}
+	*averageDepth = depthSum / tree.leaves.size();
+}
+
+static void getBSPFilePlanes(const std::vector<Plane>& planes, std::vector<BSPFilePlane>* filePlanes)
+{
+	filePlanes->resize(planes.size());
+	for (size_t i = 0; i < planes.size(); i++) {
+		const Plane& plane = planes[i];
+		(*filePlanes)[i] = { { (float)plane.n.x, (float)plane.n.y, (float)plane.n.z }, (float)plane.d };
+	}
+}
+
+bool writeBSP(const char* fileName, const BSPTree& tree)
+{
+	std::vector<BSPFilePlane> planes, brushPlanes;
+	getBSPFilePlanes(tree.planes, &planes);
+	getBSPFilePlanes(tree.brushPlanes, &brushPlanes);
+
+	BSPHeader header = { };
+	header.magic = BSP_MAGIC;
+	header.version = BSP_VERSION;
+	header.planeCount = (uint32_t)planes.size();
+	header.nodeCount = (uint32_t)tree.nodes.size();
+	header.leafCount = (uint32_t)tree.leaves.size();
+	header.faceCount = (uint32_t)tree.faces.size();
+	header.visSize = (uint32_t)tree.vis.size();
+	header.hullCount = (uint32_t)tree.hulls.size();
+	header.brushCount = (uint32_t)tree.brushes.size();
+	header.brushPlaneCount = (uint32_t)brushPlanes.size();
+	header.leafBrushCount = (uint32_t)tree.leafBrushes.size();
+	header.planesOffset = sizeof(BSPHeader);
+	header.nodesOffset = header.planesOffset + header.planeCount * sizeof(BSPFilePlane);
+	header.leavesOffset = header.nodesOffset + header.nodeCount * sizeof(BSPNode);
+	header.facesOffset = header.leavesOffset + header.leafCount * sizeof(BSPLeaf);
+	header.hullsOffset = header.facesOffset + header.faceCount * sizeof(BSPFace);
+	header.brushesOffset = header.hullsOffset + header.hullCount * sizeof(BSPHull);
+	header.brushPlanesOffset = header.brushesOffset + header.brushCount * sizeof(BSPBrush);
+	header.leafBrushesOffset = header.brushPlanesOffset + header.brushPlaneCount * sizeof(BSPFilePlane);
+	header.visOffset = header.leafBrushesOffset + header.leafBrushCount * sizeof(uint32_t);
+
+	FILE* file = fopen(fileName, "wb");
+	if (!file) {
+		return false;
+	}
+	bool isWritten = fwrite(&header, sizeof(header), 1, file) == 1;
+	if (!planes.empty()) isWritten &= fwrite(&planes[0], sizeof(BSPFilePlane), planes.size(), file) == planes.size();
+	if (!tree.nodes.empty()) isWritten &= fwrite(&tree.nodes[0], sizeof(BSPNode), tree.nodes.size(), file) == tree.nodes.size();
+	if (!tree.leaves.empty()) isWritten &= fwrite(&tree.leaves[0], sizeof(BSPLeaf), tree.leaves.size(), file) == tree.leaves.size();
+	if (!tree.faces.empty()) isWritten &= fwrite(&tree.faces[0], sizeof(BSPFace), tree.faces.size(), file) == tree.faces.size();
+	if (!tree.hulls.empty()) isWritten &= fwrite(&tree.hulls[0], sizeof(BSPHull), tree.hulls.size(), file) == tree.hulls.size();
+	if (!tree.brushes.empty()) isWritten &= fwrite(&tree.brushes[0], sizeof(BSPBrush), tree.brushes.size(), file) == tree.brushes.size();
+	if (!brushPlanes.empty()) isWritten &= fwrite(&brushPlanes[0], sizeof(BSPFilePlane), brushPlanes.size(), file) == brushPlanes.size();
+	if (!tree.leafBrushes.empty()) isWritten &= fwrite(&tree.leafBrushes[0], sizeof(uint32_t), tree.leafBrushes.size(), file) == tree.leafBrushes.size();
+	if (!tree.vis.empty()) isWritten &= fwrite(&tree.vis[0], 1, tree.vis.size(), file) == tree.vis.size();
+	fclose(file);
+
+	return isWritten;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,113 @@
+/*
+* world.bsp as writeBSP (bsp.h) writes it. The engine reads it with the same
+* structs, src/Engine/bsp.h includes this file as well.
+*
+* File layout (native byte order, every section 4 byte aligned):
+* ----------------------------------------------------------------
+* BSPHeader
+* BSPFilePlane planes[ planeCount ]
+* BSPNode      nodes[ nodeCount ]     (nodes[ 0 ] is the root)
+* BSPLeaf      leaves[ leafCount ]
+* BSPFace      faces[ faceCount ]     (leaf faces are contiguous)
+* BSPHull      hulls[ hullCount ]     (collision hulls, see hull.h)
+* BSPBrush     brushes[ brushCount ]  (hull brushes are contiguous)
+* BSPFilePlane brushPlanes[ brushPlaneCount ]
+* uint32_t     leafBrushes[ leafBrushCount ]
+* uint8_t      vis[ visSize ]         (see vis.h)
+*/
+
+#ifndef _BSPFILE_H_
+#define _BSPFILE_H_
+
+#include <stdint.h>
+
+#define BSP_MAGIC				(0x20505342) // 'BSP '
+#define BSP_VERSION				(3)
+#define BSP_NO_VIS				(0xFFFFFFFF)
+
+enum BSPContents
+{
+	BSP_EMPTY,
+	BSP_SOLID
+};
+
+struct BSPHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t planeCount;
+	uint32_t nodeCount;
+	uint32_t leafCount;
+	uint32_t faceCount;
+	uint32_t visSize;
+	uint32_t planesOffset;
+	uint32_t nodesOffset;
+	uint32_t leavesOffset;
+	uint32_t facesOffset;
+	uint32_t visOffset;
+	uint32_t hullCount;
+	uint32_t brushCount;
+	uint32_t brushPlaneCount;
+	uint32_t hullsOffset;
+	uint32_t brushesOffset;
+	uint32_t brushPlanesOffset;
+	uint32_t leafBrushCount;
+	uint32_t leafBrushesOffset;
+};
+
+struct BSPFilePlane
+{
+	float n[3];
+	float d;	// Distance of p to the plane = n dot p + d
+};
+
+struct BSPNode
+{
+	int32_t plane;
+	int32_t children[2];	// Front, back. < 0: leaf -(child + 1)
+};
+
+struct BSPLeaf
+{
+	uint32_t contents;
+	uint32_t firstFace;
+	uint32_t faceCount;
+	uint32_t visOffset;	// Into vis, BSP_NO_VIS: sees everything
+	uint32_t firstBrush;	// Into leafBrushes
+	uint32_t brushCount;
+};
+
+/*
+* Triangles of one polygon of the polysoup in the triangulated output
+* (tris.bin, mesh.bin).
+*/
+struct BSPFace
+{
+	uint32_t firstTriangle;
+	uint32_t triangleCount;
+};
+
+/*
+* The solids grown by a box (mins, maxs around the origin of whatever
+* moves), a point inside one of its brushes is where the box collides.
+*/
+struct BSPHull
+{
+	float mins[3];
+	uint32_t firstBrush;
+	float maxs[3];
+	uint32_t brushCount;
+};
+
+/*
+* A convex brush of a hull: inside all of its planes. min, max are its bounds.
+*/
+struct BSPBrush
+{
+	float min[3];
+	uint32_t firstPlane;
+	float max[3];
+	uint32_t planeCount;
+};
+
+#endif
@@ -0,0 +1,541 @@
+/*
+* Bounding volume hierarchy over a triangle soup, for casting rays.
+*
+* Build: top down with the surface area heuristic. The centroids of a node's
+* triangles are sorted into PS_BVH_BINS bins along each axis, and the bin
+* border with the lowest
+*   area( left ) * count( left ) + area( right ) * count( right )
+* is the split. A node becomes a leaf if no split beats testing all of its
+* triangles, or once it holds PS_BVH_MAX_LEAF_SIZE triangles or less.
+* Nodes are stored depth first: the left child right after its parent, so
+* an inner node only needs the index of its right child.
+*
+* Rays are cast in packets of four. One box test decides for all four rays
+* whether to go down a node, one triangle test checks a triangle against all
+* four. With SSE (every x64 compiler) the four rays are the four lanes of a
+* register, otherwise the same code runs on plain arrays.
+*/
+
+#ifndef _BVH_H_
+#define _BVH_H_
+
+#include <vector>
+#include <stdint.h>
+
+#include <glm/glm.hpp>
+
+#include "polysoup.h"
+
+#define PS_BVH_BINS				(16)
+#define PS_BVH_MAX_LEAF_SIZE	(4)
+#define PS_BVH_MAX_DEPTH		(60)	// Keeps the traversal stacks of 64 from overflowing
+#define PS_BVH_NO_HIT			(0xFFFFFFFF)
+
+struct BVHNode
+{
+	float		min[3];
+	uint32_t	first;	// Leaf: first triangle, inner node: right child
+	float		max[3];
+	uint32_t	count;	// Triangles in the leaf, 0 for inner nodes
+};
+
+/*
+* Edges instead of the other two vertices, that is what the ray test needs.
+*/
+struct BVHTriangle
+{
+	glm::vec3 v0;
+	glm::vec3 e1;
+	glm::vec3 e2;
+};
+
+struct BVH
+{
+	std::vector<BVHNode>		nodes;
+	std::vector<BVHTriangle>	triangles;	// In leaf order
+	std::vector<uint32_t>		indices;	// Index into the soup for every triangle
+};
+
+/*
+* Four rays. Directions do not have to be normalized, t is in units of the
+* direction. Rays with t outside of (tMin, tMax) do not hit.
+*/
+struct BVHRay4
+{
+	float origin[3][4];
+	float dir[3][4];
+	float tMin[4];
+	float tMax[4];
+};
+
+/*
+* tris is what triangulate returns: polygons with three vertices each.
+*/
+BVH			buildBVH(const std::vector<Polygon>& tris);
+
+/*
+* Returns bit i set if ray i of the mask hits anything. Stops as soon as all
+* of them have.
+*/
+uint32_t	occludeBVH4(const BVH& bvh, const BVHRay4& rays, uint32_t mask = 0xF);
+
+/*
+* Closest hit of every ray of the mask: hits[ i ] is the index of the triangle
+* in the soup (PS_BVH_NO_HIT if there is none) and rays->tMax[ i ] its t.
+*/
+void		intersectBVH4(const BVH& bvh, BVHRay4* rays, uint32_t hits[4], uint32_t mask = 0xF);
+
+
+
+/*
+*
+* IMPLEMENTATION
+*
+*/
+
+
+
+#if defined(BVH_IMPLEMENTATION)
+
+#include <algorithm>
+#include <float.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PS_BVH_SSE
+#include <emmintrin.h>
+#endif
+
+/*
+* Four floats, one per ray of a packet.
+*/
+#if defined(PS_BVH_SSE)
+
+struct BVHFloat4
+{
+	__m128 v;
+};
+
+static inline BVHFloat4 bvhLoad4(const float* p) { return { _mm_loadu_ps(p) }; }
+static inline void bvhStore4(float* p, BVHFloat4 a) { _mm_storeu_ps(p, a.v); }
+static inline BVHFloat4 bvhSet4(float f) { return { _mm_set1_ps(f) }; }
+static inline BVHFloat4 operator+(BVHFloat4 a, BVHFloat4 b) { return { _mm_add_ps(a.v, b.v) }; }
+static inline BVHFloat4 operator-(BVHFloat4 a, BVHFloat4 b) { return { _mm_sub_ps(a.v, b.v) }; }
+static inline BVHFloat4 operator*(BVHFloat4 a, BVHFloat4 b) { return { _mm_mul_ps(a.v, b.v) }; }
+static inline BVHFloat4 operator/(BVHFloat4 a, BVHFloat4 b) { return { _mm_div_ps(a.v, b.v) }; }
+static inline BVHFloat4 bvhMin4(BVHFloat4 a, BVHFloat4 b) { return { _mm_min_ps(a.v, b.v) }; }
+static inline BVHFloat4 bvhMax4(BVHFloat4 a, BVHFloat4 b) { return { _mm_max_ps(a.v, b.v) }; }
+static inline BVHFloat4 bvhAbs4(BVHFloat4 a) { return { _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v) }; }
+// Comparisons return a mask with bit i set for lane i.
+static inline uint32_t bvhLess4(BVHFloat4 a, BVHFloat4 b) { return (uint32_t)_mm_movemask_ps(_mm_cmplt_ps(a.v, b.v)); }
+static inline uint32_t bvhLessEqual4(BVHFloat4 a, BVHFloat4 b) { return (uint32_t)_mm_movemask_ps(_mm_cmple_ps(a.v, b.v)); }
+
+#else
+
+struct BVHFloat4
+{
+	float v[4];
+};
+
+static inline BVHFloat4 bvhLoad4(const float* p) { return { { p[0], p[1], p[2], p[3] } }; }
+static inline void bvhStore4(float* p, BVHFloat4 a) { for (int i = 0; i < 4; i++) p[i] = a.v[i]; }
+static inline BVHFloat4 bvhSet4(float f) { return { { f, f, f, f } }; }
+#define PS_BVH_LANES(op) BVHFloat4 r; for (int i = 0; i < 4; i++) r.v[i] = op; return r;
+static inline BVHFloat4 operator+(BVHFloat4 a, BVHFloat4 b) { PS_BVH_LANES(a.v[i] + b.v[i]) }
+static inline BVHFloat4 operator-(BVHFloat4 a, BVHFloat4 b) { PS_BVH_LANES(a.v[i] - b.v[i]) }
+static inline BVHFloat4 operator*(BVHFloat4 a, BVHFloat4 b) { PS_BVH_LANES(a.v[i] * b.v[i]) }
+static inline BVHFloat4 operator/(BVHFloat4 a, BVHFloat4 b) { PS_BVH_LANES(a.v[i] / b.v[i]) }
+static inline BVHFloat4 bvhMin4(BVHFloat4 a, BVHFloat4 b) { PS_BVH_LANES(b.v[i] < a.v[i] ? b.v[i] : a.v[i]) }
+static inline BVHFloat4 bvhMax4(BVHFloat4 a, BVHFloat4 b) { PS_BVH_LANES(b.v[i] > a.v[i] ? b.v[i] : a.v[i]) }
+static inline BVHFloat4 bvhAbs4(BVHFloat4 a) { PS_BVH_LANES(a.v[i] < 0.0f ? -a.v[i] : a.v[i]) }
+#undef PS_BVH_LANES
+static inline uint32_t bvhLess4(BVHFloat4 a, BVHFloat4 b)
+{
+	uint32_t mask = 0;
+	for (int i = 0; i < 4; i++) mask |= (uint32_t)(a.v[i] < b.v[i]) << i;
+	return mask;
+}
+static inline uint32_t bvhLessEqual4(BVHFloat4 a, BVHFloat4 b)
+{
+	uint32_t mask = 0;
+	for (int i = 0; i < 4; i++) mask |= (uint32_t)(a.v[i] <= b.v[i]) << i;
+	return mask;
+}
+
+#endif
+
+struct BVHBuildTriangle
+{
+	glm::vec3	min;
+	glm::vec3	max;
+	glm::vec3	center;
+	uint32_t	index;
+};
+
+struct BVHBin
+{
+	glm::vec3	min;
+	glm::vec3	max;
+	uint32_t	count;
+};
+
+static inline float getBVHArea(const glm::vec3& min, const glm::vec3& max)
+{
+	glm::vec3 d = max - min;
+
+	return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+
+static void buildBVHNode(BVH* bvh, std::vector<BVHBuildTriangle>* tris, uint32_t first, uint32_t count, int depth)
+{
+	uint32_t nodeIndex = (uint32_t)bvh->nodes.size();
+	bvh->nodes.push_back({ });
+
+	glm::vec3 min(FLT_MAX), max(-FLT_MAX), centerMin(FLT_MAX), centerMax(-FLT_MAX);
+	for (uint32_t i = first; i < first + count; i++) {
+		const BVHBuildTriangle& t = (*tris)[i];
+		min = glm::min(min, t.min);
+		max = glm::max(max, t.max);
+		centerMin = glm::min(centerMin, t.center);
+		centerMax = glm::max(centerMax, t.center);
+	}
+	for (int a = 0; a < 3; a++) {
+		bvh->nodes[nodeIndex].min[a] = min[a];
+		bvh->nodes[nodeIndex].max[a] = max[a];
+	}
+
+	// Best bin border over all three axes. Costs are relative to the node's area.
+	int bestAxis = -1, bestBorder = 0;
+	float bestCost = (float)count; // Testing every triangle
+	if (count > PS_BVH_MAX_LEAF_SIZE && depth < PS_BVH_MAX_DEPTH) {
+		for (int axis = 0; axis < 3; axis++) {
+			float extent = centerMax[axis] - centerMin[axis];
+			if (extent <= 0.0f) {
+				continue;
+			}
+			BVHBin bins[PS_BVH_BINS];
+			for (int b = 0; b < PS_BVH_BINS; b++) {
+				bins[b] = { glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX), 0 };
+			}
+			float scale = PS_BVH_BINS / extent;
+			for (uint32_t i = first; i < first + count; i++) {
+				const BVHBuildTriangle& t = (*tris)[i];
+				int b = std::min((int)((t.center[axis] - centerMin[axis]) * scale), PS_BVH_BINS - 1);
+				bins[b].min = glm::min(bins[b].min, t.min);
+				bins[b].max = glm::max(bins[b].max, t.max);
+				bins[b].count++;
+			}
+
+			// Sweep from the right to get the right side's cost at every border, then from the left.
+			float rightCosts[PS_BVH_BINS];
+			glm::vec3 sideMin(FLT_MAX), sideMax(-FLT_MAX);
+			uint32_t sideCount = 0;
+			for (int b = PS_BVH_BINS - 1; b > 0; b--) {
+				sideMin = glm::min(sideMin, bins[b].min);
+				sideMax = glm::max(sideMax, bins[b].max);
+				sideCount += bins[b].count;
+				rightCosts[b] = sideCount ? getBVHArea(sideMin, sideMax) * sideCount : 0.0f;
+			}
+			sideMin = glm::vec3(FLT_MAX);
+			sideMax = glm::vec3(-FLT_MAX);
+			sideCount = 0;
+			float area = getBVHArea(min, max);
+			for (int b = 1; b < PS_BVH_BINS; b++) {
+				sideMin = glm::min(sideMin, bins[b - 1].min);
+				sideMax = glm::max(sideMax, bins[b - 1].max);
+				sideCount += bins[b - 1].count;
+				if (sideCount == 0 || sideCount == count) {
+					continue;
+				}
+				float cost = 1.0f + (getBVHArea(sideMin, sideMax) * sideCount + rightCosts[b]) / area;
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestBorder = b;
+				}
+			}
+		}
+	}
+
+	if (bestAxis < 0) {
+		bvh->nodes[nodeIndex].first = (uint32_t)bvh->triangles.size();
+		bvh->nodes[nodeIndex].count = count;
+		for (uint32_t i = first; i < first + count; i++) {
+			bvh->indices.push_back((*tris)[i].index);
+		}
+		return;
+	}
+
+	float scale = PS_BVH_BINS / (centerMax[bestAxis] - centerMin[bestAxis]);
+	auto middle = std::partition(tris->begin() + first, tris->begin() + first + count, [&](const BVHBuildTriangle& t) {
+		return std::min((int)((t.center[bestAxis] - centerMin[bestAxis]) * scale), PS_BVH_BINS - 1) < bestBorder;
+	});
+	uint32_t leftCount = (uint32_t)(middle - (tris->begin() + first));
+
+	buildBVHNode(bvh, tris, first, leftCount, depth + 1);
+	bvh->nodes[nodeIndex].first = (uint32_t)bvh->nodes.size();
+	bvh->nodes[nodeIndex].count = 0;
+	buildBVHNode(bvh, tris, first + leftCount, count - leftCount, depth + 1);
+}
+
+BVH buildBVH(const std::vector<Polygon>& tris)
+{
+	std::vector<BVHBuildTriangle> buildTris(tris.size());
+	for (size_t i = 0; i < tris.size(); i++) {
+		glm::vec3 v0 = tris[i].vertices[0], v1 = tris[i].vertices[1], v2 = tris[i].vertices[2];
+		buildTris[i].min = glm::min(v0, glm::min(v1, v2));
+		buildTris[i].max = glm::max(v0, glm::max(v1, v2));
+		buildTris[i].center = (buildTris[i].min + buildTris[i].max) * 0.5f;
+		buildTris[i].index = (uint32_t)i;
+	}
+
+	BVH bvh;
+	if (tris.empty()) {
+		return bvh;
+	}
+	bvh.nodes.reserve(2 * tris.size() / PS_BVH_MAX_LEAF_SIZE + 1);
+	bvh.indices.reserve(tris.size());
+	buildBVHNode(&bvh, &buildTris, 0, (uint32_t)buildTris.size(), 0);
+
+	// Leaves took their triangles in order, so the leaf order is the index order.
+	bvh.triangles.reserve(bvh.indices.size());
+	for (auto i = bvh.indices.begin(); i != bvh.indices.end(); i++) {
+		glm::vec3 v0 = tris[*i].vertices[0], v1 = tris[*i].vertices[1], v2 = tris[*i].vertices[2];
+		bvh.triangles.push_back({ v0, v1 - v0, v2 - v0 });
+	}
+
+	return bvh;
+}
+
+/*
+* The packet with the reciprocal directions the box tests need.
+*/
+struct BVHPacket
+{
+	BVHFloat4 origin[3];
+	BVHFloat4 dir[3];
+	BVHFloat4 invDir[3];
+	BVHFloat4 tMin;
+	BVHFloat4 tMax;
+};
+
+static void initBVHPacket(const BVHRay4& rays, BVHPacket* packet)
+{
+	for (int a = 0; a < 3; a++) {
+		packet->origin[a] = bvhLoad4(rays.origin[a]);
+		packet->dir[a] = bvhLoad4(rays.dir[a]);
+		float invDir[4];
+		for (int i = 0; i < 4; i++) {
+			// A huge number instead of infinity: 0 * infinity would be NaN for rays starting on a slab.
+			float d = rays.dir[a][i];
+			invDir[i] = fabsf(d) > 1e-20f ? 1.0f / d : (d < 0.0f ? -1e30f : 1e30f);
+		}
+		packet->invDir[a] = bvhLoad4(invDir);
+	}
+	packet->tMin = bvhLoad4(rays.tMin);
+	packet->tMax = bvhLoad4(rays.tMax);
+}
+
+/*
+* Returns the rays of the mask that hit the node's box, near: where they enter it.
+*/
+static inline uint32_t intersectBVHBox4(const BVHNode& node, const BVHPacket& packet, uint32_t mask, BVHFloat4* near)
+{
+	BVHFloat4 tNear = packet.tMin, tFar = packet.tMax;
+	for (int a = 0; a < 3; a++) {
+		BVHFloat4 t0 = (bvhSet4(node.min[a]) - packet.origin[a]) * packet.invDir[a];
+		BVHFloat4 t1 = (bvhSet4(node.max[a]) - packet.origin[a]) * packet.invDir[a];
+		tNear = bvhMax4(tNear, bvhMin4(t0, t1));
+		tFar = bvhMin4(tFar, bvhMax4(t0, t1));
+	}
+	*near = tNear;
+
+	return bvhLessEqual4(tNear, tFar) & mask;
+}
+
+/*
+* Moeller-Trumbore against all four rays. Returns the rays of the mask that hit
+* the triangle within their range, t: where.
+*/
+static inline uint32_t intersectBVHTriangle4(const BVHTriangle& tri, const BVHPacket& packet, uint32_t mask, BVHFloat4* t)
+{
+	const BVHFloat4 e1[3] = { bvhSet4(tri.e1.x), bvhSet4(tri.e1.y), bvhSet4(tri.e1.z) };
+	const BVHFloat4 e2[3] = { bvhSet4(tri.e2.x), bvhSet4(tri.e2.y), bvhSet4(tri.e2.z) };
+	const BVHFloat4* d = packet.dir;
+
+	// p = d x e2, det = e1 . p
+	BVHFloat4 p[3] = { d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2], d[0] * e2[1] - d[1] * e2[0] };
+	BVHFloat4 det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+	mask &= bvhLess4(bvhSet4(1e-12f), bvhAbs4(det));
+	if (!mask) {
+		return 0;
+	}
+	BVHFloat4 invDet = bvhSet4(1.0f) / det;
+
+	BVHFloat4 s[3] = { packet.origin[0] - bvhSet4(tri.v0.x), packet.origin[1] - bvhSet4(tri.v0.y), packet.origin[2] - bvhSet4(tri.v0.z) };
+	BVHFloat4 u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * invDet;
+	mask &= bvhLessEqual4(bvhSet4(0.0f), u) & bvhLessEqual4(u, bvhSet4(1.0f));
+	if (!mask) {
+		return 0;
+	}
+
+	// q = s x e1
+	BVHFloat4 q[3] = { s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2], s[0] * e1[1] - s[1] * e1[0] };
+	BVHFloat4 v = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) * invDet;
+	mask &= bvhLessEqual4(bvhSet4(0.0f), v) & bvhLessEqual4(u + v, bvhSet4(1.0f));
+	if (!mask) {
+		return 0;
+	}
+
+	*t = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * invDet;
+
+	return mask & bvhLess4(packet.tMin, *t) & bvhLess4(*t, packet.tMax);
+}
+
+uint32_t occludeBVH4(const BVH& bvh, const BVHRay4& rays, uint32_t mask)
+{
+	if (bvh.nodes.empty() || !mask) {
+		return 0;
+	}
+
+	BVHPacket packet;
+	initBVHPacket(rays, &packet);
+
+	// Node and the rays that go into its box.
+	uint32_t occluded = 0;
+	uint32_t stack[64][2];
+	int stackSize = 0;
+	BVHFloat4 near;
+	uint32_t rootMask = intersectBVHBox4(bvh.nodes[0], packet, mask, &near);
+	if (rootMask) {
+		stack[stackSize][0] = 0;
+		stack[stackSize++][1] = rootMask;
+	}
+	while (stackSize > 0) {
+		stackSize--;
+		uint32_t nodeIndex = stack[stackSize][0];
+		uint32_t active = stack[stackSize][1] & ~occluded;
+		if (!active) {
+			continue;
+		}
+		const BVHNode& node = bvh.nodes[nodeIndex];
+
+		if (node.count) {
+			for (uint32_t i = node.first; i < node.first + node.count && active; i++) {
+				BVHFloat4 t;
+				uint32_t hit = intersectBVHTriangle4(bvh.triangles[i], packet, active, &t);
+				occluded |= hit;
+				active &= ~hit;
+			}
+			if (occluded == mask) {
+				break;
+			}
+			continue;
+		}
+
+		// Shadow rays take any hit, the order does not matter.
+		uint32_t children[2] = { nodeIndex + 1, node.first };
+		for (int c = 0; c < 2; c++) {
+			uint32_t childMask = intersectBVHBox4(bvh.nodes[children[c]], packet, active, &near);
+			if (childMask) {
+				stack[stackSize][0] = children[c];
+				stack[stackSize++][1] = childMask;
+			}
+		}
+	}
+
+	return occluded;
+}
+
+/*
+* A node that is still to be visited by the rays of mask, which enter its box at near.
+*/
+struct BVHStackEntry
+{
+	BVHFloat4	near;
+	uint32_t	node;
+	uint32_t	mask;
+};
+
+void intersectBVH4(const BVH& bvh, BVHRay4* rays, uint32_t hits[4], uint32_t mask)
+{
+	for (int i = 0; i < 4; i++) {
+		hits[i] = PS_BVH_NO_HIT;
+	}
+	if (bvh.nodes.empty() || !mask) {
+		return;
+	}
+
+	BVHPacket packet;
+	initBVHPacket(*rays, &packet);
+
+	BVHStackEntry stack[64];
+	int stackSize = 0;
+	BVHFloat4 rootNear;
+	uint32_t rootMask = intersectBVHBox4(bvh.nodes[0], packet, mask, &rootNear);
+	if (rootMask) {
+		stack[stackSize++] = { rootNear, 0, rootMask };
+	}
+	while (stackSize > 0) {
+		const BVHStackEntry& entry = stack[--stackSize];
+		// Rays that found something closer than the box since it was pushed are done with it.
+		uint32_t active = entry.mask & bvhLessEqual4(entry.near, packet.tMax);
+		if (!active) {
+			continue;
+		}
+		uint32_t nodeIndex = entry.node;
+		const BVHNode& node = bvh.nodes[nodeIndex];
+
+		if (node.count) {
+			for (uint32_t i = node.first; i < node.first + node.count; i++) {
+				BVHFloat4 t;
+				uint32_t hit = intersectBVHTriangle4(bvh.triangles[i], packet, active, &t);
+				if (!hit) {
+					continue;
+				}
+				float ts[4], tMax[4];
+				bvhStore4(ts, t);
+				bvhStore4(tMax, packet.tMax);
+				for (int r = 0; r < 4; r++) {
+					if (hit & (1 << r)) {
+						tMax[r] = ts[r];
+						hits[r] = bvh.indices[i];
+					}
+				}
+				packet.tMax = bvhLoad4(tMax);
+			}
+			continue;
+		}
+
+		// Near child first, judged by the first ray that goes into both.
+		uint32_t children[2] = { nodeIndex + 1, node.first };
+		BVHFloat4 nears[2];
+		uint32_t childMasks[2];
+		for (int c = 0; c < 2; c++) {
+			childMasks[c] = intersectBVHBox4(bvh.nodes[children[c]], packet, active, &nears[c]);
+		}
+		int first = 0;
+		uint32_t both = childMasks[0] & childMasks[1];
+		if (both) {
+			float n0[4], n1[4];
+			bvhStore4(n0, nears[0]);
+			bvhStore4(n1, nears[1]);
+			int lane = 0;
+			while (!(both & (1 << lane))) {
+				lane++;
+			}
+			first = n1[lane] < n0[lane] ? 1 : 0;
+		}
+		for (int c = 1; c >= 0; c--) {
+			int child = c == 0 ? first : 1 - first;
+			if (childMasks[child]) {
+				stack[stackSize++] = { nears[child], children[child], childMasks[child] };
+			}
+		}
+	}
+
+	bvhStore4(rays->tMax, packet.tMax);
+}
+
+#endif
+
+#endif
@@ -0,0 +1,762 @@
+/*
+* Removes faces nobody can ever see.
+*
+* Hidden faces: every face of a brush is clipped against all other solid
+* brushes of the same entity that touch it. Whatever ends up inside another
+* brush (or lies flat against one, facing into it) is dropped. Candidates come
+* from an AABB tree over the brushes, each face is only clipped against the
+* ones that overlap its own bounds. When two brushes have a coplanar face
+* pointing the same way, only the one of the later brush is kept.
+*
+* Outside faces: the world is sampled on a grid of cells. A cell is solid if
+* its center lies in a solid world brush. Starting at the origins of the point
+* entities (player starts, lights, monsters, ...) the empty cells are flood
+* filled. A face is kept if there is a reached cell right in front of it. If
+* the flood gets out of the map's bounds, the map leaks and nothing is culled.
+* Walls must be at least as thick as a cell to stop the flood. Gaps narrower
+* than a cell count as closed.
+*/
+
+#ifndef _CSG_H_
+#define _CSG_H_
+
+#include <string_view>
+#include <vector>
+#include <stdint.h>
+
+#include <glm/glm.hpp>
+
+#include "polysoup.h"
+
+#define PS_CULL_CELL_SIZE	(8.0)
+#define PS_CULL_MAX_CELLS	(64 * 1024 * 1024)
+
+struct CSGBrush
+{
+	const Plane*			planes;
+	int						planeCount;
+	uint32_t				entity;		// Brushes only hide faces of brushes in the same entity.
+	bool					isSolid;	// Liquids, triggers, clip brushes, ... are not.
+	std::vector<Polygon>*	polys;		// Faces of the brush, replaced by what is left of them.
+};
+
+/*
+* Liquids ('*' textures) and tool textures do not hide anything.
+*/
+bool	isSolidTexture(std::string_view textureName);
+
+/*
+* Contents of a brush from the textures of all its faces, the way qbsp does
+* it: a single liquid, clip, trigger or origin face makes the whole brush non
+* solid. Skip and hint only mark the face they are on, they leave the contents
+* to the other faces. A brush of nothing but skip and hint faces is not solid.
+*/
+bool	isSolidBrush(const std::string_view* textureNames, size_t faceCount);
+
+/*
+* Removes hidden faces, then outside faces. Brushes of entity 0 (worldspawn)
+* seal the map. Returns false and keeps the outside faces if the map leaks or
+* there are no origins inside it.
+*/
+bool	cullFaces(std::vector<CSGBrush>& brushes, const std::vector<glm::f64vec3>& origins,
+			unsigned int threadCount = 1, double cellSize = PS_CULL_CELL_SIZE);
+
+/*
+* Only removes the hidden faces. Needs no origins.
+*/
+void	cullHiddenFaces(std::vector<CSGBrush>& brushes, unsigned int threadCount = 1);
+
+
+
+/*
+*
+* IMPLEMENTATION
+*
+*/
+
+
+
+#if defined(CSG_IMPLEMENTATION)
+
+#include <algorithm>
+#include <math.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "parallel.h"
+
+struct CSGBounds
+{
+	glm::f64vec3 min;
+	glm::f64vec3 max;
+};
+
+struct CSGNode
+{
+	CSGBounds	bounds;
+	uint32_t	first;		// Leaf: first index into CSGTree::brushes. Inner node: right child.
+	uint32_t	count;		// Leaf: number of brushes. Inner node: 0, the left child follows the node.
+};
+
+struct CSGTree
+{
+	std::vector<CSGNode>	nodes;
+	std::vector<uint32_t>	brushes;
+	std::vector<CSGBounds>	brushBounds;
+};
+
+static std::string_view getTextureBaseName(std::string_view textureName)
+{
+	size_t slash = textureName.find_last_of('/'); // Quake 2 textures come with their directory.
+
+	return slash == std::string_view::npos ? textureName : textureName.substr(slash + 1);
+}
+
+static bool isToolTexture(std::string_view name, const char* const* tools, size_t toolCount)
+{
+	for (size_t i = 0; i < toolCount; i++) {
+		size_t c = 0;
+		while (c < name.length() && tools[i][c] && tolower((unsigned char)name[c]) == tools[i][c]) {
+			c++;
+		}
+		if (c == name.length() && !tools[i][c]) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static const char* const contentsTools[] = { "clip", "clip_mon", "trigger", "origin" };
+static const char* const faceTools[] = { "hint", "skip" };
+
+bool isSolidTexture(std::string_view textureName)
+{
+	std::string_view name = getTextureBaseName(textureName);
+	if (!name.empty() && name[0] == '*') {
+		return false;
+	}
+
+	return !isToolTexture(name, contentsTools, sizeof(contentsTools) / sizeof(contentsTools[0]))
+		&& !isToolTexture(name, faceTools, sizeof(faceTools) / sizeof(faceTools[0]));
+}
+
+bool isSolidBrush(const std::string_view* textureNames, size_t faceCount)
+{
+	bool hasContents = false;
+	for (size_t i = 0; i < faceCount; i++) {
+		if (isToolTexture(getTextureBaseName(textureNames[i]), faceTools, sizeof(faceTools) / sizeof(faceTools[0]))) {
+			continue;
+		}
+		if (!isSolidTexture(textureNames[i])) {
+			return false;
+		}
+		hasContents = true;
+	}
+
+	return hasContents || faceCount == 0;
+}
+
+static CSGBounds getPolyBounds(const Polygon& poly)
+{
+	CSGBounds bounds = { glm::f64vec3(INFINITY), glm::f64vec3(-INFINITY) };
+	for (auto v = poly.vertices.begin(); v != poly.vertices.end(); v++) {
+		bounds.min = glm::min(bounds.min, *v);
+		bounds.max = glm::max(bounds.max, *v);
+	}
+
+	return bounds;
+}
+
+static CSGBounds getPolyBounds(const std::vector<Polygon>& polys)
+{
+	CSGBounds bounds = { glm::f64vec3(INFINITY), glm::f64vec3(-INFINITY) };
+	for (auto p = polys.begin(); p != polys.end(); p++) {
+		CSGBounds b = getPolyBounds(*p);
+		bounds.min = glm::min(bounds.min, b.min);
+		bounds.max = glm::max(bounds.max, b.max);
+	}
+
+	return bounds;
+}
+
+static inline bool boundsOverlap(const CSGBounds& a, const CSGBounds& b)
+{
+	return a.min.x <= b.max.x + PS_FLOAT_EPSILON && a.max.x >= b.min.x - PS_FLOAT_EPSILON
+		&& a.min.y <= b.max.y + PS_FLOAT_EPSILON && a.max.y >= b.min.y - PS_FLOAT_EPSILON
+		&& a.min.z <= b.max.z + PS_FLOAT_EPSILON && a.max.z >= b.min.z - PS_FLOAT_EPSILON;
+}
+
+static uint32_t buildCSGNode(CSGTree* tree, uint32_t first, uint32_t count)
+{
+	uint32_t nodeIndex = (uint32_t)tree->nodes.size();
+	tree->nodes.push_back({ });
+
+	CSGBounds bounds = { glm::f64vec3(INFINITY), glm::f64vec3(-INFINITY) };
+	for (uint32_t i = first; i < first + count; i++) {
+		const CSGBounds& b = tree->brushBounds[tree->brushes[i]];
+		bounds.min = glm::min(bounds.min, b.min);
+		bounds.max = glm::max(bounds.max, b.max);
+	}
+	tree->nodes[nodeIndex].bounds = bounds;
+
+	if (count <= 4) {
+		tree->nodes[nodeIndex].first = first;
+		tree->nodes[nodeIndex].count = count;
+		return nodeIndex;
+	}
+
+	// Split at the median of the brush centers along the longest axis.
+	glm::f64vec3 extent = bounds.max - bounds.min;
+	int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+	uint32_t* begin = &tree->brushes[first];
+	std::nth_element(begin, begin + count / 2, begin + count, [tree, axis](uint32_t a, uint32_t b) {
+		double centerA = tree->brushBounds[a].min[axis] + tree->brushBounds[a].max[axis];
+		double centerB = tree->brushBounds[b].min[axis] + tree->brushBounds[b].max[axis];
+		return centerA < centerB || (centerA == centerB && a < b);
+	});
+
+	buildCSGNode(tree, first, count / 2);
+	uint32_t right = buildCSGNode(tree, first + count / 2, count - count / 2);
+	tree->nodes[nodeIndex].first = right;
+	tree->nodes[nodeIndex].count = 0;
+
+	return nodeIndex;
+}
+
+static void findOverlappingBrushes(const CSGTree& tree, const CSGBounds& bounds, std::vector<uint32_t>* result)
+{
+	uint32_t stack[64];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize > 0) {
+		uint32_t nodeIndex = stack[--stackSize];
+		const CSGNode& node = tree.nodes[nodeIndex];
+		if (!boundsOverlap(node.bounds, bounds)) {
+			continue;
+		}
+		if (node.count > 0) {
+			for (uint32_t i = node.first; i < node.first + node.count; i++) {
+				if (boundsOverlap(tree.brushBounds[tree.brushes[i]], bounds)) {
+					result->push_back(tree.brushes[i]);
+				}
+			}
+		}
+		else {
+			stack[stackSize++] = nodeIndex + 1;
+			stack[stackSize++] = node.first;
+		}
+	}
+
+	// The order of the clips decides how faces get cut up, keep it independent of the tree.
+	std::sort(result->begin(), result->end());
+}
+
+/*
+* Splits a convex polygon at the plane. Vertices on the plane go to both sides.
+* A polygon that lies in the plane ends up in back.
+*/
+static void splitPolygon(const Polygon& poly, const Plane& plane, Polygon* front, Polygon* back)
+{
+	front->vertices.clear();
+	back->vertices.clear();
+	front->normal = poly.normal;
+	back->normal = poly.normal;
+	front->texture = poly.texture;
+	back->texture = poly.texture;
+
+	size_t count = poly.vertices.size();
+	bool hasFront = false, hasBack = false;
+	for (size_t i = 0; i < count; i++) {
+		const glm::f64vec3& a = poly.vertices[i];
+		const glm::f64vec3& b = poly.vertices[(i + 1) % count];
+		double da = glm::dot(plane.n, a) + plane.d;
+		double db = glm::dot(plane.n, b) + plane.d;
+
+		if (da >= -PS_FLOAT_EPSILON) front->vertices.push_back(a);
+		if (da <= PS_FLOAT_EPSILON) back->vertices.push_back(a);
+		hasFront |= da > PS_FLOAT_EPSILON;
+		hasBack |= da < -PS_FLOAT_EPSILON;
+
+		if ((da > PS_FLOAT_EPSILON && db < -PS_FLOAT_EPSILON) || (da < -PS_FLOAT_EPSILON && db > PS_FLOAT_EPSILON)) {
+			glm::f64vec3 v = a + (da / (da - db)) * (b - a);
+			front->vertices.push_back(v);
+			back->vertices.push_back(v);
+		}
+	}
+
+	if (!hasFront) front->vertices.clear();
+	else if (!hasBack) back->vertices.clear();
+	if (!hasFront && !hasBack) *back = poly;
+}
+
+static inline bool planesAreEqual(const glm::f64vec3& n0, double d0, const Plane& p1)
+{
+	return glm::dot(n0, p1.n) > 1.0 - PS_FLOAT_EPSILON && fabs(d0 - p1.d) < PS_FLOAT_EPSILON;
+}
+
+/*
+* Appends the parts of poly that are outside of brush to outside. If the brush
+* does not cover any of poly, poly is appended as it is.
+* overwrite: a part that lies on a face of the brush pointing the same way counts as inside.
+* Returns true if such a part was removed.
+*/
+static bool clipPolygonByBrush(const Polygon& poly, const CSGBrush& brush, bool overwrite, std::vector<Polygon>* outside)
+{
+	glm::f64vec3 n = poly.normal;
+	double d = -glm::dot(n, poly.vertices[0]);
+
+	// Entirely in front of one of the planes: the brush does not cover any of poly.
+	for (int i = 0; i < brush.planeCount; i++) {
+		const Plane& plane = brush.planes[i];
+		if (planesAreEqual(-n, -d, plane) || planesAreEqual(n, d, plane)) {
+			continue;
+		}
+		bool isInFront = true;
+		for (auto v = poly.vertices.begin(); v != poly.vertices.end() && isInFront; v++) {
+			isInFront = glm::dot(plane.n, *v) + plane.d > PS_FLOAT_EPSILON;
+		}
+		if (isInFront) {
+			outside->push_back(poly);
+			return false;
+		}
+	}
+
+	size_t firstFragment = outside->size();
+	bool isOverwritten = false;
+	Polygon inside = poly, front, back;
+	for (int i = 0; i < brush.planeCount; i++) {
+		const Plane& plane = brush.planes[i];
+		if (planesAreEqual(-n, -d, plane)) {
+			continue; // Flat against the brush, facing into it.
+		}
+		if (overwrite && planesAreEqual(n, d, plane)) {
+			isOverwritten = true;
+			continue;
+		}
+
+		if (planesAreEqual(n, d, plane)) {
+			back.vertices.clear();
+		}
+		else {
+			splitPolygon(inside, plane, &front, &back);
+			if (front.vertices.size() >= 3) {
+				outside->push_back(front);
+			}
+		}
+		if (back.vertices.size() < 3) {
+			// Nothing of poly is inside the brush, so keep poly in one piece.
+			outside->resize(firstFragment);
+			outside->push_back(poly);
+			return false;
+		}
+		inside.vertices.swap(back.vertices);
+	}
+	// Whatever is left is inside the brush.
+
+	return isOverwritten;
+}
+
+static inline bool pointsAreEqual(const glm::f64vec3& a, const glm::f64vec3& b)
+{
+	glm::f64vec3 d = glm::abs(a - b);
+
+	return d.x < PS_FLOAT_EPSILON && d.y < PS_FLOAT_EPSILON && d.z < PS_FLOAT_EPSILON;
+}
+
+/*
+* Turn at b when walking a -> b -> c, seen against the normal:
+* > 0 convex, 0 straight, < 0 concave.
+*/
+static inline double getTurn(const glm::f64vec3& a, const glm::f64vec3& b, const glm::f64vec3& c, const glm::f64vec3& n)
+{
+	return glm::dot(glm::cross(b - a, glm::normalize(c - b)), n);
+}
+
+/*
+* Merges two fragments of the same face that share an edge, if the result is
+* convex. Vertices in a straight line are dropped.
+*/
+static bool mergePolygons(const Polygon& p, const Polygon& q, Polygon* merged)
+{
+	size_t pCount = p.vertices.size(), qCount = q.vertices.size();
+	for (size_t i = 0; i < pCount; i++) {
+		const glm::f64vec3& p1 = p.vertices[i];
+		const glm::f64vec3& p2 = p.vertices[(i + 1) % pCount];
+		for (size_t j = 0; j < qCount; j++) {
+			if (!pointsAreEqual(p1, q.vertices[(j + 1) % qCount]) || !pointsAreEqual(p2, q.vertices[j])) {
+				continue;
+			}
+
+			// p: ... pPrev p1 p2 pNext ...   q: ... qPrev p2 p1 qNext ...
+			const glm::f64vec3& pPrev = p.vertices[(i + pCount - 1) % pCount];
+			const glm::f64vec3& pNext = p.vertices[(i + 2) % pCount];
+			const glm::f64vec3& qPrev = q.vertices[(j + qCount - 1) % qCount];
+			const glm::f64vec3& qNext = q.vertices[(j + 2) % qCount];
+			if (getTurn(pPrev, p1, qNext, p.normal) < -PS_FLOAT_EPSILON || getTurn(qPrev, p2, pNext, p.normal) < -PS_FLOAT_EPSILON) {
+				return false;
+			}
+
+			std::vector<glm::f64vec3> vertices;
+			for (size_t k = 0; k < pCount; k++) {
+				vertices.push_back(p.vertices[(i + 1 + k) % pCount]); // p2 ... p1
+			}
+			for (size_t k = 2; k < qCount; k++) {
+				vertices.push_back(q.vertices[(j + k) % qCount]); // qNext ... qPrev
+			}
+
+			merged->normal = p.normal;
+			merged->texture = p.texture;
+			merged->vertices.clear();
+			size_t count = vertices.size();
+			for (size_t k = 0; k < count; k++) {
+				const glm::f64vec3& prev = vertices[(k + count - 1) % count];
+				const glm::f64vec3& next = vertices[(k + 1) % count];
+				if (fabs(getTurn(prev, vertices[k], next, p.normal)) > PS_FLOAT_EPSILON) {
+					merged->vertices.push_back(vertices[k]);
+				}
+			}
+
+			return merged->vertices.size() >= 3;
+		}
+	}
+
+	return false;
+}
+
+/*
+* Clipping cuts a face into many fragments, glue back together what can be.
+* The first pair that can be merged is merged, until none is left. After a
+* merge only the pairs with the merged fragment are new, so the scan does
+* not start over: fragments before it get a chance to take it, then the scan
+* goes on from there.
+*/
+static void mergeFragments(std::vector<Polygon>* fragments)
+{
+	Polygon merged;
+	size_t i = 0;
+	while (i < fragments->size()) {
+		size_t j = i + 1;
+		while (j < fragments->size() && !mergePolygons((*fragments)[i], (*fragments)[j], &merged)) {
+			j++;
+		}
+		if (j == fragments->size()) {
+			i++;
+			continue;
+		}
+		(*fragments)[i] = merged;
+		fragments->erase(fragments->begin() + j);
+
+		size_t k = 0;
+		while (k < i) {
+			if (mergePolygons((*fragments)[k], (*fragments)[i], &merged)) {
+				(*fragments)[k] = merged;
+				fragments->erase(fragments->begin() + i);
+				i = k;
+				k = 0;
+			}
+			else {
+				k++;
+			}
+		}
+	}
+}
+
+static void removeHiddenFaces(std::vector<CSGBrush>& brushes, const std::vector<CSGBounds>& brushBounds, unsigned int threadCount)
+{
+	CSGTree tree;
+	tree.brushBounds = brushBounds;
+	for (size_t i = 0; i < brushes.size(); i++) {
+		if (brushes[i].isSolid && !brushes[i].polys->empty()) {
+			tree.brushes.push_back((uint32_t)i);
+		}
+	}
+	if (tree.brushes.empty()) {
+		return;
+	}
+	buildCSGNode(&tree, 0, (uint32_t)tree.brushes.size());
+
+	std::vector<std::vector<Polygon>> result(brushes.size());
+	parallelFor(brushes.size(), threadCount, [&](size_t i) {
+		std::vector<uint32_t> others;
+		findOverlappingBrushes(tree, tree.brushBounds[i], &others);
+
+		std::vector<Polygon> fragments, clipped;
+		for (auto p = brushes[i].polys->begin(); p != brushes[i].polys->end(); p++) {
+			// Only the brushes around this face can cover any of it, not all the ones around its brush.
+			bool isOverwritten = false;
+			CSGBounds faceBounds = getPolyBounds(*p);
+			fragments.assign(1, *p);
+			for (auto o = others.begin(); o != others.end() && !fragments.empty(); o++) {
+				if (*o == i || brushes[*o].entity != brushes[i].entity || !boundsOverlap(tree.brushBounds[*o], faceBounds)) {
+					continue;
+				}
+				clipped.clear();
+				for (auto f = fragments.begin(); f != fragments.end(); f++) {
+					isOverwritten |= clipPolygonByBrush(*f, brushes[*o], *o > i, &clipped);
+				}
+				fragments.swap(clipped);
+			}
+			mergeFragments(&fragments);
+
+			// A part buried in other brushes can not be seen anyway. If cutting it off takes more
+			// triangles than the whole face, keep the face. Unless the part lies on another face,
+			// that has to go or the two fight over the same pixels.
+			size_t triCount = 0;
+			for (auto f = fragments.begin(); f != fragments.end(); f++) {
+				triCount += f->vertices.size() - 2;
+			}
+			if (!fragments.empty() && !isOverwritten && triCount > p->vertices.size() - 2) {
+				fragments.assign(1, *p);
+			}
+			result[i].insert(result[i].end(), fragments.begin(), fragments.end());
+		}
+	});
+
+	for (size_t i = 0; i < brushes.size(); i++) {
+		brushes[i].polys->swap(result[i]);
+	}
+}
+
+struct CullGrid
+{
+	glm::f64vec3			origin;		// Corner of cell (0, 0, 0)
+	double					cellSize;
+	int						size[3];
+	std::vector<uint8_t>	cells;
+};
+
+enum CullCell
+{
+	CELL_EMPTY,
+	CELL_SOLID,
+	CELL_REACHED
+};
+
+static inline bool getCullCell(const CullGrid& grid, const glm::f64vec3& p, int* x, int* y, int* z)
+{
+	glm::f64vec3 c = (p - grid.origin) / grid.cellSize;
+	*x = (int)floor(c.x); *y = (int)floor(c.y); *z = (int)floor(c.z);
+
+	return *x >= 0 && *y >= 0 && *z >= 0 && *x < grid.size[0] && *y < grid.size[1] && *z < grid.size[2];
+}
+
+static inline size_t getCullCellIndex(const CullGrid& grid, int x, int y, int z)
+{
+	return ((size_t)z * grid.size[1] + y) * grid.size[0] + x;
+}
+
+static void markSolidCells(CullGrid* grid, const CSGBrush& brush, const CSGBounds& bounds)
+{
+	int x0, y0, z0, x1, y1, z1;
+	getCullCell(*grid, bounds.min, &x0, &y0, &z0);
+	getCullCell(*grid, bounds.max, &x1, &y1, &z1);
+
+	for (int z = z0; z <= z1; z++) {
+		for (int y = y0; y <= y1; y++) {
+			for (int x = x0; x <= x1; x++) {
+				glm::f64vec3 center = grid->origin + grid->cellSize * glm::f64vec3(x + 0.5, y + 0.5, z + 0.5);
+				bool isInside = true;
+				for (int i = 0; i < brush.planeCount && isInside; i++) {
+					isInside = glm::dot(brush.planes[i].n, center) + brush.planes[i].d <= PS_FLOAT_EPSILON;
+				}
+				if (isInside) {
+					grid->cells[getCullCellIndex(*grid, x, y, z)] = CELL_SOLID;
+				}
+			}
+		}
+	}
+}
+
+/*
+* Returns false if the flood reaches the border of the grid (the map leaks).
+* leak is then the cell where it got out. The flood fills whole runs of empty
+* cells along x at a time and leaves one seed per run it touches in the rows
+* around it.
+*/
+static bool floodCullGrid(CullGrid* grid, const std::vector<glm::f64vec3>& origins, glm::f64vec3* leak)
+{
+	std::vector<size_t> seeds;
+	for (auto o = origins.begin(); o != origins.end(); o++) {
+		int x, y, z;
+		if (getCullCell(*grid, *o, &x, &y, &z) && grid->cells[getCullCellIndex(*grid, x, y, z)] == CELL_EMPTY) {
+			seeds.push_back(getCullCellIndex(*grid, x, y, z));
+		}
+	}
+
+	size_t sizeX = grid->size[0], sizeXY = grid->size[0] * grid->size[1];
+	uint8_t* cells = grid->cells.data();
+	while (!seeds.empty()) {
+		size_t cell = seeds.back();
+		seeds.pop_back();
+		if (cells[cell] != CELL_EMPTY) {
+			continue;
+		}
+
+		size_t x = cell % sizeX, y = (cell / sizeX) % grid->size[1], z = cell / sizeXY;
+		size_t row = cell - x, first = x, last = x;
+		while (first > 0 && cells[row + first - 1] == CELL_EMPTY) first--;
+		while (last + 1 < sizeX && cells[row + last + 1] == CELL_EMPTY) last++;
+		if (first == 0 || last + 1 == sizeX || y == 0 || z == 0 || y + 1 == (size_t)grid->size[1] || z + 1 == (size_t)grid->size[2]) {
+			size_t out = first == 0 ? 0 : last + 1 == sizeX ? last : x;
+			*leak = grid->origin + grid->cellSize * glm::f64vec3(out + 0.5, y + 0.5, z + 0.5);
+			return false;
+		}
+		memset(&cells[row + first], CELL_REACHED, last - first + 1);
+
+		size_t neighbours[4] = { row - sizeX, row + sizeX, row - sizeXY, row + sizeXY };
+		for (int i = 0; i < 4; i++) {
+			bool isInRun = false;
+			for (size_t c = neighbours[i] + first; c <= neighbours[i] + last; c++) {
+				bool isEmpty = cells[c] == CELL_EMPTY;
+				if (isEmpty && !isInRun) {
+					seeds.push_back(c);
+				}
+				isInRun = isEmpty;
+			}
+		}
+	}
+
+	return true;
+}
+
+static bool isPointReached(const CullGrid& grid, const glm::f64vec3& p, const glm::f64vec3& n)
+{
+	// The cell right in front of the face may still have its center behind it, so look twice as far too.
+	for (int i = 1; i <= 2; i++) {
+		int x, y, z;
+		if (getCullCell(grid, p + (0.5 * i * grid.cellSize) * n, &x, &y, &z)
+			&& grid.cells[getCullCellIndex(grid, x, y, z)] == CELL_REACHED) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+* Samples the polygon every cell and checks whether any sample sees a reached cell.
+*/
+static bool isPolygonReached(const CullGrid& grid, const Polygon& poly)
+{
+	glm::f64vec3 center(0.0);
+	for (auto v = poly.vertices.begin(); v != poly.vertices.end(); v++) {
+		center += *v;
+	}
+	center /= (double)poly.vertices.size();
+
+	if (isPointReached(grid, center, poly.normal)) {
+		return true;
+	}
+	for (auto v = poly.vertices.begin(); v != poly.vertices.end(); v++) {
+		if (isPointReached(grid, *v + 0.01 * (center - *v), poly.normal)) {
+			return true;
+		}
+	}
+
+	// Grid of samples on the polygon's plane.
+	glm::f64vec3 axis = fabs(poly.normal.z) >= fabs(poly.normal.x) && fabs(poly.normal.z) >= fabs(poly.normal.y)
+		? glm::f64vec3(1.0, 0.0, 0.0) : glm::f64vec3(0.0, 0.0, 1.0);
+	glm::f64vec3 u = glm::normalize(glm::cross(axis, poly.normal));
+	glm::f64vec3 v = glm::cross(poly.normal, u);
+	double minU = INFINITY, maxU = -INFINITY, minV = INFINITY, maxV = -INFINITY;
+	for (auto p = poly.vertices.begin(); p != poly.vertices.end(); p++) {
+		double pu = glm::dot(*p - center, u), pv = glm::dot(*p - center, v);
+		minU = fmin(minU, pu); maxU = fmax(maxU, pu);
+		minV = fmin(minV, pv); maxV = fmax(maxV, pv);
+	}
+
+	size_t count = poly.vertices.size();
+	for (double su = minU + 0.5 * grid.cellSize; su < maxU; su += grid.cellSize) {
+		for (double sv = minV + 0.5 * grid.cellSize; sv < maxV; sv += grid.cellSize) {
+			glm::f64vec3 s = center + su * u + sv * v;
+			bool isInside = true;
+			for (size_t i = 0; i < count && isInside; i++) {
+				glm::f64vec3 edge = poly.vertices[(i + 1) % count] - poly.vertices[i];
+				isInside = glm::dot(glm::cross(edge, s - poly.vertices[i]), poly.normal) >= 0.0;
+			}
+			if (isInside && isPointReached(grid, s, poly.normal)) {
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+static bool removeOutsideFaces(std::vector<CSGBrush>& brushes, const std::vector<CSGBounds>& brushBounds,
+	const std::vector<glm::f64vec3>& origins, unsigned int threadCount, double cellSize)
+{
+	CSGBounds bounds = { glm::f64vec3(INFINITY), glm::f64vec3(-INFINITY) };
+	for (size_t i = 0; i < brushes.size(); i++) {
+		if (brushes[i].entity == 0 && brushes[i].isSolid) {
+			bounds.min = glm::min(bounds.min, brushBounds[i].min);
+			bounds.max = glm::max(bounds.max, brushBounds[i].max);
+		}
+	}
+	if (origins.empty() || bounds.min.x > bounds.max.x) {
+		fprintf(stderr, "WARNING: No point entities to flood the map from, outside faces are kept!\n");
+		return false;
+	}
+
+	// One empty cell all around the map, so the flood can tell it got out.
+	CullGrid grid;
+	glm::f64vec3 extent = bounds.max - bounds.min;
+	grid.cellSize = cellSize;
+	while ((extent.x / grid.cellSize + 3) * (extent.y / grid.cellSize + 3) * (extent.z / grid.cellSize + 3) > PS_CULL_MAX_CELLS) {
+		grid.cellSize *= 2.0;
+	}
+	grid.origin = bounds.min - glm::f64vec3(grid.cellSize);
+	for (int i = 0; i < 3; i++) {
+		grid.size[i] = (int)ceil(extent[i] / grid.cellSize) + 3;
+	}
+	grid.cells.resize((size_t)grid.size[0] * grid.size[1] * grid.size[2], CELL_EMPTY);
+
+	for (size_t i = 0; i < brushes.size(); i++) {
+		if (brushes[i].entity == 0 && brushes[i].isSolid && brushBounds[i].min.x <= brushBounds[i].max.x) {
+			markSolidCells(&grid, brushes[i], brushBounds[i]);
+		}
+	}
+	glm::f64vec3 leak;
+	if (!floodCullGrid(&grid, origins, &leak)) {
+		fprintf(stderr, "WARNING: Map leaks near ( %g %g %g ), outside faces are kept!\n", leak.x, leak.y, leak.z);
+		return false;
+	}
+
+	parallelFor(brushes.size(), threadCount, [&](size_t i) {
+		std::vector<Polygon>* polys = brushes[i].polys;
+		polys->erase(std::remove_if(polys->begin(), polys->end(), [&grid](const Polygon& p) {
+			return !isPolygonReached(grid, p);
+		}), polys->end());
+	});
+
+	return true;
+}
+
+bool cullFaces(std::vector<CSGBrush>& brushes, const std::vector<glm::f64vec3>& origins, unsigned int threadCount, double cellSize)
+{
+	// Taken before any face is removed, a buried brush still seals the map.
+	std::vector<CSGBounds> brushBounds(brushes.size());
+	for (size_t i = 0; i < brushes.size(); i++) {
+		brushBounds[i] = getPolyBounds(*brushes[i].polys);
+	}
+
+	removeHiddenFaces(brushes, brushBounds, threadCount);
+
+	return removeOutsideFaces(brushes, brushBounds, origins, threadCount, cellSize);
+}
+
+void cullHiddenFaces(std::vector<CSGBrush>& brushes, unsigned int threadCount)
+{
+	std::vector<CSGBounds> brushBounds(brushes.size());
+	for (size_t i = 0; i < brushes.size(); i++) {
+		brushBounds[i] = getPolyBounds(*brushes[i].polys);
+	}
+
+	removeHiddenFaces(brushes, brushBounds, threadCount);
+}
+
+#endif
+
+#endif
@@ -0,0 +1,465 @@
+/*
+* Exporters for meshes other programs read: Wavefront OBJ and binary glTF.
+*
+* Every exporter takes an ExportMesh, an indexed triangle mesh with optional
+* texture coordinates and groups, and is picked by the extension of the file
+* name (see exportMesh). A new format is one more entry in the exporter table.
+*
+* Output goes through a large buffer that is written with one fwrite when it
+* is full, numbers are formatted with std::to_chars: the shortest text that
+* reads back as the same float, without locales or allocations.
+*
+* Texture coordinates are in texels, as everywhere in polysoup. The texture
+* sizes are not known here.
+*/
+
+#ifndef _EXPORT_H_
+#define _EXPORT_H_
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <glm/glm.hpp>
+
+#include "polysoup.h"
+#include "texture.h"
+#include "weld.h"
+
+#define PS_EXPORT_BUFFER_SIZE	(1 << 20)
+
+/*
+* Triangles [ firstIndex / 3, (firstIndex + indexCount) / 3 ) get the
+* material name.
+*/
+struct ExportGroup
+{
+	std::string	name;
+	uint32_t	firstIndex;
+	uint32_t	indexCount;
+};
+
+struct ExportMesh
+{
+	std::vector<glm::vec3>		positions;
+	std::vector<glm::vec2>		texCoords;	// Empty or one per position
+	std::vector<uint32_t>		indices;	// Three per triangle
+	std::vector<ExportGroup>	groups;		// Empty: all triangles in one group without a name
+};
+
+typedef bool (*ExportFunction)(const char* fileName, const ExportMesh& mesh);
+
+struct Exporter
+{
+	const char*		extension;	// Without the dot, lower case
+	ExportFunction	write;
+};
+
+/*
+* tris: polygons with three vertices each. Vertices that are exactly equal
+* (position and, with ranges, texture coordinate) are shared.
+* ranges, materials: what sortByMaterial returned and the names the materials
+* refer to. Each range becomes a group with texture coordinates.
+*/
+ExportMesh		getExportMesh(const std::vector<Polygon>& tris, const std::vector<MaterialRange>* ranges = nullptr,
+					const std::vector<std::string>* materials = nullptr);
+ExportMesh		getExportMesh(const IndexedMesh& mesh);
+
+bool			exportOBJ(const char* fileName, const ExportMesh& mesh);
+bool			exportGLB(const char* fileName, const ExportMesh& mesh);
+
+/*
+* nullptr if no exporter knows the extension of fileName.
+*/
+const Exporter*	findExporter(const char* fileName);
+bool			exportMesh(const char* fileName, const ExportMesh& mesh);
+
+
+
+/*
+*
+* IMPLEMENTATION
+*
+*/
+
+
+
+#if defined(EXPORT_IMPLEMENTATION)
+
+#include <algorithm>
+#include <charconv>
+#include <unordered_map>
+#include <ctype.h>
+#include <float.h>
+#include <stdio.h>
+#include <string.h>
+
+static const Exporter exporters[] = {
+	{ "obj", exportOBJ },
+	{ "glb", exportGLB }
+};
+
+struct ExportWriter
+{
+	FILE*				file;
+	std::vector<char>	buffer;
+	size_t				used;
+	bool				isWritten;
+};
+
+static bool openExportWriter(ExportWriter* writer, const char* fileName)
+{
+	writer->file = fopen(fileName, "wb");
+	writer->buffer.resize(PS_EXPORT_BUFFER_SIZE);
+	writer->used = 0;
+	writer->isWritten = writer->file != nullptr;
+
+	return writer->isWritten;
+}
+
+static void flushExportWriter(ExportWriter* writer)
+{
+	if (writer->used > 0) {
+		writer->isWritten &= fwrite(writer->buffer.data(), 1, writer->used, writer->file) == writer->used;
+		writer->used = 0;
+	}
+}
+
+/*
+* Room for size more bytes, size <= PS_EXPORT_BUFFER_SIZE.
+*/
+static inline char* reserveExportWriter(ExportWriter* writer, size_t size)
+{
+	if (writer->used + size > writer->buffer.size()) {
+		flushExportWriter(writer);
+	}
+
+	return writer->buffer.data() + writer->used;
+}
+
+static void writeExportBytes(ExportWriter* writer, const void* data, size_t size)
+{
+	if (size == 0) {
+		return;
+	}
+	if (size > writer->buffer.size() / 2) {
+		// Big blocks go out directly, copying them only costs time.
+		flushExportWriter(writer);
+		writer->isWritten &= fwrite(data, 1, size, writer->file) == size;
+		return;
+	}
+	memcpy(reserveExportWriter(writer, size), data, size);
+	writer->used += size;
+}
+
+static inline void writeExportText(ExportWriter* writer, const char* text)
+{
+	writeExportBytes(writer, text, strlen(text));
+}
+
+static inline void writeExportFloat(ExportWriter* writer, char separator, float value)
+{
+	char* begin = reserveExportWriter(writer, 32);
+	*begin = separator;
+	// Brush vertices are mostly on the grid: whole numbers print as integers, which is a lot cheaper.
+	bool isInteger = value > -16777216.0f && value < 16777216.0f && (float)(int32_t)value == value;
+	char* end = isInteger
+		? std::to_chars(begin + 1, begin + 32, (int32_t)value).ptr
+		: std::to_chars(begin + 1, begin + 32, value).ptr;
+	writer->used += end - begin;
+}
+
+static inline void writeExportUint(ExportWriter* writer, char separator, uint64_t value)
+{
+	char* begin = reserveExportWriter(writer, 32);
+	*begin = separator;
+	char* end = std::to_chars(begin + 1, begin + 32, value).ptr;
+	writer->used += end - begin;
+}
+
+static bool closeExportWriter(ExportWriter* writer)
+{
+	if (writer->file) {
+		flushExportWriter(writer);
+		writer->isWritten &= fclose(writer->file) == 0;
+		writer->file = nullptr;
+	}
+
+	return writer->isWritten;
+}
+
+struct ExportVertexHash
+{
+	size_t operator()(const std::pair<glm::vec3, glm::vec2>& v) const
+	{
+		uint64_t hash = 14695981039346656037ull;
+		// + 0.0f: -0 and 0 are equal, so they must hash the same.
+		const float values[5] = { v.first.x + 0.0f, v.first.y + 0.0f, v.first.z + 0.0f, v.second.x + 0.0f, v.second.y + 0.0f };
+		const uint8_t* bytes = (const uint8_t*)values;
+		for (size_t i = 0; i < sizeof(values); i++) {
+			hash = (hash ^ bytes[i]) * 1099511628211ull;
+		}
+
+		return (size_t)hash;
+	}
+};
+
+ExportMesh getExportMesh(const std::vector<Polygon>& tris, const std::vector<MaterialRange>* ranges,
+	const std::vector<std::string>* materials)
+{
+	ExportMesh mesh = { };
+	std::unordered_map<std::pair<glm::vec3, glm::vec2>, uint32_t, ExportVertexHash> vertexIds;
+	vertexIds.reserve(tris.size());
+	mesh.indices.reserve(3 * tris.size());
+	for (auto t = tris.begin(); t != tris.end(); t++) {
+		for (auto v = t->vertices.begin(); v != t->vertices.end(); v++) {
+			std::pair<glm::vec3, glm::vec2> vertex(glm::vec3(*v), glm::vec2(0.0f));
+			if (ranges) {
+				vertex.second = glm::vec2(getTexCoord(t->texture, *v));
+			}
+			auto found = vertexIds.emplace(vertex, (uint32_t)mesh.positions.size());
+			if (found.second) {
+				mesh.positions.push_back(vertex.first);
+				if (ranges) {
+					mesh.texCoords.push_back(vertex.second);
+				}
+			}
+			mesh.indices.push_back(found.first->second);
+		}
+	}
+
+	if (ranges) {
+		for (auto r = ranges->begin(); r != ranges->end(); r++) {
+			std::string name = materials && r->material < materials->size() ? (*materials)[r->material] : std::to_string(r->material);
+			mesh.groups.push_back({ name, 3 * r->first, 3 * r->count });
+		}
+	}
+
+	return mesh;
+}
+
+ExportMesh getExportMesh(const IndexedMesh& indexedMesh)
+{
+	ExportMesh mesh = { };
+	mesh.positions.assign(indexedMesh.vertices.begin(), indexedMesh.vertices.end());
+	mesh.indices = indexedMesh.indices;
+
+	return mesh;
+}
+
+/*
+* One v (and vt) per vertex, then the faces of every group after its usemtl.
+*/
+bool exportOBJ(const char* fileName, const ExportMesh& mesh)
+{
+	ExportWriter writer = { };
+	if (!openExportWriter(&writer, fileName)) {
+		return false;
+	}
+
+	bool hasTexCoords = !mesh.texCoords.empty();
+	writeExportText(&writer, "o Quake-map\n");
+	for (auto p = mesh.positions.begin(); p != mesh.positions.end(); p++) {
+		writeExportBytes(&writer, "v", 1);
+		writeExportFloat(&writer, ' ', p->x);
+		writeExportFloat(&writer, ' ', p->y);
+		writeExportFloat(&writer, ' ', p->z);
+		writeExportBytes(&writer, "\n", 1);
+	}
+	for (auto t = mesh.texCoords.begin(); t != mesh.texCoords.end(); t++) {
+		writeExportBytes(&writer, "vt", 2);
+		writeExportFloat(&writer, ' ', t->x);
+		writeExportFloat(&writer, ' ', t->y);
+		writeExportBytes(&writer, "\n", 1);
+	}
+
+	std::vector<ExportGroup> groups = mesh.groups;
+	if (groups.empty()) {
+		groups.push_back({ "", 0, (uint32_t)mesh.indices.size() });
+	}
+	for (auto g = groups.begin(); g != groups.end(); g++) {
+		if (!g->name.empty()) {
+			writeExportText(&writer, "usemtl ");
+			writeExportText(&writer, g->name.c_str());
+			writeExportBytes(&writer, "\n", 1);
+		}
+		uint32_t end = std::min(g->firstIndex + g->indexCount, (uint32_t)mesh.indices.size());
+		for (uint32_t i = g->firstIndex; i + 2 < end; i += 3) {
+			writeExportBytes(&writer, "f", 1);
+			for (uint32_t c = 0; c < 3; c++) {
+				writeExportUint(&writer, ' ', mesh.indices[i + c] + 1);
+				if (hasTexCoords) {
+					writeExportUint(&writer, '/', mesh.indices[i + c] + 1);
+				}
+			}
+			writeExportBytes(&writer, "\n", 1);
+		}
+	}
+
+	return closeExportWriter(&writer);
+}
+
+static void appendJSONString(std::string* json, const std::string& text)
+{
+	json->push_back('"');
+	for (auto c = text.begin(); c != text.end(); c++) {
+		if (*c == '"' || *c == '\\') {
+			json->push_back('\\');
+			json->push_back(*c);
+		}
+		else if ((unsigned char)*c < 0x20) {
+			char escaped[8];
+			snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned char)*c);
+			json->append(escaped);
+		}
+		else {
+			json->push_back(*c);
+		}
+	}
+	json->push_back('"');
+}
+
+static void appendJSONFloat(std::string* json, float value)
+{
+	char text[32];
+	char* end = std::to_chars(text, text + sizeof(text), value).ptr;
+	json->append(text, end);
+}
+
+/*
+* glTF 2.0 binary: one buffer with positions, texture coordinates and
+* indices, one mesh with a primitive per group.
+*/
+bool exportGLB(const char* fileName, const ExportMesh& mesh)
+{
+	const uint32_t glbMagic = 0x46546C67;	// 'glTF'
+	const uint32_t jsonChunk = 0x4E4F534A;	// 'JSON'
+	const uint32_t binChunk = 0x004E4942;	// 'BIN\0'
+
+	std::vector<ExportGroup> groups = mesh.groups;
+	if (groups.empty()) {
+		groups.push_back({ "", 0, (uint32_t)mesh.indices.size() });
+	}
+	bool hasTexCoords = !mesh.texCoords.empty();
+	uint64_t positionsSize = mesh.positions.size() * sizeof(glm::vec3);
+	uint64_t texCoordsSize = mesh.texCoords.size() * sizeof(glm::vec2);
+	uint64_t indicesSize = mesh.indices.size() * sizeof(uint32_t);
+	uint64_t binSize = positionsSize + texCoordsSize + indicesSize;
+
+	glm::vec3 boundsMin(FLT_MAX), boundsMax(-FLT_MAX);
+	for (auto p = mesh.positions.begin(); p != mesh.positions.end(); p++) {
+		boundsMin = glm::min(boundsMin, *p);
+		boundsMax = glm::max(boundsMax, *p);
+	}
+
+	std::string json = "{\"asset\":{\"version\":\"2.0\",\"generator\":\"polysoup\"},\"scene\":0,";
+	if (mesh.positions.empty() || mesh.indices.empty()) {
+		json += "\"scenes\":[{}]}";
+	}
+	else {
+		json += "\"scenes\":[{\"nodes\":[0]}],\"nodes\":[{\"mesh\":0}],";
+		json += "\"buffers\":[{\"byteLength\":" + std::to_string(binSize) + "}],";
+		json += "\"bufferViews\":[{\"buffer\":0,\"byteOffset\":0,\"byteLength\":" + std::to_string(positionsSize) + ",\"target\":34962}";
+		if (hasTexCoords) {
+			json += ",{\"buffer\":0,\"byteOffset\":" + std::to_string(positionsSize) + ",\"byteLength\":" + std::to_string(texCoordsSize) + ",\"target\":34962}";
+		}
+		json += ",{\"buffer\":0,\"byteOffset\":" + std::to_string(positionsSize + texCoordsSize) + ",\"byteLength\":" + std::to_string(indicesSize) + ",\"target\":34963}],";
+
+		// Accessors: positions, texture coordinates, then the indices of every group.
+		json += "\"accessors\":[{\"bufferView\":0,\"componentType\":5126,\"count\":" + std::to_string(mesh.positions.size()) + ",\"type\":\"VEC3\",\"min\":[";
+		for (int a = 0; a < 3; a++) {
+			json += a ? "," : "";
+			appendJSONFloat(&json, boundsMin[a]);
+		}
+		json += "],\"max\":[";
+		for (int a = 0; a < 3; a++) {
+			json += a ? "," : "";
+			appendJSONFloat(&json, boundsMax[a]);
+		}
+		json += "]}";
+		if (hasTexCoords) {
+			json += ",{\"bufferView\":1,\"componentType\":5126,\"count\":" + std::to_string(mesh.texCoords.size()) + ",\"type\":\"VEC2\"}";
+		}
+		int indexView = hasTexCoords ? 2 : 1;
+		int firstIndexAccessor = hasTexCoords ? 2 : 1;
+		for (auto g = groups.begin(); g != groups.end(); g++) {
+			json += ",{\"bufferView\":" + std::to_string(indexView) + ",\"byteOffset\":" + std::to_string((uint64_t)g->firstIndex * sizeof(uint32_t))
+				+ ",\"componentType\":5125,\"count\":" + std::to_string(g->indexCount) + ",\"type\":\"SCALAR\"}";
+		}
+		json += "],";
+
+		json += "\"meshes\":[{\"primitives\":[";
+		for (size_t g = 0; g < groups.size(); g++) {
+			json += g ? "," : "";
+			json += "{\"attributes\":{\"POSITION\":0";
+			json += hasTexCoords ? ",\"TEXCOORD_0\":1}" : "}";
+			json += ",\"indices\":" + std::to_string(firstIndexAccessor + g);
+			json += mesh.groups.empty() ? "}" : ",\"material\":" + std::to_string(g) + "}";
+		}
+		json += "]}]";
+
+		if (!mesh.groups.empty()) {
+			json += ",\"materials\":[";
+			for (size_t g = 0; g < groups.size(); g++) {
+				json += g ? ",{\"name\":" : "{\"name\":";
+				appendJSONString(&json, groups[g].name);
+				json += "}";
+			}
+			json += "]";
+		}
+		json += "}";
+	}
+	while (json.size() % 4) {
+		json.push_back(' ');
+	}
+
+	ExportWriter writer = { };
+	if (!openExportWriter(&writer, fileName)) {
+		return false;
+	}
+
+	// binSize is a multiple of 4 already: floats and uint32_t only.
+	bool hasBin = binSize > 0 && !mesh.indices.empty();
+	uint32_t jsonSize = (uint32_t)json.size();
+	uint32_t totalSize = (uint32_t)(12 + 8 + jsonSize + (hasBin ? 8 + binSize : 0));
+	uint32_t header[5] = { glbMagic, 2, totalSize, jsonSize, jsonChunk };
+	writeExportBytes(&writer, header, sizeof(header));
+	writeExportBytes(&writer, json.data(), json.size());
+	if (hasBin) {
+		uint32_t chunk[2] = { (uint32_t)binSize, binChunk };
+		writeExportBytes(&writer, chunk, sizeof(chunk));
+		writeExportBytes(&writer, mesh.positions.data(), positionsSize);
+		writeExportBytes(&writer, mesh.texCoords.data(), texCoordsSize);
+		writeExportBytes(&writer, mesh.indices.data(), indicesSize);
+	}
+
+	return closeExportWriter(&writer);
+}
+
+const Exporter* findExporter(const char* fileName)
+{
+	const char* dot = strrchr(fileName, '.');
+	if (!dot) {
+		return nullptr;
+	}
+	std::string extension = dot + 1;
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)tolower(c); });
+	for (size_t i = 0; i < sizeof(exporters) / sizeof(exporters[0]); i++) {
+		if (extension == exporters[i].extension) {
+			return &exporters[i];
+		}
+	}
+
+	return nullptr;
+}
+
+bool exportMesh(const char* fileName, const ExportMesh& mesh)
+{
+	const Exporter* exporter = findExporter(fileName);
+
+	return exporter && exporter->write(fileName, mesh);
+}
+
+#endif
+
+#endif
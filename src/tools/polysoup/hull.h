@@ -0,0 +1,432 @@
+/*
+* Collision hulls: the solid brushes of the world grown by the box of whatever
+* moves through it (Minkowski sum), one set per box size as in Quake.
+*
+*   hull 0: a point, the brushes as they are
+*   hull 1: player,        ( -16, -16, -24 ) .. ( 16, 16, 32 )
+*   hull 2: large monster, ( -32, -32, -24 ) .. ( 32, 32, 64 )
+*
+* A box moving from a to b hits a brush where its center, a point, would hit
+* the grown brush, so a box trace is a ray trace against convex plane sets.
+*
+* Moving a plane out by the box's extent along its normal is only the exact
+* Minkowski sum if the brush has a plane for every direction the box's corners
+* and edges can stick out to. Brushes get bevel planes first, as q3map does:
+* the six axial planes of their bounds and the planes through every edge that
+* are parallel to an axis and touch the brush only along that edge. Without
+* them a box would catch on the air next to slanted edges and corners.
+*
+* Every hull has the same brushes in the same order, so the leaves of the
+* BSP list the brushes their region touches once for all hulls. A trace walks
+* the tree with the segment thickened by the box and clips against the
+* brushes of the leaves it passes, as Quake 3 does.
+*/
+
+#ifndef _HULL_H_
+#define _HULL_H_
+
+#include <vector>
+#include <stdint.h>
+
+#include <glm/glm.hpp>
+
+#include "polysoup.h"
+#include "bsp.h"
+
+#define PS_HULL_COUNT			(3)
+#define PS_HULL_DIST_EPSILON	(0.03125)	// Traces stop this far in front of a plane, as in Quake
+
+struct HullTrace
+{
+	double			fraction;	// 1: nothing hit
+	glm::f64vec3	normal;		// Of the plane that was hit
+	bool			startSolid;
+};
+
+/*
+* The brush's planes plus its bevel planes. planes must describe a closed
+* convex brush (createPlanePolys makes polygons for all of them).
+*/
+void		getBevelledBrush(const Plane* planes, int planeCount, std::vector<Plane>* bevelled);
+
+/*
+* Fills tree->hulls, tree->brushes, tree->brushPlanes, tree->leafBrushes and
+* the brushes of tree->leaves.
+*/
+void		buildCollisionHulls(const std::vector<BSPSolid>& solids, BSPTree* tree, unsigned int threadCount = 1);
+
+HullTrace	traceCollisionHull(const BSPTree& tree, int hull, const glm::f64vec3& start, const glm::f64vec3& end);
+
+/*
+* Clips start .. end against one brush, keeps the nearest entry in trace.
+*/
+void		clipHullBrush(const BSPTree& tree, const BSPBrush& brush, const glm::f64vec3& start, const glm::f64vec3& end,
+				HullTrace* trace);
+
+
+
+/*
+*
+* IMPLEMENTATION
+*
+*/
+
+
+
+#if defined(HULL_IMPLEMENTATION)
+
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+
+#include "parallel.h"
+
+static const glm::f64vec3 hullBoxes[PS_HULL_COUNT][2] = {
+	{ {   0.0,   0.0,   0.0 }, {  0.0,  0.0,  0.0 } },
+	{ { -16.0, -16.0, -24.0 }, { 16.0, 16.0, 32.0 } },
+	{ { -32.0, -32.0, -24.0 }, { 32.0, 32.0, 64.0 } }
+};
+
+static bool hasHullPlane(const std::vector<Plane>& planes, const glm::f64vec3& n, double d)
+{
+	for (auto p = planes.begin(); p != planes.end(); p++) {
+		if (glm::dot(p->n, n) > 1.0 - PS_FLOAT_EPSILON && fabs(p->d - d) < 0.01) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static Plane createHullPlane(const glm::f64vec3& n, double d)
+{
+	Plane plane = { };
+	plane.n = n;
+	plane.d = d;
+	plane.p0 = -d * n;
+
+	return plane;
+}
+
+void getBevelledBrush(const Plane* planes, int planeCount, std::vector<Plane>* bevelled)
+{
+	bevelled->assign(planes, planes + planeCount);
+
+	std::vector<Polygon> polys;
+	createPlanePolys(planes, planeCount, &polys);
+	glm::f64vec3 min(DBL_MAX), max(-DBL_MAX);
+	for (auto p = polys.begin(); p != polys.end(); p++) {
+		for (auto v = p->vertices.begin(); v != p->vertices.end(); v++) {
+			min = glm::min(min, *v);
+			max = glm::max(max, *v);
+		}
+	}
+	if (polys.empty()) {
+		return;
+	}
+
+	// Axial planes: n . p + d <= 0 inside, so +x is x - max.x and -x is -x + min.x.
+	for (int a = 0; a < 3; a++) {
+		for (int sign = -1; sign <= 1; sign += 2) {
+			glm::f64vec3 n(0.0);
+			n[a] = (double)sign;
+			double d = sign > 0 ? -max[a] : min[a];
+			bool hasAxial = false;
+			for (auto p = bevelled->begin(); p != bevelled->end(); p++) {
+				hasAxial |= glm::dot(p->n, n) > 1.0 - PS_FLOAT_EPSILON;
+			}
+			if (!hasAxial) {
+				bevelled->push_back(createHullPlane(n, d));
+			}
+		}
+	}
+
+	// Edge bevels: planes through an edge and an axis that have the whole brush behind them.
+	for (auto p = polys.begin(); p != polys.end(); p++) {
+		for (size_t i = 0; i < p->vertices.size(); i++) {
+			const glm::f64vec3& v0 = p->vertices[i];
+			const glm::f64vec3& v1 = p->vertices[(i + 1) % p->vertices.size()];
+			glm::f64vec3 edge = v1 - v0;
+			if (glm::length(edge) < 0.5) {
+				continue;
+			}
+			edge = glm::normalize(edge);
+			for (int a = 0; a < 3; a++) {
+				if (fabs(edge[a]) > 1.0 - PS_FLOAT_EPSILON) {
+					continue; // Axial edges are covered by the axial planes
+				}
+				for (int sign = -1; sign <= 1; sign += 2) {
+					glm::f64vec3 axis(0.0);
+					axis[a] = (double)sign;
+					glm::f64vec3 n = glm::cross(edge, axis);
+					if (glm::length(n) < 0.5) {
+						continue;
+					}
+					n = glm::normalize(n);
+					double d = -glm::dot(n, v0);
+					if (hasHullPlane(*bevelled, n, d)) {
+						continue;
+					}
+
+					bool isBehind = true;
+					for (auto q = polys.begin(); q != polys.end() && isBehind; q++) {
+						for (auto v = q->vertices.begin(); v != q->vertices.end(); v++) {
+							if (glm::dot(n, *v) + d > 0.1) {
+								isBehind = false;
+								break;
+							}
+						}
+					}
+					if (isBehind) {
+						bevelled->push_back(createHullPlane(n, d));
+					}
+				}
+			}
+		}
+	}
+}
+
+/*
+* The box touches the plane with its corner furthest behind it, the plane
+* moves out by that corner's distance: a floor by -mins.z, a ceiling by maxs.z.
+*/
+static inline double getBoxOffset(const glm::f64vec3& n, const glm::f64vec3& mins, const glm::f64vec3& maxs)
+{
+	return (n.x > 0.0 ? n.x * mins.x : n.x * maxs.x)
+		+ (n.y > 0.0 ? n.y * mins.y : n.y * maxs.y)
+		+ (n.z > 0.0 ? n.z * mins.z : n.z * maxs.z);
+}
+
+/*
+* Leaves the box (center, extents) touches, a little more generously than
+* the tree would place a point.
+*/
+static void filterHullBox(const BSPTree& tree, int32_t child, const glm::f64vec3& center, const glm::f64vec3& extents,
+	std::vector<uint32_t>* leaves)
+{
+	while (child >= 0) {
+		const BSPNode& node = tree.nodes[child];
+		const Plane& plane = tree.planes[node.plane];
+		double distance = glm::dot(plane.n, center) + plane.d;
+		double radius = glm::dot(glm::abs(plane.n), extents) + 1.0;
+		if (distance > -radius && distance < radius) {
+			filterHullBox(tree, node.children[0], center, extents, leaves);
+			child = node.children[1];
+		}
+		else {
+			child = node.children[distance >= 0.0 ? 0 : 1];
+		}
+	}
+	leaves->push_back((uint32_t)(-(child + 1)));
+}
+
+void buildCollisionHulls(const std::vector<BSPSolid>& solids, BSPTree* tree, unsigned int threadCount)
+{
+	std::vector<std::vector<Plane>> bevelled(solids.size());
+	parallelFor(solids.size(), threadCount, [&](size_t i) {
+		getBevelledBrush(solids[i].planes, solids[i].planeCount, &bevelled[i]);
+	});
+
+	tree->hulls.clear();
+	tree->brushes.clear();
+	tree->brushPlanes.clear();
+	for (int h = 0; h < PS_HULL_COUNT; h++) {
+		const glm::f64vec3& mins = hullBoxes[h][0];
+		const glm::f64vec3& maxs = hullBoxes[h][1];
+		BSPHull hull = { };
+		for (int a = 0; a < 3; a++) {
+			hull.mins[a] = (float)mins[a];
+			hull.maxs[a] = (float)maxs[a];
+		}
+		hull.firstBrush = (uint32_t)tree->brushes.size();
+		for (size_t s = 0; s < solids.size(); s++) {
+			if (bevelled[s].empty()) {
+				continue;
+			}
+			BSPBrush brush = { };
+			brush.firstPlane = (uint32_t)tree->brushPlanes.size();
+			brush.planeCount = (uint32_t)bevelled[s].size();
+			for (int a = 0; a < 3; a++) {
+				brush.min[a] = FLT_MAX;
+				brush.max[a] = -FLT_MAX;
+			}
+			for (auto p = bevelled[s].begin(); p != bevelled[s].end(); p++) {
+				tree->brushPlanes.push_back(createHullPlane(p->n, p->d + getBoxOffset(p->n, mins, maxs)));
+				// The axial planes bound the grown brush.
+				for (int a = 0; a < 3; a++) {
+					if (p->n[a] > 1.0 - PS_FLOAT_EPSILON) brush.max[a] = (float)-tree->brushPlanes.back().d;
+					if (p->n[a] < -1.0 + PS_FLOAT_EPSILON) brush.min[a] = (float)tree->brushPlanes.back().d;
+				}
+			}
+			tree->brushes.push_back(brush);
+		}
+		hull.brushCount = (uint32_t)tree->brushes.size() - hull.firstBrush;
+		tree->hulls.push_back(hull);
+	}
+
+	// Hull 0's brushes are the solids themselves.
+	uint32_t brushCount = tree->hulls[0].brushCount;
+	std::vector<std::vector<uint32_t>> brushLeaves(brushCount);
+	if (!tree->nodes.empty()) {
+		parallelFor(brushCount, threadCount, [&](size_t i) {
+			const BSPBrush& brush = tree->brushes[i];
+			glm::f64vec3 min(brush.min[0], brush.min[1], brush.min[2]);
+			glm::f64vec3 max(brush.max[0], brush.max[1], brush.max[2]);
+			filterHullBox(*tree, 0, 0.5 * (min + max), 0.5 * (max - min), &brushLeaves[i]);
+		});
+	}
+	else {
+		for (uint32_t i = 0; i < brushCount; i++) {
+			brushLeaves[i].push_back(0);
+		}
+	}
+
+	for (auto l = tree->leaves.begin(); l != tree->leaves.end(); l++) {
+		l->brushCount = 0;
+	}
+	for (auto b = brushLeaves.begin(); b != brushLeaves.end(); b++) {
+		for (auto l = b->begin(); l != b->end(); l++) {
+			tree->leaves[*l].brushCount++;
+		}
+	}
+	uint32_t leafBrushCount = 0;
+	for (auto l = tree->leaves.begin(); l != tree->leaves.end(); l++) {
+		l->firstBrush = leafBrushCount;
+		leafBrushCount += l->brushCount;
+		l->brushCount = 0;
+	}
+	tree->leafBrushes.resize(leafBrushCount);
+	for (uint32_t b = 0; b < brushCount; b++) {
+		for (auto l = brushLeaves[b].begin(); l != brushLeaves[b].end(); l++) {
+			BSPLeaf& leaf = tree->leaves[*l];
+			tree->leafBrushes[leaf.firstBrush + leaf.brushCount++] = b;
+		}
+	}
+}
+
+void clipHullBrush(const BSPTree& tree, const BSPBrush& brush, const glm::f64vec3& start, const glm::f64vec3& end,
+	HullTrace* trace)
+{
+	if (std::min(start.x, end.x) > brush.max[0] || std::max(start.x, end.x) < brush.min[0]
+		|| std::min(start.y, end.y) > brush.max[1] || std::max(start.y, end.y) < brush.min[1]
+		|| std::min(start.z, end.z) > brush.max[2] || std::max(start.z, end.z) < brush.min[2]) {
+		return;
+	}
+
+	double enter = -1.0, exit = 1.0;
+	glm::f64vec3 enterNormal(0.0);
+	bool startsOutside = false;
+	for (uint32_t p = brush.firstPlane; p < brush.firstPlane + brush.planeCount; p++) {
+		const Plane& plane = tree.brushPlanes[p];
+		double d0 = glm::dot(plane.n, start) + plane.d;
+		double d1 = glm::dot(plane.n, end) + plane.d;
+		startsOutside |= d0 > 0.0;
+		if (d0 > 0.0 && (d1 >= PS_HULL_DIST_EPSILON || d1 >= d0)) {
+			return; // In front of the plane all the way
+		}
+		else if (d0 <= 0.0 && d1 <= 0.0) {
+			continue; // Behind it all the way, the other planes decide
+		}
+		else if (d0 > d1) {
+			double f = (d0 - PS_HULL_DIST_EPSILON) / (d0 - d1);
+			if (f > enter) {
+				enter = f;
+				enterNormal = plane.n;
+			}
+		}
+		else {
+			exit = std::min(exit, (d0 + PS_HULL_DIST_EPSILON) / (d0 - d1));
+		}
+	}
+
+	if (!startsOutside) {
+		trace->startSolid = true;
+		trace->fraction = 0.0;
+	}
+	else if (enter < exit && enter > -1.0 && enter < trace->fraction) {
+		trace->fraction = std::max(enter, 0.0);
+		trace->normal = enterNormal;
+	}
+}
+
+struct HullTracer
+{
+	const BSPTree*	tree;
+	const BSPHull*	hull;
+	glm::f64vec3	start;
+	glm::f64vec3	end;
+	glm::f64vec3	offset;		// Of the box's center from the traced point
+	glm::f64vec3	extents;	// Half the box
+	HullTrace		trace;
+};
+
+/*
+* s0 .. s1: the part of the trace that is in the node's region.
+*/
+static void traceHullNode(HullTracer* tracer, int32_t child, double s0, double s1)
+{
+	const BSPTree& tree = *tracer->tree;
+	if (s0 >= tracer->trace.fraction) {
+		return; // Something nearer was hit already
+	}
+
+	if (child < 0) {
+		const BSPLeaf& leaf = tree.leaves[-(child + 1)];
+		for (uint32_t i = leaf.firstBrush; i < leaf.firstBrush + leaf.brushCount; i++) {
+			clipHullBrush(tree, tree.brushes[tracer->hull->firstBrush + tree.leafBrushes[i]], tracer->start, tracer->end, &tracer->trace);
+		}
+		return;
+	}
+
+	const BSPNode& node = tree.nodes[child];
+	const Plane& plane = tree.planes[node.plane];
+	glm::f64vec3 delta = tracer->end - tracer->start;
+	double t0 = glm::dot(plane.n, tracer->start + s0 * delta + tracer->offset) + plane.d;
+	double t1 = glm::dot(plane.n, tracer->start + s1 * delta + tracer->offset) + plane.d;
+	double radius = glm::dot(glm::abs(plane.n), tracer->extents) + 1.0;
+	if (t0 >= radius && t1 >= radius) {
+		traceHullNode(tracer, node.children[0], s0, s1);
+	}
+	else if (t0 < -radius && t1 < -radius) {
+		traceHullNode(tracer, node.children[1], s0, s1);
+	}
+	else if (t0 == t1) {
+		traceHullNode(tracer, node.children[0], s0, s1);
+		traceHullNode(tracer, node.children[1], s0, s1);
+	}
+	else {
+		// The parts with t >= -radius and t <= radius, near side first.
+		int nearSide = t0 >= t1 ? 0 : 1;
+		double front = std::clamp((t0 + radius) / (t0 - t1), 0.0, 1.0);
+		double back = std::clamp((t0 - radius) / (t0 - t1), 0.0, 1.0);
+		if (nearSide == 0) {
+			traceHullNode(tracer, node.children[0], s0, s0 + (s1 - s0) * front);
+			traceHullNode(tracer, node.children[1], s0 + (s1 - s0) * back, s1);
+		}
+		else {
+			traceHullNode(tracer, node.children[1], s0, s0 + (s1 - s0) * back);
+			traceHullNode(tracer, node.children[0], s0 + (s1 - s0) * front, s1);
+		}
+	}
+}
+
+HullTrace traceCollisionHull(const BSPTree& tree, int hull, const glm::f64vec3& start, const glm::f64vec3& end)
+{
+	HullTracer tracer = { &tree, nullptr, start, end, glm::f64vec3(0.0), glm::f64vec3(0.0), { 1.0, glm::f64vec3(0.0), false } };
+	if (hull < 0 || hull >= (int)tree.hulls.size() || tree.leaves.empty()) {
+		return tracer.trace;
+	}
+
+	tracer.hull = &tree.hulls[hull];
+	glm::f64vec3 mins(tracer.hull->mins[0], tracer.hull->mins[1], tracer.hull->mins[2]);
+	glm::f64vec3 maxs(tracer.hull->maxs[0], tracer.hull->maxs[1], tracer.hull->maxs[2]);
+	tracer.offset = 0.5 * (mins + maxs);
+	tracer.extents = 0.5 * (maxs - mins);
+	traceHullNode(&tracer, tree.nodes.empty() ? -1 : 0, 0.0, 1.0);
+
+	return tracer.trace;
+}
+
+#endif
+
+#endif
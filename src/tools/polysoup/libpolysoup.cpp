@@ -0,0 +1,804 @@
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <memory_resource>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <glm/glm.hpp>
+#include <glm/ext.hpp>
+
+#include "polysoup.h"
+
+#define MAP_PARSER_IMPLEMENTATION
+#include "parser.h"
+#define MAPSOA_IMPLEMENTATION
+#include "mapsoa.h"
+#define BMAP_IMPLEMENTATION
+#include "bmap.h"
+#define WELD_IMPLEMENTATION
+#include "weld.h"
+#define CSG_IMPLEMENTATION
+#include "csg.h"
+#define BSP_IMPLEMENTATION
+#include "bsp.h"
+#define HULL_IMPLEMENTATION
+#include "hull.h"
+#define VIS_IMPLEMENTATION
+#include "vis.h"
+#define BVH_IMPLEMENTATION
+#include "bvh.h"
+#define LIGHT_IMPLEMENTATION
+#include "light.h"
+#define TEXTURE_IMPLEMENTATION
+#include "texture.h"
+#define MESHOPT_IMPLEMENTATION
+#include "meshopt.h"
+#define WORLDMESH_IMPLEMENTATION
+#include "worldmesh.h"
+#define EXPORT_IMPLEMENTATION
+#include "export.h"
+#define NAVMESH_IMPLEMENTATION
+#include "navmesh.h"
+#define BRUSHCACHE_IMPLEMENTATION
+#include "brushcache.h"
+#include "libpolysoup.h"
+
+Plane createPlane(glm::f64vec3 p0, glm::f64vec3 p1, glm::f64vec3 p2)
+{
+	glm::f64vec3 v0 = p2 - p0;
+	glm::f64vec3 v1 = p1 - p0;
+	glm::f64vec3 n = glm::normalize(glm::cross(v0, v1));
+	double d = -glm::dot(n, p0);
+
+	return { n, p0, d };
+}
+
+static inline glm::f64vec3 convertVertexToVec3(Vertex v)
+{
+	return glm::f64vec3(v.x, v.y, v.z);
+}
+
+Plane convertFaceToPlane(const Face& face)
+{
+	glm::f64vec3 p0 = convertVertexToVec3(face.vertices[0]);
+	glm::f64vec3 p1 = convertVertexToVec3(face.vertices[1]);
+	glm::f64vec3 p2 = convertVertexToVec3(face.vertices[2]);
+	return createPlane(p0, p1, p2);
+}
+
+bool vec3IsEqual(const glm::f64vec3& lhs, const glm::f64vec3& rhs) {
+	return ( glm::abs(lhs.x - rhs.x) < PS_FLOAT_EPSILON 
+		&& glm::abs(lhs.y - rhs.y) < PS_FLOAT_EPSILON
+		&& glm::abs(lhs.z - rhs.z) < PS_FLOAT_EPSILON );
+}
+
+/*
+* Half the edge length of the quad a face starts out as. Has to cover the
+* whole map. Quake maps stay within +-4096 units on every axis.
+*/
+#define PS_MAX_MAP_EXTENT	(65536.0)
+
+/*
+* A big quad on the plane, wound counter-clockwise when looking against n
+* (n points out of the brush).
+*/
+void createBaseWinding(const Plane& plane, std::vector<glm::f64vec3>* winding)
+{
+	// Any vector not parallel to n will do, use the axis n is furthest away from.
+	glm::f64vec3 axis(0.0, 0.0, 1.0);
+	if (fabs(plane.n.z) >= fabs(plane.n.x) && fabs(plane.n.z) >= fabs(plane.n.y)) {
+		axis = glm::f64vec3(1.0, 0.0, 0.0);
+	}
+	glm::f64vec3 u = glm::normalize(glm::cross(axis, plane.n));
+	glm::f64vec3 v = glm::cross(plane.n, u); // u x v = n
+	glm::f64vec3 origin = -plane.d * plane.n;
+
+	u *= PS_MAX_MAP_EXTENT;
+	v *= PS_MAX_MAP_EXTENT;
+	winding->clear();
+	winding->push_back(origin - u - v);
+	winding->push_back(origin + u - v);
+	winding->push_back(origin + u + v);
+	winding->push_back(origin - u + v);
+}
+
+enum PlaneSide
+{
+	SIDE_BACK,	// Inside the brush
+	SIDE_ON,
+	SIDE_FRONT
+};
+
+static inline PlaneSide getPlaneSide(double distance)
+{
+	if (distance > PS_FLOAT_EPSILON) return SIDE_FRONT;
+	if (distance < -PS_FLOAT_EPSILON) return SIDE_BACK;
+
+	return SIDE_ON;
+}
+
+/*
+* Sutherland-Hodgman: keeps the part of the convex winding that is behind the
+* plane (or on it). The order of the vertices is preserved. 'out' must not be 'in'.
+*/
+void clipWinding(const std::vector<glm::f64vec3>& in, const Plane& plane, std::vector<glm::f64vec3>* out)
+{
+	out->clear();
+	size_t count = in.size();
+	for (size_t i = 0; i < count; i++) {
+		const glm::f64vec3& a = in[i];
+		const glm::f64vec3& b = in[(i + 1) % count];
+		double da = glm::dot(plane.n, a) + plane.d;
+		double db = glm::dot(plane.n, b) + plane.d;
+		PlaneSide sideA = getPlaneSide(da);
+		PlaneSide sideB = getPlaneSide(db);
+
+		if (sideA != SIDE_FRONT) {
+			out->push_back(a);
+		}
+		if ((sideA == SIDE_FRONT && sideB == SIDE_BACK) || (sideA == SIDE_BACK && sideB == SIDE_FRONT)) {
+			double t = da / (da - db);
+			out->push_back(a + t * (b - a));
+		}
+	}
+}
+
+#define PS_NO_PLANE			(-1)
+
+/*
+* + 0.0 turns -0 into 0: a corner at 0 has the same bits whichever side it was
+* computed from, and a brush moved there from elsewhere gets the same ones.
+*/
+static inline double snapToGrid(double x)
+{
+	return round(x * PS_SNAP_GRID) / PS_SNAP_GRID + 0.0;
+}
+
+/*
+* Orders planes by value, with n and -n counting as the same plane. Flipping
+* a plane flips the signs in intersectPlanes exactly, so the same three planes
+* in this order give the same bits no matter which brush or face they are from.
+*/
+static bool planeIsLess(const Plane& lhs, const Plane& rhs)
+{
+	double lhsSign = (lhs.n.x != 0.0 ? lhs.n.x : (lhs.n.y != 0.0 ? lhs.n.y : lhs.n.z)) < 0.0 ? -1.0 : 1.0;
+	double rhsSign = (rhs.n.x != 0.0 ? rhs.n.x : (rhs.n.y != 0.0 ? rhs.n.y : rhs.n.z)) < 0.0 ? -1.0 : 1.0;
+	const double l[4] = { lhsSign * lhs.n.x, lhsSign * lhs.n.y, lhsSign * lhs.n.z, lhsSign * lhs.d };
+	const double r[4] = { rhsSign * rhs.n.x, rhsSign * rhs.n.y, rhsSign * rhs.n.z, rhsSign * rhs.d };
+
+	return std::lexicographical_compare(l, l + 4, r, r + 4);
+}
+
+/*
+* The point on all three planes (Cramer's rule). False if two of them are
+* (nearly) parallel.
+*/
+static bool intersectPlanes(const Plane& p0, const Plane& p1, const Plane& p2, glm::f64vec3* point)
+{
+	const Plane* planes[3] = { &p0, &p1, &p2 };
+	std::sort(planes, planes + 3, [](const Plane* lhs, const Plane* rhs) { return planeIsLess(*lhs, *rhs); });
+
+	glm::f64vec3 n12 = glm::cross(planes[1]->n, planes[2]->n);
+	double det = glm::dot(planes[0]->n, n12);
+	if (fabs(det) < PS_FLOAT_EPSILON) {
+		return false;
+	}
+	*point = -(planes[0]->d * n12 + planes[1]->d * glm::cross(planes[2]->n, planes[0]->n) + planes[2]->d * glm::cross(planes[0]->n, planes[1]->n)) / det;
+
+	return true;
+}
+
+/*
+* clipWinding that also tracks where the edges come from: edges[k] is the
+* plane the edge from vertex k to k + 1 lies on, PS_NO_PLANE for the edges of
+* the base winding.
+*/
+static void clipBrushWinding(const std::vector<glm::f64vec3>& in, const std::vector<int>& inEdges, const Plane& plane, int planeIndex,
+	std::vector<glm::f64vec3>* out, std::vector<int>* outEdges)
+{
+	out->clear();
+	outEdges->clear();
+	size_t count = in.size();
+	for (size_t i = 0; i < count; i++) {
+		const glm::f64vec3& a = in[i];
+		const glm::f64vec3& b = in[(i + 1) % count];
+		double da = glm::dot(plane.n, a) + plane.d;
+		double db = glm::dot(plane.n, b) + plane.d;
+		PlaneSide sideA = getPlaneSide(da);
+		PlaneSide sideB = getPlaneSide(db);
+
+		// The last point output on a -> b starts an edge along the plane if b gets clipped away.
+		if (sideA != SIDE_FRONT) {
+			out->push_back(a);
+			outEdges->push_back(sideA == SIDE_ON && sideB == SIDE_FRONT ? planeIndex : inEdges[i]);
+		}
+		if ((sideA == SIDE_FRONT && sideB == SIDE_BACK) || (sideA == SIDE_BACK && sideB == SIDE_FRONT)) {
+			double t = da / (da - db);
+			out->push_back(a + t * (b - a));
+			outEdges->push_back(sideB == SIDE_FRONT ? planeIndex : inEdges[i]);
+		}
+	}
+}
+
+/*
+* Polygons of a convex brush given by its planes. Every face starts as a big
+* quad on its plane and gets clipped by all other planes of the brush, which
+* leaves exactly the part of the plane that is on the brush's surface.
+* The vertices come out in counter-clockwise order around the plane's normal.
+* textures: one per plane, or nullptr for untextured polygons.
+*
+* Clipping only finds the edges. Every vertex is then computed again from the
+* face's plane and the planes of its two edges, and snapped to the grid: the
+* same corner comes out with the same bits in every face and brush it is in,
+* whatever order the planes were clipped in. Every polygon starts at its
+* smallest vertex (by x, then y, then z), not where the clipping happened to
+* start, so a moved brush has its vertices in the same order.
+*/
+void createPlanePolys(const Plane* planes, int planeCount, std::vector<Polygon>* polys, const PolygonTexture* textures)
+{
+	std::vector<glm::f64vec3> winding, clipped;
+	std::vector<int> edges, clippedEdges;
+	for (int i = 0; i < planeCount; i++) {
+		createBaseWinding(planes[i], &winding);
+		edges.assign(winding.size(), PS_NO_PLANE);
+		for (int j = 0; j < planeCount && winding.size() >= 3; j++) {
+			if (j != i) {
+				clipBrushWinding(winding, edges, planes[j], j, &clipped, &clippedEdges);
+				winding.swap(clipped);
+				edges.swap(clippedEdges);
+			}
+		}
+		if (winding.size() < 3)
+			continue; // Face is clipped away completely, eg. it lies flush with another face.
+
+		size_t count = winding.size();
+		for (size_t k = 0; k < count; k++) {
+			int inEdge = edges[(k + count - 1) % count];
+			int outEdge = edges[k];
+			glm::f64vec3 exact;
+			if (inEdge != PS_NO_PLANE && outEdge != PS_NO_PLANE && inEdge != outEdge
+				&& intersectPlanes(planes[i], planes[inEdge], planes[outEdge], &exact)) {
+				winding[k] = exact;
+			}
+			winding[k] = glm::f64vec3(snapToGrid(winding[k].x), snapToGrid(winding[k].y), snapToGrid(winding[k].z));
+		}
+
+		Polygon poly = {};
+		poly.normal = planes[i].n;
+		if (textures) {
+			poly.texture = textures[i];
+		}
+		poly.vertices.reserve(winding.size());
+		for (auto v = winding.begin(); v != winding.end(); v++) {
+			if (poly.vertices.empty() || !vec3IsEqual(*v, poly.vertices.back())) {
+				poly.vertices.push_back(*v);
+			}
+		}
+		while (poly.vertices.size() > 1 && vec3IsEqual(poly.vertices.front(), poly.vertices.back())) {
+			poly.vertices.pop_back();
+		}
+		auto first = std::min_element(poly.vertices.begin(), poly.vertices.end(), [](const glm::f64vec3& lhs, const glm::f64vec3& rhs) {
+			return lhs.x != rhs.x ? lhs.x < rhs.x : (lhs.y != rhs.y ? lhs.y < rhs.y : lhs.z < rhs.z);
+		});
+		std::rotate(poly.vertices.begin(), first, poly.vertices.end());
+		if (poly.vertices.size() >= 3)
+			polys->push_back(poly);
+	}
+}
+
+/*
+* Planes of the brush's faces in face order. Computed once per brush, then
+* every stage works on these instead of going back to the faces.
+*/
+void getBrushPlanes(const Brush& brush, std::vector<Plane>* planes)
+{
+	planes->resize(brush.faces.size());
+	for (size_t i = 0; i < brush.faces.size(); i++) {
+		(*planes)[i] = convertFaceToPlane(brush.faces[i]);
+	}
+}
+
+void createBrushPolys(const Brush& brush, std::vector<Polygon>* polys)
+{
+	std::vector<Plane> planes;
+	getBrushPlanes(brush, &planes);
+	createPlanePolys(planes.data(), (int)planes.size(), polys);
+}
+
+/*
+* Appends the polygons of every brush in brush order, so the result does not
+* depend on which thread built which brush.
+*/
+static std::vector<Polygon> joinBrushPolys(std::vector<std::vector<Polygon>>& brushPolys)
+{
+	size_t polyCount = 0;
+	for (auto b = brushPolys.begin(); b != brushPolys.end(); b++) {
+		polyCount += b->size();
+	}
+
+	std::vector<Polygon> polys;
+	polys.reserve(polyCount);
+	for (auto b = brushPolys.begin(); b != brushPolys.end(); b++) {
+		polys.insert(polys.end(), std::make_move_iterator(b->begin()), std::make_move_iterator(b->end()));
+	}
+
+	return polys;
+}
+
+static bool getOrigin(std::string_view value, glm::f64vec3* origin)
+{
+	std::string s(value);
+
+	return sscanf(s.c_str(), "%lf %lf %lf", &origin->x, &origin->y, &origin->z) == 3;
+}
+
+/*
+* Texture names are interned in the order they first show up, the same way
+* MapSoA does it. Returns the material of the texture.
+*/
+static uint32_t internMaterial(std::unordered_map<std::string, uint32_t>* materialIds, std::vector<std::string>* materials, std::string_view textureName)
+{
+	std::string name(textureName);
+	auto id = materialIds->find(name);
+	if (id != materialIds->end()) {
+		return id->second;
+	}
+	uint32_t material = (uint32_t)materials->size();
+	materials->push_back(name);
+	(*materialIds)[name] = material;
+
+	return material;
+}
+
+/*
+* Texture names of the brush's faces, for isSolidBrush.
+*/
+static void getBrushTextureNames(const Brush& brush, std::vector<std::string_view>* textureNames)
+{
+	textureNames->clear();
+	for (auto f = brush.faces.begin(); f != brush.faces.end(); f++) {
+		textureNames->push_back(f->textureName);
+	}
+}
+
+static void getBrushTextureNames(const MapSoAView& map, const MapRange& brush, std::vector<std::string_view>* textureNames)
+{
+	textureNames->clear();
+	for (uint32_t f = brush.first; f < brush.first + brush.count; f++) {
+		textureNames->push_back(map.textures[map.textureIds[f]]);
+	}
+}
+
+static void getBrushTextures(const Brush& brush, const std::vector<Plane>& planes, const uint32_t* materials, std::vector<PolygonTexture>* textures)
+{
+	textures->resize(brush.faces.size());
+	for (size_t i = 0; i < brush.faces.size(); i++) {
+		(*textures)[i] = getFaceTexture(brush.faces[i], planes[i].n, materials[i]);
+	}
+}
+
+std::vector<Polygon> createPolysoup(const Map& map, unsigned int threadCount, bool cull, std::vector<std::string>* materials, BrushCache* cache)
+{
+	std::vector<const Brush*> brushes;
+	std::vector<uint32_t> brushEntities;
+	std::vector<glm::f64vec3> origins;
+	std::vector<std::string> materialNames;
+	std::unordered_map<std::string, uint32_t> materialIds;
+	std::vector<uint32_t> faceMaterials;
+	std::vector<size_t> firstFaces;
+	for (auto e = map.entities.begin(); e != map.entities.end(); e++) {
+		for (auto b = e->brushes.begin(); b != e->brushes.end(); b++) {
+			brushes.push_back(&*b);
+			brushEntities.push_back((uint32_t)(e - map.entities.begin()));
+			firstFaces.push_back(faceMaterials.size());
+			for (auto f = b->faces.begin(); f != b->faces.end(); f++) {
+				faceMaterials.push_back(internMaterial(&materialIds, &materialNames, f->textureName));
+			}
+		}
+		for (auto p = e->properties.begin(); p != e->properties.end(); p++) {
+			glm::f64vec3 origin;
+			if (e != map.entities.begin() && p->key == "origin" && getOrigin(p->value, &origin)) {
+				origins.push_back(origin);
+			}
+		}
+	}
+
+	std::vector<std::vector<Plane>> brushPlanes(brushes.size());
+	std::vector<std::vector<Polygon>> brushPolys(brushes.size());
+	std::vector<std::vector<PolygonTexture>> brushTextures(cache ? brushes.size() : 0);
+	parallelFor(brushes.size(), threadCount, [&](size_t i) {
+		std::vector<PolygonTexture> textures;
+		getBrushPlanes(*brushes[i], &brushPlanes[i]);
+		getBrushTextures(*brushes[i], brushPlanes[i], faceMaterials.data() + firstFaces[i], &textures);
+		if (cache) {
+			brushTextures[i].swap(textures);
+		}
+		else {
+			createPlanePolys(brushPlanes[i].data(), (int)brushPlanes[i].size(), &brushPolys[i], textures.data());
+		}
+	});
+	if (cache) {
+		createCachedBrushPolys(cache, brushPlanes, brushTextures, threadCount, &brushPolys);
+	}
+
+	if (cull) {
+		std::vector<CSGBrush> csgBrushes(brushes.size());
+		std::vector<std::string_view> textureNames;
+		for (size_t i = 0; i < brushes.size(); i++) {
+			getBrushTextureNames(*brushes[i], &textureNames);
+			bool isSolid = isSolidBrush(textureNames.data(), textureNames.size());
+			csgBrushes[i] = { brushPlanes[i].data(), (int)brushPlanes[i].size(), brushEntities[i], isSolid, &brushPolys[i] };
+		}
+		cullFaces(csgBrushes, origins, threadCount);
+	}
+	if (materials) {
+		materials->swap(materialNames);
+	}
+
+	return joinBrushPolys(brushPolys);
+}
+
+static PolygonTexture getMapSoATexture(const MapSoAView& map, uint32_t face)
+{
+	PolygonTexture texture;
+	if (map.mapVersion == VALVE_220) {
+		const MapTextureAxis& u = map.uAxis[face];
+		const MapTextureAxis& v = map.vAxis[face];
+		texture = getValveTexture(glm::f64vec3(u.x, u.y, u.z), u.offset, glm::f64vec3(v.x, v.y, v.z), v.offset,
+			map.xScale[face], map.yScale[face]);
+	}
+	else {
+		texture = getQuakeTexture(map.planes[face].n, map.xOffset[face], map.yOffset[face], map.rotation[face],
+			map.xScale[face], map.yScale[face]);
+	}
+	texture.material = map.textureIds[face];
+
+	return texture;
+}
+
+std::vector<Polygon> createPolysoup(const MapSoAView& map, unsigned int threadCount, bool cull, std::vector<std::string>* materials,
+	BrushCache* cache)
+{
+	std::vector<std::vector<Polygon>> brushPolys(map.brushCount);
+	std::vector<std::vector<Plane>> brushPlanes(cache ? map.brushCount : 0);
+	std::vector<std::vector<PolygonTexture>> brushTextures(cache ? map.brushCount : 0);
+	parallelFor(map.brushCount, threadCount, [&](size_t i) {
+		const MapRange& brush = map.brushes[i];
+		std::vector<PolygonTexture> textures(brush.count);
+		for (uint32_t f = 0; f < brush.count; f++) {
+			textures[f] = getMapSoATexture(map, brush.first + f);
+		}
+		if (cache) {
+			brushPlanes[i].assign(&map.planes[brush.first], &map.planes[brush.first] + brush.count);
+			brushTextures[i].swap(textures);
+		}
+		else {
+			createPlanePolys(&map.planes[brush.first], brush.count, &brushPolys[i], textures.data());
+		}
+	});
+	if (cache) {
+		createCachedBrushPolys(cache, brushPlanes, brushTextures, threadCount, &brushPolys);
+	}
+
+	if (cull) {
+		std::vector<CSGBrush> csgBrushes(map.brushCount);
+		std::vector<glm::f64vec3> origins;
+		std::vector<std::string_view> textureNames;
+		for (size_t e = 0; e < map.entityCount; e++) {
+			const MapEntityRanges& entity = map.entities[e];
+			for (uint32_t b = entity.brushes.first; b < entity.brushes.first + entity.brushes.count; b++) {
+				const MapRange& brush = map.brushes[b];
+				getBrushTextureNames(map, brush, &textureNames);
+				bool isSolid = isSolidBrush(textureNames.data(), textureNames.size());
+				csgBrushes[b] = { &map.planes[brush.first], (int)brush.count, (uint32_t)e, isSolid, &brushPolys[b] };
+			}
+			for (uint32_t p = entity.properties.first; p < entity.properties.first + entity.properties.count; p++) {
+				glm::f64vec3 origin;
+				if (e > 0 && map.keys[p] == "origin" && getOrigin(map.values[p], &origin)) {
+					origins.push_back(origin);
+				}
+			}
+		}
+		cullFaces(csgBrushes, origins, threadCount);
+	}
+	if (materials) {
+		materials->assign(map.textures.begin(), map.textures.end());
+	}
+
+	return joinBrushPolys(brushPolys);
+}
+
+std::vector<Polygon> createPolysoup(const MapSoA& map, unsigned int threadCount, bool cull)
+{
+	return createPolysoup(getMapSoAView(map), threadCount, cull);
+}
+
+static void addWorldSolids(WorldSolids* world, const std::vector<size_t>& firstPlanes, unsigned int threadCount)
+{
+	world->faces.resize(firstPlanes.size());
+	std::vector<CSGBrush> csgBrushes(firstPlanes.size());
+	for (size_t i = 0; i < firstPlanes.size(); i++) {
+		size_t end = i + 1 < firstPlanes.size() ? firstPlanes[i + 1] : world->planes.size();
+		const Plane* planes = &world->planes[firstPlanes[i]];
+		createPlanePolys(planes, (int)(end - firstPlanes[i]), &world->faces[i]);
+		csgBrushes[i] = { planes, (int)(end - firstPlanes[i]), 0, true, &world->faces[i] };
+	}
+	cullHiddenFaces(csgBrushes, threadCount);
+
+	for (size_t i = 0; i < csgBrushes.size(); i++) {
+		world->solids.push_back({ csgBrushes[i].planes, csgBrushes[i].planeCount, &world->faces[i] });
+	}
+}
+
+void getWorldSolids(const Map& map, unsigned int threadCount, WorldSolids* world)
+{
+	if (map.entities.empty()) {
+		return;
+	}
+
+	std::vector<Plane> brushPlanes;
+	std::vector<size_t> firstPlanes;
+	std::vector<std::string_view> textureNames;
+	for (auto b = map.entities[0].brushes.begin(); b != map.entities[0].brushes.end(); b++) {
+		getBrushTextureNames(*b, &textureNames);
+		if (!b->faces.empty() && isSolidBrush(textureNames.data(), textureNames.size())) {
+			getBrushPlanes(*b, &brushPlanes);
+			firstPlanes.push_back(world->planes.size());
+			world->planes.insert(world->planes.end(), brushPlanes.begin(), brushPlanes.end());
+		}
+	}
+	addWorldSolids(world, firstPlanes, threadCount);
+
+	for (auto e = map.entities.begin() + 1; e != map.entities.end(); e++) {
+		for (auto p = e->properties.begin(); p != e->properties.end(); p++) {
+			glm::f64vec3 origin;
+			if (p->key == "origin" && getOrigin(p->value, &origin)) {
+				world->origins.push_back(origin);
+			}
+		}
+	}
+}
+
+void getWorldSolids(const MapSoAView& map, unsigned int threadCount, WorldSolids* world)
+{
+	if (map.entityCount == 0) {
+		return;
+	}
+
+	std::vector<size_t> firstPlanes;
+	std::vector<std::string_view> textureNames;
+	const MapRange& brushes = map.entities[0].brushes;
+	for (uint32_t b = brushes.first; b < brushes.first + brushes.count; b++) {
+		const MapRange& brush = map.brushes[b];
+		getBrushTextureNames(map, brush, &textureNames);
+		if (brush.count > 0 && isSolidBrush(textureNames.data(), textureNames.size())) {
+			firstPlanes.push_back(world->planes.size());
+			world->planes.insert(world->planes.end(), &map.planes[brush.first], &map.planes[brush.first] + brush.count);
+		}
+	}
+	addWorldSolids(world, firstPlanes, threadCount);
+
+	for (size_t e = 1; e < map.entityCount; e++) {
+		const MapRange& properties = map.entities[e].properties;
+		for (uint32_t p = properties.first; p < properties.first + properties.count; p++) {
+			glm::f64vec3 origin;
+			if (map.keys[p] == "origin" && getOrigin(map.values[p], &origin)) {
+				world->origins.push_back(origin);
+			}
+		}
+	}
+}
+
+void getWorldSolids(const MapSoA& map, unsigned int threadCount, WorldSolids* world)
+{
+	getWorldSolids(getMapSoAView(map), threadCount, world);
+}
+
+/*
+* Quake: "light" is the intensity. Half-Life: "_light" is "r g b intensity".
+* "_color" is 0..1 or 0..255.
+*/
+static void setLightProperty(LightSource* light, std::string_view key, std::string_view value)
+{
+	std::string s(value);
+	glm::f64vec3 color;
+	double intensity;
+	if (key == "origin") {
+		getOrigin(value, &light->origin);
+	}
+	else if (key == "light" && sscanf(s.c_str(), "%lf", &intensity) == 1) {
+		light->intensity = intensity;
+	}
+	else if (key == "_light") {
+		int count = sscanf(s.c_str(), "%lf %lf %lf %lf", &color.x, &color.y, &color.z, &intensity);
+		if (count == 4) {
+			light->color = color / 255.0;
+			light->intensity = intensity;
+		}
+		else if (count >= 1) {
+			light->intensity = color.x;
+		}
+	}
+	else if (key == "_color" && sscanf(s.c_str(), "%lf %lf %lf", &color.x, &color.y, &color.z) == 3) {
+		light->color = color.x > 1.0 || color.y > 1.0 || color.z > 1.0 ? color / 255.0 : color;
+	}
+}
+
+static const LightSource defaultLight = { glm::f64vec3(0.0), PS_LIGHT_DEFAULT_INTENSITY, glm::f64vec3(1.0) };
+
+std::vector<LightSource> getLights(const Map& map)
+{
+	std::vector<LightSource> lights;
+	for (auto e = map.entities.begin(); e != map.entities.end(); e++) {
+		auto classname = std::find_if(e->properties.begin(), e->properties.end(), [](const Property& p) { return p.key == "classname"; });
+		if (classname == e->properties.end() || std::string_view(classname->value).substr(0, 5) != "light") {
+			continue;
+		}
+		LightSource light = defaultLight;
+		for (auto p = e->properties.begin(); p != e->properties.end(); p++) {
+			setLightProperty(&light, p->key, p->value);
+		}
+		lights.push_back(light);
+	}
+
+	return lights;
+}
+
+std::vector<LightSource> getLights(const MapSoAView& map)
+{
+	std::vector<LightSource> lights;
+	for (size_t e = 0; e < map.entityCount; e++) {
+		const MapRange& properties = map.entities[e].properties;
+		bool isLight = false;
+		for (uint32_t p = properties.first; p < properties.first + properties.count; p++) {
+			isLight |= map.keys[p] == "classname" && map.values[p].substr(0, 5) == "light";
+		}
+		if (!isLight) {
+			continue;
+		}
+		LightSource light = defaultLight;
+		for (uint32_t p = properties.first; p < properties.first + properties.count; p++) {
+			setLightProperty(&light, map.keys[p], map.values[p]);
+		}
+		lights.push_back(light);
+	}
+
+	return lights;
+}
+
+std::vector<LightSource> getLights(const MapSoA& map)
+{
+	return getLights(getMapSoAView(map));
+}
+
+/*
+* Builds the polysoup while the map is being parsed: every brush is turned into
+* polygons as soon as its closing brace is read. No Map is built, so memory
+* does not grow with the number of brushes, only with the resulting polygons.
+*/
+class PolysoupBuilder : public MapListener
+{
+public:
+	void onBrush(const Brush& brush) override
+	{
+		getBrushPlanes(brush, &m_Planes);
+		m_FaceMaterials.clear();
+		for (auto f = brush.faces.begin(); f != brush.faces.end(); f++) {
+			m_FaceMaterials.push_back(internMaterial(&m_MaterialIds, &m_Materials, f->textureName));
+		}
+		getBrushTextures(brush, m_Planes, m_FaceMaterials.data(), &m_Textures);
+		createPlanePolys(m_Planes.data(), (int)m_Planes.size(), &m_Polys, m_Textures.data());
+	}
+
+	std::vector<Polygon>						m_Polys;
+	std::vector<std::string>					m_Materials;
+	std::unordered_map<std::string, uint32_t>	m_MaterialIds;
+	std::vector<Plane>							m_Planes; // Reused for every brush
+	std::vector<PolygonTexture>					m_Textures;
+	std::vector<uint32_t>						m_FaceMaterials;
+};
+
+bool createPolysoupStreaming(char* mapData, size_t mapDataLength, MapVersion mapVersion, std::vector<Polygon>* polys,
+	std::vector<std::string>* materials)
+{
+	MapParser parser;
+	initMapParser(&parser, mapData, mapDataLength, mapVersion);
+	PolysoupBuilder builder;
+	parseMap(&parser, &builder);
+	polys->swap(builder.m_Polys);
+	if (materials) {
+		materials->swap(builder.m_Materials);
+	}
+
+	return !parser.hasError;
+}
+
+/*
+* Assumes only convex polygons with their vertices in order (as createPlanePolys
+* makes them) -> use trivial triangulation approach where
+* a triangle-fan gets built, eg:
+* 
+*       v2______v3                        v2______v3
+*       /       |                         /|     /|
+*      /        |                        / |    / |
+*   v1/         |       -->           v1/  |   /  |
+*     \         |                       \  |  /   |
+*      \        |                        \ | /    | 
+*       \_______|                         \|/_____|
+*        v0     v4                         v0     v4     
+* 
+* v0 is the 'provoking vertex'. It is the anchor-point of the triangle fan.
+* Note that a lot of redundant data is generated: (v0, v1, v2), (v0, v2, v3), (v0, v3, v4).
+*/
+std::vector<Polygon> triangulate(const std::vector<Polygon>& polys)
+{
+	std::vector<Polygon> tris = { };
+
+	for (auto p = polys.begin(); p != polys.end(); p++) {
+		size_t vertCount = p->vertices.size();
+		glm::f64vec3 provokingVert = p->vertices[0];
+		for (size_t i = 2; i < vertCount; i++) {
+			Polygon poly = { };
+			poly.normal = p->normal;
+			poly.texture = p->texture;
+			poly.vertices.push_back(provokingVert);
+			poly.vertices.push_back(p->vertices[i - 1]);
+			poly.vertices.push_back(p->vertices[i]);
+			tris.push_back(poly);
+		}		
+	}
+
+	return tris;
+}
+
+/*
+* The stages compileMap and compileWorldMesh share: the map's triangles and
+* the names their materials refer to.
+*/
+static bool getMapTris(const char* mapFile, const PolysoupOptions& options, std::vector<Polygon>* tris, std::vector<std::string>* materials)
+{
+	std::string mapData;
+	if (!loadMapFile(mapFile, &mapData)) {
+		return false;
+	}
+	MapVersion mapVersion = getMapVersion(&mapData[0], mapData.length(), options.mapVersion);
+	Map map;
+	if (!getMapParallel(&mapData[0], mapData.length(), mapVersion, options.threadCount, &map)) {
+		return false;
+	}
+	BrushCache cache;
+	if (options.brushCacheFile && !loadBrushCache(options.brushCacheFile, &cache)) {
+		fprintf(stderr, "WARNING: Brush cache %s is damaged, starting over!\n", options.brushCacheFile);
+	}
+	*tris = triangulate(createPolysoup(map, options.threadCount, options.cull, materials, options.brushCacheFile ? &cache : nullptr));
+	if (cache.isChanged && !writeBrushCache(options.brushCacheFile, cache)) {
+		fprintf(stderr, "WARNING: Unable to write brush cache %s!\n", options.brushCacheFile);
+	}
+
+	return true;
+}
+
+bool compileMap(const char* mapFile, const PolysoupOptions& options, PolysoupMesh* out)
+{
+	if (!getMapTris(mapFile, options, &out->tris, &out->materials)) {
+		return false;
+	}
+	out->mesh = weldTriangles(out->tris, options.weldTolerance);
+
+	return true;
+}
+
+bool compileWorldMesh(const char* mapFile, const char* worldMeshFile, const PolysoupOptions& options)
+{
+	std::vector<Polygon> tris;
+	std::vector<std::string> materials;
+	if (!getMapTris(mapFile, options, &tris, &materials)) {
+		return false;
+	}
+	std::vector<MaterialRange> ranges = sortByMaterial(&tris);
+
+	return writeWorldMesh(worldMeshFile, buildWorldMesh(tris, ranges, materials, options.quantize));
+}
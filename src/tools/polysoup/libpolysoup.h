@@ -0,0 +1,134 @@
+/*
+* Polysoup as a library, for programs that compile maps themselves (the engine
+* does, when it is started with a .map). The stages are the ones the command
+* line tool runs:
+*
+*   Map map = getMap(&mapData[0], mapData.length(), QUAKE);             parse, parser.h
+*   std::vector<Polygon> polys = createPolysoup(map, 0, true, &materials);
+*   std::vector<Polygon> tris = triangulate(polys);
+*   IndexedMesh mesh = weldTriangles(tris);                               weld.h
+*
+* compileMap runs all of them on a map file, compileWorldMesh goes on to write
+* a world.mesh (worldmesh.h) the engine can map.
+*
+* The polysoup library target has the implementation of every module in it,
+* programs that link it must not define the *_IMPLEMENTATION macros again.
+*
+* Nothing here keeps state between calls, so maps can be compiled on any
+* thread. Nothing exits the program either: a map with a syntax error gets
+* reported on stderr and the call returns false.
+*/
+
+#ifndef _LIBPOLYSOUP_H_
+#define _LIBPOLYSOUP_H_
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <glm/glm.hpp>
+
+#include "polysoup.h"
+#include "parser.h"
+#include "mapsoa.h"
+#include "weld.h"
+#include "bsp.h"
+#include "light.h"
+#include "brushcache.h"
+
+struct PolysoupOptions
+{
+	MapVersion		mapVersion;		// Of maps whose worldspawn has no "mapversion" key
+
+	unsigned int	threadCount;	// 0 = all hardware threads
+	bool			cull;			// Remove faces that can not be seen (see csg.h)
+	bool			quantize;		// world.mesh with quantized vertices
+	double			weldTolerance;
+	const char*		brushCacheFile;	// nullptr: every brush gets built (see brushcache.h)
+};
+
+static const PolysoupOptions defaultPolysoupOptions = { QUAKE, 0, true, false, PS_WELD_TOLERANCE, nullptr };
+
+/*
+* A compiled map. The materials of tris refer to materials, the texture names
+* of the map. mesh is tris welded.
+*/
+struct PolysoupMesh
+{
+	std::vector<Polygon>		tris;
+	IndexedMesh					mesh;
+	std::vector<std::string>	materials;
+};
+
+/*
+* Solid worldspawn brushes, what the BSP is built from, and the origins of the
+* point entities, where vis floods the inside of the map from. solids points
+* into planes and faces, so they are filled together.
+*/
+struct WorldSolids
+{
+	std::vector<Plane>					planes;
+	std::vector<std::vector<Polygon>>	faces;
+	std::vector<BSPSolid>				solids;
+	std::vector<glm::f64vec3>			origins;
+};
+
+void					getBrushPlanes(const Brush& brush, std::vector<Plane>* planes);
+void					createBrushPolys(const Brush& brush, std::vector<Polygon>* polys);
+
+/*
+* Brushes are independent of each other, so they are built on threadCount
+* threads (0 = all hardware threads), each into its own slot.
+* cull: remove faces that can not be seen (see csg.h).
+* materials: gets the texture names the materials of the polygons refer to.
+* cache: brushes get looked up in it first, the ones that were not in it are
+* added (see brushcache.h).
+*/
+std::vector<Polygon>	createPolysoup(const Map& map, unsigned int threadCount = 1, bool cull = false, std::vector<std::string>* materials = nullptr,
+							BrushCache* cache = nullptr);
+
+/*
+* The materials of the polygons refer to map.textures. The MapSoAView
+* overloads read the columns wherever they are, in a MapSoA or in place in a
+* mapped .bmap (bmap.h).
+*/
+std::vector<Polygon>	createPolysoup(const MapSoAView& map, unsigned int threadCount = 1, bool cull = false, std::vector<std::string>* materials = nullptr,
+								BrushCache* cache = nullptr);
+std::vector<Polygon>	createPolysoup(const MapSoA& map, unsigned int threadCount = 1, bool cull = false);
+
+/*
+* Builds the polysoup while the map is being parsed, without building a Map.
+* Returns false if the map has a syntax error.
+*/
+bool					createPolysoupStreaming(char* mapData, size_t mapDataLength, MapVersion mapVersion, std::vector<Polygon>* polys,
+							std::vector<std::string>* materials = nullptr);
+
+/*
+* Every convex polygon split into a fan of triangles around its first vertex.
+*/
+std::vector<Polygon>	triangulate(const std::vector<Polygon>& polys);
+
+void					getWorldSolids(const Map& map, unsigned int threadCount, WorldSolids* world);
+void					getWorldSolids(const MapSoA& map, unsigned int threadCount, WorldSolids* world);
+void					getWorldSolids(const MapSoAView& map, unsigned int threadCount, WorldSolids* world);
+
+/*
+* Every entity whose classname starts with "light".
+*/
+std::vector<LightSource>	getLights(const Map& map);
+std::vector<LightSource>	getLights(const MapSoA& map);
+std::vector<LightSource>	getLights(const MapSoAView& map);
+
+/*
+* Parses, builds, triangulates and welds mapFile. Returns false if the file
+* can not be read or has a syntax error.
+*/
+bool					compileMap(const char* mapFile, const PolysoupOptions& options, PolysoupMesh* out);
+
+/*
+* The triangles of compileMap, sorted by material into worldMeshFile. Nothing
+* gets welded, world.mesh shares vertices per draw by itself.
+*/
+bool					compileWorldMesh(const char* mapFile, const char* worldMeshFile, const PolysoupOptions& options = defaultPolysoupOptions);
+
+#endif
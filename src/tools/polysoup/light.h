@@ -0,0 +1,525 @@
+/*
+* Lightmaps for the polysoup, baked on the CPU with rays through a BVH (see
+* bvh.h).
+*
+* Charts: every polygon gets its own grid of luxels, PS_LIGHT_LUXEL_SIZE units
+* apart. Like Quake, the grid is laid onto the two world axes the polygon faces
+* the least, so luxels on a wall line up with those on the walls next to it.
+* Every chart has a border of one luxel so filtering does not bleed in from
+* the neighbours in the atlas. A luxel is lit at the point of the polygon
+* closest to its center, lifted a bit off the surface.
+*
+* Direct light: Quake's light entities. A light of intensity I adds
+*   (I - distance) * (0.5 + 0.5 * cos(angle of incidence))
+* if nothing is between it and the luxel, so it reaches I units far. Shadow
+* rays go in packets of four neighbouring luxels towards the same light.
+* Bounces: every luxel gathers PS_LIGHT_BOUNCE_SAMPLES cosine distributed rays.
+* What the luxel a ray hits got in the previous bounce comes back in, times
+* PS_LIGHT_ALBEDO. Rays that hit the back of a face see nothing. Packets are
+* four neighbouring luxels again, sending their rays in the same directions.
+*
+* Charts are spread over the threads, every chart only writes its own luxels
+* and the random numbers only depend on chart, luxel and sample, so the result
+* does not depend on the thread count.
+*
+* Atlases: the charts are packed into rows of PS_LIGHT_ATLAS_SIZE square
+* atlases, highest charts first. A new atlas is started when one is full.
+*/
+
+#ifndef _LIGHT_H_
+#define _LIGHT_H_
+
+#include <vector>
+#include <stdint.h>
+
+#include <glm/glm.hpp>
+
+#include "polysoup.h"
+
+#define PS_LIGHT_LUXEL_SIZE			(16.0)
+#define PS_LIGHT_ATLAS_SIZE			(1024)
+#define PS_LIGHT_DEFAULT_INTENSITY	(300.0)
+#define PS_LIGHT_BOUNCES			(2)
+#define PS_LIGHT_BOUNCE_SAMPLES		(16)
+#define PS_LIGHT_ALBEDO				(0.5)
+#define PS_LIGHT_SURFACE_OFFSET		(1.0)	// Luxels are lit this far in front of their polygon
+#define PS_LIGHT_MAX_DISTANCE		(65536.0)
+
+#define LIGHTMAP_MAGIC		(0x50414D4C) // 'LMAP'
+#define LIGHTMAP_VERSION	(1)
+
+struct LightSource
+{
+	glm::f64vec3	origin;
+	double			intensity;
+	glm::f64vec3	color;		// 0..1
+};
+
+/*
+* Where a triangle's vertices are in the atlases, in atlas texture coordinates.
+*/
+struct LightmapTriangle
+{
+	uint32_t	atlas;
+	float		uvs[3][2];
+};
+
+struct Lightmap
+{
+	uint32_t						atlasSize;
+	uint32_t						atlasCount;
+	std::vector<uint8_t>			atlases;	// RGBA, atlasCount * atlasSize * atlasSize
+	std::vector<LightmapTriangle>	triangles;	// Same order as triangulate makes them
+	size_t							luxelCount;
+	uint64_t						rayCount;
+};
+
+/*
+* Lightmap of polys, lit by lights. bounces: number of indirect bounces, 0 for
+* direct light only.
+*/
+Lightmap	bakeLightmap(const std::vector<Polygon>& polys, const std::vector<LightSource>& lights,
+				unsigned int threadCount = 1, int bounces = PS_LIGHT_BOUNCES);
+
+/*
+* Header { magic, version, atlasSize, atlasCount, triangleCount }, the atlases,
+* then a LightmapTriangle for every triangle.
+*/
+bool		writeLightmap(const char* fileName, const Lightmap& lightmap);
+
+
+
+/*
+*
+* IMPLEMENTATION
+*
+*/
+
+
+
+#if defined(LIGHT_IMPLEMENTATION)
+
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+
+#include "bvh.h"
+#include "parallel.h"
+
+struct LightmapHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t atlasSize;
+	uint32_t atlasCount;
+	uint32_t triangleCount;
+};
+
+struct LightChart
+{
+	int				axes[3];		// The two axes the luxel grid is on, then the one the polygon faces
+	glm::f64vec2	origin;			// Corner of the chart on the grid axes
+	double			luxelSize;
+	int				width;
+	int				height;
+	size_t			firstLuxel;
+	uint32_t		atlas;
+	int				x;				// In the atlas
+	int				y;
+};
+
+struct LightData
+{
+	const std::vector<Polygon>*		polys;
+	const std::vector<LightSource>*	lights;
+	BVH								bvh;
+	std::vector<uint32_t>			triPolys;	// Polygon of every triangle
+	std::vector<LightChart>			charts;		// One per polygon
+	std::vector<glm::f64vec3>		points;		// Where every luxel is lit
+	std::vector<uint64_t>			rayCounts;	// Per chart
+};
+
+static void createLightChart(const Polygon& poly, LightChart* chart)
+{
+	glm::f64vec3 n = glm::abs(poly.normal);
+	int faceAxis = n.x >= n.y && n.x >= n.z ? 0 : (n.y >= n.z ? 1 : 2);
+	chart->axes[0] = faceAxis == 0 ? 1 : 0;
+	chart->axes[1] = faceAxis == 2 ? 1 : 2;
+	chart->axes[2] = faceAxis;
+
+	glm::f64vec2 min(INFINITY), max(-INFINITY);
+	for (auto v = poly.vertices.begin(); v != poly.vertices.end(); v++) {
+		glm::f64vec2 p((*v)[chart->axes[0]], (*v)[chart->axes[1]]);
+		min = glm::min(min, p);
+		max = glm::max(max, p);
+	}
+
+	// Coarser luxels for polygons that would not fit into an atlas otherwise.
+	chart->luxelSize = PS_LIGHT_LUXEL_SIZE;
+	while (true) {
+		glm::f64vec2 gridMin = glm::floor(min / chart->luxelSize);
+		glm::f64vec2 gridMax = glm::ceil(max / chart->luxelSize);
+		chart->width = (int)(gridMax.x - gridMin.x) + 2;
+		chart->height = (int)(gridMax.y - gridMin.y) + 2;
+		chart->origin = (gridMin - 1.0) * chart->luxelSize;
+		if (chart->width <= PS_LIGHT_ATLAS_SIZE && chart->height <= PS_LIGHT_ATLAS_SIZE) {
+			break;
+		}
+		chart->luxelSize *= 2.0;
+	}
+}
+
+/*
+* Point of the polygon's plane at the grid position s, t (in luxels).
+*/
+static glm::f64vec3 getLightChartPoint(const Polygon& poly, const LightChart& chart, double s, double t)
+{
+	glm::f64vec3 p;
+	p[chart.axes[0]] = chart.origin.x + s * chart.luxelSize;
+	p[chart.axes[1]] = chart.origin.y + t * chart.luxelSize;
+	p[chart.axes[2]] = 0.0;
+	// n . p = n . v0 solved for the third axis. n faces that axis the most, so it is never 0.
+	p[chart.axes[2]] = (glm::dot(poly.normal, poly.vertices[0]) - glm::dot(poly.normal, p)) / poly.normal[chart.axes[2]];
+
+	return p;
+}
+
+/*
+* Moves p (on the polygon's plane) onto the closest point of the polygon.
+* Good enough for the convex polygons of the soup: each edge p is outside of
+* pulls it back onto that edge.
+*/
+static glm::f64vec3 clampToPolygon(const Polygon& poly, glm::f64vec3 p)
+{
+	size_t count = poly.vertices.size();
+	for (int pass = 0; pass < 2; pass++) {
+		for (size_t i = 0; i < count; i++) {
+			const glm::f64vec3& a = poly.vertices[i];
+			const glm::f64vec3& b = poly.vertices[(i + 1) % count];
+			glm::f64vec3 edge = b - a;
+			glm::f64vec3 inward = glm::cross(poly.normal, edge); // Vertices go counter-clockwise around the normal
+			if (glm::dot(p - a, inward) < 0.0) {
+				double length2 = glm::dot(edge, edge);
+				double t = length2 > 0.0 ? glm::clamp(glm::dot(p - a, edge) / length2, 0.0, 1.0) : 0.0;
+				p = a + t * edge;
+			}
+		}
+	}
+
+	return p;
+}
+
+static inline uint32_t hashLight(uint32_t x)
+{
+	x ^= x >> 16;
+	x *= 0x7FEB352Du;
+	x ^= x >> 15;
+	x *= 0x846CA68Bu;
+	x ^= x >> 16;
+
+	return x;
+}
+
+static inline float getLightRandom(uint32_t* state)
+{
+	*state = hashLight(*state + 0x9E3779B9u);
+
+	return (*state >> 8) * (1.0f / 16777216.0f);
+}
+
+static void setLightRay(BVHRay4* rays, int lane, const glm::f64vec3& origin, const glm::f64vec3& dir, float tMax)
+{
+	for (int a = 0; a < 3; a++) {
+		rays->origin[a][lane] = (float)origin[a];
+		rays->dir[a][lane] = (float)dir[a];
+	}
+	rays->tMin[lane] = 0.0f;
+	rays->tMax[lane] = tMax;
+}
+
+/*
+* Direct light of all luxels of a chart.
+*/
+static void lightChartDirect(LightData* data, size_t c, std::vector<glm::vec3>* direct)
+{
+	const LightChart& chart = data->charts[c];
+	const Polygon& poly = (*data->polys)[c];
+	size_t luxelCount = (size_t)chart.width * chart.height;
+
+	// Lights in front of the polygon and close enough to reach some of it.
+	glm::f64vec3 min(INFINITY), max(-INFINITY);
+	for (size_t i = 0; i < luxelCount; i++) {
+		min = glm::min(min, data->points[chart.firstLuxel + i]);
+		max = glm::max(max, data->points[chart.firstLuxel + i]);
+	}
+	std::vector<const LightSource*> lights;
+	for (auto l = data->lights->begin(); l != data->lights->end(); l++) {
+		glm::f64vec3 closest = glm::clamp(l->origin, min, max);
+		if (glm::length(l->origin - closest) < l->intensity && glm::dot(poly.normal, l->origin - closest) > -PS_LIGHT_LUXEL_SIZE) {
+			lights.push_back(&*l);
+		}
+	}
+
+	uint64_t rayCount = 0;
+	for (auto l = lights.begin(); l != lights.end(); l++) {
+		const LightSource& light = **l;
+		for (size_t first = 0; first < luxelCount; first += 4) {
+			BVHRay4 rays;
+			uint32_t mask = 0;
+			double adds[4] = { };
+			for (int lane = 0; lane < 4; lane++) {
+				setLightRay(&rays, lane, glm::f64vec3(0.0), glm::f64vec3(0.0, 0.0, 1.0), 0.0f);
+				if (first + lane >= luxelCount) {
+					continue;
+				}
+				const glm::f64vec3& p = data->points[chart.firstLuxel + first + lane];
+				glm::f64vec3 toLight = light.origin - p;
+				double distance = glm::length(toLight);
+				double cosine = distance > 0.0 ? glm::dot(poly.normal, toLight) / distance : 1.0;
+				if (distance >= light.intensity || cosine <= 0.0) {
+					continue;
+				}
+				adds[lane] = (light.intensity - distance) * (0.5 + 0.5 * cosine);
+				// The light itself is at t = 1.
+				setLightRay(&rays, lane, p, toLight, 0.999f);
+				mask |= 1 << lane;
+			}
+			if (!mask) {
+				continue;
+			}
+			uint32_t occluded = occludeBVH4(data->bvh, rays, mask);
+			for (int lane = 0; lane < 4; lane++) {
+				rayCount += (mask >> lane) & 1;
+				if ((mask & ~occluded) & (1 << lane)) {
+					(*direct)[chart.firstLuxel + first + lane] += glm::vec3(adds[lane] * light.color);
+				}
+			}
+		}
+	}
+	data->rayCounts[c] += rayCount;
+}
+
+/*
+* What the luxel closest to p got in the last bounce.
+*/
+static glm::vec3 getLightAt(const LightData& data, uint32_t poly, const glm::f64vec3& p, const std::vector<glm::vec3>& light)
+{
+	const LightChart& chart = data.charts[poly];
+	int s = (int)floor((p[chart.axes[0]] - chart.origin.x) / chart.luxelSize);
+	int t = (int)floor((p[chart.axes[1]] - chart.origin.y) / chart.luxelSize);
+	s = std::min(std::max(s, 0), chart.width - 1);
+	t = std::min(std::max(t, 0), chart.height - 1);
+
+	return light[chart.firstLuxel + (size_t)t * chart.width + s];
+}
+
+/*
+* One bounce for all luxels of a chart: gathers last from what the rays hit.
+*/
+static void lightChartBounce(LightData* data, size_t c, int bounce, const std::vector<glm::vec3>& last, std::vector<glm::vec3>* next)
+{
+	const LightChart& chart = data->charts[c];
+	const Polygon& poly = (*data->polys)[c];
+	size_t luxelCount = (size_t)chart.width * chart.height;
+
+	// Any two vectors that are orthogonal to the normal and each other.
+	glm::f64vec3 up = fabs(poly.normal.z) < 0.9 ? glm::f64vec3(0.0, 0.0, 1.0) : glm::f64vec3(1.0, 0.0, 0.0);
+	glm::f64vec3 tangent = glm::normalize(glm::cross(up, poly.normal));
+	glm::f64vec3 bitangent = glm::cross(poly.normal, tangent);
+
+	// Four neighbouring luxels share their directions, so the rays of a packet stay together.
+	uint64_t rayCount = 0;
+	for (size_t first = 0; first < luxelCount; first += 4) {
+		uint32_t mask = 0;
+		for (int lane = 0; lane < 4 && first + lane < luxelCount; lane++) {
+			mask |= 1 << lane;
+		}
+		uint32_t random = hashLight(hashLight(hashLight((uint32_t)c) ^ (uint32_t)first) ^ (uint32_t)bounce);
+		glm::vec3 sums[4] = { };
+		for (int sample = 0; sample < PS_LIGHT_BOUNCE_SAMPLES; sample++) {
+			// Cosine distributed: uniform on the disk, projected up onto the hemisphere.
+			double r = sqrt(getLightRandom(&random));
+			double phi = 6.283185307179586 * getLightRandom(&random);
+			double h = sqrt(std::max(0.0, 1.0 - r * r));
+			glm::f64vec3 dir = r * cos(phi) * tangent + r * sin(phi) * bitangent + h * poly.normal;
+
+			BVHRay4 rays;
+			for (int lane = 0; lane < 4; lane++) {
+				setLightRay(&rays, lane, data->points[chart.firstLuxel + first + ((mask >> lane) & 1 ? lane : 0)], dir, (float)PS_LIGHT_MAX_DISTANCE);
+			}
+			uint32_t hits[4];
+			intersectBVH4(data->bvh, &rays, hits, mask);
+			for (int lane = 0; lane < 4; lane++) {
+				rayCount += (mask >> lane) & 1;
+				if (hits[lane] == PS_BVH_NO_HIT) {
+					continue;
+				}
+				uint32_t hitPoly = data->triPolys[hits[lane]];
+				if (glm::dot(dir, (*data->polys)[hitPoly].normal) >= 0.0) {
+					continue;
+				}
+				const glm::f64vec3& p = data->points[chart.firstLuxel + first + lane];
+				sums[lane] += getLightAt(*data, hitPoly, p + (double)rays.tMax[lane] * dir, last);
+			}
+		}
+		for (int lane = 0; lane < 4 && first + lane < luxelCount; lane++) {
+			(*next)[chart.firstLuxel + first + lane] = sums[lane] * (float)(PS_LIGHT_ALBEDO / PS_LIGHT_BOUNCE_SAMPLES);
+		}
+	}
+	data->rayCounts[c] += rayCount;
+}
+
+/*
+* Rows of charts, highest first. Returns the number of atlases.
+*/
+static uint32_t packLightCharts(std::vector<LightChart>* charts)
+{
+	std::vector<uint32_t> order(charts->size());
+	for (size_t i = 0; i < order.size(); i++) {
+		order[i] = (uint32_t)i;
+	}
+	std::stable_sort(order.begin(), order.end(), [&](uint32_t lhs, uint32_t rhs) {
+		return (*charts)[lhs].height > (*charts)[rhs].height;
+	});
+
+	uint32_t atlas = 0;
+	int x = 0, y = 0, rowHeight = 0;
+	for (auto i = order.begin(); i != order.end(); i++) {
+		LightChart& chart = (*charts)[*i];
+		if (x + chart.width > PS_LIGHT_ATLAS_SIZE) {
+			x = 0;
+			y += rowHeight;
+			rowHeight = 0;
+		}
+		if (y + chart.height > PS_LIGHT_ATLAS_SIZE) {
+			atlas++;
+			x = y = 0;
+		}
+		chart.atlas = atlas;
+		chart.x = x;
+		chart.y = y;
+		x += chart.width;
+		rowHeight = std::max(rowHeight, chart.height);
+	}
+
+	return charts->empty() ? 0 : atlas + 1;
+}
+
+Lightmap bakeLightmap(const std::vector<Polygon>& polys, const std::vector<LightSource>& lights, unsigned int threadCount, int bounces)
+{
+	LightData data;
+	data.polys = &polys;
+	data.lights = &lights;
+
+	// Same fans as triangulate.
+	std::vector<Polygon> tris;
+	for (size_t p = 0; p < polys.size(); p++) {
+		for (size_t i = 2; i < polys[p].vertices.size(); i++) {
+			Polygon tri = { };
+			tri.vertices = { polys[p].vertices[0], polys[p].vertices[i - 1], polys[p].vertices[i] };
+			tris.push_back(tri);
+			data.triPolys.push_back((uint32_t)p);
+		}
+	}
+	data.bvh = buildBVH(tris);
+
+	data.charts.resize(polys.size());
+	size_t luxelCount = 0;
+	for (size_t c = 0; c < polys.size(); c++) {
+		createLightChart(polys[c], &data.charts[c]);
+		data.charts[c].firstLuxel = luxelCount;
+		luxelCount += (size_t)data.charts[c].width * data.charts[c].height;
+	}
+	data.points.resize(luxelCount);
+	data.rayCounts.resize(polys.size());
+	parallelFor(polys.size(), threadCount, [&](size_t c) {
+		const LightChart& chart = data.charts[c];
+		for (int t = 0; t < chart.height; t++) {
+			for (int s = 0; s < chart.width; s++) {
+				glm::f64vec3 p = clampToPolygon(polys[c], getLightChartPoint(polys[c], chart, s + 0.5, t + 0.5));
+				data.points[chart.firstLuxel + (size_t)t * chart.width + s] = p + PS_LIGHT_SURFACE_OFFSET * polys[c].normal;
+			}
+		}
+	});
+
+	std::vector<glm::vec3> total(luxelCount, glm::vec3(0.0f));
+	parallelFor(polys.size(), threadCount, [&](size_t c) {
+		lightChartDirect(&data, c, &total);
+	});
+	std::vector<glm::vec3> last = total, next(luxelCount);
+	for (int bounce = 1; bounce <= bounces; bounce++) {
+		parallelFor(polys.size(), threadCount, [&](size_t c) {
+			lightChartBounce(&data, c, bounce, last, &next);
+		});
+		for (size_t i = 0; i < luxelCount; i++) {
+			total[i] += next[i];
+		}
+		last.swap(next);
+	}
+
+	Lightmap lightmap = { };
+	lightmap.atlasSize = PS_LIGHT_ATLAS_SIZE;
+	lightmap.atlasCount = packLightCharts(&data.charts);
+	lightmap.luxelCount = luxelCount;
+	for (auto r = data.rayCounts.begin(); r != data.rayCounts.end(); r++) {
+		lightmap.rayCount += *r;
+	}
+
+	// Quake's scale: 255 is as bright as a luxel gets.
+	size_t atlasBytes = (size_t)PS_LIGHT_ATLAS_SIZE * PS_LIGHT_ATLAS_SIZE * 4;
+	lightmap.atlases.resize(lightmap.atlasCount * atlasBytes);
+	for (size_t c = 0; c < data.charts.size(); c++) {
+		const LightChart& chart = data.charts[c];
+		for (int t = 0; t < chart.height; t++) {
+			uint8_t* texel = &lightmap.atlases[chart.atlas * atlasBytes + ((size_t)(chart.y + t) * PS_LIGHT_ATLAS_SIZE + chart.x) * 4];
+			for (int s = 0; s < chart.width; s++, texel += 4) {
+				glm::vec3 color = glm::min(total[chart.firstLuxel + (size_t)t * chart.width + s], glm::vec3(255.0f));
+				texel[0] = (uint8_t)(color.r + 0.5f);
+				texel[1] = (uint8_t)(color.g + 0.5f);
+				texel[2] = (uint8_t)(color.b + 0.5f);
+				texel[3] = 255;
+			}
+		}
+	}
+
+	lightmap.triangles.resize(tris.size());
+	for (size_t i = 0; i < tris.size(); i++) {
+		const LightChart& chart = data.charts[data.triPolys[i]];
+		LightmapTriangle& triangle = lightmap.triangles[i];
+		triangle.atlas = chart.atlas;
+		for (int v = 0; v < 3; v++) {
+			const glm::f64vec3& p = tris[i].vertices[v];
+			double s = chart.x + (p[chart.axes[0]] - chart.origin.x) / chart.luxelSize;
+			double t = chart.y + (p[chart.axes[1]] - chart.origin.y) / chart.luxelSize;
+			triangle.uvs[v][0] = (float)(s / PS_LIGHT_ATLAS_SIZE);
+			triangle.uvs[v][1] = (float)(t / PS_LIGHT_ATLAS_SIZE);
+		}
+	}
+
+	return lightmap;
+}
+
+bool writeLightmap(const char* fileName, const Lightmap& lightmap)
+{
+	LightmapHeader header = { };
+	header.magic = LIGHTMAP_MAGIC;
+	header.version = LIGHTMAP_VERSION;
+	header.atlasSize = lightmap.atlasSize;
+	header.atlasCount = lightmap.atlasCount;
+	header.triangleCount = (uint32_t)lightmap.triangles.size();
+
+	FILE* file = fopen(fileName, "wb");
+	if (!file) {
+		return false;
+	}
+	bool isWritten = fwrite(&header, sizeof(header), 1, file) == 1;
+	if (!lightmap.atlases.empty()) isWritten &= fwrite(&lightmap.atlases[0], 1, lightmap.atlases.size(), file) == lightmap.atlases.size();
+	if (!lightmap.triangles.empty()) isWritten &= fwrite(&lightmap.triangles[0], sizeof(LightmapTriangle), lightmap.triangles.size(), file) == lightmap.triangles.size();
+	fclose(file);
+
+	return isWritten;
+}
+
+#endif
+
+#endif
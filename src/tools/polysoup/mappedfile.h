@@ -0,0 +1,111 @@
+/*
+* Read-only memory mapped files for Windows and POSIX.
+*/
+
+#ifndef _MAPPEDFILE_H_
+#define _MAPPEDFILE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32) || defined(_WIN64)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+struct MappedFile
+{
+	const uint8_t*	data;
+	size_t			size;
+#if defined(_WIN32) || defined(_WIN64)
+	HANDLE			file;
+	HANDLE			mapping;
+#else
+	int				fd = -1;		// -1 when not open, = { } included
+#endif
+};
+
+/*
+* Maps the whole file into memory. Returns false if the file does not exist
+* or can not be mapped. Empty files are mapped successfully with data == NULL.
+*/
+static inline bool openMappedFile(const char* fileName, MappedFile* mappedFile)
+{
+	*mappedFile = { };
+
+#if defined(_WIN32) || defined(_WIN64)
+	mappedFile->file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (mappedFile->file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(mappedFile->file, &size)) {
+		CloseHandle(mappedFile->file);
+		return false;
+	}
+	mappedFile->size = (size_t)size.QuadPart;
+	if (mappedFile->size == 0) {
+		return true;
+	}
+	mappedFile->mapping = CreateFileMappingA(mappedFile->file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mappedFile->mapping == NULL) {
+		CloseHandle(mappedFile->file);
+		return false;
+	}
+	mappedFile->data = (const uint8_t*)MapViewOfFile(mappedFile->mapping, FILE_MAP_READ, 0, 0, 0);
+	if (mappedFile->data == NULL) {
+		CloseHandle(mappedFile->mapping);
+		CloseHandle(mappedFile->file);
+		return false;
+	}
+#else
+	mappedFile->fd = open(fileName, O_RDONLY);
+	if (mappedFile->fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if (fstat(mappedFile->fd, &st) != 0) {
+		close(mappedFile->fd);
+		mappedFile->fd = -1;
+		return false;
+	}
+	mappedFile->size = (size_t)st.st_size;
+	if (mappedFile->size == 0) {
+		return true;
+	}
+	void* data = mmap(NULL, mappedFile->size, PROT_READ, MAP_PRIVATE, mappedFile->fd, 0);
+	if (data == MAP_FAILED) {
+		close(mappedFile->fd);
+		mappedFile->fd = -1;
+		return false;
+	}
+	mappedFile->data = (const uint8_t*)data;
+#endif
+
+	return true;
+}
+
+static inline void closeMappedFile(MappedFile* mappedFile)
+{
+#if defined(_WIN32) || defined(_WIN64)
+	if (mappedFile->data) UnmapViewOfFile(mappedFile->data);
+	if (mappedFile->mapping) CloseHandle(mappedFile->mapping);
+	if (mappedFile->file && mappedFile->file != INVALID_HANDLE_VALUE) CloseHandle(mappedFile->file);
+#else
+	if (mappedFile->data) munmap((void*)mappedFile->data, mappedFile->size);
+	if (mappedFile->fd >= 0) close(mappedFile->fd);
+#endif
+	*mappedFile = { };
+}
+
+#endif
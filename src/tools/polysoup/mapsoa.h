@@ -0,0 +1,305 @@
+/*
+* Structure-of-arrays representation of a map.
+*
+* A Face carries its texture name as a string, the Quake texture
+* parameters, the Valve 220 texture axes (even in Quake maps) and three
+* Vertex doubles. The geometry passes only ever look at the planes. Here every
+* attribute lives in its own column, so those passes stream through nothing
+* but planes:
+*
+* planes[ face ]            plane of the face, computed once while parsing
+* textureIds[ face ]        index into textures (every name is stored once)
+* xOffset[ face ] ...       Quake texture parameters
+* uAxis[ face ], vAxis[ face ]  Valve 220 texture axes, empty for Quake maps
+* brushes[ brush ]          range of faces belonging to the brush
+* entities[ entity ]        range of brushes and properties of the entity
+*/
+
+#ifndef _MAPSOA_H_
+#define _MAPSOA_H_
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <stdint.h>
+
+#include "parser.h"
+#include "polysoup.h"
+
+struct MapRange
+{
+	uint32_t first;
+	uint32_t count;
+};
+
+struct MapEntityRanges
+{
+	MapRange brushes;
+	MapRange properties;
+};
+
+struct MapTextureAxis
+{
+	double x, y, z;
+	double offset;
+};
+
+struct MapSoA
+{
+	MapVersion						mapVersion;
+
+	/* Per face */
+	std::vector<Plane>				planes;
+	std::vector<uint32_t>			textureIds;
+	std::vector<double>				xOffset, yOffset;
+	std::vector<double>				rotation;
+	std::vector<double>				xScale, yScale;
+	std::vector<MapTextureAxis>		uAxis, vAxis; // Valve 220 only
+
+	/* Per brush, per entity */
+	std::vector<MapRange>			brushes;
+	std::vector<MapEntityRanges>	entities;
+	std::vector<Property>			properties;
+
+	/* Interned texture names */
+	std::vector<std::string>		textures;
+	std::unordered_map<std::string, uint32_t> textureIndices;
+};
+
+/*
+* The columns of a map without owning them. Every consumer of a MapSoA reads
+* the map through one of these, so the columns can also live in a memory
+* mapped .bmap (bmap.h) and get used in place. Property keys and values and
+* the texture names point into the strings of whoever owns the map.
+*/
+struct MapSoAView
+{
+	MapVersion						mapVersion;
+	size_t							faceCount;
+	size_t							brushCount;
+	size_t							entityCount;
+	size_t							propertyCount;
+
+	/* Per face */
+	const Plane*					planes;
+	const uint32_t*					textureIds;
+	const double*					xOffset;
+	const double*					yOffset;
+	const double*					rotation;
+	const double*					xScale;
+	const double*					yScale;
+	const MapTextureAxis*			uAxis;	// Valve 220 only
+	const MapTextureAxis*			vAxis;
+
+	/* Per brush, per entity, per property */
+	const MapRange*					brushes;
+	const MapEntityRanges*			entities;
+	std::vector<std::string_view>	keys;
+	std::vector<std::string_view>	values;
+
+	std::vector<std::string_view>	textures;
+};
+
+/*
+* Parses the map straight into a MapSoA. No Map is built on the way.
+* Returns false if the map has a syntax error.
+*/
+bool		getMapSoA(char* mapData, size_t mapDataLength, MapVersion mapVersion, MapSoA* map);
+
+uint32_t	internTexture(MapSoA* map, const std::string& textureName);
+size_t		getMapSoAMemory(const MapSoA& map);
+
+/*
+* The view stays valid as long as map is not changed.
+*/
+MapSoAView	getMapSoAView(const MapSoA& map);
+
+static inline size_t getFaceCount(const MapSoA& map)
+{
+	return map.planes.size();
+}
+
+/*
+* Bytes a string holds on the heap. Short strings live inside the object.
+*/
+template<typename String>
+static inline size_t getStringHeapMemory(const String& s)
+{
+	const char* data = s.data();
+	bool isInline = data >= (const char*)&s && data < (const char*)(&s + 1);
+
+	return isInline ? 0 : s.capacity() + 1;
+}
+
+
+
+/*
+*
+* IMPLEMENTATION
+*
+*/
+
+
+
+#if defined(MAPSOA_IMPLEMENTATION)
+
+uint32_t internTexture(MapSoA* map, const std::string& textureName)
+{
+	auto texture = map->textureIndices.find(textureName);
+	if (texture != map->textureIndices.end()) {
+		return texture->second;
+	}
+
+	uint32_t textureId = (uint32_t)map->textures.size();
+	map->textures.push_back(textureName);
+	map->textureIndices[textureName] = textureId;
+
+	return textureId;
+}
+
+class MapSoABuilder : public MapListener
+{
+public:
+	MapSoABuilder(MapSoA* map)
+		: m_Map(map)
+	{
+	}
+
+	void onEntityBegin() override
+	{
+		MapEntityRanges entity = { };
+		entity.brushes.first = (uint32_t)m_Map->brushes.size();
+		entity.properties.first = (uint32_t)m_Map->properties.size();
+		m_Map->entities.push_back(entity);
+	}
+
+	void onProperty(std::string_view key, std::string_view value) override
+	{
+		m_Map->properties.emplace_back(key, value);
+		m_Map->entities.back().properties.count++;
+	}
+
+	void onFace(const Face& face) override
+	{
+		glm::f64vec3 p0(face.vertices[0].x, face.vertices[0].y, face.vertices[0].z);
+		glm::f64vec3 p1(face.vertices[1].x, face.vertices[1].y, face.vertices[1].z);
+		glm::f64vec3 p2(face.vertices[2].x, face.vertices[2].y, face.vertices[2].z);
+		m_Map->planes.push_back(createPlane(p0, p1, p2));
+		m_TextureName.assign(face.textureName.data(), face.textureName.size());
+		m_Map->textureIds.push_back(internTexture(m_Map, m_TextureName));
+		m_Map->xOffset.push_back(face.xOffset);
+		m_Map->yOffset.push_back(face.yOffset);
+		m_Map->rotation.push_back(face.rotation);
+		m_Map->xScale.push_back(face.xScale);
+		m_Map->yScale.push_back(face.yScale);
+		if (m_Map->mapVersion == VALVE_220) {
+			m_Map->uAxis.push_back({ face.tx1, face.ty1, face.tz1, face.tOffset1 });
+			m_Map->vAxis.push_back({ face.tx2, face.ty2, face.tz2, face.tOffset2 });
+		}
+		m_FaceCount++;
+	}
+
+	void onBrush(const Brush&) override
+	{
+		uint32_t faceCount = (uint32_t)m_FaceCount;
+		m_Map->brushes.push_back({ (uint32_t)m_Map->planes.size() - faceCount, faceCount });
+		m_Map->entities.back().brushes.count++;
+		m_FaceCount = 0;
+	}
+
+private:
+	MapSoA*		m_Map;
+	size_t		m_FaceCount = 0;
+	std::string	m_TextureName; // Lookup key, reused for every face
+};
+
+bool getMapSoA(char* mapData, size_t mapDataLength, MapVersion mapVersion, MapSoA* out)
+{
+	MapSoA& map = *out;
+	map = MapSoA();
+	map.mapVersion = mapVersion;
+
+	MapParser parser;
+	initMapParser(&parser, mapData, mapDataLength, mapVersion);
+	MapSoABuilder builder(&map);
+	parseMap(&parser, &builder);
+
+	// The columns grew by doubling. The map does not change anymore, so drop the slack.
+	map.planes.shrink_to_fit();
+	map.textureIds.shrink_to_fit();
+	map.xOffset.shrink_to_fit();
+	map.yOffset.shrink_to_fit();
+	map.rotation.shrink_to_fit();
+	map.xScale.shrink_to_fit();
+	map.yScale.shrink_to_fit();
+	map.uAxis.shrink_to_fit();
+	map.vAxis.shrink_to_fit();
+	map.brushes.shrink_to_fit();
+	map.entities.shrink_to_fit();
+	map.properties.shrink_to_fit();
+
+	return !parser.hasError;
+}
+
+MapSoAView getMapSoAView(const MapSoA& map)
+{
+	MapSoAView view;
+	view.mapVersion = map.mapVersion;
+	view.faceCount = map.planes.size();
+	view.brushCount = map.brushes.size();
+	view.entityCount = map.entities.size();
+	view.propertyCount = map.properties.size();
+	view.planes = map.planes.data();
+	view.textureIds = map.textureIds.data();
+	view.xOffset = map.xOffset.data();
+	view.yOffset = map.yOffset.data();
+	view.rotation = map.rotation.data();
+	view.xScale = map.xScale.data();
+	view.yScale = map.yScale.data();
+	view.uAxis = map.uAxis.data();
+	view.vAxis = map.vAxis.data();
+	view.brushes = map.brushes.data();
+	view.entities = map.entities.data();
+	view.keys.reserve(map.properties.size());
+	view.values.reserve(map.properties.size());
+	for (auto p = map.properties.begin(); p != map.properties.end(); p++) {
+		view.keys.push_back(p->key);
+		view.values.push_back(p->value);
+	}
+	view.textures.assign(map.textures.begin(), map.textures.end());
+
+	return view;
+}
+
+template<typename T>
+static size_t getVectorMemory(const std::vector<T>& v)
+{
+	return v.capacity() * sizeof(T);
+}
+
+size_t getMapSoAMemory(const MapSoA& map)
+{
+	size_t bytes = sizeof(MapSoA);
+	bytes += getVectorMemory(map.planes) + getVectorMemory(map.textureIds);
+	bytes += getVectorMemory(map.xOffset) + getVectorMemory(map.yOffset) + getVectorMemory(map.rotation);
+	bytes += getVectorMemory(map.xScale) + getVectorMemory(map.yScale);
+	bytes += getVectorMemory(map.uAxis) + getVectorMemory(map.vAxis);
+	bytes += getVectorMemory(map.brushes) + getVectorMemory(map.entities) + getVectorMemory(map.properties);
+	for (auto p = map.properties.begin(); p != map.properties.end(); p++) {
+		bytes += getStringHeapMemory(p->key) + getStringHeapMemory(p->value);
+	}
+	bytes += getVectorMemory(map.textures);
+	for (auto t = map.textures.begin(); t != map.textures.end(); t++) {
+		bytes += 2 * getStringHeapMemory(*t); // The name is also the key in textureIndices.
+	}
+	// Rough estimate of the hash map: one node with key per texture plus the buckets.
+	bytes += map.textureIndices.size() * (sizeof(std::string) + sizeof(uint32_t) + 2 * sizeof(void*));
+	bytes += map.textureIndices.bucket_count() * sizeof(void*);
+
+	return bytes;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,328 @@
+/*
+* Index orders that are cheap for the GPU.
+*
+* optimizeVertexCache: Tom Forsyth's "Linear-Speed Vertex Cache Optimisation",
+* triangles whose vertices were used recently come first.
+* optimizeOverdraw: cuts the cache ordered triangles into clusters where the
+* cache starts over anyway and draws the clusters facing out of the mesh
+* first (Sander et al., "Fast Triangle Reordering for Vertex Locality and
+* Reduced Overdraw"), keeping the cache order inside of them.
+* optimizeVertexFetch: vertices in the order the indices first use them.
+*
+* getACMR: average cache miss ratio, transformed vertices per triangle of a
+* FIFO cache with cacheSize entries. 3 is as bad as it gets, 0.5 is about the
+* best a big regular grid can do.
+*/
+
+#ifndef _MESHOPT_H_
+#define _MESHOPT_H_
+
+#include <vector>
+#include <stdint.h>
+
+#include <glm/glm.hpp>
+
+#define PS_MESHOPT_CACHE_SIZE		(32)	// Forsyth's LRU cache
+#define PS_MESHOPT_FIFO_SIZE		(16)	// For getACMR, about what hardware does
+#define PS_MESHOPT_OVERDRAW_LIMIT	(1.05)	// Clusters may cost this much more ACMR than the cache order
+
+void	optimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount);
+
+/*
+* indices must be in cache order already (optimizeVertexCache). positions:
+* vertexCount positions, stride bytes apart.
+*/
+void	optimizeOverdraw(uint32_t* indices, size_t indexCount, const float* positions, size_t vertexCount, size_t stride,
+			double limit = PS_MESHOPT_OVERDRAW_LIMIT);
+
+/*
+* Renumbers the indices in place. remap gets the old index of every new
+* vertex, vertices no index uses are dropped.
+*/
+void	optimizeVertexFetch(uint32_t* indices, size_t indexCount, size_t vertexCount, std::vector<uint32_t>* remap);
+
+double	getACMR(const uint32_t* indices, size_t indexCount, size_t vertexCount, int cacheSize = PS_MESHOPT_FIFO_SIZE);
+
+
+
+/*
+*
+* IMPLEMENTATION
+*
+*/
+
+
+
+#if defined(MESHOPT_IMPLEMENTATION)
+
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+static inline float getForsythScore(int cachePosition, uint32_t liveTriangles)
+{
+	if (liveTriangles == 0) {
+		return -1.0f;
+	}
+
+	float score = 0.0f;
+	if (cachePosition >= 0) {
+		// The last triangle's vertices score the same, whatever order they came in.
+		score = cachePosition < 3 ? 0.75f : powf(1.0f - (cachePosition - 3) / (float)(PS_MESHOPT_CACHE_SIZE - 3), 1.5f);
+	}
+
+	// Vertices with few triangles left are finished first, so they leave the cache for good.
+	return score + 2.0f / sqrtf((float)liveTriangles);
+}
+
+void optimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount)
+{
+	size_t triangleCount = indexCount / 3;
+	if (triangleCount == 0) {
+		return;
+	}
+
+	// Triangles of every vertex.
+	std::vector<uint32_t> firstTriangle(vertexCount + 1, 0);
+	for (size_t i = 0; i < 3 * triangleCount; i++) {
+		firstTriangle[indices[i] + 1]++;
+	}
+	for (size_t v = 0; v < vertexCount; v++) {
+		firstTriangle[v + 1] += firstTriangle[v];
+	}
+	std::vector<uint32_t> liveTriangles(vertexCount);
+	std::vector<uint32_t> vertexTriangles(3 * triangleCount);
+	for (size_t v = 0; v < vertexCount; v++) {
+		liveTriangles[v] = firstTriangle[v + 1] - firstTriangle[v];
+	}
+	std::vector<uint32_t> filled(vertexCount, 0);
+	for (size_t t = 0; t < triangleCount; t++) {
+		for (int c = 0; c < 3; c++) {
+			uint32_t v = indices[3 * t + c];
+			vertexTriangles[firstTriangle[v] + filled[v]++] = (uint32_t)t;
+		}
+	}
+
+	std::vector<int> cachePositions(vertexCount, -1);
+	std::vector<float> vertexScores(vertexCount);
+	for (size_t v = 0; v < vertexCount; v++) {
+		vertexScores[v] = getForsythScore(-1, liveTriangles[v]);
+	}
+	std::vector<float> triangleScores(triangleCount);
+	for (size_t t = 0; t < triangleCount; t++) {
+		triangleScores[t] = vertexScores[indices[3 * t]] + vertexScores[indices[3 * t + 1]] + vertexScores[indices[3 * t + 2]];
+	}
+
+	std::vector<uint8_t> isEmitted(triangleCount, 0);
+	std::vector<uint32_t> ordered;
+	ordered.reserve(3 * triangleCount);
+	uint32_t cache[PS_MESHOPT_CACHE_SIZE + 3];
+	int cacheSize = 0;
+	size_t nextUnemitted = 0;	// Every triangle before it is emitted
+	int64_t bestTriangle = -1;
+	for (size_t emitted = 0; emitted < triangleCount; emitted++) {
+		if (bestTriangle < 0) {
+			// Nothing in the cache has triangles left: go on with the first one in input
+			// order. Searching all of them for the best would make islands quadratic.
+			while (isEmitted[nextUnemitted]) {
+				nextUnemitted++;
+			}
+			bestTriangle = (int64_t)nextUnemitted;
+		}
+
+		uint32_t t = (uint32_t)bestTriangle;
+		isEmitted[t] = 1;
+		const uint32_t* tri = &indices[3 * t];
+		ordered.insert(ordered.end(), tri, tri + 3);
+
+		// The triangle's vertices go to the front of the LRU cache, the rest moves back.
+		uint32_t newCache[PS_MESHOPT_CACHE_SIZE + 3];
+		int newCacheSize = 0;
+		for (int c = 0; c < 3; c++) {
+			newCache[newCacheSize++] = tri[c];
+			uint32_t v = tri[c];
+			uint32_t* begin = &vertexTriangles[firstTriangle[v]];
+			uint32_t* end = begin + liveTriangles[v];
+			*std::find(begin, end, t) = *(end - 1);
+			liveTriangles[v]--;
+		}
+		for (int c = 0; c < cacheSize; c++) {
+			if (cache[c] != tri[0] && cache[c] != tri[1] && cache[c] != tri[2]) {
+				newCache[newCacheSize++] = cache[c];
+			}
+		}
+
+		// Rescore what is or was in the cache, the best triangle among theirs is next.
+		for (int c = 0; c < newCacheSize; c++) {
+			uint32_t v = newCache[c];
+			cachePositions[v] = c < PS_MESHOPT_CACHE_SIZE ? c : -1;
+			float score = getForsythScore(cachePositions[v], liveTriangles[v]);
+			float delta = score - vertexScores[v];
+			vertexScores[v] = score;
+			for (uint32_t i = firstTriangle[v]; i < firstTriangle[v] + liveTriangles[v]; i++) {
+				triangleScores[vertexTriangles[i]] += delta;
+			}
+		}
+		bestTriangle = -1;
+		float bestScore = -FLT_MAX;
+		for (int c = 0; c < newCacheSize && c < PS_MESHOPT_CACHE_SIZE; c++) {
+			uint32_t v = newCache[c];
+			for (uint32_t i = firstTriangle[v]; i < firstTriangle[v] + liveTriangles[v]; i++) {
+				if (triangleScores[vertexTriangles[i]] > bestScore) {
+					bestScore = triangleScores[vertexTriangles[i]];
+					bestTriangle = vertexTriangles[i];
+				}
+			}
+		}
+		cacheSize = std::min(newCacheSize, PS_MESHOPT_CACHE_SIZE);
+		memcpy(cache, newCache, cacheSize * sizeof(uint32_t));
+	}
+
+	memcpy(indices, ordered.data(), ordered.size() * sizeof(uint32_t));
+}
+
+void optimizeOverdraw(uint32_t* indices, size_t indexCount, const float* positions, size_t vertexCount, size_t stride, double limit)
+{
+	size_t triangleCount = indexCount / 3;
+	if (triangleCount < 2) {
+		return;
+	}
+
+	// Hard boundaries: where all three vertices of a triangle miss the cache, the
+	// order of what is before and after does not matter to the cache.
+	std::vector<uint32_t> hardClusters;
+	std::vector<uint64_t> fifo(vertexCount, 0);
+	uint64_t time = PS_MESHOPT_FIFO_SIZE + 1;
+	for (size_t t = 0; t < triangleCount; t++) {
+		int misses = 0;
+		for (int c = 0; c < 3; c++) {
+			uint32_t v = indices[3 * t + c];
+			if (time - fifo[v] > PS_MESHOPT_FIFO_SIZE) {
+				fifo[v] = time++;
+				misses++;
+			}
+		}
+		if (t == 0 || misses == 3) {
+			hardClusters.push_back((uint32_t)t);
+		}
+	}
+	hardClusters.push_back((uint32_t)triangleCount);
+
+	// Soft boundaries: a hard cluster is cut again as soon as the part so far gets
+	// the cache within limit of what the whole cluster does. Every cut starts
+	// with a cold cache, that is the ACMR the limit is for.
+	std::vector<uint32_t> clusters;
+	for (size_t h = 0; h + 1 < hardClusters.size(); h++) {
+		uint32_t begin = hardClusters[h];
+		uint32_t end = hardClusters[h + 1];
+		double clusterACMR = getACMR(indices + 3 * begin, 3 * (end - begin), vertexCount);
+		clusters.push_back(begin);
+		time += PS_MESHOPT_FIFO_SIZE + 1;
+		size_t misses = 0;
+		for (uint32_t t = begin; t < end; t++) {
+			for (int c = 0; c < 3; c++) {
+				uint32_t v = indices[3 * t + c];
+				if (time - fifo[v] > PS_MESHOPT_FIFO_SIZE) {
+					fifo[v] = time++;
+					misses++;
+				}
+			}
+			if (t + 1 < end && misses <= limit * clusterACMR * (t + 1 - clusters.back())) {
+				clusters.push_back(t + 1);
+				time += PS_MESHOPT_FIFO_SIZE + 1;
+				misses = 0;
+			}
+		}
+	}
+	clusters.push_back((uint32_t)triangleCount);
+
+	auto getPosition = [&](uint32_t v) {
+		const float* p = (const float*)((const uint8_t*)positions + v * stride);
+		return glm::dvec3(p[0], p[1], p[2]);
+	};
+	glm::dvec3 meshCenter(0.0);
+	for (size_t i = 0; i < 3 * triangleCount; i++) {
+		meshCenter += getPosition(indices[i]);
+	}
+	meshCenter /= (double)(3 * triangleCount);
+
+	// Clusters facing away from the center are in front of the others from most views.
+	struct Cluster
+	{
+		uint32_t	first;
+		uint32_t	count;
+		double		sortKey;
+	};
+	std::vector<Cluster> sorted;
+	for (size_t c = 0; c + 1 < clusters.size(); c++) {
+		glm::dvec3 center(0.0), normal(0.0);
+		double totalArea = 0.0;
+		for (uint32_t t = clusters[c]; t < clusters[c + 1]; t++) {
+			glm::dvec3 p0 = getPosition(indices[3 * t]);
+			glm::dvec3 p1 = getPosition(indices[3 * t + 1]);
+			glm::dvec3 p2 = getPosition(indices[3 * t + 2]);
+			glm::dvec3 areaNormal = glm::cross(p1 - p0, p2 - p0);
+			double area = glm::length(areaNormal);
+			center += (p0 + p1 + p2) * (area / 3.0);
+			normal += areaNormal;
+			totalArea += area;
+		}
+		// The centroid is weighted by area, the normals of a curved cluster cancel out
+		// partly, so only their direction is used.
+		double sortKey = 0.0;
+		double normalLength = glm::length(normal);
+		if (totalArea > 0.0 && normalLength > 0.0) {
+			sortKey = glm::dot(center / totalArea - meshCenter, normal / normalLength);
+		}
+		sorted.push_back({ clusters[c], clusters[c + 1] - clusters[c], sortKey });
+	}
+	std::stable_sort(sorted.begin(), sorted.end(), [](const Cluster& lhs, const Cluster& rhs) { return lhs.sortKey > rhs.sortKey; });
+
+	std::vector<uint32_t> ordered;
+	ordered.reserve(3 * triangleCount);
+	for (auto c = sorted.begin(); c != sorted.end(); c++) {
+		ordered.insert(ordered.end(), indices + 3 * c->first, indices + 3 * (c->first + c->count));
+	}
+	memcpy(indices, ordered.data(), ordered.size() * sizeof(uint32_t));
+}
+
+void optimizeVertexFetch(uint32_t* indices, size_t indexCount, size_t vertexCount, std::vector<uint32_t>* remap)
+{
+	std::vector<uint32_t> newIndices(vertexCount, UINT32_MAX);
+	remap->clear();
+	for (size_t i = 0; i < indexCount; i++) {
+		uint32_t& newIndex = newIndices[indices[i]];
+		if (newIndex == UINT32_MAX) {
+			newIndex = (uint32_t)remap->size();
+			remap->push_back(indices[i]);
+		}
+		indices[i] = newIndex;
+	}
+}
+
+double getACMR(const uint32_t* indices, size_t indexCount, size_t vertexCount, int cacheSize)
+{
+	size_t triangleCount = indexCount / 3;
+	if (triangleCount == 0) {
+		return 0.0;
+	}
+
+	// FIFO: a vertex is in the cache if fewer than cacheSize misses happened since its own.
+	std::vector<uint64_t> missTime(vertexCount, 0);
+	uint64_t time = (uint64_t)cacheSize + 1;
+	size_t misses = 0;
+	for (size_t i = 0; i < 3 * triangleCount; i++) {
+		uint32_t v = indices[i];
+		if (time - missTime[v] > (uint64_t)cacheSize) {
+			missTime[v] = time++;
+			misses++;
+		}
+	}
+
+	return (double)misses / triangleCount;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,1465 @@
+/*
+* Navigation mesh: the floor an agent of the player's size can stand and walk
+* on, as convex polygons, for enemies to plan paths across. Built like Recast
+* does it:
+*
+*   1. The triangles are rasterized into a heightfield, columns of solid spans
+*      on a grid of PS_NAV_CELL_SIZE, PS_NAV_CELL_HEIGHT high. The top of a span
+*      is walkable if its triangle's slope is.
+*   2. Filters take the walkable flag away where the agent does not fit under
+*      the span above, at ledges deeper than a step, and give it to obstacles
+*      low enough to step onto.
+*   3. The walkable area shrinks by the agent's radius, so polygons keep the
+*      agent's center away from the walls.
+*   4. Regions: rows of spans are swept into monotone regions, which have no
+*      holes and are simple to outline.
+*   5. Contours: the outline of every region, simplified to within
+*      PS_NAV_MAX_EDGE_ERROR cells of the walls. Corners where the neighbor
+*      region changes stay, so neighboring contours share them.
+*   6. Polygons: every contour is triangulated and the triangles are merged
+*      into convex polygons of up to PS_NAV_MAX_POLY_VERTICES vertices.
+*
+* The world is cut into square tiles of PS_NAV_TILE_CELLS cells that are built
+* independently, on as many threads as there are. Each tile rasterizes a
+* border of cells around it, so its edges come out as if the world went on.
+* Polygon edges on a tile's side are portals to the tile next to it.
+*
+* Heights are in Quake units with z up, as in the map. Brushes with a trigger
+* texture are ignored, they do not stop anyone.
+*
+* File layout (navmesh.bin, native byte order, every tile 16 byte aligned):
+* ----------------------------------------------------------------
+* NavMeshHeader
+* NavMeshTileHeader tiles[ tileCount ]   (sorted by y, then x)
+* per tile, at its offset:
+*   NavMeshVertex   vertices[ vertexCount ]
+*   NavMeshPoly     polys[ polyCount ]      (at the next 16 byte boundary)
+*
+* Tiles without polygons are left out. The engine maps the file and only
+* reads the tiles of the area it needs.
+*/
+
+#ifndef _NAVMESH_H_
+#define _NAVMESH_H_
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <glm/glm.hpp>
+
+#include "polysoup.h"
+
+#define NAVMESH_MAGIC				(0x4D56414E) // 'NAVM'
+#define NAVMESH_VERSION				(1)
+#define NAVMESH_ALIGNMENT			(16)
+#define NAVMESH_MAX_POLY_VERTICES	(6)
+#define NAVMESH_NO_NEIGHBOR			(0xFFFF)
+#define NAVMESH_PORTAL				(0x8000)	// | side: the neighbor is in the next tile that way
+
+#define PS_NAV_CELL_SIZE			(8.0)
+#define PS_NAV_CELL_HEIGHT			(4.0)
+#define PS_NAV_TILE_CELLS			(64)
+#define PS_NAV_AGENT_HEIGHT			(56.0)	// The player's hull
+#define PS_NAV_AGENT_RADIUS			(16.0)
+#define PS_NAV_AGENT_CLIMB			(18.0)	// Quake's step height
+#define PS_NAV_MIN_FLOOR_Z			(0.7)	// Steepest walkable normal, as in Quake
+#define PS_NAV_MAX_EDGE_ERROR		(1.3)	// Cells between a contour and its wall
+#define PS_NAV_MIN_REGION_CELLS		(16)	// Smaller regions are dropped, unless at a tile's side
+
+/*
+* Sides of a tile and directions on the grid.
+*/
+enum NavMeshSide
+{
+	NAVMESH_SIDE_MIN_X,
+	NAVMESH_SIDE_MAX_Y,
+	NAVMESH_SIDE_MAX_X,
+	NAVMESH_SIDE_MIN_Y
+};
+
+struct NavMeshHeader
+{
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	tileCount;
+	uint32_t	tileCells;		// Cells along a tile's side
+	float		origin[3];		// Corner of tile 0, 0 and height 0
+	float		cellSize;
+	float		cellHeight;
+	float		agentHeight;
+	float		agentRadius;
+	float		agentClimb;
+	uint32_t	tilesX;
+	uint32_t	tilesY;
+	uint32_t	maxPolyVertices;
+	uint32_t	reserved;
+};
+
+struct NavMeshTileHeader
+{
+	int32_t		x;
+	int32_t		y;
+	uint32_t	vertexCount;
+	uint32_t	polyCount;
+	uint64_t	offset;			// Of the vertices, from the start of the file
+	uint64_t	size;			// Vertices, padding and polygons
+};
+
+/*
+* x, y: cells from the tile's corner, 0 .. tileCells. h: cell heights above
+* the origin.
+*/
+struct NavMeshVertex
+{
+	uint16_t	x;
+	uint16_t	h;
+	uint16_t	y;
+};
+
+/*
+* Convex, counter-clockwise seen from above. neighbors[ i ] is across the edge
+* from vertices[ i ] to the next one: a polygon of the tile,
+* NAVMESH_NO_NEIGHBOR for walls, NAVMESH_PORTAL | side at the tile's sides.
+*/
+struct NavMeshPoly
+{
+	uint16_t	vertices[NAVMESH_MAX_POLY_VERTICES];
+	uint16_t	neighbors[NAVMESH_MAX_POLY_VERTICES];
+	uint8_t		vertexCount;
+	uint8_t		area;
+	uint16_t	region;			// Of the tile, polygons of one region came from one contour
+};
+
+struct NavMeshTile
+{
+	int32_t						x;
+	int32_t						y;
+	std::vector<NavMeshVertex>	vertices;
+	std::vector<NavMeshPoly>	polys;
+};
+
+struct NavMesh
+{
+	glm::f64vec3				origin;
+	uint32_t					tilesX;
+	uint32_t					tilesY;
+	std::vector<NavMeshTile>	tiles;	// Only the ones with polygons, sorted by y, then x
+};
+
+/*
+* tris: the triangulated polysoup, materials: the names its materials refer to.
+* threadCount 0 = all hardware threads, the result does not depend on it.
+*/
+NavMesh		buildNavMesh(const std::vector<Polygon>& tris, const std::vector<std::string>& materials,
+				unsigned int threadCount = 1);
+bool		writeNavMesh(const char* fileName, const NavMesh& navMesh);
+
+
+
+/*
+*
+* IMPLEMENTATION
+*
+*/
+
+
+
+#if defined(NAVMESH_IMPLEMENTATION)
+
+#include <algorithm>
+#include <unordered_map>
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "parallel.h"
+
+#define NAV_MAX_HEIGHT		(0xFFFF)
+#define NAV_NOT_CONNECTED	(-1)
+#define NAV_BORDER_REGION	(0x8000)
+#define NAV_NULL_NEIGHBOR	(0xFFFF)
+#define NAV_CAN_REMOVE		(0x80000000)
+#define NAV_INDEX_MASK		(0x0FFFFFFF)
+
+static const int navDirX[4] = { -1, 0, 1, 0 };
+static const int navDirY[4] = { 0, 1, 0, -1 };
+
+struct NavSpan
+{
+	int			min;
+	int			max;
+	uint8_t		area;
+};
+
+/*
+* Columns of solid spans, sorted bottom up and apart from each other.
+*/
+struct NavHeightfield
+{
+	int									width;
+	int									height;
+	glm::f64vec3						min;	// Corner of column 0, 0 and height 0
+	std::vector<std::vector<NavSpan>>	columns;
+};
+
+/*
+* The open space above the walkable spans: y is the floor, h the room above it.
+*/
+struct NavCompactSpan
+{
+	int			y;
+	int			h;
+	int			con[4];		// Index of the span the agent gets to that way
+	uint16_t	region;
+	uint16_t	dist;
+	uint8_t		area;
+};
+
+struct NavCompactCell
+{
+	uint32_t	index;
+	uint32_t	count;
+};
+
+struct NavCompactField
+{
+	int							width;
+	int							height;
+	std::vector<NavCompactCell>	cells;
+	std::vector<NavCompactSpan>	spans;
+};
+
+/*
+* Contour vertices: x, height, y on the grid and the region across the edge
+* that starts at them (0: a wall).
+*/
+struct NavContour
+{
+	std::vector<int>	vertices;	// 4 ints each
+	uint16_t			region;
+};
+
+struct NavBuildParams
+{
+	int		walkableHeight;		// Cells
+	int		walkableClimb;
+	int		walkableRadius;
+	int		borderSize;
+	int		tileCells;
+	double	cellSize;
+	double	cellHeight;
+};
+
+static NavBuildParams getNavBuildParams()
+{
+	NavBuildParams params;
+	params.cellSize = PS_NAV_CELL_SIZE;
+	params.cellHeight = PS_NAV_CELL_HEIGHT;
+	params.walkableHeight = (int)ceil(PS_NAV_AGENT_HEIGHT / PS_NAV_CELL_HEIGHT);
+	params.walkableClimb = (int)floor(PS_NAV_AGENT_CLIMB / PS_NAV_CELL_HEIGHT);
+	params.walkableRadius = (int)ceil(PS_NAV_AGENT_RADIUS / PS_NAV_CELL_SIZE);
+	params.borderSize = params.walkableRadius + 3;
+	params.tileCells = PS_NAV_TILE_CELLS;
+
+	return params;
+}
+
+/*
+* Splits in at axis = x into the parts below and above it.
+*/
+static void divideNavPoly(const std::vector<glm::f64vec3>& in, std::vector<glm::f64vec3>* below,
+	std::vector<glm::f64vec3>* above, double x, int axis)
+{
+	below->clear();
+	above->clear();
+	for (size_t i = 0, j = in.size() - 1; i < in.size(); j = i, i++) {
+		double di = x - in[i][axis];
+		double dj = x - in[j][axis];
+		if ((dj >= 0.0) != (di >= 0.0)) {
+			glm::f64vec3 v = in[j] + (in[i] - in[j]) * (dj / (dj - di));
+			below->push_back(v);
+			above->push_back(v);
+			if (di > 0.0) {
+				below->push_back(in[i]);
+			}
+			else if (di < 0.0) {
+				above->push_back(in[i]);
+			}
+		}
+		else {
+			if (di >= 0.0) {
+				below->push_back(in[i]);
+				if (di != 0.0) {
+					continue;
+				}
+			}
+			above->push_back(in[i]);
+		}
+	}
+}
+
+/*
+* Merges the new span with the ones it overlaps. The walkable flag survives
+* if the tops are within a step of each other.
+*/
+static void addNavSpan(NavHeightfield* hf, int x, int y, NavSpan span, int mergeThreshold)
+{
+	std::vector<NavSpan>& column = hf->columns[x + y * hf->width];
+	auto s = column.begin();
+	while (s != column.end()) {
+		if (s->min > span.max) {
+			break;
+		}
+		if (s->max < span.min) {
+			s++;
+			continue;
+		}
+		span.min = std::min(span.min, s->min);
+		span.max = std::max(span.max, s->max);
+		if (abs(span.max - s->max) <= mergeThreshold) {
+			span.area = std::max(span.area, s->area);
+		}
+		s = column.erase(s);
+	}
+	column.insert(s, span);
+}
+
+static void rasterizeNavTriangle(NavHeightfield* hf, const NavBuildParams& params, const Polygon& tri, uint8_t area,
+	std::vector<glm::f64vec3> polys[4])
+{
+	const double cs = params.cellSize;
+	glm::f64vec3 triMin(DBL_MAX), triMax(-DBL_MAX);
+	for (auto v = tri.vertices.begin(); v != tri.vertices.end(); v++) {
+		triMin = glm::min(triMin, *v);
+		triMax = glm::max(triMax, *v);
+	}
+	if (triMax.x < hf->min.x || triMin.x > hf->min.x + hf->width * cs
+		|| triMax.y < hf->min.y || triMin.y > hf->min.y + hf->height * cs) {
+		return;
+	}
+
+	std::vector<glm::f64vec3>& in = polys[0];
+	std::vector<glm::f64vec3>& row = polys[1];
+	std::vector<glm::f64vec3>& cell = polys[2];
+	std::vector<glm::f64vec3>& rest = polys[3];
+	in = tri.vertices;
+	int y0 = std::clamp((int)floor((triMin.y - hf->min.y) / cs), -1, hf->height - 1);
+	int y1 = std::clamp((int)floor((triMax.y - hf->min.y) / cs), 0, hf->height - 1);
+	for (int y = y0; y <= y1; y++) {
+		divideNavPoly(in, &row, &rest, hf->min.y + (y + 1) * cs, 1);
+		in.swap(rest);
+		if (row.size() < 3 || y < 0) {
+			continue;
+		}
+
+		double rowMinX = row[0].x, rowMaxX = row[0].x;
+		for (auto v = row.begin(); v != row.end(); v++) {
+			rowMinX = std::min(rowMinX, v->x);
+			rowMaxX = std::max(rowMaxX, v->x);
+		}
+		int x0 = std::clamp((int)floor((rowMinX - hf->min.x) / cs), -1, hf->width - 1);
+		int x1 = std::clamp((int)floor((rowMaxX - hf->min.x) / cs), 0, hf->width - 1);
+		for (int x = x0; x <= x1; x++) {
+			divideNavPoly(row, &cell, &rest, hf->min.x + (x + 1) * cs, 0);
+			row.swap(rest);
+			if (cell.size() < 3 || x < 0) {
+				continue;
+			}
+
+			double min = cell[0].z, max = cell[0].z;
+			for (auto v = cell.begin(); v != cell.end(); v++) {
+				min = std::min(min, v->z);
+				max = std::max(max, v->z);
+			}
+			min -= hf->min.z;
+			max -= hf->min.z;
+			if (max < 0.0) {
+				continue;
+			}
+			NavSpan span;
+			span.min = std::clamp((int)floor(std::max(min, 0.0) / params.cellHeight), 0, NAV_MAX_HEIGHT);
+			span.max = std::clamp((int)ceil(max / params.cellHeight), span.min + 1, NAV_MAX_HEIGHT);
+			span.area = area;
+			addNavSpan(hf, x, y, span, params.walkableClimb);
+		}
+	}
+}
+
+/*
+* Low obstacles the agent steps onto, ledges it would fall off and spans it
+* does not fit on.
+*/
+static void filterNavSpans(NavHeightfield* hf, const NavBuildParams& params)
+{
+	const int climb = params.walkableClimb;
+	for (auto c = hf->columns.begin(); c != hf->columns.end(); c++) {
+		bool isPreviousWalkable = false;
+		uint8_t previousArea = 0;
+		int previousMax = 0;
+		for (auto s = c->begin(); s != c->end(); s++) {
+			bool isWalkable = s->area != 0;
+			if (!isWalkable && isPreviousWalkable && abs(s->max - previousMax) <= climb) {
+				s->area = previousArea;
+			}
+			isPreviousWalkable = isWalkable; // Only one obstacle high, it must not creep up a wall
+			previousArea = s->area;
+			previousMax = s->max;
+		}
+	}
+
+	std::vector<uint8_t> ledges;
+	for (int y = 0; y < hf->height; y++) {
+		for (int x = 0; x < hf->width; x++) {
+			const std::vector<NavSpan>& column = hf->columns[x + y * hf->width];
+			for (size_t i = 0; i < column.size(); i++) {
+				if (!column[i].area) {
+					continue;
+				}
+				int bottom = column[i].max;
+				int top = i + 1 < column.size() ? column[i + 1].min : NAV_MAX_HEIGHT;
+				int minDrop = NAV_MAX_HEIGHT;
+				int accessibleMin = bottom, accessibleMax = bottom;
+				for (int dir = 0; dir < 4; dir++) {
+					int nx = x + navDirX[dir], ny = y + navDirY[dir];
+					if (nx < 0 || ny < 0 || nx >= hf->width || ny >= hf->height) {
+						minDrop = std::min(minDrop, -climb - bottom);
+						continue;
+					}
+					const std::vector<NavSpan>& neighbors = hf->columns[nx + ny * hf->width];
+					int neighborBottom = -climb;
+					int neighborTop = neighbors.empty() ? NAV_MAX_HEIGHT : neighbors[0].min;
+					if (std::min(top, neighborTop) - std::max(bottom, neighborBottom) > params.walkableHeight) {
+						minDrop = std::min(minDrop, neighborBottom - bottom);
+					}
+					for (size_t n = 0; n < neighbors.size(); n++) {
+						neighborBottom = neighbors[n].max;
+						neighborTop = n + 1 < neighbors.size() ? neighbors[n + 1].min : NAV_MAX_HEIGHT;
+						if (std::min(top, neighborTop) - std::max(bottom, neighborBottom) > params.walkableHeight) {
+							minDrop = std::min(minDrop, neighborBottom - bottom);
+							if (abs(neighborBottom - bottom) <= climb) {
+								accessibleMin = std::min(accessibleMin, neighborBottom);
+								accessibleMax = std::max(accessibleMax, neighborBottom);
+							}
+						}
+					}
+				}
+				bool isLedge = minDrop < -climb || accessibleMax - accessibleMin > climb;
+				bool isLow = top - bottom < params.walkableHeight;
+				if (isLedge || isLow) {
+					ledges.push_back(1);
+				}
+				else {
+					ledges.push_back(0);
+				}
+			}
+		}
+	}
+
+	// The flags change after all spans were looked at, a ledge does not make its neighbor one.
+	size_t l = 0;
+	for (auto c = hf->columns.begin(); c != hf->columns.end(); c++) {
+		for (auto s = c->begin(); s != c->end(); s++) {
+			if (s->area && ledges[l++]) {
+				s->area = 0;
+			}
+		}
+	}
+}
+
+static NavCompactField buildNavCompactField(const NavHeightfield& hf, const NavBuildParams& params)
+{
+	NavCompactField chf;
+	chf.width = hf.width;
+	chf.height = hf.height;
+	chf.cells.resize(hf.columns.size());
+	for (size_t c = 0; c < hf.columns.size(); c++) {
+		const std::vector<NavSpan>& column = hf.columns[c];
+		chf.cells[c].index = (uint32_t)chf.spans.size();
+		for (size_t i = 0; i < column.size(); i++) {
+			if (!column[i].area) {
+				continue;
+			}
+			NavCompactSpan span = { };
+			span.y = column[i].max;
+			span.h = std::min((i + 1 < column.size() ? column[i + 1].min : NAV_MAX_HEIGHT) - span.y, NAV_MAX_HEIGHT);
+			span.area = column[i].area;
+			for (int dir = 0; dir < 4; dir++) {
+				span.con[dir] = NAV_NOT_CONNECTED;
+			}
+			chf.spans.push_back(span);
+		}
+		chf.cells[c].count = (uint32_t)chf.spans.size() - chf.cells[c].index;
+	}
+
+	for (int y = 0; y < chf.height; y++) {
+		for (int x = 0; x < chf.width; x++) {
+			const NavCompactCell& cell = chf.cells[x + y * chf.width];
+			for (uint32_t i = cell.index; i < cell.index + cell.count; i++) {
+				NavCompactSpan& span = chf.spans[i];
+				for (int dir = 0; dir < 4; dir++) {
+					int nx = x + navDirX[dir], ny = y + navDirY[dir];
+					if (nx < 0 || ny < 0 || nx >= chf.width || ny >= chf.height) {
+						continue;
+					}
+					const NavCompactCell& neighborCell = chf.cells[nx + ny * chf.width];
+					for (uint32_t n = neighborCell.index; n < neighborCell.index + neighborCell.count; n++) {
+						const NavCompactSpan& neighbor = chf.spans[n];
+						int bottom = std::max(span.y, neighbor.y);
+						int top = std::min(span.y + span.h, neighbor.y + neighbor.h);
+						if (top - bottom >= params.walkableHeight && abs(neighbor.y - span.y) <= params.walkableClimb) {
+							span.con[dir] = (int)n;
+							break;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	return chf;
+}
+
+/*
+* Chamfer distance to the nearest edge of the walkable area, 2 per cell
+* straight, 3 diagonally. Spans closer than the agent's radius are dropped.
+*/
+static void erodeNavArea(NavCompactField* chf, int radius)
+{
+	std::vector<NavCompactSpan>& spans = chf->spans;
+	for (auto s = spans.begin(); s != spans.end(); s++) {
+		int connected = 0;
+		for (int dir = 0; dir < 4; dir++) {
+			connected += s->con[dir] != NAV_NOT_CONNECTED && spans[s->con[dir]].area;
+		}
+		s->dist = connected == 4 ? 0xFFFF : 0;
+	}
+
+	auto relax = [&](NavCompactSpan& s, int dir, int diagonalDir) {
+		if (s.con[dir] == NAV_NOT_CONNECTED) {
+			return;
+		}
+		const NavCompactSpan& a = spans[s.con[dir]];
+		s.dist = std::min<int>(s.dist, a.dist + 2);
+		if (a.con[diagonalDir] != NAV_NOT_CONNECTED) {
+			s.dist = std::min<int>(s.dist, spans[a.con[diagonalDir]].dist + 3);
+		}
+	};
+	for (int y = 0; y < chf->height; y++) {
+		for (int x = 0; x < chf->width; x++) {
+			const NavCompactCell& cell = chf->cells[x + y * chf->width];
+			for (uint32_t i = cell.index; i < cell.index + cell.count; i++) {
+				relax(spans[i], NAVMESH_SIDE_MIN_X, NAVMESH_SIDE_MIN_Y);
+				relax(spans[i], NAVMESH_SIDE_MIN_Y, NAVMESH_SIDE_MAX_X);
+			}
+		}
+	}
+	for (int y = chf->height - 1; y >= 0; y--) {
+		for (int x = chf->width - 1; x >= 0; x--) {
+			const NavCompactCell& cell = chf->cells[x + y * chf->width];
+			for (uint32_t i = cell.index; i < cell.index + cell.count; i++) {
+				relax(spans[i], NAVMESH_SIDE_MAX_X, NAVMESH_SIDE_MAX_Y);
+				relax(spans[i], NAVMESH_SIDE_MAX_Y, NAVMESH_SIDE_MIN_X);
+			}
+		}
+	}
+
+	for (auto s = spans.begin(); s != spans.end(); s++) {
+		if (s->dist < radius * 2) {
+			s->area = 0;
+		}
+	}
+}
+
+/*
+* The border cells belong to four border regions, they only give the
+* contours their corners on the tile's sides. Inside, every row of spans is
+* cut into sweeps at walls; a sweep continues the region of the row before if
+* it is the only sweep that touches that region and touches nothing else.
+*/
+static void buildNavRegions(NavCompactField* chf, const NavBuildParams& params)
+{
+	const int w = chf->width, h = chf->height, border = params.borderSize;
+	std::vector<NavCompactSpan>& spans = chf->spans;
+	uint16_t regionId = 1;
+
+	auto paintRect = [&](int minX, int maxX, int minY, int maxY) {
+		for (int y = minY; y < maxY; y++) {
+			for (int x = minX; x < maxX; x++) {
+				const NavCompactCell& cell = chf->cells[x + y * w];
+				for (uint32_t i = cell.index; i < cell.index + cell.count; i++) {
+					if (spans[i].area) {
+						spans[i].region = regionId | NAV_BORDER_REGION;
+					}
+				}
+			}
+		}
+		regionId++;
+	};
+	paintRect(0, border, 0, h);
+	paintRect(w - border, w, 0, h);
+	paintRect(0, w, 0, border);
+	paintRect(0, w, h - border, h);
+
+	struct Sweep
+	{
+		uint16_t	id;
+		uint16_t	neighbor;
+		uint32_t	neighborSpans;
+	};
+	std::vector<Sweep> sweeps;
+	std::vector<uint32_t> previousCounts;
+	for (int y = border; y < h - border; y++) {
+		sweeps.assign(1, { 0, 0, 0 });
+		previousCounts.assign(regionId + 1, 0);
+		for (int x = border; x < w - border; x++) {
+			const NavCompactCell& cell = chf->cells[x + y * w];
+			for (uint32_t i = cell.index; i < cell.index + cell.count; i++) {
+				NavCompactSpan& span = spans[i];
+				if (!span.area) {
+					continue;
+				}
+
+				uint16_t sweep = 0;
+				int left = span.con[NAVMESH_SIDE_MIN_X];
+				if (left != NAV_NOT_CONNECTED && spans[left].area && spans[left].region
+					&& !(spans[left].region & NAV_BORDER_REGION)) {
+					sweep = spans[left].region;
+				}
+				if (!sweep) {
+					sweep = (uint16_t)sweeps.size();
+					sweeps.push_back({ 0, 0, 0 });
+				}
+				span.region = sweep;
+
+				int below = span.con[NAVMESH_SIDE_MIN_Y];
+				if (below != NAV_NOT_CONNECTED && spans[below].area && spans[below].region
+					&& !(spans[below].region & NAV_BORDER_REGION)) {
+					uint16_t region = spans[below].region;
+					Sweep& s = sweeps[sweep];
+					if (!s.neighbor || s.neighbor == region) {
+						s.neighbor = region;
+						s.neighborSpans++;
+						previousCounts[region]++;
+					}
+					else {
+						s.neighbor = NAV_NULL_NEIGHBOR;
+					}
+				}
+			}
+		}
+
+		for (size_t s = 1; s < sweeps.size(); s++) {
+			Sweep& sweep = sweeps[s];
+			if (sweep.neighbor && sweep.neighbor != NAV_NULL_NEIGHBOR && previousCounts[sweep.neighbor] == sweep.neighborSpans) {
+				sweep.id = sweep.neighbor;
+			}
+			else {
+				sweep.id = regionId++;
+				previousCounts.push_back(0);
+			}
+		}
+		for (int x = border; x < w - border; x++) {
+			const NavCompactCell& cell = chf->cells[x + y * w];
+			for (uint32_t i = cell.index; i < cell.index + cell.count; i++) {
+				if (spans[i].area && spans[i].region) {
+					spans[i].region = sweeps[spans[i].region].id;
+				}
+			}
+		}
+	}
+
+	// Specks in the middle of a tile are not worth polygons.
+	std::vector<uint32_t> regionSpans(regionId, 0);
+	std::vector<uint8_t> isAtBorder(regionId, 0);
+	for (auto s = spans.begin(); s != spans.end(); s++) {
+		if (!s->area || !s->region || (s->region & NAV_BORDER_REGION)) {
+			continue;
+		}
+		regionSpans[s->region]++;
+		for (int dir = 0; dir < 4; dir++) {
+			if (s->con[dir] != NAV_NOT_CONNECTED && (spans[s->con[dir]].region & NAV_BORDER_REGION)) {
+				isAtBorder[s->region] = 1;
+			}
+		}
+	}
+	for (auto s = spans.begin(); s != spans.end(); s++) {
+		if (s->region && !(s->region & NAV_BORDER_REGION)
+			&& regionSpans[s->region] < PS_NAV_MIN_REGION_CELLS && !isAtBorder[s->region]) {
+			s->region = 0;
+		}
+	}
+}
+
+/*
+* Height of the corner after the edge dir of span i: the highest floor
+* around it, so the contour does not cut into steps.
+*/
+static int getNavCornerHeight(const NavCompactField& chf, uint32_t i, int dir)
+{
+	const NavCompactSpan& span = chf.spans[i];
+	int height = span.y;
+	int nextDir = (dir + 1) & 3;
+	if (span.con[dir] != NAV_NOT_CONNECTED) {
+		const NavCompactSpan& a = chf.spans[span.con[dir]];
+		height = std::max(height, a.y);
+		if (a.con[nextDir] != NAV_NOT_CONNECTED) {
+			height = std::max(height, chf.spans[a.con[nextDir]].y);
+		}
+	}
+	if (span.con[nextDir] != NAV_NOT_CONNECTED) {
+		const NavCompactSpan& a = chf.spans[span.con[nextDir]];
+		height = std::max(height, a.y);
+		if (a.con[dir] != NAV_NOT_CONNECTED) {
+			height = std::max(height, chf.spans[a.con[dir]].y);
+		}
+	}
+
+	return height;
+}
+
+/*
+* Follows the region's outline from span i: turns right at every edge to
+* another region, steps over to the neighbor and turns left otherwise.
+*/
+static void walkNavContour(const NavCompactField& chf, int x, int y, uint32_t i, std::vector<uint8_t>* flags,
+	std::vector<int>* points)
+{
+	int dir = 0;
+	while (!((*flags)[i] & (1 << dir))) {
+		dir++;
+	}
+	const int startDir = dir;
+	const uint32_t startSpan = i;
+
+	for (int iteration = 0; iteration < 40000; iteration++) {
+		const NavCompactSpan& span = chf.spans[i];
+		if ((*flags)[i] & (1 << dir)) {
+			int px = x, pz = y;
+			int py = getNavCornerHeight(chf, i, dir);
+			switch (dir) {
+			case 0: pz++; break;
+			case 1: px++; pz++; break;
+			case 2: px++; break;
+			}
+			int region = span.con[dir] != NAV_NOT_CONNECTED ? chf.spans[span.con[dir]].region : 0;
+			points->insert(points->end(), { px, py, pz, region });
+			(*flags)[i] &= ~(1 << dir);
+			dir = (dir + 1) & 3;
+		}
+		else {
+			if (span.con[dir] == NAV_NOT_CONNECTED) {
+				return; // The flags say there is a neighbor of the same region
+			}
+			x += navDirX[dir];
+			y += navDirY[dir];
+			i = (uint32_t)span.con[dir];
+			dir = (dir + 3) & 3;
+		}
+		if (i == startSpan && dir == startDir) {
+			break;
+		}
+	}
+}
+
+static double getNavPointSegmentDistance(int x, int z, int px, int pz, int qx, int qz)
+{
+	double pqx = qx - px, pqz = qz - pz;
+	double dx = x - px, dz = z - pz;
+	double d = pqx * pqx + pqz * pqz;
+	double t = pqx * dx + pqz * dz;
+	if (d > 0.0) {
+		t /= d;
+	}
+	t = std::clamp(t, 0.0, 1.0);
+	dx = px + t * pqx - x;
+	dz = pz + t * pqz - z;
+
+	return dx * dx + dz * dz;
+}
+
+/*
+* Keeps the corners where the region on the other side changes, then adds
+* the raw point furthest from each wall segment until all are within
+* maxError. Walls are walked in the same direction from both sides, so the
+* result does not depend on which region gets outlined.
+*/
+static void simplifyNavContour(const std::vector<int>& points, double maxError, std::vector<int>* simplified)
+{
+	const int pointCount = (int)points.size() / 4;
+	simplified->clear();
+	for (int i = 0; i < pointCount; i++) {
+		int next = (i + 1) % pointCount;
+		if (points[i * 4 + 3] != points[next * 4 + 3]) {
+			simplified->insert(simplified->end(), { points[i * 4], points[i * 4 + 1], points[i * 4 + 2], i });
+		}
+	}
+	if (simplified->empty()) {
+		// No neighbors at all: start with the lower left and upper right corners.
+		int lower = 0, upper = 0;
+		for (int i = 1; i < pointCount; i++) {
+			const int* p = &points[i * 4];
+			const int* l = &points[lower * 4];
+			const int* u = &points[upper * 4];
+			if (p[0] < l[0] || (p[0] == l[0] && p[2] < l[2])) {
+				lower = i;
+			}
+			if (p[0] > u[0] || (p[0] == u[0] && p[2] > u[2])) {
+				upper = i;
+			}
+		}
+		simplified->insert(simplified->end(), { points[lower * 4], points[lower * 4 + 1], points[lower * 4 + 2], lower });
+		simplified->insert(simplified->end(), { points[upper * 4], points[upper * 4 + 1], points[upper * 4 + 2], upper });
+	}
+
+	for (size_t i = 0; i < simplified->size() / 4; ) {
+		size_t next = (i + 1) % (simplified->size() / 4);
+		int ax = (*simplified)[i * 4], az = (*simplified)[i * 4 + 2], ai = (*simplified)[i * 4 + 3];
+		int bx = (*simplified)[next * 4], bz = (*simplified)[next * 4 + 2], bi = (*simplified)[next * 4 + 3];
+
+		int step, ci, endi;
+		if (bx > ax || (bx == ax && bz > az)) {
+			step = 1;
+			ci = (ai + step) % pointCount;
+			endi = bi;
+		}
+		else {
+			step = pointCount - 1;
+			ci = (bi + step) % pointCount;
+			endi = ai;
+			std::swap(ax, bx);
+			std::swap(az, bz);
+		}
+
+		double maxDistance = 0.0;
+		int maxi = -1;
+		if (points[ci * 4 + 3] == 0) {
+			// Only walls get more points, edges to other regions stay straight.
+			for (; ci != endi; ci = (ci + step) % pointCount) {
+				double d = getNavPointSegmentDistance(points[ci * 4], points[ci * 4 + 2], ax, az, bx, bz);
+				if (d > maxDistance) {
+					maxDistance = d;
+					maxi = ci;
+				}
+			}
+		}
+		if (maxi != -1 && maxDistance > maxError * maxError) {
+			simplified->insert(simplified->begin() + (i + 1) * 4,
+				{ points[maxi * 4], points[maxi * 4 + 1], points[maxi * 4 + 2], maxi });
+		}
+		else {
+			i++;
+		}
+	}
+
+	// The region across the edge that starts at each vertex.
+	for (size_t i = 0; i < simplified->size() / 4; i++) {
+		int raw = ((*simplified)[i * 4 + 3] + 1) % pointCount;
+		(*simplified)[i * 4 + 3] = points[raw * 4 + 3];
+	}
+
+	for (size_t i = 0; simplified->size() / 4 > 0 && i < simplified->size() / 4; ) {
+		size_t next = (i + 1) % (simplified->size() / 4);
+		if ((*simplified)[i * 4] == (*simplified)[next * 4] && (*simplified)[i * 4 + 2] == (*simplified)[next * 4 + 2]) {
+			simplified->erase(simplified->begin() + next * 4, simplified->begin() + next * 4 + 4);
+		}
+		else {
+			i++;
+		}
+	}
+}
+
+static void buildNavContours(const NavCompactField& chf, const NavBuildParams& params, std::vector<NavContour>* contours)
+{
+	const int w = chf.width, h = chf.height;
+	std::vector<uint8_t> flags(chf.spans.size(), 0);
+	for (int y = 0; y < h; y++) {
+		for (int x = 0; x < w; x++) {
+			const NavCompactCell& cell = chf.cells[x + y * w];
+			for (uint32_t i = cell.index; i < cell.index + cell.count; i++) {
+				const NavCompactSpan& span = chf.spans[i];
+				if (!span.area || !span.region || (span.region & NAV_BORDER_REGION)) {
+					continue;
+				}
+				uint8_t connected = 0;
+				for (int dir = 0; dir < 4; dir++) {
+					if (span.con[dir] != NAV_NOT_CONNECTED && chf.spans[span.con[dir]].region == span.region) {
+						connected |= 1 << dir;
+					}
+				}
+				flags[i] = connected ^ 0xF;
+			}
+		}
+	}
+
+	std::vector<int> points, simplified;
+	for (int y = 0; y < h; y++) {
+		for (int x = 0; x < w; x++) {
+			const NavCompactCell& cell = chf.cells[x + y * w];
+			for (uint32_t i = cell.index; i < cell.index + cell.count; i++) {
+				if (flags[i] == 0 || flags[i] == 0xF) {
+					flags[i] = 0; // Inner, or a single span that cannot be outlined
+					continue;
+				}
+				points.clear();
+				walkNavContour(chf, x, y, i, &flags, &points);
+				if (points.size() < 12) {
+					continue;
+				}
+				simplifyNavContour(points, PS_NAV_MAX_EDGE_ERROR, &simplified);
+				if (simplified.size() < 12) {
+					continue;
+				}
+
+				NavContour contour;
+				contour.region = chf.spans[i].region;
+				contour.vertices = simplified;
+				for (size_t v = 0; v < contour.vertices.size(); v += 4) {
+					contour.vertices[v] -= params.borderSize;
+					contour.vertices[v + 2] -= params.borderSize;
+				}
+				contours->push_back(std::move(contour));
+			}
+		}
+	}
+}
+
+/*
+* Ear clipping on the grid, as in Recast. area2 < 0: c is left of a -> b in
+* the contours' winding.
+*/
+static inline int navPrev(int i, int n) { return i - 1 >= 0 ? i - 1 : n - 1; }
+static inline int navNext(int i, int n) { return i + 1 < n ? i + 1 : 0; }
+
+static inline int navArea2(const int* a, const int* b, const int* c)
+{
+	return (b[0] - a[0]) * (c[2] - a[2]) - (c[0] - a[0]) * (b[2] - a[2]);
+}
+
+static inline bool navLeft(const int* a, const int* b, const int* c) { return navArea2(a, b, c) < 0; }
+static inline bool navLeftOn(const int* a, const int* b, const int* c) { return navArea2(a, b, c) <= 0; }
+static inline bool navCollinear(const int* a, const int* b, const int* c) { return navArea2(a, b, c) == 0; }
+static inline bool navEqual(const int* a, const int* b) { return a[0] == b[0] && a[2] == b[2]; }
+
+static bool navIntersectProp(const int* a, const int* b, const int* c, const int* d)
+{
+	if (navCollinear(a, b, c) || navCollinear(a, b, d) || navCollinear(c, d, a) || navCollinear(c, d, b)) {
+		return false;
+	}
+
+	return (navLeft(a, b, c) != navLeft(a, b, d)) && (navLeft(c, d, a) != navLeft(c, d, b));
+}
+
+static bool navBetween(const int* a, const int* b, const int* c)
+{
+	if (!navCollinear(a, b, c)) {
+		return false;
+	}
+	if (a[0] != b[0]) {
+		return (a[0] <= c[0] && c[0] <= b[0]) || (a[0] >= c[0] && c[0] >= b[0]);
+	}
+
+	return (a[2] <= c[2] && c[2] <= b[2]) || (a[2] >= c[2] && c[2] >= b[2]);
+}
+
+static bool navIntersect(const int* a, const int* b, const int* c, const int* d)
+{
+	return navIntersectProp(a, b, c, d)
+		|| navBetween(a, b, c) || navBetween(a, b, d) || navBetween(c, d, a) || navBetween(c, d, b);
+}
+
+static const int* getNavVertex(const int* vertices, const int* indices, int i)
+{
+	return &vertices[(indices[i] & NAV_INDEX_MASK) * 4];
+}
+
+/*
+* i -> j crosses no edge of the polygon.
+*/
+static bool isNavDiagonalInside(int i, int j, int n, const int* vertices, const int* indices)
+{
+	const int* d0 = getNavVertex(vertices, indices, i);
+	const int* d1 = getNavVertex(vertices, indices, j);
+	for (int k = 0; k < n; k++) {
+		int k1 = navNext(k, n);
+		if (k == i || k1 == i || k == j || k1 == j) {
+			continue;
+		}
+		const int* p0 = getNavVertex(vertices, indices, k);
+		const int* p1 = getNavVertex(vertices, indices, k1);
+		if (navEqual(d0, p0) || navEqual(d1, p0) || navEqual(d0, p1) || navEqual(d1, p1)) {
+			continue;
+		}
+		if (navIntersect(d0, d1, p0, p1)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+* i -> j starts into the polygon at i.
+*/
+static bool isNavDiagonalInCone(int i, int j, int n, const int* vertices, const int* indices)
+{
+	const int* pi = getNavVertex(vertices, indices, i);
+	const int* pj = getNavVertex(vertices, indices, j);
+	const int* next = getNavVertex(vertices, indices, navNext(i, n));
+	const int* prev = getNavVertex(vertices, indices, navPrev(i, n));
+	if (navLeftOn(prev, pi, next)) {
+		return navLeft(pi, pj, prev) && navLeft(pj, pi, next);
+	}
+
+	return !(navLeftOn(pi, pj, next) && navLeftOn(pj, pi, prev));
+}
+
+static bool isNavDiagonal(int i, int j, int n, const int* vertices, const int* indices)
+{
+	return isNavDiagonalInCone(i, j, n, vertices, indices) && isNavDiagonalInside(i, j, n, vertices, indices);
+}
+
+/*
+* Cuts off the ear with the shortest diagonal until a triangle is left.
+* Returns the triangle count, negative if the contour could not be finished.
+*/
+static int triangulateNavContour(int n, const int* vertices, std::vector<int>* indexBuffer, std::vector<int>* tris)
+{
+	std::vector<int>& indices = *indexBuffer;
+	indices.resize(n);
+	for (int i = 0; i < n; i++) {
+		indices[i] = i;
+	}
+	for (int i = 0; i < n; i++) {
+		int i2 = navNext(navNext(i, n), n);
+		if (isNavDiagonal(i, i2, n, vertices, indices.data())) {
+			indices[navNext(i, n)] |= NAV_CAN_REMOVE;
+		}
+	}
+
+	tris->clear();
+	while (n > 3) {
+		int minLength = -1, mini = -1;
+		for (int i = 0; i < n; i++) {
+			int i1 = navNext(i, n);
+			if (indices[i1] & NAV_CAN_REMOVE) {
+				const int* p0 = getNavVertex(vertices, indices.data(), i);
+				const int* p2 = getNavVertex(vertices, indices.data(), navNext(i1, n));
+				int dx = p2[0] - p0[0], dz = p2[2] - p0[2];
+				int length = dx * dx + dz * dz;
+				if (minLength < 0 || length < minLength) {
+					minLength = length;
+					mini = i;
+				}
+			}
+		}
+		if (mini == -1) {
+			return -(int)(tris->size() / 3);
+		}
+
+		int i = mini;
+		int i1 = navNext(i, n);
+		int i2 = navNext(i1, n);
+		tris->insert(tris->end(), { indices[i] & NAV_INDEX_MASK, indices[i1] & NAV_INDEX_MASK, indices[i2] & NAV_INDEX_MASK });
+
+		n--;
+		for (int k = i1; k < n; k++) {
+			indices[k] = indices[k + 1];
+		}
+		if (i1 >= n) {
+			i1 = 0;
+		}
+		i = navPrev(i1, n);
+		if (isNavDiagonal(navPrev(i, n), i1, n, vertices, indices.data())) {
+			indices[i] |= NAV_CAN_REMOVE;
+		}
+		else {
+			indices[i] &= NAV_INDEX_MASK;
+		}
+		if (isNavDiagonal(i, navNext(i1, n), n, vertices, indices.data())) {
+			indices[i1] |= NAV_CAN_REMOVE;
+		}
+		else {
+			indices[i1] &= NAV_INDEX_MASK;
+		}
+	}
+	tris->insert(tris->end(), { indices[0] & NAV_INDEX_MASK, indices[1] & NAV_INDEX_MASK, indices[2] & NAV_INDEX_MASK });
+
+	return (int)(tris->size() / 3);
+}
+
+static int countNavPolyVertices(const uint16_t* p)
+{
+	for (int i = 0; i < NAVMESH_MAX_POLY_VERTICES; i++) {
+		if (p[i] == NAVMESH_NO_NEIGHBOR) {
+			return i;
+		}
+	}
+
+	return NAVMESH_MAX_POLY_VERTICES;
+}
+
+static inline bool navVertexLeft(const NavMeshVertex& a, const NavMeshVertex& b, const NavMeshVertex& c)
+{
+	return ((int)b.x - (int)a.x) * ((int)c.y - (int)a.y) - ((int)c.x - (int)a.x) * ((int)b.y - (int)a.y) < 0;
+}
+
+/*
+* Squared length of the edge pa and pb share if merging them gives a convex
+* polygon that is not too big, -1 otherwise.
+*/
+static int getNavMergeValue(const uint16_t* pa, const uint16_t* pb, const std::vector<NavMeshVertex>& vertices, int* ea, int* eb)
+{
+	const int na = countNavPolyVertices(pa);
+	const int nb = countNavPolyVertices(pb);
+	if (na + nb - 2 > NAVMESH_MAX_POLY_VERTICES) {
+		return -1;
+	}
+
+	*ea = -1;
+	*eb = -1;
+	for (int i = 0; i < na && *ea < 0; i++) {
+		uint16_t va0 = pa[i], va1 = pa[(i + 1) % na];
+		if (va0 > va1) {
+			std::swap(va0, va1);
+		}
+		for (int j = 0; j < nb; j++) {
+			uint16_t vb0 = pb[j], vb1 = pb[(j + 1) % nb];
+			if (vb0 > vb1) {
+				std::swap(vb0, vb1);
+			}
+			if (va0 == vb0 && va1 == vb1) {
+				*ea = i;
+				*eb = j;
+				break;
+			}
+		}
+	}
+	if (*ea < 0) {
+		return -1;
+	}
+
+	if (!navVertexLeft(vertices[pa[(*ea + na - 1) % na]], vertices[pa[*ea]], vertices[pb[(*eb + 2) % nb]])
+		|| !navVertexLeft(vertices[pb[(*eb + nb - 1) % nb]], vertices[pb[*eb]], vertices[pa[(*ea + 2) % na]])) {
+		return -1;
+	}
+
+	const NavMeshVertex& a = vertices[pa[*ea]];
+	const NavMeshVertex& b = vertices[pa[(*ea + 1) % na]];
+	int dx = (int)a.x - (int)b.x, dy = (int)a.y - (int)b.y;
+
+	return dx * dx + dy * dy;
+}
+
+static void mergeNavPolys(uint16_t* pa, const uint16_t* pb, int ea, int eb)
+{
+	const int na = countNavPolyVertices(pa);
+	const int nb = countNavPolyVertices(pb);
+	uint16_t merged[NAVMESH_MAX_POLY_VERTICES];
+	memset(merged, 0xFF, sizeof(merged));
+	int n = 0;
+	for (int i = 0; i < na - 1; i++) {
+		merged[n++] = pa[(ea + 1 + i) % na];
+	}
+	for (int i = 0; i < nb - 1; i++) {
+		merged[n++] = pb[(eb + 1 + i) % nb];
+	}
+	memcpy(pa, merged, sizeof(merged));
+}
+
+/*
+* Vertices of contours next to each other meet on the grid, heights may be a
+* step apart where the corner heights disagree.
+*/
+static uint16_t addNavVertex(std::vector<NavMeshVertex>* vertices, std::unordered_map<uint32_t, std::vector<uint16_t>>* grid,
+	int x, int h, int y)
+{
+	uint32_t key = (uint32_t)x | ((uint32_t)y << 16);
+	std::vector<uint16_t>& candidates = (*grid)[key];
+	for (auto c = candidates.begin(); c != candidates.end(); c++) {
+		if (abs((int)(*vertices)[*c].h - h) <= 2) {
+			return *c;
+		}
+	}
+
+	uint16_t index = (uint16_t)vertices->size();
+	vertices->push_back({ (uint16_t)x, (uint16_t)std::clamp(h, 0, NAV_MAX_HEIGHT), (uint16_t)y });
+	candidates.push_back(index);
+
+	return index;
+}
+
+static void buildNavPolys(const std::vector<NavContour>& contours, const NavBuildParams& params, NavMeshTile* tile)
+{
+	std::unordered_map<uint32_t, std::vector<uint16_t>> grid;
+	std::vector<int> indexBuffer, tris;
+	std::vector<uint16_t> remap;
+	for (auto c = contours.begin(); c != contours.end(); c++) {
+		int n = (int)c->vertices.size() / 4;
+		int triCount = triangulateNavContour(n, c->vertices.data(), &indexBuffer, &tris);
+		if (triCount < 0) {
+			triCount = -triCount; // Keep what there is, the rest of the region is lost
+		}
+
+		remap.resize(n);
+		for (int v = 0; v < n; v++) {
+			const int* p = &c->vertices[v * 4];
+			remap[v] = addNavVertex(&tile->vertices, &grid, p[0], p[1], p[2]);
+		}
+
+		std::vector<NavMeshPoly> polys;
+		for (int t = 0; t < triCount; t++) {
+			uint16_t a = remap[tris[t * 3]], b = remap[tris[t * 3 + 1]], d = remap[tris[t * 3 + 2]];
+			if (a == b || a == d || b == d) {
+				continue;
+			}
+			NavMeshPoly poly;
+			memset(&poly, 0xFF, sizeof(poly));
+			poly.vertices[0] = a;
+			poly.vertices[1] = b;
+			poly.vertices[2] = d;
+			poly.area = 1;
+			poly.region = c->region;
+			polys.push_back(poly);
+		}
+
+		for (;;) {
+			int bestValue = 0, bestA = -1, bestB = -1, bestEdgeA = -1, bestEdgeB = -1;
+			for (size_t a = 0; a + 1 < polys.size(); a++) {
+				for (size_t b = a + 1; b < polys.size(); b++) {
+					int ea, eb;
+					int value = getNavMergeValue(polys[a].vertices, polys[b].vertices, tile->vertices, &ea, &eb);
+					if (value > bestValue) {
+						bestValue = value;
+						bestA = (int)a;
+						bestB = (int)b;
+						bestEdgeA = ea;
+						bestEdgeB = eb;
+					}
+				}
+			}
+			if (bestValue <= 0) {
+				break;
+			}
+			mergeNavPolys(polys[bestA].vertices, polys[bestB].vertices, bestEdgeA, bestEdgeB);
+			polys[bestB] = polys.back();
+			polys.pop_back();
+		}
+		tile->polys.insert(tile->polys.end(), polys.begin(), polys.end());
+	}
+
+	// Contours wind the other way round, the file has counter-clockwise polygons.
+	for (auto p = tile->polys.begin(); p != tile->polys.end(); p++) {
+		p->vertexCount = (uint8_t)countNavPolyVertices(p->vertices);
+		std::reverse(p->vertices, p->vertices + p->vertexCount);
+	}
+
+	// Neighbors: the other polygon with the same edge the other way round.
+	std::unordered_map<uint32_t, std::pair<uint16_t, uint8_t>> edges;
+	for (size_t p = 0; p < tile->polys.size(); p++) {
+		const NavMeshPoly& poly = tile->polys[p];
+		for (int e = 0; e < poly.vertexCount; e++) {
+			uint32_t key = (uint32_t)poly.vertices[e] | ((uint32_t)poly.vertices[(e + 1) % poly.vertexCount] << 16);
+			edges[key] = { (uint16_t)p, (uint8_t)e };
+		}
+	}
+	const int size = params.tileCells;
+	for (size_t p = 0; p < tile->polys.size(); p++) {
+		NavMeshPoly& poly = tile->polys[p];
+		for (int e = 0; e < poly.vertexCount; e++) {
+			uint16_t v0 = poly.vertices[e], v1 = poly.vertices[(e + 1) % poly.vertexCount];
+			auto other = edges.find((uint32_t)v1 | ((uint32_t)v0 << 16));
+			if (other != edges.end()) {
+				poly.neighbors[e] = other->second.first;
+				continue;
+			}
+			const NavMeshVertex& a = tile->vertices[v0];
+			const NavMeshVertex& b = tile->vertices[v1];
+			if (a.x == 0 && b.x == 0) {
+				poly.neighbors[e] = NAVMESH_PORTAL | NAVMESH_SIDE_MIN_X;
+			}
+			else if (a.y == size && b.y == size) {
+				poly.neighbors[e] = NAVMESH_PORTAL | NAVMESH_SIDE_MAX_Y;
+			}
+			else if (a.x == size && b.x == size) {
+				poly.neighbors[e] = NAVMESH_PORTAL | NAVMESH_SIDE_MAX_X;
+			}
+			else if (a.y == 0 && b.y == 0) {
+				poly.neighbors[e] = NAVMESH_PORTAL | NAVMESH_SIDE_MIN_Y;
+			}
+			else {
+				poly.neighbors[e] = NAVMESH_NO_NEIGHBOR;
+			}
+		}
+	}
+}
+
+static void buildNavTile(const std::vector<Polygon>& tris, const std::vector<uint32_t>& tileTris, const std::vector<uint8_t>& areas,
+	const NavBuildParams& params, const glm::f64vec3& origin, NavMeshTile* tile)
+{
+	NavHeightfield hf;
+	hf.width = params.tileCells + 2 * params.borderSize;
+	hf.height = hf.width;
+	hf.min = origin + glm::f64vec3((tile->x * params.tileCells - params.borderSize) * params.cellSize,
+		(tile->y * params.tileCells - params.borderSize) * params.cellSize, 0.0);
+	hf.columns.resize(hf.width * hf.height);
+
+	std::vector<glm::f64vec3> polys[4];
+	for (auto t = tileTris.begin(); t != tileTris.end(); t++) {
+		rasterizeNavTriangle(&hf, params, tris[*t], areas[*t], polys);
+	}
+	filterNavSpans(&hf, params);
+
+	NavCompactField chf = buildNavCompactField(hf, params);
+	hf = NavHeightfield();
+	erodeNavArea(&chf, params.walkableRadius);
+	buildNavRegions(&chf, params);
+
+	std::vector<NavContour> contours;
+	buildNavContours(chf, params, &contours);
+	buildNavPolys(contours, params, tile);
+	if (tile->polys.empty()) {
+		tile->vertices.clear();
+	}
+}
+
+static bool isNavTrigger(const std::string& material)
+{
+	std::string name = material.substr(material.find_last_of('/') + 1);
+	std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return (char)tolower(c); });
+
+	return name.find("trigger") != std::string::npos;
+}
+
+NavMesh buildNavMesh(const std::vector<Polygon>& tris, const std::vector<std::string>& materials, unsigned int threadCount)
+{
+	const NavBuildParams params = getNavBuildParams();
+	NavMesh navMesh = { glm::f64vec3(0.0), 0, 0, { } };
+
+	std::vector<uint8_t> isTrigger(materials.size());
+	for (size_t m = 0; m < materials.size(); m++) {
+		isTrigger[m] = isNavTrigger(materials[m]);
+	}
+	glm::f64vec3 min(DBL_MAX), max(-DBL_MAX);
+	std::vector<uint8_t> areas(tris.size());
+	for (size_t t = 0; t < tris.size(); t++) {
+		for (auto v = tris[t].vertices.begin(); v != tris[t].vertices.end(); v++) {
+			min = glm::min(min, *v);
+			max = glm::max(max, *v);
+		}
+		areas[t] = tris[t].normal.z >= PS_NAV_MIN_FLOOR_Z;
+	}
+	if (tris.empty()) {
+		return navMesh;
+	}
+
+	const double tileSize = params.tileCells * params.cellSize;
+	navMesh.origin = glm::floor(min / params.cellSize) * params.cellSize;
+	navMesh.origin.z = floor(min.z / params.cellHeight) * params.cellHeight;
+	navMesh.tilesX = (uint32_t)std::max(ceil((max.x - navMesh.origin.x) / tileSize), 1.0);
+	navMesh.tilesY = (uint32_t)std::max(ceil((max.y - navMesh.origin.y) / tileSize), 1.0);
+
+	// Every triangle goes to the tiles whose borders it reaches into.
+	const double border = params.borderSize * params.cellSize;
+	std::vector<std::vector<uint32_t>> tileTris(navMesh.tilesX * navMesh.tilesY);
+	for (size_t t = 0; t < tris.size(); t++) {
+		uint32_t material = tris[t].texture.material;
+		if (material < isTrigger.size() && isTrigger[material]) {
+			continue;
+		}
+		glm::f64vec3 triMin(DBL_MAX), triMax(-DBL_MAX);
+		for (auto v = tris[t].vertices.begin(); v != tris[t].vertices.end(); v++) {
+			triMin = glm::min(triMin, *v);
+			triMax = glm::max(triMax, *v);
+		}
+		int x0 = std::max((int)floor((triMin.x - border - navMesh.origin.x) / tileSize), 0);
+		int x1 = std::min((int)floor((triMax.x + border - navMesh.origin.x) / tileSize), (int)navMesh.tilesX - 1);
+		int y0 = std::max((int)floor((triMin.y - border - navMesh.origin.y) / tileSize), 0);
+		int y1 = std::min((int)floor((triMax.y + border - navMesh.origin.y) / tileSize), (int)navMesh.tilesY - 1);
+		for (int y = y0; y <= y1; y++) {
+			for (int x = x0; x <= x1; x++) {
+				tileTris[x + y * navMesh.tilesX].push_back((uint32_t)t);
+			}
+		}
+	}
+
+	std::vector<NavMeshTile> tiles(tileTris.size());
+	parallelFor(tiles.size(), threadCount, [&](size_t i) {
+		tiles[i].x = (int32_t)(i % navMesh.tilesX);
+		tiles[i].y = (int32_t)(i / navMesh.tilesX);
+		buildNavTile(tris, tileTris[i], areas, params, navMesh.origin, &tiles[i]);
+	});
+	for (auto t = tiles.begin(); t != tiles.end(); t++) {
+		if (!t->polys.empty()) {
+			navMesh.tiles.push_back(std::move(*t));
+		}
+	}
+
+	return navMesh;
+}
+
+static inline uint64_t alignNavMeshOffset(uint64_t offset)
+{
+	return (offset + NAVMESH_ALIGNMENT - 1) & ~(uint64_t)(NAVMESH_ALIGNMENT - 1);
+}
+
+bool writeNavMesh(const char* fileName, const NavMesh& navMesh)
+{
+	const NavBuildParams params = getNavBuildParams();
+	NavMeshHeader header = { };
+	header.magic = NAVMESH_MAGIC;
+	header.version = NAVMESH_VERSION;
+	header.tileCount = (uint32_t)navMesh.tiles.size();
+	header.tileCells = (uint32_t)params.tileCells;
+	for (int a = 0; a < 3; a++) {
+		header.origin[a] = (float)navMesh.origin[a];
+	}
+	header.cellSize = (float)params.cellSize;
+	header.cellHeight = (float)params.cellHeight;
+	header.agentHeight = (float)PS_NAV_AGENT_HEIGHT;
+	header.agentRadius = (float)PS_NAV_AGENT_RADIUS;
+	header.agentClimb = (float)PS_NAV_AGENT_CLIMB;
+	header.tilesX = navMesh.tilesX;
+	header.tilesY = navMesh.tilesY;
+	header.maxPolyVertices = NAVMESH_MAX_POLY_VERTICES;
+
+	std::vector<NavMeshTileHeader> tileHeaders(navMesh.tiles.size());
+	uint64_t offset = alignNavMeshOffset(sizeof(NavMeshHeader) + tileHeaders.size() * sizeof(NavMeshTileHeader));
+	for (size_t t = 0; t < navMesh.tiles.size(); t++) {
+		const NavMeshTile& tile = navMesh.tiles[t];
+		NavMeshTileHeader& tileHeader = tileHeaders[t];
+		tileHeader.x = tile.x;
+		tileHeader.y = tile.y;
+		tileHeader.vertexCount = (uint32_t)tile.vertices.size();
+		tileHeader.polyCount = (uint32_t)tile.polys.size();
+		tileHeader.offset = offset;
+		tileHeader.size = alignNavMeshOffset(tile.vertices.size() * sizeof(NavMeshVertex)) + tile.polys.size() * sizeof(NavMeshPoly);
+		offset = alignNavMeshOffset(offset + tileHeader.size);
+	}
+
+	FILE* file = fopen(fileName, "wb");
+	if (!file) {
+		return false;
+	}
+	static const uint8_t padding[NAVMESH_ALIGNMENT] = { };
+	bool isWritten = fwrite(&header, sizeof(header), 1, file) == 1;
+	if (!tileHeaders.empty()) isWritten &= fwrite(&tileHeaders[0], sizeof(NavMeshTileHeader), tileHeaders.size(), file) == tileHeaders.size();
+	uint64_t written = sizeof(NavMeshHeader) + tileHeaders.size() * sizeof(NavMeshTileHeader);
+	for (size_t t = 0; t < navMesh.tiles.size() && isWritten; t++) {
+		const NavMeshTile& tile = navMesh.tiles[t];
+		isWritten &= fwrite(padding, 1, tileHeaders[t].offset - written, file) == tileHeaders[t].offset - written;
+		isWritten &= fwrite(&tile.vertices[0], sizeof(NavMeshVertex), tile.vertices.size(), file) == tile.vertices.size();
+		uint64_t vertexBytes = tile.vertices.size() * sizeof(NavMeshVertex);
+		isWritten &= fwrite(padding, 1, alignNavMeshOffset(vertexBytes) - vertexBytes, file) == alignNavMeshOffset(vertexBytes) - vertexBytes;
+		isWritten &= fwrite(&tile.polys[0], sizeof(NavMeshPoly), tile.polys.size(), file) == tile.polys.size();
+		written = tileHeaders[t].offset + tileHeaders[t].size;
+	}
+	fclose(file);
+
+	return isWritten;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,68 @@
+/*
+* Minimal helpers to spread independent work items over a couple of threads.
+*
+* There is no persistent pool: the workers only live for the duration of
+* one parallelFor call. Items are handed out one by one through an atomic
+* counter, so a mix of big and small items balances itself.
+*/
+
+#ifndef _PARALLEL_H_
+#define _PARALLEL_H_
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <stddef.h>
+
+/*
+* Returns the number of threads to use if the user asked for 'requested'.
+* 0 means: use every hardware thread there is.
+*/
+static inline unsigned int getThreadCount(unsigned int requested)
+{
+	if (requested > 0) {
+		return requested;
+	}
+	unsigned int hardwareThreads = std::thread::hardware_concurrency();
+
+	return hardwareThreads > 0 ? hardwareThreads : 1;
+}
+
+/*
+* Calls func(i) for every i in [0, count). The calling thread works as well,
+* so threadCount == 1 runs everything serially without spawning anything.
+*/
+template<typename Func>
+void parallelFor(size_t count, unsigned int threadCount, Func func)
+{
+	threadCount = getThreadCount(threadCount);
+	if (threadCount > count) {
+		threadCount = (unsigned int)count;
+	}
+
+	if (threadCount <= 1) {
+		for (size_t i = 0; i < count; i++) {
+			func(i);
+		}
+		return;
+	}
+
+	std::atomic<size_t> next(0);
+	auto worker = [&]() {
+		for (size_t i = next++; i < count; i = next++) {
+			func(i);
+		}
+	};
+
+	std::vector<std::thread> threads;
+	threads.reserve(threadCount - 1);
+	for (unsigned int i = 0; i < threadCount - 1; i++) {
+		threads.push_back(std::thread(worker));
+	}
+	worker();
+	for (auto t = threads.begin(); t != threads.end(); t++) {
+		t->join();
+	}
+}
+
+#endif
@@ -21,13 +21,20 @@
 #ifndef _PARSER_H_
 #define _PARSER_H_
 
+#include <algorithm>
 #include <string>
+#include <string_view>
+#include <charconv>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <vector>
+#include <memory_resource>
+
+#include "parallel.h"
 
 enum MapVersion
 {
@@ -56,42 +63,201 @@ struct Vertex
 	double x, y, z;
 };
 
+/*
+* The map containers are allocator aware (std::pmr). A whole Map can be parsed
+* into one caller supplied arena (see MapParser::memory), and every nested
+* vector and string picks up the arena of the container it is stored in.
+* Without an arena everything comes from the default heap as usual.
+*/
+typedef std::pmr::polymorphic_allocator<char> MapAllocator;
+
 struct Face
 {
-	Vertex			vertices[3];     // Define the plane.
-	std::string		textureName;
-	double			xOffset, yOffset;
-	double			rotation;
-	double			xScale, yScale;
+	typedef MapAllocator allocator_type;
+
+	Vertex				vertices[3] = { };     // Define the plane.
+	std::pmr::string	textureName;
+	double				xOffset = 0.0, yOffset = 0.0;
+	double				rotation = 0.0;
+	double				xScale = 0.0, yScale = 0.0;
 
 	// Valve 220 texture format
-	double			tx1, ty1, tz1, tOffset1;
-	double			tx2, ty2, tz2, tOffset2;
+	double				tx1 = 0.0, ty1 = 0.0, tz1 = 0.0, tOffset1 = 0.0;
+	double				tx2 = 0.0, ty2 = 0.0, tz2 = 0.0, tOffset2 = 0.0;
+
+	Face() { }
+	explicit Face(const allocator_type& allocator) : textureName(allocator) { }
+	Face(const Face& other) = default;
+	Face(Face&& other) = default;
+	Face(const Face& other, const allocator_type& allocator) : textureName(allocator) { *this = other; }
+	Face(Face&& other, const allocator_type& allocator) : textureName(allocator) { *this = std::move(other); }
+	Face& operator=(const Face& other) = default;
+	Face& operator=(Face&& other) = default;
 };
 
 struct Brush
 {
-	std::vector<Face> faces;
+	typedef MapAllocator allocator_type;
+
+	std::pmr::vector<Face> faces;
+
+	Brush() { }
+	explicit Brush(const allocator_type& allocator) : faces(allocator) { }
+	Brush(const Brush& other) = default;
+	Brush(Brush&& other) = default;
+	Brush(const Brush& other, const allocator_type& allocator) : faces(other.faces, allocator) { }
+	Brush(Brush&& other, const allocator_type& allocator) : faces(std::move(other.faces), allocator) { }
+	Brush& operator=(const Brush& other) = default;
+	Brush& operator=(Brush&& other) = default;
 };
 
 struct Property
 {
-	std::string key;
-	std::string value;
+	typedef MapAllocator allocator_type;
+
+	std::pmr::string key;
+	std::pmr::string value;
+
+	Property() { }
+	explicit Property(const allocator_type& allocator) : key(allocator), value(allocator) { }
+	Property(std::string_view key, std::string_view value, const allocator_type& allocator = { })
+		: key(key, allocator), value(value, allocator) { }
+	Property(const Property& other) = default;
+	Property(Property&& other) = default;
+	Property(const Property& other, const allocator_type& allocator)
+		: key(other.key, allocator), value(other.value, allocator) { }
+	Property(Property&& other, const allocator_type& allocator)
+		: key(std::move(other.key), allocator), value(std::move(other.value), allocator) { }
+	Property& operator=(const Property& other) = default;
+	Property& operator=(Property&& other) = default;
 };
 
 struct Entity
 {
-	std::vector<Property> properties;
-	std::vector<Brush>    brushes;
+	typedef MapAllocator allocator_type;
+
+	std::pmr::vector<Property> properties;
+	std::pmr::vector<Brush>    brushes;
+
+	Entity() { }
+	explicit Entity(const allocator_type& allocator) : properties(allocator), brushes(allocator) { }
+	Entity(const Entity& other) = default;
+	Entity(Entity&& other) = default;
+	Entity(const Entity& other, const allocator_type& allocator)
+		: properties(other.properties, allocator), brushes(other.brushes, allocator) { }
+	Entity(Entity&& other, const allocator_type& allocator)
+		: properties(std::move(other.properties), allocator), brushes(std::move(other.brushes), allocator) { }
+	Entity& operator=(const Entity& other) = default;
+	Entity& operator=(Entity&& other) = default;
 };
 
 struct Map
 {
-	std::vector<Entity> entities;
+	typedef MapAllocator allocator_type;
+
+	std::pmr::vector<Entity> entities;
+
+	Map() { }
+	explicit Map(const allocator_type& allocator) : entities(allocator) { }
+};
+
+/*
+* All state of a parse lives in here, so any number of maps can be parsed
+* at the same time (one MapParser per map).
+*/
+struct MapParser
+{
+	char*						input;
+	int							inputLength;
+	int							pos;
+	int							lineNo;
+	MapVersion					mapVersion;
+	std::pmr::memory_resource*	memory;		// Where the Map gets allocated
+	bool						hasError;	// Set by the first syntax error, parsing stops there
+	int							errorLineNo;
 };
 
-Map getMap(char* mapData, size_t mapDataLength, MapVersion mapVersion = QUAKE);
+/*
+* Streaming interface: parseMap calls these while it walks the map, without
+* ever building a Map. The Face and Brush handed out are reused for the next
+* face/brush and the string views point into the map data, so copy whatever
+* has to outlive the callback.
+* 
+* Order of calls:
+* onEntityBegin, onProperty*, (onFace*, onBrush)*, onEntityEnd
+*/
+class MapListener
+{
+public:
+	virtual			~MapListener() { }
+	virtual void	onEntityBegin() { }
+	virtual void	onProperty(std::string_view /*key*/, std::string_view /*value*/) { }
+	virtual void	onFace(const Face& /*face*/) { }
+	virtual void	onBrush(const Brush& /*brush*/) { }
+	virtual void	onEntityEnd() { }
+};
+
+void				initMapParser(MapParser* parser, char* mapData, size_t mapDataLength, MapVersion mapVersion = QUAKE,
+						std::pmr::memory_resource* memory = std::pmr::get_default_resource());
+
+/*
+* None of these exit on a syntax error. They report it, set parser->hasError
+* and stop there: the Map (or the calls to the listener) ends with the
+* entity the error is in, which is left incomplete.
+*/
+void				parseMap(MapParser* parser, MapListener* listener);
+Map					getMap(MapParser* parser);
+Map					getMap(char* mapData, size_t mapDataLength, MapVersion mapVersion = QUAKE,
+						std::pmr::memory_resource* memory = std::pmr::get_default_resource());
+
+/*
+* Same result as getMap, but the brushes are parsed on threadCount threads
+* (0 = all hardware threads). Useful for maps with one huge worldspawn.
+* Allocates from the default heap, as monotonic arenas are not thread safe.
+* Returns false if the map has a syntax error.
+*/
+bool				getMapParallel(char* mapData, size_t mapDataLength, MapVersion mapVersion, unsigned int threadCount, Map* map);
+
+/*
+* The format the worldspawn's "mapversion" key names ("220" is VALVE_220),
+* fallback if the map does not have one.
+*/
+MapVersion			getMapVersion(char* mapData, size_t mapDataLength, MapVersion fallback = QUAKE);
+
+/*
+* Where a brush is in the map text. pos..end is everything between its braces.
+*/
+struct BrushChunk
+{
+	int pos;		// First character after the brush's '{'
+	int end;		// The brush's '}'
+	int lineNo;
+};
+
+/*
+* Finds all brushes of the map in source order without parsing them.
+* Returns false if the map is malformed.
+*/
+bool				getBrushChunks(char* mapData, size_t mapDataLength, std::vector<BrushChunk>* brushes);
+
+/*
+* Parses the brush at chunk. Used to reparse single brushes that changed.
+* Returns false if the brush has a syntax error.
+*/
+bool				getBrushAt(char* mapData, size_t mapDataLength, MapVersion mapVersion, const BrushChunk& chunk, Brush* brush);
+
+/*
+* Loads and parses all files in mapFiles on threadCount threads
+* (0 = all hardware threads). The result is in the same order as mapFiles.
+* Returns false if a file can not be read or has a syntax error.
+*/
+bool				getMaps(const std::vector<std::string>& mapFiles, MapVersion mapVersion, unsigned int threadCount, std::vector<Map>* maps);
+
+/*
+* Reads the whole file into a string. The terminating '\0' of the string is
+* what stops the scanning functions at the end of the input.
+*/
+bool				loadMapFile(const std::string& fileName, std::string* mapData);
 
 
 
@@ -105,92 +271,106 @@ Map getMap(char* mapData, size_t mapDataLength, MapVersion mapVersion = QUAKE);
 
 #if defined(MAP_PARSER_IMPLEMENTATION)
 
-static int			g_InputLength;
-static int			g_LineNo;
-static MapVersion	g_MapVersion;
-
-static int advanceCursor(int* pos, int steps)
+static inline bool isWhitespace(char c)
 {
-	int advanceable = g_InputLength - *pos + steps;
-	if (advanceable > 0) {
-		*pos += advanceable;
-		return advanceable;
-	}
-	return 0;
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
 }
 
-static void advanceToNextNonWhitespace(char* c, int* pos)
+/*
+* The scanning functions below work on a local cursor and write the
+* position back once. Writing through the parser for every character forces
+* the compiler to store it on each iteration as char loads may alias it.
+*/
+static void advanceToNextNonWhitespace(MapParser* p)
 {
-	char* cur = c + *pos;
-	while (isspace(*cur)) {
+	char* start = p->input + p->pos;
+	char* cur = start;
+	int lineNo = p->lineNo;
+	while (isWhitespace(*cur)) {
 		if (*cur == '\n') { // TODO: Get Env-Newline?
-			g_LineNo++;
+			lineNo++;
 		}
-		cur++; *pos += 1;
+		cur++;
 	}
+	p->pos += (int)(cur - start);
+	p->lineNo = lineNo;
 }
 
-static void advanceToNextWhitespaceOrLinebreak(char** c, int* pos)
+static void advanceToNextWhitespaceOrLinebreak(MapParser* p)
 {
-	while (!isspace(**c) && **c != '\n' && **c != '\r') {
-		*c += 1; *pos += 1;
+	char* start = p->input + p->pos;
+	char* cur = start;
+	while (!isWhitespace(*cur) && *cur != '\0') {
+		cur++;
 	}
+	p->pos += (int)(cur - start);
 }
 
-static void skipLinebreaks(char* c, int* pos)
+static void skipLinebreaks(MapParser* p)
 {
-	char* cur = c + *pos;
+	char* start = p->input + p->pos;
+	char* cur = start;
 	while (*cur == '\r' || *cur == '\n') {
-		cur++; *pos += 1; g_LineNo++;
+		cur++; p->lineNo++;
 	}
+	p->pos += (int)(cur - start);
 }
 
-static void advanceToNextLine(char* c, int* pos)
+static void advanceToNextLine(MapParser* p)
 {
-	char* cur = c + *pos;
-	while (*cur != '\r' && *cur != '\n') {
-		cur++; *pos += 1;
+	char* start = p->input + p->pos;
+	char* cur = start;
+	while (*cur != '\r' && *cur != '\n' && *cur != '\0') {
+		cur++;
 	}
 	if (*cur == '\r') {
-		cur++; *pos += 1;
+		cur++;
 	}
 	if (*cur == '\n') {
-		cur++; *pos += 1;
-		g_LineNo++;
+		cur++;
+		p->lineNo++;
 	}
+	p->pos += (int)(cur - start);
 }
 
-static std::string getString(char* c, int* pos)
+/*
+* Returns a view into the input buffer covering the contents between the quotes.
+* The view is only valid as long as the map data is alive.
+*/
+static std::string_view getString(MapParser* p)
 {
-	char* cur = c + *pos;
+	if (p->hasError) {
+		return std::string_view();
+	}
+	char* cur = p->input + p->pos;
 
-	cur++; *pos += 1; // advance over "
-	std::string result = "";
+	cur++; // advance over "
+	char* start = cur;
 	while (*cur != '\"') {
-		result += *cur; *pos += 1; cur++;
+		cur++;
 	}
-	*pos += 1; // advance over "
+	p->pos += (int)(cur - start) + 2; // advance over both " and the contents
 
-	return result;
+	return std::string_view(start, cur - start);
 }
 
-static TokenType getToken(char* c, int* pos)
+static TokenType getToken(MapParser* p)
 {
-	if (*pos >= g_InputLength) {
+	if (p->hasError || p->pos >= p->inputLength) {
 		return END_OF_INPUT;
 	}
 
 	TokenType result = UNKNOWN;
 
-	advanceToNextNonWhitespace(c, pos);
-	skipLinebreaks(c, pos);
+	advanceToNextNonWhitespace(p);
+	skipLinebreaks(p);
 
-	while (*(c + *pos) == '/') { // Skip over all comments
-		advanceToNextLine(c, pos);
-		advanceToNextNonWhitespace(c, pos);
+	while (*(p->input + p->pos) == '/') { // Skip over all comments
+		advanceToNextLine(p);
+		advanceToNextNonWhitespace(p);
 	}
 
-	char* cur = c + *pos;
+	char* cur = p->input + p->pos;
 
 	if (*cur == '{') {
 		result = LBRACE;
@@ -221,13 +401,13 @@ static TokenType getToken(char* c, int* pos)
 	}
 	else {
 		result = UNKNOWN;
-		*pos += 1;
+		p->pos += 1;
 	}
 
 	return result;
 }
 
-static std::string tokenToString(TokenType tokenType)
+static const char* tokenToString(TokenType tokenType)
 {
 	switch (tokenType)
 	{
@@ -244,111 +424,135 @@ static std::string tokenToString(TokenType tokenType)
 	}
 }
 
-static bool check(TokenType got, TokenType expected)
+/*
+* After the first error getToken only returns END_OF_INPUT, so every loop of
+* the parser runs out and the rest of the input is not looked at.
+*/
+static bool check(MapParser* p, TokenType got, TokenType expected)
 {
 	if (expected != got) {
-		fprintf(stderr, "ERROR: Expected Token: %s, but got: %s in line %d\n",
-			tokenToString(expected).c_str(), tokenToString(got).c_str(), g_LineNo);
-		exit(-1);
+		if (!p->hasError) {
+			fprintf(stderr, "ERROR: Expected Token: %s, but got: %s in line %d\n",
+				tokenToString(expected), tokenToString(got), p->lineNo);
+			p->hasError = true;
+			p->errorLineNo = p->lineNo;
+		}
+		return false;
 	}
 
 	return true;
 }
 
-static double parseNumber(char* c, int* pos)
+static inline bool isNumberChar(char c)
 {
-	char* cur = c + *pos;
-	std::string number = "";
-	while (*cur == '-' || *cur >= '0' && *cur <= '9' || *cur == '.') {
-		number += *cur; cur++; *pos += 1;
-	}
-	return atof(number.c_str());
+	return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E';
 }
 
-static Vertex getVertex(char* c, int* pos)
+/*
+* Numbers are converted in place. No temporary string is built.
+* Most coordinates in a map are plain integers, so those are accumulated
+* directly (exact for up to 15 digits). Everything else goes through
+* std::from_chars. If the characters do not form a valid number, 0.0
+* is returned, just like atof would do.
+*/
+static double getNumber(MapParser* p)
 {
-	Vertex v = { };
-	std::vector<double> values;
-	for (int i = 0; i < 3; i++) { // A face is defined by 3 vertices.
-		advanceToNextNonWhitespace(c, pos);
-		double value = parseNumber(c, pos);
-		values.push_back(value);
+	if (p->hasError) {
+		return 0.0;
+	}
+	char* start = p->input + p->pos;
+	char* end = start;
+	char* inputEnd = p->input + p->inputLength;
+	while (end < inputEnd && isNumberChar(*end)) {
+		end++;
+	}
+	p->pos += (int)(end - start);
+
+	char* digits = (*start == '-') ? start + 1 : start;
+	if (end > digits && end - digits <= 15) {
+		int64_t integer = 0;
+		char* cur = digits;
+		while (cur < end && *cur >= '0' && *cur <= '9') {
+			integer = integer * 10 + (*cur - '0');
+			cur++;
+		}
+		if (cur == end) {
+			return (*start == '-') ? -(double)integer : (double)integer;
+		}
 	}
 
-	v.x = values[0];
-	v.y = values[1];
-	v.z = values[2];
+	double result = 0.0;
+	std::from_chars(start, end, result);
 
-	return v;
+	return result;
 }
 
-static double getNumber(char* c, int* pos)
+static std::string_view getTextureName(MapParser* p)
 {
-	char* cur = c + *pos;
-	std::string number = "";
-	while (*cur == '-' || *cur >= '0' && *cur <= '9' || *cur == '.' || *cur == 'e') {
-		number += *cur; cur++; *pos += 1;
+	if (p->hasError) {
+		return std::string_view();
 	}
-	return atof(number.c_str());
+	char* start = p->input + p->pos;
+	advanceToNextWhitespaceOrLinebreak(p);
+	char* end = p->input + p->pos;
+
+	return std::string_view(start, end - start);
 }
 
-static std::string getTextureName(char* c, int* pos)
+static Property getProperty(MapParser* p)
 {
-	char* cur = c + *pos;
-
-	std::string textureName = "";
-	char* end = cur;
-	advanceToNextWhitespaceOrLinebreak(&end, pos);
-	while (cur != end) {
-		textureName += *cur; cur++;
-	}
+	check(p, getToken(p), STRING);
+	std::string_view key = getString(p);
+	check(p, getToken(p), STRING);
+	std::string_view value = getString(p);
 
-	return textureName;
+	return Property(key, value, p->memory);
 }
 
-static Property getProperty(char* c, int* pos)
+/*
+* Resets everything but the texture name, whose buffer can be reused
+* when the same Face is parsed into over and over again.
+*/
+static void clearFace(Face* face)
 {
-	check(getToken(c, pos), STRING);
-	std::string key = getString(c, pos);
-	check(getToken(c, pos), STRING);
-	std::string value = getString(c, pos);
-
-	return { key, value };
+	std::pmr::string textureName = std::move(face->textureName);
+	*face = { };
+	face->textureName = std::move(textureName);
 }
 
 /*
 * TODO: getFace and getFaceValve220 are fairly similar. Try to compress this?
 */
-static Face getFace(char* c, int* pos)
+static void getFace(MapParser* p, Face* face)
 {
-	Face face = { };
+	clearFace(face);
 
 	/* 3 Vertices defining the plane */
 	for (size_t i = 0; i < 3; ++i) {
-		check(getToken(c, pos), LPAREN); *pos += 1;
-		check(getToken(c, pos), NUMBER);
-		double x = getNumber(c, pos);
-		check(getToken(c, pos), NUMBER);
-		double y = getNumber(c, pos);
-		check(getToken(c, pos), NUMBER);
-		double z = getNumber(c, pos);
-		check(getToken(c, pos), RPAREN); *pos += 1;
-		face.vertices[i] = { x, y, z };
+		check(p, getToken(p), LPAREN); p->pos += 1;
+		check(p, getToken(p), NUMBER);
+		double x = getNumber(p);
+		check(p, getToken(p), NUMBER);
+		double y = getNumber(p);
+		check(p, getToken(p), NUMBER);
+		double z = getNumber(p);
+		check(p, getToken(p), RPAREN); p->pos += 1;
+		face->vertices[i] = { x, y, z };
 	}
 
 	/* Texture stuff */
-	check(getToken(c, pos), TEXNAME);
-	face.textureName = getTextureName(c, pos);
-	check(getToken(c, pos), NUMBER);
-	face.xOffset = getNumber(c, pos);
-	check(getToken(c, pos), NUMBER);
-	face.yOffset = getNumber(c, pos);
-	check(getToken(c, pos), NUMBER);
-	face.rotation = getNumber(c, pos);
-	check(getToken(c, pos), NUMBER);
-	face.xScale = getNumber(c, pos);
-	check(getToken(c, pos), NUMBER);
-	face.yScale = getNumber(c, pos);
+	check(p, getToken(p), TEXNAME);
+	face->textureName.assign(getTextureName(p));
+	check(p, getToken(p), NUMBER);
+	face->xOffset = getNumber(p);
+	check(p, getToken(p), NUMBER);
+	face->yOffset = getNumber(p);
+	check(p, getToken(p), NUMBER);
+	face->rotation = getNumber(p);
+	check(p, getToken(p), NUMBER);
+	face->xScale = getNumber(p);
+	check(p, getToken(p), NUMBER);
+	face->yScale = getNumber(p);
 
 	/*
 	* Some map formats do have extra texture information.
@@ -359,89 +563,103 @@ static Face getFace(char* c, int* pos)
 	* 
 	* TODO: Figure out what those 3 extra numbers are in Q2.
 	*/
-	int *currentPos = pos; // save original (eg. do a lookahead)
-	if (getToken(c, currentPos) == NUMBER) { 
-
-		getToken(c, pos); // if the lookahead returned a NUMBER get the token again to advance pos.
-		getNumber(c, pos);
-		check(getToken(c, pos), NUMBER);
-		getNumber(c, pos);
-		check(getToken(c, pos), NUMBER);
-		getNumber(c, pos);
+	if (getToken(p) == NUMBER) { // getToken only skips whitespace here, so this lookahead is safe.
+		getNumber(p);
+		check(p, getToken(p), NUMBER);
+		getNumber(p);
+		check(p, getToken(p), NUMBER);
+		getNumber(p);
 	}
 
-	return face;
 }
 
-static Face getFaceValve220(char* c, int* pos)
+static void getFaceValve220(MapParser* p, Face* face)
 {
-	Face face = { };
+	clearFace(face);
 
 	/* 3 Vertices defining the plane */
 	for (size_t i = 0; i < 3; ++i) {
-		check(getToken(c, pos), LPAREN); *pos += 1;
-		check(getToken(c, pos), NUMBER);
-		double x = getNumber(c, pos);
-		check(getToken(c, pos), NUMBER);
-		double y = getNumber(c, pos);
-		check(getToken(c, pos), NUMBER);
-		double z = getNumber(c, pos);
-		check(getToken(c, pos), RPAREN); *pos += 1;
-		face.vertices[i] = { x, y, z };
+		check(p, getToken(p), LPAREN); p->pos += 1;
+		check(p, getToken(p), NUMBER);
+		double x = getNumber(p);
+		check(p, getToken(p), NUMBER);
+		double y = getNumber(p);
+		check(p, getToken(p), NUMBER);
+		double z = getNumber(p);
+		check(p, getToken(p), RPAREN); p->pos += 1;
+		face->vertices[i] = { x, y, z };
 	}
 
-	check(getToken(c, pos), TEXNAME);
-	face.textureName = getTextureName(c, pos);
+	check(p, getToken(p), TEXNAME);
+	face->textureName.assign(getTextureName(p));
 
 	/* Texture stuff */
-	check(getToken(c, pos), LBRACKET); *pos += 1;
-	check(getToken(c, pos), NUMBER);
-	face.tx1 = getNumber(c, pos);
-	check(getToken(c, pos), NUMBER);
-	face.ty1 = getNumber(c, pos);
-	check(getToken(c, pos), NUMBER);
-	face.tz1 = getNumber(c, pos);
-	check(getToken(c, pos), NUMBER);
-	face.tOffset1 = getNumber(c, pos);
-	check(getToken(c, pos), RBRACKET); *pos += 1;
-
-	check(getToken(c, pos), LBRACKET); *pos += 1;
-	check(getToken(c, pos), NUMBER);
-	face.tx2 = getNumber(c, pos);
-	check(getToken(c, pos), NUMBER);
-	face.ty2 = getNumber(c, pos);
-	check(getToken(c, pos), NUMBER);
-	face.tz2 = getNumber(c, pos);
-	check(getToken(c, pos), NUMBER);
-	face.tOffset2 = getNumber(c, pos);
-	check(getToken(c, pos), RBRACKET); *pos += 1;
-
-	check(getToken(c, pos), NUMBER);
-	face.rotation = getNumber(c, pos);
-	check(getToken(c, pos), NUMBER);
-	face.xScale = getNumber(c, pos);
-	check(getToken(c, pos), NUMBER);
-	face.yScale = getNumber(c, pos);
-
-	return face;
-}
-
-static Brush getBrush(char* c, int* pos)
-{
-	Brush brush = { };
-
-	while (getToken(c, pos) == LPAREN) {
-		if (g_MapVersion == VALVE_220) {
-			brush.faces.push_back(getFaceValve220(c, pos));
-		}
-		else {
-			brush.faces.push_back(getFace(c, pos));
-		}
+	check(p, getToken(p), LBRACKET); p->pos += 1;
+	check(p, getToken(p), NUMBER);
+	face->tx1 = getNumber(p);
+	check(p, getToken(p), NUMBER);
+	face->ty1 = getNumber(p);
+	check(p, getToken(p), NUMBER);
+	face->tz1 = getNumber(p);
+	check(p, getToken(p), NUMBER);
+	face->tOffset1 = getNumber(p);
+	check(p, getToken(p), RBRACKET); p->pos += 1;
+
+	check(p, getToken(p), LBRACKET); p->pos += 1;
+	check(p, getToken(p), NUMBER);
+	face->tx2 = getNumber(p);
+	check(p, getToken(p), NUMBER);
+	face->ty2 = getNumber(p);
+	check(p, getToken(p), NUMBER);
+	face->tz2 = getNumber(p);
+	check(p, getToken(p), NUMBER);
+	face->tOffset2 = getNumber(p);
+	check(p, getToken(p), RBRACKET); p->pos += 1;
+
+	check(p, getToken(p), NUMBER);
+	face->rotation = getNumber(p);
+	check(p, getToken(p), NUMBER);
+	face->xScale = getNumber(p);
+	check(p, getToken(p), NUMBER);
+	face->yScale = getNumber(p);
+
+}
+
+static void getAnyFace(MapParser* p, Face* face)
+{
+	if (p->mapVersion == VALVE_220) {
+		getFaceValve220(p, face);
+	}
+	else {
+		getFace(p, face);
+	}
+}
+
+static Brush getBrushFaces(MapParser* p)
+{
+	Brush brush(p->memory);
+	brush.faces.reserve(6); // Most brushes are boxes.
+
+	while (getToken(p) == LPAREN) {
+		brush.faces.emplace_back();
+		getAnyFace(p, &brush.faces.back());
 	}
 
-	int faceCount = brush.faces.size();
+	return brush;
+}
+
+static void checkBrushFaceCount(int faceCount, int lineNo)
+{
 	if (faceCount < 6) {
-		fprintf(stderr, "WARNING (Line %d): Brush found with only %d faces!\n", g_LineNo, faceCount);
+		fprintf(stderr, "WARNING (Line %d): Brush found with only %d faces!\n", lineNo, faceCount);
+	}
+}
+
+static Brush getBrush(MapParser* p)
+{
+	Brush brush = getBrushFaces(p);
+	if (!p->hasError) {
+		checkBrushFaceCount(brush.faces.size(), p->lineNo);
 	}
 
 	return brush;
@@ -450,43 +668,342 @@ static Brush getBrush(char* c, int* pos)
 /**
 * I assume that the grammar does not allow a brush *before* a property within an entity!
 */
-static Entity getEntity(char* c, int* pos)
+static Entity getEntity(MapParser* p)
 {
-	Entity e = { };
+	Entity e(p->memory);
 
-	while (getToken(c, pos) == STRING) {
-		e.properties.push_back(getProperty(c, pos));
+	while (getToken(p) == STRING) {
+		e.properties.push_back(getProperty(p));
 	}
 
-	while (getToken(c, pos) == LBRACE) {
-		*pos += 1;
-		e.brushes.push_back(getBrush(c, pos));
-		check(getToken(c, pos), RBRACE);
-		*pos += 1;
+	while (getToken(p) == LBRACE) {
+		p->pos += 1;
+		e.brushes.push_back(getBrush(p));
+		check(p, getToken(p), RBRACE);
+		p->pos += 1;
 	}
 
-	check(getToken(c, pos), RBRACE); *pos += 1;
+	check(p, getToken(p), RBRACE); p->pos += 1;
 
 	return e;
 }
 
-Map getMap(char* mapData, size_t mapDataLength, MapVersion mapVersion)
+void initMapParser(MapParser* parser, char* mapData, size_t mapDataLength, MapVersion mapVersion, std::pmr::memory_resource* memory)
 {
-	Map map = {};
+	parser->input = mapData;
+	parser->inputLength = (int)mapDataLength;
+	parser->pos = 0;
+	parser->lineNo = 1; // Editors often start at line 1
+	parser->mapVersion = mapVersion;
+	parser->memory = memory;
+	parser->hasError = false;
+	parser->errorLineNo = 0;
+}
 
-	g_InputLength = mapDataLength;
-	g_LineNo = 1; // Editors often start at line 1
-	g_MapVersion = mapVersion;
-	int pos = 0;
-	check(getToken(&mapData[0], &pos), LBRACE); // Map file must start with an entity!
-	while (getToken(&mapData[0], &pos) == LBRACE) {
-		pos++;
-		map.entities.push_back(getEntity(&mapData[0], &pos));
+Map getMap(MapParser* parser)
+{
+	Map map(parser->memory);
+
+	check(parser, getToken(parser), LBRACE); // Map file must start with an entity!
+	while (getToken(parser) == LBRACE) {
+		parser->pos++;
+		map.entities.push_back(getEntity(parser));
 	}
 
 	return map;
 }
 
+void parseMap(MapParser* parser, MapListener* listener)
+{
+	Brush brush = { }; // Reused for every brush, so the face buffers stay allocated.
+
+	check(parser, getToken(parser), LBRACE); // Map file must start with an entity!
+	while (getToken(parser) == LBRACE) {
+		parser->pos++;
+		listener->onEntityBegin();
+
+		while (getToken(parser) == STRING) {
+			check(parser, getToken(parser), STRING);
+			std::string_view key = getString(parser);
+			check(parser, getToken(parser), STRING);
+			std::string_view value = getString(parser);
+			listener->onProperty(key, value);
+		}
+
+		while (getToken(parser) == LBRACE) {
+			parser->pos += 1;
+			size_t faceCount = 0;
+			while (getToken(parser) == LPAREN) {
+				if (faceCount == brush.faces.size()) {
+					brush.faces.emplace_back();
+				}
+				getAnyFace(parser, &brush.faces[faceCount]);
+				if (parser->hasError) {
+					return; // The listener only gets whole faces and brushes.
+				}
+				listener->onFace(brush.faces[faceCount]);
+				faceCount++;
+			}
+			brush.faces.resize(faceCount);
+			checkBrushFaceCount(faceCount, parser->lineNo);
+			listener->onBrush(brush);
+
+			check(parser, getToken(parser), RBRACE);
+			parser->pos += 1;
+		}
+
+		check(parser, getToken(parser), RBRACE); parser->pos += 1;
+		listener->onEntityEnd();
+	}
+}
+
+Map getMap(char* mapData, size_t mapDataLength, MapVersion mapVersion, std::pmr::memory_resource* memory)
+{
+	MapParser parser;
+	initMapParser(&parser, mapData, mapDataLength, mapVersion, memory);
+
+	return getMap(&parser);
+}
+
+/*
+* Parallel parsing of a single map:
+* 
+* A pre-scan walks the input once and finds where every entity and every
+* brush starts. It classifies characters exactly like getToken does, so braces
+* inside comments, quoted strings or texture names are not miscounted, and it
+* counts lines the same way so warnings and errors report the same line numbers.
+* The properties of each entity are then parsed serially (they are tiny), while
+* the brushes are parsed in parallel, each with its own MapParser, and written
+* into pre-sized slots. That way the result is in source order and identical to getMap.
+*/
+struct EntityChunk
+{
+	int		pos;	// First character after the entity's '{'
+	int		lineNo;
+	size_t	firstBrush;
+	size_t	brushCount;
+};
+
+/*
+* Returns false if the input does not look like a well formed map. The caller
+* then falls back to the serial parser, which reports the actual error.
+*/
+static bool prescanMap(MapParser* p, std::vector<EntityChunk>* entities, std::vector<BrushChunk>* brushes)
+{
+	char* c = p->input;
+	int length = p->inputLength;
+	int pos = 0;
+	int lineNo = 1;
+	int depth = 0;
+	bool entityHasBrushes = false;
+
+	while (pos < length) {
+		char cur = c[pos];
+		if (isWhitespace(cur)) {
+			if (cur == '\n') lineNo++;
+			pos++;
+		}
+		else if (cur == '/') { // Comment, skip the rest of the line
+			while (pos < length && c[pos] != '\r' && c[pos] != '\n') {
+				pos++;
+			}
+		}
+		else if (cur == '{') {
+			if (depth == 0) {
+				entities->push_back({ pos + 1, lineNo, brushes->size(), 0 });
+				entityHasBrushes = false;
+			}
+			else if (depth == 1) {
+				brushes->push_back({ pos + 1, 0, lineNo });
+				entities->back().brushCount++;
+				entityHasBrushes = true;
+			}
+			else {
+				return false;
+			}
+			depth++; pos++;
+		}
+		else if (cur == '}') {
+			if (depth == 0) {
+				break; // getMap stops at the first token that is not an entity.
+			}
+			if (depth == 2) {
+				brushes->back().end = pos;
+			}
+			depth--; pos++;
+		}
+		else if (depth == 0) {
+			break;
+		}
+		else if (depth == 1 && (cur != '"' || entityHasBrushes)) {
+			return false; // Only properties, and only before the first brush.
+		}
+		else if (cur == '"') { // Strings do not count lines, just like getString.
+			pos++;
+			while (pos < length && c[pos] != '"') {
+				pos++;
+			}
+			pos++;
+		}
+		else if ((cur >= '0' && cur <= '9') || cur == '-') {
+			while (pos < length && isNumberChar(c[pos])) {
+				pos++;
+			}
+		}
+		else if (cur == '(' || cur == ')' || cur == '[' || cur == ']' || cur < 0x21 || cur > 0x7E) {
+			pos++;
+		}
+		else { // Texture name
+			while (pos < length && !isWhitespace(c[pos]) && c[pos] != '\0') {
+				pos++;
+			}
+		}
+	}
+
+	return depth == 0 && !entities->empty();
+}
+
+bool getMapParallel(char* mapData, size_t mapDataLength, MapVersion mapVersion, unsigned int threadCount, Map* map)
+{
+	MapParser parser;
+	initMapParser(&parser, mapData, mapDataLength, mapVersion);
+
+	std::vector<EntityChunk> entityChunks;
+	std::vector<BrushChunk> brushChunks;
+	if (!prescanMap(&parser, &entityChunks, &brushChunks)) {
+		*map = getMap(&parser);
+		return !parser.hasError;
+	}
+
+	*map = Map();
+	map->entities.resize(entityChunks.size());
+	for (size_t i = 0; i < entityChunks.size(); i++) {
+		MapParser entityParser = parser;
+		entityParser.pos = entityChunks[i].pos;
+		entityParser.lineNo = entityChunks[i].lineNo;
+		Entity* e = &map->entities[i];
+		while (getToken(&entityParser) == STRING) {
+			e->properties.push_back(getProperty(&entityParser));
+		}
+		if (entityParser.hasError) {
+			return false;
+		}
+		e->brushes.resize(entityChunks[i].brushCount);
+	}
+
+	std::vector<Brush*> brushSlots(brushChunks.size());
+	for (size_t i = 0; i < entityChunks.size(); i++) {
+		for (size_t j = 0; j < entityChunks[i].brushCount; j++) {
+			brushSlots[entityChunks[i].firstBrush + j] = &map->entities[i].brushes[j];
+		}
+	}
+
+	// 0: the brush parsed, else the line of its syntax error.
+	std::vector<int> brushEndLines(brushChunks.size());
+	std::vector<int> brushErrorLines(brushChunks.size());
+	parallelFor(brushChunks.size(), threadCount, [&](size_t i) {
+		MapParser brushParser = parser;
+		brushParser.pos = brushChunks[i].pos;
+		brushParser.lineNo = brushChunks[i].lineNo;
+		*brushSlots[i] = getBrushFaces(&brushParser);
+		brushEndLines[i] = brushParser.lineNo;
+		check(&brushParser, getToken(&brushParser), RBRACE);
+		brushErrorLines[i] = brushParser.hasError ? brushParser.errorLineNo : 0;
+	});
+
+	// Report in source order, so the log does not depend on the thread count.
+	for (size_t i = 0; i < brushChunks.size(); i++) {
+		if (brushErrorLines[i] != 0) {
+			return false;
+		}
+		checkBrushFaceCount(brushSlots[i]->faces.size(), brushEndLines[i]);
+	}
+
+	return true;
+}
+
+MapVersion getMapVersion(char* mapData, size_t mapDataLength, MapVersion fallback)
+{
+	MapParser parser;
+	initMapParser(&parser, mapData, mapDataLength);
+	if (getToken(&parser) != LBRACE) {
+		return fallback;
+	}
+	parser.pos++;
+
+	while (getToken(&parser) == STRING) {
+		std::string_view key = getString(&parser);
+		if (!check(&parser, getToken(&parser), STRING)) {
+			break;
+		}
+		std::string_view value = getString(&parser);
+		if (key == "mapversion") {
+			return value == "220" ? VALVE_220 : QUAKE;
+		}
+	}
+
+	return fallback;
+}
+
+bool getBrushChunks(char* mapData, size_t mapDataLength, std::vector<BrushChunk>* brushes)
+{
+	MapParser parser;
+	initMapParser(&parser, mapData, mapDataLength);
+	std::vector<EntityChunk> entityChunks;
+
+	return prescanMap(&parser, &entityChunks, brushes);
+}
+
+bool getBrushAt(char* mapData, size_t mapDataLength, MapVersion mapVersion, const BrushChunk& chunk, Brush* brush)
+{
+	MapParser parser;
+	initMapParser(&parser, mapData, mapDataLength, mapVersion);
+	parser.pos = chunk.pos;
+	parser.lineNo = chunk.lineNo;
+	*brush = getBrush(&parser);
+	check(&parser, getToken(&parser), RBRACE);
+
+	return !parser.hasError;
+}
+
+bool loadMapFile(const std::string& fileName, std::string* mapData)
+{
+	FILE* file = fopen(fileName.c_str(), "rb");
+	if (!file) {
+		return false;
+	}
+
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	mapData->resize(size > 0 ? size : 0);
+	size_t read = size > 0 ? fread(&(*mapData)[0], 1, size, file) : 0;
+	fclose(file);
+
+	return read == mapData->size();
+}
+
+bool getMaps(const std::vector<std::string>& mapFiles, MapVersion mapVersion, unsigned int threadCount, std::vector<Map>* maps)
+{
+	maps->clear();
+	maps->resize(mapFiles.size());
+	std::vector<char> isValid(mapFiles.size());
+
+	parallelFor(mapFiles.size(), threadCount, [&](size_t i) {
+		std::string mapData;
+		if (!loadMapFile(mapFiles[i], &mapData)) {
+			fprintf(stderr, "Unable to open file: %s!\n", mapFiles[i].c_str());
+			return;
+		}
+		MapParser parser;
+		initMapParser(&parser, &mapData[0], mapData.length(), mapVersion);
+		(*maps)[i] = getMap(&parser);
+		isValid[i] = !parser.hasError;
+	});
+
+	return std::find(isValid.begin(), isValid.end(), 0) == isValid.end();
+}
+
 #endif
 
 #endif
\ No newline at end of file
@@ -8,9 +8,15 @@
 #include <sstream>
 #include <vector>
 #include <unordered_map>
+#include <map>
 #include <set>
 #include <stack>
+#include <tuple>
 #include <algorithm>
+#include <chrono>
+#include <memory_resource>
+#include <filesystem>
+#include <thread>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -19,26 +25,23 @@
 #include <glm/ext.hpp>
 
 #include "polysoup.h"
-
-#define MAP_PARSER_IMPLEMENTATION
 #include "parser.h"
-
-#define PS_FLOAT_EPSILON	(0.0001)
-
-
-
-struct Polygon
-{
-	std::vector<glm::f64vec3>  vertices;
-	glm::f64vec3			   normal;
-};
-
-struct Plane
-{
-	glm::f64vec3 n;
-	glm::f64vec3 p0;
-	double d;		// = n dot p0. Just for convenience.
-};
+#include "bmap.h"
+#include "mapsoa.h"
+#include "weld.h"
+#include "csg.h"
+#include "bsp.h"
+#include "hull.h"
+#include "vis.h"
+#include "bvh.h"
+#include "light.h"
+#include "texture.h"
+#include "meshopt.h"
+#include "worldmesh.h"
+#include "export.h"
+#include "navmesh.h"
+#include "brushcache.h"
+#include "libpolysoup.h"
 
 static std::string loadTextFile(std::string file)
 {
@@ -56,7 +59,7 @@ static std::string loadTextFile(std::string file)
 	return data;
 }
 
-static void writePolys(std::string fileName, std::vector<Polygon> polys)
+static void writePolys(std::string fileName, const std::vector<Polygon>& polys)
 {
 	std::ofstream oFileStream;
 	oFileStream.open(fileName, std::ios::binary | std::ios::out);
@@ -73,276 +76,1532 @@ static void writePolys(std::string fileName, std::vector<Polygon> polys)
 	oFileStream.close();
 }
 
-static void writePolysOBJ(std::string fileName, std::vector<Polygon> polys)
+/*
+* Every vertex once, faces index them.
+*/
+static void writePolysOBJ(std::string fileName, const std::vector<Polygon>& polys)
+{
+	if (!exportOBJ(fileName.c_str(), getExportMesh(polys))) {
+		fprintf(stderr, "WARNING: Could not write %s!\n", fileName.c_str());
+	}
+}
+
+/*
+* Indexed mesh in a form that can be uploaded to the GPU as is:
+* uint32_t vertexCount, uint32_t indexCount, float[3] * vertexCount, uint32_t * indexCount
+*/
+static void writeIndexedMesh(std::string fileName, const IndexedMesh& mesh)
 {
-	std::stringstream faces;
 	std::ofstream oFileStream;
-	oFileStream.open(fileName, std::ios::out);
-	
-	oFileStream << "o Quake-map" << std::endl;
+	oFileStream.open(fileName, std::ios::binary | std::ios::out);
 
-	size_t count = 1;
-	for (auto p = polys.begin(); p != polys.end(); p++) {
-		faces << "f";
-		for (auto v = p->vertices.begin(); v != p->vertices.end(); v++) {
-			oFileStream << "v " << std::to_string(v->x) << " " << std::to_string(v->y) << " " << std::to_string(v->z) << std::endl;
-			faces << " " << count; count++;
+	uint32_t vertexCount = (uint32_t)mesh.vertices.size();
+	uint32_t indexCount = (uint32_t)mesh.indices.size();
+	oFileStream.write((char*)&vertexCount, sizeof(uint32_t));
+	oFileStream.write((char*)&indexCount, sizeof(uint32_t));
+
+	std::vector<glm::vec3> vertices(mesh.vertices.begin(), mesh.vertices.end());
+	oFileStream.write((char*)vertices.data(), vertices.size() * sizeof(glm::vec3));
+	oFileStream.write((char*)mesh.indices.data(), mesh.indices.size() * sizeof(uint32_t));
+
+	oFileStream.close();
+}
+
+static void writeIndexedMeshOBJ(std::string fileName, const IndexedMesh& mesh)
+{
+	if (!exportOBJ(fileName.c_str(), getExportMesh(mesh))) {
+		fprintf(stderr, "WARNING: Could not write %s!\n", fileName.c_str());
+	}
+}
+
+/*
+* Triangles grouped by material, one draw call per range:
+* uint32_t rangeCount, uint32_t triangleCount,
+* rangeCount * { uint32_t firstTriangle, uint32_t triangleCount, uint32_t nameLength, char[ nameLength ] name },
+* 3 * triangleCount * { float[3] position, float[2] texCoord (in texels) }
+*/
+static void writeMaterialMesh(std::string fileName, const std::vector<Polygon>& tris, const std::vector<MaterialRange>& ranges,
+	const std::vector<std::string>& materials)
+{
+	std::ofstream oFileStream;
+	oFileStream.open(fileName, std::ios::binary | std::ios::out);
+
+	uint32_t rangeCount = (uint32_t)ranges.size();
+	uint32_t triangleCount = (uint32_t)tris.size();
+	oFileStream.write((char*)&rangeCount, sizeof(uint32_t));
+	oFileStream.write((char*)&triangleCount, sizeof(uint32_t));
+	for (auto r = ranges.begin(); r != ranges.end(); r++) {
+		const std::string& name = materials[r->material];
+		uint32_t nameLength = (uint32_t)name.length();
+		oFileStream.write((char*)&r->first, sizeof(uint32_t));
+		oFileStream.write((char*)&r->count, sizeof(uint32_t));
+		oFileStream.write((char*)&nameLength, sizeof(uint32_t));
+		oFileStream.write(name.data(), nameLength);
+	}
+
+	std::vector<float> vertices;
+	vertices.reserve(tris.size() * 3 * 5);
+	for (auto t = tris.begin(); t != tris.end(); t++) {
+		for (auto v = t->vertices.begin(); v != t->vertices.end(); v++) {
+			glm::f64vec2 texCoord = getTexCoord(t->texture, *v);
+			vertices.insert(vertices.end(), { (float)v->x, (float)v->y, (float)v->z, (float)texCoord.x, (float)texCoord.y });
 		}
-		faces << std::endl;
 	}
+	oFileStream.write((char*)vertices.data(), vertices.size() * sizeof(float));
 
-	oFileStream << faces.rdbuf();
 	oFileStream.close();
-	
 }
 
-Plane createPlane(glm::f64vec3 p0, glm::f64vec3 p1, glm::f64vec3 p2)
+static bool facesAreEqual(const Face& lhs, const Face& rhs)
 {
-	glm::f64vec3 v0 = p2 - p0;
-	glm::f64vec3 v1 = p1 - p0;
-	glm::f64vec3 n = glm::normalize(glm::cross(v0, v1));
-	double d = -glm::dot(n, p0);
+	return !memcmp(lhs.vertices, rhs.vertices, sizeof(lhs.vertices))
+		&& lhs.textureName == rhs.textureName
+		&& lhs.xOffset == rhs.xOffset && lhs.yOffset == rhs.yOffset
+		&& lhs.rotation == rhs.rotation
+		&& lhs.xScale == rhs.xScale && lhs.yScale == rhs.yScale
+		&& lhs.tx1 == rhs.tx1 && lhs.ty1 == rhs.ty1 && lhs.tz1 == rhs.tz1 && lhs.tOffset1 == rhs.tOffset1
+		&& lhs.tx2 == rhs.tx2 && lhs.ty2 == rhs.ty2 && lhs.tz2 == rhs.tz2 && lhs.tOffset2 == rhs.tOffset2;
+}
 
-	return { n, p0, d };
+static bool mapsAreEqual(const Map& lhs, const Map& rhs)
+{
+	if (lhs.entities.size() != rhs.entities.size()) return false;
+	for (size_t e = 0; e < lhs.entities.size(); e++) {
+		const Entity& a = lhs.entities[e];
+		const Entity& b = rhs.entities[e];
+		if (a.properties.size() != b.properties.size() || a.brushes.size() != b.brushes.size()) return false;
+		for (size_t p = 0; p < a.properties.size(); p++) {
+			if (a.properties[p].key != b.properties[p].key || a.properties[p].value != b.properties[p].value) return false;
+		}
+		for (size_t br = 0; br < a.brushes.size(); br++) {
+			if (a.brushes[br].faces.size() != b.brushes[br].faces.size()) return false;
+			for (size_t f = 0; f < a.brushes[br].faces.size(); f++) {
+				if (!facesAreEqual(a.brushes[br].faces[f], b.brushes[br].faces[f])) return false;
+			}
+		}
+	}
+
+	return true;
 }
 
-static inline glm::f64vec3 convertVertexToVec3(Vertex v)
+/*
+* Times build(threads) on 1, 2, 4 .. threadCount threads, iterations times
+* each, and checks every result against the one of the first serial build.
+* Only the builds are timed. Returns the serial result, secondsPerBuild gets
+* the time of a serial build.
+*/
+template<typename Build, typename IsEqual>
+static auto benchmarkThreads(const char* name, unsigned int threadCount, int iterations, Build build, IsEqual isEqual,
+	double* serialSecondsPerBuild = nullptr) -> decltype(build(1u))
 {
-	return glm::f64vec3(v.x, v.y, v.z);
+	auto start = std::chrono::steady_clock::now();
+	auto serial = build(1u);
+	auto end = std::chrono::steady_clock::now();
+	double serialSeconds = std::chrono::duration<double>(end - start).count();
+
+	for (unsigned int threads = 1; threads <= threadCount; threads *= 2) {
+		bool isIdentical = true;
+		double seconds = threads == 1 ? serialSeconds : 0.0;
+		for (int i = threads == 1 ? 1 : 0; i < iterations; i++) {
+			start = std::chrono::steady_clock::now();
+			auto result = build(threads);
+			end = std::chrono::steady_clock::now();
+			seconds += std::chrono::duration<double>(end - start).count();
+			isIdentical &= isEqual(result, serial);
+		}
+		seconds /= iterations;
+		if (threads == 1) {
+			serialSeconds = seconds;
+		}
+		printf("%s: %2u threads, %.3f ms, speedup %.2fx, %s\n",
+			name, threads, 1000.0 * seconds, serialSeconds / seconds, isIdentical ? "identical to serial" : "DIFFERENT FROM SERIAL");
+	}
+	if (serialSecondsPerBuild) {
+		*serialSecondsPerBuild = serialSeconds;
+	}
+
+	return serial;
 }
 
-Plane convertFaceToPlane(Face face)
+/*
+* Parses the map a couple of times and reports the throughput of the parser,
+* serial and chunked parallel. Run with: polysoup <mapfile> -bench [-threads N]
+*/
+static void benchmarkParser(std::string& mapData, MapVersion mapVersion, unsigned int threadCount)
 {
-	glm::f64vec3 p0 = convertVertexToVec3(face.vertices[0]);
-	glm::f64vec3 p1 = convertVertexToVec3(face.vertices[1]);
-	glm::f64vec3 p2 = convertVertexToVec3(face.vertices[2]);
-	return createPlane(p0, p1, p2);
+	const int iterations = 20;
+	size_t brushCount = 0;
+	double megabytes = (double)mapData.length() * iterations / (1024.0 * 1024.0);
+
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < iterations; i++) {
+		Map map = getMap(&mapData[0], mapData.length(), mapVersion);
+		for (auto e = map.entities.begin(); e != map.entities.end(); e++) {
+			brushCount += e->brushes.size();
+		}
+	}
+	auto end = std::chrono::steady_clock::now();
+
+	double seconds = std::chrono::duration<double>(end - start).count();
+	printf("parser: %d iterations, %zu brushes, %.3f ms per parse, %.1f MB/s\n",
+		iterations, brushCount / iterations, 1000.0 * seconds / iterations, megabytes / seconds);
+
+	Map serialMap = getMap(&mapData[0], mapData.length(), mapVersion);
+	Map parallelMap = benchmarkThreads("parser", threadCount, iterations, [&](unsigned int threads) {
+		Map map;
+		getMapParallel(&mapData[0], mapData.length(), mapVersion, threads, &map);
+		return map;
+	}, mapsAreEqual);
+	printf("parser: chunked on 1 thread %s\n", mapsAreEqual(serialMap, parallelMap) ? "identical to getMap" : "DIFFERENT FROM getMap");
 }
 
-bool intersectThreePlanes(Plane p0, Plane p1, Plane p2, glm::f64vec3* intersectionPoint)
-{	
-	glm::f64vec3 n0xn1 = glm::cross(p0.n, p1.n);
-	double det = glm::dot(n0xn1, p2.n);
+/*
+* Bytes held by a parsed Map (strings that fit into the small string buffer
+* do not add anything).
+*/
+static size_t getMapMemory(const Map& map)
+{
+	size_t bytes = sizeof(Map) + map.entities.capacity() * sizeof(Entity);
+	for (auto e = map.entities.begin(); e != map.entities.end(); e++) {
+		bytes += e->properties.capacity() * sizeof(Property) + e->brushes.capacity() * sizeof(Brush);
+		for (auto p = e->properties.begin(); p != e->properties.end(); p++) {
+			bytes += getStringHeapMemory(p->key) + getStringHeapMemory(p->value);
+		}
+		for (auto b = e->brushes.begin(); b != e->brushes.end(); b++) {
+			bytes += b->faces.capacity() * sizeof(Face);
+			for (auto f = b->faces.begin(); f != b->faces.end(); f++) {
+				bytes += getStringHeapMemory(f->textureName);
+			}
+		}
+	}
 
-	if (fabs(det) < PS_FLOAT_EPSILON) // Early out if planes do not intersect at single point
-		return false;
+	return bytes;
+}
 
-	*intersectionPoint = (
-		-p0.d * (glm::cross(p1.n, p2.n))
-		-p1.d * (glm::cross(p2.n, p0.n))
-		-p2.d * (glm::cross(p0.n, p1.n))
-		) / det;
+/*
+* Map tree + createPolysoup vs. createPolysoupStreaming.
+*/
+static void benchmarkStreaming(std::string& mapData, MapVersion mapVersion)
+{
+	const int iterations = 5;
+	size_t mapBytes = 0;
+	size_t treePolyCount = 0;
+	size_t streamPolyCount = 0;
+
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < iterations; i++) {
+		Map map = getMap(&mapData[0], mapData.length(), mapVersion);
+		mapBytes = getMapMemory(map);
+		treePolyCount = createPolysoup(map).size();
+	}
+	auto end = std::chrono::steady_clock::now();
+	double treeSeconds = std::chrono::duration<double>(end - start).count() / iterations;
+
+	start = std::chrono::steady_clock::now();
+	for (int i = 0; i < iterations; i++) {
+		std::vector<Polygon> polys;
+		createPolysoupStreaming(&mapData[0], mapData.length(), mapVersion, &polys);
+		streamPolyCount = polys.size();
+	}
+	end = std::chrono::steady_clock::now();
+	double streamSeconds = std::chrono::duration<double>(end - start).count() / iterations;
+
+	printf("map tree:  %.3f ms, %zu polys, Map holds %.1f KB\n", 1000.0 * treeSeconds, treePolyCount, mapBytes / 1024.0);
+	printf("streaming: %.3f ms, %zu polys, one Brush at a time\n", 1000.0 * streamSeconds, streamPolyCount);
+}
+
+/*
+* Time spent in each stage of the default pipeline (without the .bmap cache).
+*/
+static void benchmarkStages(std::string& mapData, MapVersion mapVersion)
+{
+	const int iterations = 5;
+	double parseMs = 0.0, polysoupMs = 0.0, triangulateMs = 0.0, writeMs = 0.0;
+
+	for (int i = 0; i < iterations; i++) {
+		auto t0 = std::chrono::steady_clock::now();
+		Map map = getMap(&mapData[0], mapData.length(), mapVersion);
+		auto t1 = std::chrono::steady_clock::now();
+		std::vector<Polygon> polysoup = createPolysoup(map);
+		auto t2 = std::chrono::steady_clock::now();
+		std::vector<Polygon> tris = triangulate(polysoup);
+		auto t3 = std::chrono::steady_clock::now();
+		writePolys("tris.bin", tris);
+		writePolysOBJ("tris.obj", tris);
+		auto t4 = std::chrono::steady_clock::now();
+
+		parseMs += std::chrono::duration<double, std::milli>(t1 - t0).count();
+		polysoupMs += std::chrono::duration<double, std::milli>(t2 - t1).count();
+		triangulateMs += std::chrono::duration<double, std::milli>(t3 - t2).count();
+		writeMs += std::chrono::duration<double, std::milli>(t4 - t3).count();
+	}
+
+	printf("stages: parse %.3f ms, createPolysoup %.3f ms, triangulate %.3f ms, write %.3f ms\n",
+		parseMs / iterations, polysoupMs / iterations, triangulateMs / iterations, writeMs / iterations);
+}
+
+static bool polysAreEqual(const std::vector<Polygon>& lhs, const std::vector<Polygon>& rhs)
+{
+	if (lhs.size() != rhs.size()) {
+		return false;
+	}
+	for (size_t i = 0; i < lhs.size(); i++) {
+		if (lhs[i].vertices.size() != rhs[i].vertices.size()
+			|| memcmp(lhs[i].vertices.data(), rhs[i].vertices.data(), lhs[i].vertices.size() * sizeof(glm::f64vec3))
+			|| memcmp(&lhs[i].normal, &rhs[i].normal, sizeof(glm::f64vec3))
+			|| lhs[i].texture.material != rhs[i].texture.material
+			|| lhs[i].texture.s != rhs[i].texture.s || lhs[i].texture.t != rhs[i].texture.t) {
+			return false;
+		}
+	}
 
 	return true;
 }
 
-bool vec3IsEqual(const glm::f64vec3& lhs, const glm::f64vec3& rhs) {
-	return ( glm::abs(lhs.x - rhs.x) < PS_FLOAT_EPSILON 
-		&& glm::abs(lhs.y - rhs.y) < PS_FLOAT_EPSILON
-		&& glm::abs(lhs.z - rhs.z) < PS_FLOAT_EPSILON );
+/*
+* createPolysoup on 1..threadCount threads, checked against the serial result.
+*/
+static void benchmarkPolysoupThreads(std::string& mapData, MapVersion mapVersion, unsigned int threadCount)
+{
+	const int iterations = 5;
+
+	Map map = getMap(&mapData[0], mapData.length(), mapVersion);
+	benchmarkThreads("createPolysoup", threadCount, iterations,
+		[&](unsigned int threads) { return createPolysoup(map, threads); }, polysAreEqual);
 }
 
-void insertVertexToPolygon(glm::f64vec3 v, Polygon* p)
+/*
+* Triangle soup vs. welded, indexed mesh: vertex counts and file sizes.
+*/
+static void benchmarkWeld(std::string& mapData, MapVersion mapVersion)
 {
-	auto v0 = p->vertices.begin();
-	if (v0 == p->vertices.end()) {
-		p->vertices.push_back(v);
-		return;
+	const int iterations = 5;
+
+	Map map = getMap(&mapData[0], mapData.length(), mapVersion);
+	std::vector<Polygon> tris = triangulate(createPolysoup(map));
+
+	IndexedMesh mesh;
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < iterations; i++) {
+		mesh = weldTriangles(tris);
 	}
+	auto end = std::chrono::steady_clock::now();
+	double seconds = std::chrono::duration<double>(end - start).count() / iterations;
 
-	for (; v0 != p->vertices.end(); v0++) {
-		if (vec3IsEqual(v, *v0)) { // TODO: Is this check actually needed??
-			return;
+	writePolys("tris.bin", tris);
+	writePolysOBJ("tris.obj", tris);
+	writeIndexedMesh("mesh.bin", mesh);
+	writeIndexedMeshOBJ("mesh.obj", mesh);
+
+	printf("weld: %.3f ms, %zu -> %zu vertices, tris.bin %.1f KB -> mesh.bin %.1f KB, tris.obj %.1f KB -> mesh.obj %.1f KB\n",
+		1000.0 * seconds, 3 * tris.size(), mesh.vertices.size(),
+		std::filesystem::file_size("tris.bin") / 1024.0, std::filesystem::file_size("mesh.bin") / 1024.0,
+		std::filesystem::file_size("tris.obj") / 1024.0, std::filesystem::file_size("mesh.obj") / 1024.0);
+}
+
+/*
+* Draw calls: one per polygon vs. one per material range.
+*/
+static void benchmarkMaterials(std::string& mapData, MapVersion mapVersion)
+{
+	Map map = getMap(&mapData[0], mapData.length(), mapVersion);
+	std::vector<std::string> materials;
+	std::vector<Polygon> polysoup = createPolysoup(map, 1, false, &materials);
+	std::vector<Polygon> tris = triangulate(polysoup);
+
+	auto start = std::chrono::steady_clock::now();
+	std::vector<MaterialRange> ranges = sortByMaterial(&tris);
+	auto end = std::chrono::steady_clock::now();
+
+	printf("materials: %zu textures, %zu polys -> %zu material ranges, sort %.3f ms\n", materials.size(), polysoup.size(), ranges.size(),
+		std::chrono::duration<double, std::milli>(end - start).count());
+}
+
+/*
+* Exporters against writing the same number of bytes with one fwrite,
+* which is as fast as the disk (or the page cache) takes them.
+*/
+static void benchmarkExport(std::string& mapData, MapVersion mapVersion)
+{
+	const int iterations = 5;
+
+	Map map = getMap(&mapData[0], mapData.length(), mapVersion);
+	std::vector<std::string> materials;
+	std::vector<Polygon> tris = triangulate(createPolysoup(map, 1, false, &materials));
+	std::vector<MaterialRange> ranges = sortByMaterial(&tris);
+	ExportMesh mesh = getExportMesh(tris, &ranges, &materials);
+
+	const char* fileNames[] = { "export.obj", "export.glb" };
+	for (int f = 0; f < 2; f++) {
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < iterations; i++) {
+			exportMesh(fileNames[f], mesh);
+		}
+		auto end = std::chrono::steady_clock::now();
+		double seconds = std::chrono::duration<double>(end - start).count() / iterations;
+		size_t size = std::filesystem::file_size(fileNames[f]);
+
+		// Into a file of its own, the exported one stays.
+		const char* scratchFileName = "export.tmp";
+		std::vector<char> bytes(size);
+		start = std::chrono::steady_clock::now();
+		for (int i = 0; i < iterations; i++) {
+			FILE* file = fopen(scratchFileName, "wb");
+			if (file) {
+				fwrite(bytes.data(), 1, bytes.size(), file);
+				fclose(file);
+			}
 		}
+		end = std::chrono::steady_clock::now();
+		double rawSeconds = std::chrono::duration<double>(end - start).count() / iterations;
+		remove(scratchFileName);
+
+		printf("export %s: %zu vertices, %zu tris, %.1f KiB, %.3f ms (%.0f MiB/s), plain fwrite %.3f ms\n",
+			fileNames[f], mesh.positions.size(), mesh.indices.size() / 3, size / 1024.0,
+			1000.0 * seconds, size / (1024.0 * 1024.0) / seconds, 1000.0 * rawSeconds);
 	}
-	
-	p->vertices.push_back(v);
 }
 
-bool isPointInsideBrush(Brush brush, glm::f64vec3 intersectionPoint)
+/*
+* Transformed vertices per triangle over all draws, see getACMR.
+*/
+static double getWorldMeshACMR(const WorldMesh& mesh)
 {
-	for (int i = 0; i < brush.faces.size(); i++) {
-		Face face = brush.faces[i];
-		Plane plane = convertFaceToPlane(face);
-		glm::f64vec3 a = glm::normalize(intersectionPoint - plane.p0);
-		double dotProd = glm::dot(plane.n, a);
-		if (glm::dot(plane.n, intersectionPoint) + plane.d > PS_FLOAT_EPSILON) // FIXME: HOW DO WE GET IT NUMERICALLY GOOD ENOUGH??
-			return false;
+	double misses = 0.0;
+	for (auto d = mesh.draws.begin(); d != mesh.draws.end(); d++) {
+		std::vector<uint32_t> indices(mesh.indices.begin() + d->firstIndex, mesh.indices.begin() + d->firstIndex + d->indexCount);
+		misses += getACMR(indices.data(), indices.size(), d->vertexCount) * (d->indexCount / 3);
 	}
 
-	return true;
+	return mesh.indices.empty() ? 0.0 : misses / (mesh.indices.size() / 3);
 }
 
-std::vector<Polygon> createPolysoup(Map map)
+/*
+* Navigation mesh on 1..threadCount threads (checked against the serial
+* result), its size, how well the tiles fit (portal edges should meet the
+* portal edges of the tile next to them) and whether the monsters of the map
+* have somewhere to walk.
+*/
+static void benchmarkNavMesh(std::string& mapData, MapVersion mapVersion, unsigned int threadCount)
 {
-	std::vector<Polygon> polys;
+	const int iterations = 3;
+
+	Map map = getMap(&mapData[0], mapData.length(), mapVersion);
+	std::vector<std::string> materials;
+	std::vector<Polygon> tris = triangulate(createPolysoup(map, 1, true, &materials));
+
+	auto navMeshesAreEqual = [](const NavMesh& lhs, const NavMesh& rhs) {
+		bool isEqual = lhs.tiles.size() == rhs.tiles.size();
+		for (size_t t = 0; t < lhs.tiles.size() && isEqual; t++) {
+			const NavMeshTile& l = lhs.tiles[t];
+			const NavMeshTile& r = rhs.tiles[t];
+			isEqual = l.x == r.x && l.y == r.y && l.vertices.size() == r.vertices.size() && l.polys.size() == r.polys.size()
+				&& !memcmp(l.vertices.data(), r.vertices.data(), l.vertices.size() * sizeof(NavMeshVertex))
+				&& !memcmp(l.polys.data(), r.polys.data(), l.polys.size() * sizeof(NavMeshPoly));
+		}
+		return isEqual;
+	};
+
+	NavMesh serial = benchmarkThreads("navmesh", threadCount, iterations,
+		[&](unsigned int threads) { return buildNavMesh(tris, materials, threads); }, navMeshesAreEqual);
+
+	// Portal edges by tile and side, as intervals along the side.
+	const int size = PS_NAV_TILE_CELLS;
+	std::map<std::tuple<int, int, int>, std::vector<std::pair<int, int>>> portals;
+	size_t polyCount = 0, vertexCount = 0, polyVertexCount = 0, clockwiseCount = 0, outsideCount = 0;
+	double area = 0.0;
+	for (auto t = serial.tiles.begin(); t != serial.tiles.end(); t++) {
+		polyCount += t->polys.size();
+		vertexCount += t->vertices.size();
+		for (auto v = t->vertices.begin(); v != t->vertices.end(); v++) {
+			outsideCount += v->x > size || v->y > size;
+		}
+		for (auto p = t->polys.begin(); p != t->polys.end(); p++) {
+			polyVertexCount += p->vertexCount;
+			double polyArea = 0.0;
+			for (int i = 0; i < p->vertexCount; i++) {
+				const NavMeshVertex& a = t->vertices[p->vertices[i]];
+				const NavMeshVertex& b = t->vertices[p->vertices[(i + 1) % p->vertexCount]];
+				polyArea += 0.5 * ((double)a.x * b.y - (double)b.x * a.y);
+				if (p->neighbors[i] != NAVMESH_NO_NEIGHBOR && (p->neighbors[i] & NAVMESH_PORTAL)) {
+					int side = p->neighbors[i] & 3;
+					int along0 = (side & 1) ? a.x : a.y, along1 = (side & 1) ? b.x : b.y;
+					portals[{ t->x, t->y, side }].push_back({ std::min(along0, along1), std::max(along0, along1) });
+				}
+			}
+			clockwiseCount += polyArea <= 0.0;
+			area += polyArea * PS_NAV_CELL_SIZE * PS_NAV_CELL_SIZE;
+		}
+	}
+	size_t portalCount = 0;
+	double portalLength = 0.0, coveredLength = 0.0;
+	const int sideX[4] = { -1, 0, 1, 0 }, sideY[4] = { 0, 1, 0, -1 };
+	for (auto p = portals.begin(); p != portals.end(); p++) {
+		int side = std::get<2>(p->first);
+		auto other = portals.find({ std::get<0>(p->first) + sideX[side], std::get<1>(p->first) + sideY[side], (side + 2) & 3 });
+		for (auto e = p->second.begin(); e != p->second.end(); e++) {
+			double covered = 0.0;
+			for (size_t o = 0; other != portals.end() && o < other->second.size(); o++) {
+				covered += std::max(std::min(e->second, other->second[o].second) - std::max(e->first, other->second[o].first), 0);
+			}
+			portalCount++;
+			portalLength += e->second - e->first;
+			coveredLength += std::min(covered, (double)(e->second - e->first));
+		}
+	}
+
+	// Monsters and player starts should stand on a polygon, their feet are 24 units below their origin.
+	size_t agentCount = 0, standingCount = 0;
 	for (auto e = map.entities.begin(); e != map.entities.end(); e++) {
-		for (auto b = e->brushes.begin(); b != e->brushes.end(); b++) {
-			int faceCount = b->faces.size();
-			for (int i = 0; i <  faceCount; i++) {
-				Plane p0 = convertFaceToPlane(b->faces[i]);
-				Polygon poly = {};
-				poly.normal = p0.n;
-				for (int j = 0; j < faceCount; j++) {
-					Plane p1 = convertFaceToPlane(b->faces[j]);
-					for (int k = 0; k < faceCount; k++) {
-						glm::f64vec3 intersectionPoint;
-						Plane p2 = convertFaceToPlane(b->faces[k]);
-						if (i != j != k) {
-							if (intersectThreePlanes(p0, p1, p2, &intersectionPoint)) {
-								if (isPointInsideBrush(*b, intersectionPoint)) {
-									// TODO: Calculate texture coordinates
-									insertVertexToPolygon(intersectionPoint, &poly);
-								}
-							}
-						}
-					}
+		std::string classname, origin;
+		for (auto p = e->properties.begin(); p != e->properties.end(); p++) {
+			if (p->key == "classname") classname = p->value;
+			if (p->key == "origin") origin = p->value;
+		}
+		glm::f64vec3 feet;
+		if ((classname.rfind("monster_", 0) && classname.rfind("info_player", 0))
+			|| sscanf(origin.c_str(), "%lf %lf %lf", &feet.x, &feet.y, &feet.z) != 3) {
+			continue;
+		}
+		feet.z -= 24.0;
+		agentCount++;
+		glm::f64vec3 cell = (feet - serial.origin) / glm::f64vec3(PS_NAV_CELL_SIZE, PS_NAV_CELL_SIZE, PS_NAV_CELL_HEIGHT);
+		bool isStanding = false;
+		for (auto t = serial.tiles.begin(); t != serial.tiles.end() && !isStanding; t++) {
+			double x = cell.x - t->x * size, y = cell.y - t->y * size;
+			if (x < 0.0 || y < 0.0 || x > size || y > size) {
+				continue;
+			}
+			for (auto p = t->polys.begin(); p != t->polys.end() && !isStanding; p++) {
+				bool isInside = true;
+				int minH = INT_MAX, maxH = INT_MIN;
+				for (int i = 0; i < p->vertexCount; i++) {
+					const NavMeshVertex& a = t->vertices[p->vertices[i]];
+					const NavMeshVertex& b = t->vertices[p->vertices[(i + 1) % p->vertexCount]];
+					isInside &= (b.x - a.x) * (y - a.y) - (b.y - a.y) * (x - a.x) >= 0.0;
+					minH = std::min<int>(minH, a.h);
+					maxH = std::max<int>(maxH, a.h);
 				}
-				if (poly.vertices.size() > 0)
-					polys.push_back(poly);
+				const double climb = PS_NAV_AGENT_CLIMB / PS_NAV_CELL_HEIGHT;
+				isStanding = isInside && cell.z >= minH - climb && cell.z <= maxH + climb;
 			}
 		}
+		standingCount += isStanding;
 	}
 
-	return polys;
+	writeNavMesh("navmesh.bin", serial);
+	printf("navmesh: %zu of %u x %u tiles, %zu polys, %.1f vertices per poly, %zu vertices, %.0f units^2 walkable, "
+		"%zu clockwise, %zu outside their tile, navmesh.bin %.1f KB\n",
+		serial.tiles.size(), serial.tilesX, serial.tilesY, polyCount, polyCount ? (double)polyVertexCount / polyCount : 0.0,
+		vertexCount, area, clockwiseCount, outsideCount, std::filesystem::file_size("navmesh.bin") / 1024.0);
+	printf("navmesh: %zu portal edges, %.1f%% of their length meets the next tile, %zu of %zu monsters and player starts stand on a polygon\n",
+		portalCount, portalLength > 0.0 ? 100.0 * coveredLength / portalLength : 100.0, standingCount, agentCount);
 }
 
-bool isAngleLegal(glm::f64vec3 center, glm::f64vec3 v0, glm::f64vec3 v1)
+/*
+* world.mesh: shared vertices per draw, float vs. quantized, and what the
+* index order does to the vertex cache.
+*/
+static void benchmarkWorldMesh(std::string& mapData, MapVersion mapVersion)
 {
-	Plane polyPlane = createPlane(center, v0, v1);
-	glm::f64vec3 b = glm::normalize(v1 - center);
-	Plane p = createPlane(center, v0, center + polyPlane.n);
-	if (glm::dot(p.n, b) < -0.00001) {
-		return false;
-	}
+	Map map = getMap(&mapData[0], mapData.length(), mapVersion);
+	std::vector<std::string> materials;
+	std::vector<Polygon> tris = triangulate(createPolysoup(map, 1, false, &materials));
+	std::vector<MaterialRange> ranges = sortByMaterial(&tris);
 
-	return true;
+	WorldMesh unoptimizedMesh = buildWorldMesh(tris, ranges, materials, false, false);
+	auto start = std::chrono::steady_clock::now();
+	WorldMesh mesh = buildWorldMesh(tris, ranges, materials);
+	auto end = std::chrono::steady_clock::now();
+	writeWorldMesh("world.mesh", mesh);
+	size_t floatSize = std::filesystem::file_size("world.mesh");
+	mesh.isQuantized = true;
+	writeWorldMesh("world.mesh", mesh);
+	size_t quantizedSize = std::filesystem::file_size("world.mesh");
+
+	printf("world mesh: %zu tris, %zu vertices -> %zu, %zu draws, build %.3f ms, %.1f KiB float, %.1f KiB quantized\n",
+		tris.size(), 3 * tris.size(), mesh.vertices.size(), mesh.draws.size(),
+		std::chrono::duration<double, std::milli>(end - start).count(), floatSize / 1024.0, quantizedSize / 1024.0);
+	printf("world mesh ACMR (FIFO %d): unoptimized %.3f, optimized %.3f, lower bound %.3f\n",
+		PS_MESHOPT_FIFO_SIZE, getWorldMeshACMR(unoptimizedMesh), getWorldMeshACMR(mesh),
+		tris.empty() ? 0.0 : (double)mesh.vertices.size() / tris.size());
 }
 
-double getAngle(glm::f64vec3 center, glm::f64vec3 v0, glm::f64vec3 v1)
+/*
+* Triangles with and without hidden/outside face removal.
+*/
+static void benchmarkCull(std::string& mapData, MapVersion mapVersion)
 {
-	glm::f64vec3 a = glm::normalize(v0 - center);
-	glm::f64vec3 b = glm::normalize(v1 - center);
+	Map map = getMap(&mapData[0], mapData.length(), mapVersion);
+	size_t triCount = triangulate(createPolysoup(map)).size();
+
+	auto start = std::chrono::steady_clock::now();
+	std::vector<Polygon> polysoup = createPolysoup(map, 1, true);
+	auto end = std::chrono::steady_clock::now();
+	size_t culledTriCount = triangulate(polysoup).size();
+
+	printf("cull: %zu -> %zu tris (%.1f%% removed), createPolysoup with culling %.3f ms\n",
+		triCount, culledTriCount, 100.0 * (1.0 - (double)culledTriCount / triCount),
+		std::chrono::duration<double, std::milli>(end - start).count());
+}
 
-	return glm::dot(a, b);
+/*
+* BSP: build time on 1..threadCount threads (checked against the serial tree),
+* what the split weight does to splits and depth, and point-in-leaf queries.
+*/
+static bool bspTreesAreEqual(const BSPTree& lhs, const BSPTree& rhs)
+{
+	return lhs.planes.size() == rhs.planes.size() && lhs.nodes.size() == rhs.nodes.size()
+		&& lhs.leaves.size() == rhs.leaves.size() && lhs.faces.size() == rhs.faces.size()
+		&& (lhs.planes.empty() || !memcmp(&lhs.planes[0], &rhs.planes[0], lhs.planes.size() * sizeof(Plane)))
+		&& (lhs.nodes.empty() || !memcmp(&lhs.nodes[0], &rhs.nodes[0], lhs.nodes.size() * sizeof(BSPNode)))
+		&& (lhs.leaves.empty() || !memcmp(&lhs.leaves[0], &rhs.leaves[0], lhs.leaves.size() * sizeof(BSPLeaf)))
+		&& (lhs.faces.empty() || !memcmp(&lhs.faces[0], &rhs.faces[0], lhs.faces.size() * sizeof(BSPFace)));
 }
 
-Polygon sortVerticesCCW(Polygon poly)
+static void benchmarkBSP(std::string& mapData, MapVersion mapVersion, unsigned int threadCount)
 {
-	Polygon result;
-	size_t vertCount = poly.vertices.size();
-	
-	if (vertCount < 3)
-		return poly; // Actually not a valid polygon
+	const int iterations = 3;
+	const int queryCount = 1000000;
 
-	// Center of poly
-	glm::f64vec3 center(0.0f);
-	for (auto v = poly.vertices.begin(); v != poly.vertices.end(); v++) {
-		center += *v;
+	Map map = getMap(&mapData[0], mapData.length(), mapVersion);
+	std::vector<Polygon> polysoup = createPolysoup(map, 1, true);
+	WorldSolids world;
+	getWorldSolids(map, 1, &world);
+	BSPTree serialTree = benchmarkThreads("bsp", threadCount, iterations,
+		[&](unsigned int threads) { return buildBSP(polysoup, world.solids, threads); }, bspTreesAreEqual);
+
+	int weights[] = { 0, 1, 4, PS_BSP_SPLIT_WEIGHT, 32 };
+	for (size_t i = 0; i < sizeof(weights) / sizeof(weights[0]); i++) {
+		BSPTree tree = buildBSP(polysoup, world.solids, 1, weights[i]);
+		int maxDepth;
+		double averageDepth;
+		getBSPDepth(tree, &maxDepth, &averageDepth);
+		printf("bsp: split weight %2d, %zu polys, %u splits, %zu nodes, %zu leaves, %zu planes, depth max %d avg %.1f\n",
+			weights[i], polysoup.size(), tree.splitCount, tree.nodes.size(), tree.leaves.size(), tree.planes.size(),
+			maxDepth, averageDepth);
 	}
-	center /= vertCount;
 
-	size_t closestVertexID = 0;
-	for (size_t i = 0; i < vertCount-1; i++) {
-		glm::f64vec3 v0 = poly.vertices[i]; // Find next vertex to v0 with smallest angle
+	glm::f64vec3 min(INFINITY), max(-INFINITY);
+	for (auto p = polysoup.begin(); p != polysoup.end(); p++) {
+		for (auto v = p->vertices.begin(); v != p->vertices.end(); v++) {
+			min = glm::min(min, *v);
+			max = glm::max(max, *v);
+		}
+	}
+	std::vector<glm::f64vec3> points(queryCount);
+	uint32_t random = 1;
+	for (auto p = points.begin(); p != points.end(); p++) {
+		for (int a = 0; a < 3; a++) {
+			random = random * 1664525u + 1013904223u;
+			(*p)[a] = min[a] + (max[a] - min[a]) * (random >> 8) / (double)(1 << 24);
+		}
+	}
 
-		// Plane definition:
-		// glm::f64vec3 v0 = p2 - p0;
-		// glm::f64vec3 v1 = p1 - p0;
-		// glm::f64vec3 n = glm::normalize(glm::cross(v0, v1));
-		Plane plane = createPlane(center, v0, center + poly.normal);
+	uint64_t leafSum = 0;
+	size_t solidCount = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (auto p = points.begin(); p != points.end(); p++) {
+		uint32_t leaf = findBSPLeaf(serialTree, *p);
+		leafSum += leaf;
+		solidCount += serialTree.leaves[leaf].contents == BSP_SOLID;
+	}
+	auto end = std::chrono::steady_clock::now();
 
-		int smallesAngleIndex = 0;
-		double smallestAngle = -1.0;
-		for (size_t j = i+1; j < vertCount; j++) {
-			glm::f64vec3 test = glm::normalize(poly.vertices[j] - center);
-			if (glm::dot(plane.n, test) < -PS_FLOAT_EPSILON) { // check if point is legal
-				double angle = getAngle(center, v0, poly.vertices[j]);
-				if (angle > smallestAngle) {
-					smallestAngle = angle;
-					smallesAngleIndex = j;
-				}
+	writeBSP("world.bsp", serialTree);
+	printf("bsp: findBSPLeaf %.1f ns per query, %.1f%% of the bounds solid, world.bsp %.1f KB (checksum %llu)\n",
+		std::chrono::duration<double, std::nano>(end - start).count() / queryCount, 100.0 * solidCount / queryCount,
+		std::filesystem::file_size("world.bsp") / 1024.0, (unsigned long long)leafSum);
+}
+
+/*
+* Collision hulls: build time, brushes and bevel planes per hull, box traces
+* through the tree against clipping every brush. Both must hit the same,
+* hull 0 must agree with the BSP on what is solid, and no trace may end where
+* its box is stuck in a brush.
+*/
+static void benchmarkHulls(std::string& mapData, MapVersion mapVersion, unsigned int threadCount)
+{
+	const int iterations = 3;
+	const int traceCount = 200000;
+	const double traceLength = 256.0;
+
+	Map map = getMap(&mapData[0], mapData.length(), mapVersion);
+	std::vector<Polygon> polysoup = createPolysoup(map, 1, true);
+	WorldSolids world;
+	getWorldSolids(map, 1, &world);
+	BSPTree tree = buildBSP(polysoup, world.solids, 1);
+
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < iterations; i++) {
+		buildCollisionHulls(world.solids, &tree, threadCount);
+	}
+	auto end = std::chrono::steady_clock::now();
+	printf("hulls: %.3f ms on %u threads, %zu solids, %zu brush planes, %zu KB\n",
+		1000.0 * std::chrono::duration<double>(end - start).count() / iterations, threadCount, world.solids.size(),
+		tree.brushPlanes.size(), (tree.brushes.size() * sizeof(BSPBrush) + tree.brushPlanes.size() * sizeof(BSPFilePlane)) / 1024);
+
+	uint32_t random = 1;
+	auto getRandomPoint = [&]() {
+		glm::f64vec3 p;
+		for (int a = 0; a < 3; a++) {
+			random = random * 1664525u + 1013904223u;
+			p[a] = tree.bounds.min[a] + (tree.bounds.max[a] - tree.bounds.min[a]) * (random >> 8) / (double)(1 << 24);
+		}
+		return p;
+	};
+
+	size_t disagreeCount = 0;
+	for (int i = 0; i < traceCount; i++) {
+		glm::f64vec3 p = getRandomPoint();
+		bool isSolid = tree.leaves[findBSPLeaf(tree, p)].contents == BSP_SOLID;
+		disagreeCount += traceCollisionHull(tree, 0, p, p).startSolid != isSolid;
+	}
+	printf("hulls: hull 0 and the BSP disagree on %.3f%% of %d points (surface epsilon)\n", 100.0 * disagreeCount / traceCount, traceCount);
+
+	for (int h = 0; h < (int)tree.hulls.size(); h++) {
+		const BSPHull& hull = tree.hulls[h];
+		std::vector<std::pair<glm::f64vec3, glm::f64vec3>> segments;
+		while ((int)segments.size() < traceCount) {
+			glm::f64vec3 a = getRandomPoint();
+			glm::f64vec3 b = getRandomPoint() - a;
+			if (!traceCollisionHull(tree, h, a, a).startSolid && glm::length(b) > 0.0) {
+				segments.push_back({ a, a + traceLength * glm::normalize(b) });
+			}
+		}
+
+		std::vector<HullTrace> traces(segments.size()), allBrushTraces(segments.size());
+		start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < segments.size(); i++) {
+			traces[i] = traceCollisionHull(tree, h, segments[i].first, segments[i].second);
+		}
+		end = std::chrono::steady_clock::now();
+		double seconds = std::chrono::duration<double>(end - start).count();
+
+		start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < segments.size(); i++) {
+			allBrushTraces[i] = { 1.0, glm::f64vec3(0.0), false };
+			for (uint32_t b = hull.firstBrush; b < hull.firstBrush + hull.brushCount; b++) {
+				clipHullBrush(tree, tree.brushes[b], segments[i].first, segments[i].second, &allBrushTraces[i]);
+			}
+		}
+		end = std::chrono::steady_clock::now();
+		double allBrushSeconds = std::chrono::duration<double>(end - start).count();
+
+		size_t hitCount = 0, differentCount = 0, stuckCount = 0;
+		for (size_t i = 0; i < segments.size(); i++) {
+			hitCount += traces[i].fraction < 1.0;
+			differentCount += traces[i].fraction != allBrushTraces[i].fraction;
+			glm::f64vec3 endPos = segments[i].first + traces[i].fraction * (segments[i].second - segments[i].first);
+			stuckCount += traceCollisionHull(tree, h, endPos, endPos).startSolid;
+		}
+
+		printf("hulls: hull %d (%g %g %g .. %g %g %g), %u brushes, %zu leaf brushes, %.1f%% hit, "
+			"%.0f ns per %g unit trace (all brushes %.0f ns), %zu different, %zu stuck\n",
+			h, hull.mins[0], hull.mins[1], hull.mins[2], hull.maxs[0], hull.maxs[1], hull.maxs[2], hull.brushCount,
+			tree.leafBrushes.size(), 100.0 * hitCount / traceCount, 1e9 * seconds / traceCount, traceLength,
+			1e9 * allBrushSeconds / traceCount, differentCount, stuckCount);
+	}
+}
+
+/*
+* PVS: time of the base flood and the full flow on 1..threadCount threads
+* (checked against the serial result), visible leaves and row sizes.
+*/
+static void benchmarkVis(std::string& mapData, MapVersion mapVersion, unsigned int threadCount)
+{
+	Map map = getMap(&mapData[0], mapData.length(), mapVersion);
+	std::vector<Polygon> polysoup = createPolysoup(map, 1, true);
+	WorldSolids world;
+	getWorldSolids(map, 1, &world);
+	BSPTree tree = buildBSP(polysoup, world.solids, 1);
+
+	// computeVis fills in the tree, only the vis rows and the leaves' offsets into them change.
+	auto visAreEqual = [](const BSPTree& lhs, const BSPTree& rhs) {
+		return lhs.vis == rhs.vis && !memcmp(&lhs.leaves[0], &rhs.leaves[0], lhs.leaves.size() * sizeof(BSPLeaf));
+	};
+	for (int fast = 1; fast >= 0; fast--) {
+		size_t portalCount = 0;
+		tree = benchmarkThreads(fast ? "vis: base" : "vis: full", threadCount, 1, [&](unsigned int threads) {
+			portalCount = computeVis(&tree, world.origins, threads, fast);
+			return tree;
+		}, visAreEqual);
+		printf("vis: %s, %zu portals\n", fast ? "base" : "full", portalCount);
+
+		size_t emptyCount = 0, visibleCount = 0;
+		std::vector<uint8_t> row;
+		for (uint32_t leaf = 0; leaf < tree.leaves.size(); leaf++) {
+			if (tree.leaves[leaf].contents != BSP_EMPTY) {
+				continue;
+			}
+			decompressVis(tree, leaf, &row);
+			for (uint32_t other = 0; other < tree.leaves.size(); other++) {
+				visibleCount += (row[other >> 3] >> (other & 7)) & 1;
 			}
-		}	
-		std::swap(poly.vertices[i+1], poly.vertices[smallesAngleIndex]);
+			emptyCount++;
+		}
+		printf("vis: %s, %zu of %zu leaves empty, each sees %.1f of them on average (%.1f%%), rows %.1f KB -> %.1f KB compressed\n",
+			fast ? "base" : "full", emptyCount, tree.leaves.size(), (double)visibleCount / emptyCount,
+			100.0 * visibleCount / ((double)emptyCount * emptyCount), emptyCount * row.size() / 1024.0, tree.vis.size() / 1024.0);
+	}
+}
+
+/*
+* Lightmap: BVH build, bake time on 1..threadCount threads (checked against the
+* serial bake), rays per second.
+*/
+static bool lightmapsAreEqual(const Lightmap& lhs, const Lightmap& rhs)
+{
+	return lhs.atlases == rhs.atlases && lhs.triangles.size() == rhs.triangles.size()
+		&& (lhs.triangles.empty() || !memcmp(&lhs.triangles[0], &rhs.triangles[0], lhs.triangles.size() * sizeof(LightmapTriangle)));
+}
+
+static void benchmarkLight(std::string& mapData, MapVersion mapVersion, unsigned int threadCount)
+{
+	Map map = getMap(&mapData[0], mapData.length(), mapVersion);
+	std::vector<Polygon> polysoup = createPolysoup(map, 1, true);
+	std::vector<Polygon> tris = triangulate(polysoup);
+	std::vector<LightSource> lights = getLights(map);
+
+	auto start = std::chrono::steady_clock::now();
+	BVH bvh = buildBVH(tris);
+	auto end = std::chrono::steady_clock::now();
+	printf("light: %zu tris, %zu lights, BVH %zu nodes in %.3f ms\n", tris.size(), lights.size(), bvh.nodes.size(),
+		std::chrono::duration<double, std::milli>(end - start).count());
+
+	double serialSeconds = 0.0;
+	Lightmap serialLightmap = benchmarkThreads("light", threadCount, 1,
+		[&](unsigned int threads) { return bakeLightmap(polysoup, lights, threads); }, lightmapsAreEqual, &serialSeconds);
+	printf("light: %llu rays, %.2f Mrays/s on 1 thread\n",
+		(unsigned long long)serialLightmap.rayCount, serialLightmap.rayCount / serialSeconds / 1e6);
+	printf("light: %zu luxels in %u atlases of %ux%u, %d bounces\n", serialLightmap.luxelCount,
+		serialLightmap.atlasCount, serialLightmap.atlasSize, serialLightmap.atlasSize, PS_LIGHT_BOUNCES);
+}
+
+/*
+* Map (array of structs) vs. MapSoA: memory and createPolysoup time.
+*/
+static void benchmarkSoA(std::string& mapData, MapVersion mapVersion)
+{
+	const int iterations = 5;
+
+	Map map = getMap(&mapData[0], mapData.length(), mapVersion);
+	MapSoA soa;
+	getMapSoA(&mapData[0], mapData.length(), mapVersion, &soa);
+
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < iterations; i++) {
+		createPolysoup(map);
 	}
+	auto end = std::chrono::steady_clock::now();
+	double mapSeconds = std::chrono::duration<double>(end - start).count() / iterations;
 
-	// Fix winding
-	glm::f64vec3 a = poly.vertices[0] - center;
-	glm::f64vec3 b = poly.vertices[1] - center;
-	glm::f64vec3 normal = glm::normalize(glm::cross(a, b));
-	if (glm::dot(normal, poly.normal) < PS_FLOAT_EPSILON) {
-		std::reverse(poly.vertices.begin(), poly.vertices.end());
-		poly.normal = normal;
+	start = std::chrono::steady_clock::now();
+	for (int i = 0; i < iterations; i++) {
+		createPolysoup(soa);
 	}
+	end = std::chrono::steady_clock::now();
+	double soaSeconds = std::chrono::duration<double>(end - start).count() / iterations;
 
-	return poly;
+	printf("Map:    %.1f KB (%zu bytes per Face), createPolysoup %.3f ms\n",
+		getMapMemory(map) / 1024.0, sizeof(Face), 1000.0 * mapSeconds);
+	printf("MapSoA: %.1f KB (%zu faces, %zu textures), createPolysoup %.3f ms\n",
+		getMapSoAMemory(soa) / 1024.0, getFaceCount(soa), soa.textures.size(), 1000.0 * soaSeconds);
 }
 
 /*
-* Assumes only convex polygons -> use trivial triangulation approach where
-* a triangle-fan gets built, eg:
-* 
-*       v2______v3                        v2______v3
-*       /       |                         /|     /|
-*      /        |                        / |    / |
-*   v1/         |       -->           v1/  |   /  |
-*     \         |                       \  |  /   |
-*      \        |                        \ | /    | 
-*       \_______|                         \|/_____|
-*        v0     v4                         v0     v4     
-* 
-* v0 is the 'provoking vertex'. It is the anchor-point of the triangle fan.
-* Note that a lot of redundant data is generated: (v0, v1, v2), (v0, v2, v3), (v0, v3, v4).
-* 
-* TODO: Fix this with indexed data.
+* Forwards to upstream and counts what goes through.
 */
-std::vector<Polygon> triangulate(std::vector<Polygon> polys)
+class CountingMemoryResource : public std::pmr::memory_resource
 {
-	std::vector<Polygon> tris = { };
+public:
+	CountingMemoryResource(std::pmr::memory_resource* upstream)
+		: m_Upstream(upstream)
+	{
+	}
 
-	for (auto p = polys.begin(); p != polys.end(); p++) {
-		Polygon sortedPoly = sortVerticesCCW(*p);
-		size_t vertCount = sortedPoly.vertices.size();		
-		glm::f64vec3 provokingVert = sortedPoly.vertices[0];
-		for (size_t i = 2; i < vertCount; i++) {
-			Polygon poly = { };
-			poly.vertices.push_back(provokingVert);
-			poly.vertices.push_back(sortedPoly.vertices[i - 1]);
-			poly.vertices.push_back(sortedPoly.vertices[i]);
-			tris.push_back(poly);
-		}		
+	size_t m_Allocations = 0;
+	size_t m_Deallocations = 0;
+
+private:
+	void* do_allocate(size_t bytes, size_t alignment) override
+	{
+		m_Allocations++;
+		return m_Upstream->allocate(bytes, alignment);
+	}
+
+	void do_deallocate(void* p, size_t bytes, size_t alignment) override
+	{
+		m_Deallocations++;
+		m_Upstream->deallocate(p, bytes, alignment);
+	}
+
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+	{
+		return this == &other;
+	}
+
+	std::pmr::memory_resource* m_Upstream;
+};
+
+/*
+* Heap allocations and time of parse + teardown, with and without an arena.
+*/
+static void benchmarkArena(std::string& mapData, MapVersion mapVersion)
+{
+	const int iterations = 20;
+
+	CountingMemoryResource heap(std::pmr::new_delete_resource());
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < iterations; i++) {
+		Map map = getMap(&mapData[0], mapData.length(), mapVersion, &heap);
+	}
+	auto end = std::chrono::steady_clock::now();
+	double heapSeconds = std::chrono::duration<double>(end - start).count() / iterations;
+
+	CountingMemoryResource arenaUpstream(std::pmr::new_delete_resource());
+	start = std::chrono::steady_clock::now();
+	for (int i = 0; i < iterations; i++) {
+		std::pmr::monotonic_buffer_resource arena(mapData.length() * 2, &arenaUpstream);
+		Map map = getMap(&mapData[0], mapData.length(), mapVersion, &arena);
+	}
+	end = std::chrono::steady_clock::now();
+	double arenaSeconds = std::chrono::duration<double>(end - start).count() / iterations;
+
+	printf("heap:  %zu allocations, %zu frees per parse, parse + teardown %.3f ms\n",
+		heap.m_Allocations / iterations, heap.m_Deallocations / iterations, 1000.0 * heapSeconds);
+	printf("arena: %zu allocations, %zu frees per parse, parse + teardown %.3f ms\n",
+		arenaUpstream.m_Allocations / iterations, arenaUpstream.m_Deallocations / iterations, 1000.0 * arenaSeconds);
+}
+
+/*
+* Compares a full text parse into a MapSoA with mapping the map's .bmap and
+* pointing a MapSoAView at it.
+*/
+static void benchmarkBMap(std::string& mapData, MapVersion mapVersion)
+{
+	const int iterations = 20;
+	const char* bmapFile = "bench.bmap"; // Scratch file, the map's own .bmap is left alone
+
+	MapSoA map;
+	auto parseStart = std::chrono::steady_clock::now();
+	getMapSoA(&mapData[0], mapData.length(), mapVersion, &map);
+	double parseSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - parseStart).count();
+	uint64_t hash = hashMapSource(mapData.c_str(), mapData.length());
+	if (!writeBMap(bmapFile, map, hash)) {
+		fprintf(stderr, "Unable to write %s!\n", bmapFile);
+		return;
+	}
+
+	double openSeconds = 0.0;
+	double viewSeconds = 0.0;
+	for (int i = 0; i < iterations; i++) {
+		auto start = std::chrono::steady_clock::now();
+		BMap bmap;
+		bool ok = openBMap(bmapFile, hashMapSource(mapData.c_str(), mapData.length()), mapVersion, &bmap);
+		auto opened = std::chrono::steady_clock::now();
+		if (!ok) {
+			fprintf(stderr, "Unable to open %s!\n", bmapFile);
+			remove(bmapFile);
+			return;
+		}
+		MapSoAView view;
+		getBMapView(&bmap, &view);
+		auto viewed = std::chrono::steady_clock::now();
+
+		openSeconds += std::chrono::duration<double>(opened - start).count();
+		viewSeconds += std::chrono::duration<double>(viewed - opened).count();
+		if (i == 0 && !polysAreEqual(createPolysoup(view), createPolysoup(map))) {
+			fprintf(stderr, "%s does not match the parsed map!\n", bmapFile);
+		}
+		closeBMap(&bmap);
+	}
+	remove(bmapFile);
+
+	printf("bmap: parse %.3f ms, hash + mmap + validate %.3f ms, view %.3f ms\n",
+		1000.0 * parseSeconds, 1000.0 * openSeconds / iterations, 1000.0 * viewSeconds / iterations);
+}
+
+static Map loadMap(std::string& mapFile, MapVersion mapVersion, unsigned int threadCount)
+{
+	std::string mapData = loadTextFile(mapFile);
+	Map map;
+	if (!getMapParallel(&mapData[0], mapData.length(), mapVersion, threadCount, &map)) {
+		fprintf(stderr, "Unable to parse file: %s!\nExiting...", mapFile.c_str());
+		exit(-1);
+	}
+
+	return map;
+}
+
+/*
+* With useBMap an up to date .bmap next to the map file is mapped and used in
+* place. Otherwise the map is parsed into mapSoA, and with useBMap the .bmap
+* is (re)written for the next run. The view points into bmap or mapSoA.
+*/
+static MapSoAView loadMapSoA(std::string& mapFile, MapVersion mapVersion, bool useBMap, MapSoA* mapSoA, BMap* bmap)
+{
+	MappedFile source;
+	if (!openMappedFile(mapFile.c_str(), &source)) {
+		fprintf(stderr, "Unable to open file: %s!\nExiting...", mapFile.c_str());
+		exit(-1);
+	}
+
+	MapSoAView view;
+	uint64_t hash = hashMapSource((const char*)source.data, source.size);
+	std::string bmapFile = getBMapFileName(mapFile);
+	if (useBMap && openBMap(bmapFile.c_str(), hash, mapVersion, bmap)) {
+		closeMappedFile(&source);
+		getBMapView(bmap, &view);
+		return view;
+	}
+
+	std::string mapData((const char*)source.data, source.size); // Parser needs the terminating '\0'.
+	closeMappedFile(&source);
+	if (!getMapSoA(&mapData[0], mapData.length(), mapVersion, mapSoA)) {
+		fprintf(stderr, "Unable to parse file: %s!\nExiting...", mapFile.c_str());
+		exit(-1);
+	}
+	if (useBMap && !writeBMap(bmapFile.c_str(), *mapSoA, hash)) {
+		fprintf(stderr, "WARNING: Unable to write map cache %s!\n", bmapFile.c_str());
+	}
+
+	return getMapSoAView(*mapSoA);
+}
+
+/*
+* State of the watch mode. The triangles of every brush are kept, keyed by a
+* hash of the brush's text. After an edit only brushes whose text is not in
+* here yet get parsed and built again. Everything else is reused as is.
+*/
+struct IncrementalMap
+{
+	std::unordered_map<uint64_t, std::vector<Polygon>>	brushTris;
+	std::vector<uint64_t>								brushes;	// Hash of every brush in source order
+};
+
+/*
+* Brings map up to date with mapData. Returns the number of brushes that had to
+* be rebuilt, or -1 if the map is malformed (eg. the editor is still writing it).
+*/
+static int updateIncrementalMap(IncrementalMap* map, std::string& mapData, MapVersion mapVersion)
+{
+	std::vector<BrushChunk> chunks;
+	if (!getBrushChunks(&mapData[0], mapData.length(), &chunks)) {
+		return -1;
+	}
+
+	// Only new brushes go in here, map stays untouched until all of them parsed.
+	std::unordered_map<uint64_t, std::vector<Polygon>> brushTris;
+	std::vector<uint64_t> brushes(chunks.size());
+	for (size_t i = 0; i < chunks.size(); i++) {
+		uint64_t hash = hashMapSource(&mapData[chunks[i].pos], chunks[i].end - chunks[i].pos);
+		brushes[i] = hash;
+		if (brushTris.find(hash) != brushTris.end() || map->brushTris.find(hash) != map->brushTris.end()) {
+			continue; // Unchanged, or the same brush twice in the map.
+		}
+
+		Brush brush;
+		if (!getBrushAt(&mapData[0], mapData.length(), mapVersion, chunks[i], &brush)) {
+			return -1;
+		}
+		std::vector<Polygon> polys;
+		createBrushPolys(brush, &polys);
+		brushTris[hash] = triangulate(polys);
+	}
+	int rebuiltCount = (int)brushTris.size();
+
+	for (auto b = brushes.begin(); b != brushes.end(); b++) {
+		auto old = map->brushTris.find(*b);
+		if (old != map->brushTris.end() && brushTris.find(*b) == brushTris.end()) {
+			brushTris[*b] = std::move(old->second);
+		}
+	}
+
+	// Brushes that are gone get dropped here.
+	map->brushTris.swap(brushTris);
+	map->brushes.swap(brushes);
+
+	return rebuiltCount;
+}
+
+/*
+* Same triangles, in the same order, as triangulate(createPolysoup(map)).
+*/
+static std::vector<Polygon> getIncrementalTris(const IncrementalMap& map)
+{
+	size_t triCount = 0;
+	for (auto b = map.brushes.begin(); b != map.brushes.end(); b++) {
+		triCount += map.brushTris.at(*b).size();
+	}
+
+	std::vector<Polygon> tris;
+	tris.reserve(triCount);
+	for (auto b = map.brushes.begin(); b != map.brushes.end(); b++) {
+		const std::vector<Polygon>& brushTris = map.brushTris.at(*b);
+		tris.insert(tris.end(), brushTris.begin(), brushTris.end());
 	}
 
 	return tris;
 }
 
+static bool getFileTime(const std::string& fileName, std::filesystem::file_time_type* time)
+{
+	std::error_code error;
+	*time = std::filesystem::last_write_time(fileName, error);
+
+	return !error;
+}
+
+/*
+* Rebuilds tris.bin, tris.obj, mesh.bin and mesh.obj every time the map file is saved, until killed.
+* Only brushes that changed since the last save are rebuilt.
+*/
+static void watchMap(std::string& mapFile, MapVersion mapVersion, double weldTolerance)
+{
+	IncrementalMap map;
+	std::filesystem::file_time_type lastTime = { };
+
+	printf("watching %s\n", mapFile.c_str());
+	fflush(stdout);
+	while (true) {
+		std::filesystem::file_time_type time;
+		std::string mapData;
+		if (!getFileTime(mapFile, &time) || time == lastTime || !loadMapFile(mapFile, &mapData)) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			continue;
+		}
+		lastTime = time;
+
+		auto start = std::chrono::steady_clock::now();
+		int rebuiltCount = updateIncrementalMap(&map, mapData, mapVersion);
+		if (rebuiltCount < 0) {
+			fprintf(stderr, "WARNING: %s is malformed, waiting for the next save.\n", mapFile.c_str());
+			lastTime = { }; // Try again, the editor may still be writing it.
+			continue;
+		}
+		std::vector<Polygon> tris = getIncrementalTris(map);
+		auto built = std::chrono::steady_clock::now();
+		writePolys("tris.bin", tris);
+		writePolysOBJ("tris.obj", tris);
+		IndexedMesh mesh = weldTriangles(tris, weldTolerance);
+		writeIndexedMesh("mesh.bin", mesh);
+		writeIndexedMeshOBJ("mesh.obj", mesh);
+		auto end = std::chrono::steady_clock::now();
+
+		printf("%d of %zu brushes rebuilt, %zu tris, build %.3f ms, write %.3f ms\n",
+			rebuiltCount, map.brushes.size(), tris.size(),
+			std::chrono::duration<double, std::milli>(built - start).count(),
+			std::chrono::duration<double, std::milli>(end - built).count());
+		fflush(stdout);
+	}
+}
+
+/*
+* Time from an edit of a single brush to the new triangles, compared with a
+* full rebuild. The edit only adds a space to the brush in the middle of the
+* map, so its text (and hash) changes but the result is the same.
+*/
+static void benchmarkIncremental(std::string& mapData, MapVersion mapVersion)
+{
+	auto start = std::chrono::steady_clock::now();
+	IncrementalMap map;
+	updateIncrementalMap(&map, mapData, mapVersion);
+	std::vector<Polygon> fullTris = getIncrementalTris(map);
+	auto end = std::chrono::steady_clock::now();
+	double fullMs = std::chrono::duration<double, std::milli>(end - start).count();
+
+	std::vector<BrushChunk> chunks;
+	getBrushChunks(&mapData[0], mapData.length(), &chunks);
+	std::string editedData = mapData;
+	editedData.insert(chunks[chunks.size() / 2].pos, " ");
+
+	start = std::chrono::steady_clock::now();
+	int rebuiltCount = updateIncrementalMap(&map, editedData, mapVersion);
+	std::vector<Polygon> tris = getIncrementalTris(map);
+	end = std::chrono::steady_clock::now();
+	double editMs = std::chrono::duration<double, std::milli>(end - start).count();
+
+	printf("incremental: full build %.3f ms, edit of one brush %.3f ms (%d of %zu brushes rebuilt, %zu tris)\n",
+		fullMs, editMs, rebuiltCount, map.brushes.size(), tris.size());
+}
+
+/*
+* createPolysoup of all maps one after another, the way a batch compile of an
+* episode runs: without a brush cache, with an empty one that fills up from
+* map to map, and with the cache as it was written and loaded again (nothing
+* changed since the last compile). Then all maps moved by whole units, which
+* only the brushes that can be moved still hit. Every result is checked
+* against the build without the cache.
+*/
+static void benchmarkBrushCache(std::vector<Map>& maps, unsigned int threadCount)
+{
+	const char* cacheFile = "brushes.cache";
+	std::vector<std::vector<Polygon>> uncached(maps.size());
+	auto runMaps = [&](BrushCache* cache, const char* name) {
+		size_t hitCount = cache ? cache->hitCount : 0;
+		size_t brushCount = 0;
+		bool isIdentical = true;
+		auto start = std::chrono::steady_clock::now();
+		for (size_t m = 0; m < maps.size(); m++) {
+			std::vector<Polygon> polys = createPolysoup(maps[m], threadCount, false, nullptr, cache);
+			if (cache) {
+				isIdentical &= polysAreEqual(polys, uncached[m]);
+			}
+			else {
+				uncached[m].swap(polys);
+			}
+			for (auto e = maps[m].entities.begin(); e != maps[m].entities.end(); e++) {
+				brushCount += e->brushes.size();
+			}
+		}
+		auto end = std::chrono::steady_clock::now();
+		printf("brushcache: %-10s %zu maps, %.3f ms, %zu of %zu brushes from the cache, %s\n", name, maps.size(),
+			std::chrono::duration<double, std::milli>(end - start).count(), cache ? cache->hitCount - hitCount : 0, brushCount,
+			!cache ? "reference" : (isIdentical ? "identical" : "DIFFERENT FROM UNCACHED"));
+	};
+
+	runMaps(nullptr, "uncached");
+	BrushCache cache;
+	runMaps(&cache, "cold");
+	size_t translatableCount = 0;
+	for (auto e = cache.entries.begin(); e != cache.entries.end(); e++) {
+		translatableCount += e->second.mobility == BRUSHCACHE_TRANSLATABLE;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	writeBrushCache(cacheFile, cache);
+	auto mid = std::chrono::steady_clock::now();
+	bool isLoaded = loadBrushCache(cacheFile, &cache);
+	auto end = std::chrono::steady_clock::now();
+	printf("brushcache: %zu entries (%zu movable), %.1f KB, write %.3f ms, load %.3f ms%s\n", cache.entries.size(), translatableCount,
+		std::filesystem::file_size(cacheFile) / 1024.0, std::chrono::duration<double, std::milli>(mid - start).count(),
+		std::chrono::duration<double, std::milli>(end - mid).count(), isLoaded ? "" : ", LOAD FAILED");
+	std::filesystem::remove(cacheFile);
+	runMaps(&cache, "warm");
+
+	for (auto m = maps.begin(); m != maps.end(); m++) {
+		for (auto e = m->entities.begin(); e != m->entities.end(); e++) {
+			for (auto b = e->brushes.begin(); b != e->brushes.end(); b++) {
+				for (auto f = b->faces.begin(); f != b->faces.end(); f++) {
+					for (int i = 0; i < 3; i++) {
+						f->vertices[i].x += 1024.0; f->vertices[i].y -= 512.0; f->vertices[i].z += 64.0;
+					}
+				}
+			}
+		}
+	}
+	runMaps(nullptr, "uncached");
+	runMaps(&cache, "moved");
+	runMaps(&cache, "moved 2nd"); // The first run found out which entries move
+}
+
+/*
+* Parses all given maps at once with getMaps for 1..threadCount threads.
+* Run with: polysoup <mapfile> <mapfile> ... -bench [-threads N]
+*/
+static void benchmarkBatch(std::vector<std::string>& mapFiles, MapVersion mapVersion, unsigned int threadCount)
+{
+	const int iterations = 5;
+	size_t totalBytes = 0;
+	for (auto f = mapFiles.begin(); f != mapFiles.end(); f++) {
+		totalBytes += loadTextFile(*f).length();
+	}
+
+	double serialSeconds = 0.0;
+	for (unsigned int threads = 1; threads <= threadCount; threads *= 2) {
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < iterations; i++) {
+			std::vector<Map> maps;
+			getMaps(mapFiles, mapVersion, threads, &maps);
+		}
+		auto end = std::chrono::steady_clock::now();
+
+		double seconds = std::chrono::duration<double>(end - start).count() / iterations;
+		if (threads == 1) {
+			serialSeconds = seconds;
+		}
+		printf("batch: %zu maps, %2u threads, %.3f ms, %.1f MB/s, speedup %.2fx\n",
+			mapFiles.size(), threads, 1000.0 * seconds, totalBytes / (1024.0 * 1024.0) / seconds, serialSeconds / seconds);
+	}
+
+	std::vector<Map> maps;
+	if (!getMaps(mapFiles, mapVersion, threadCount, &maps)) {
+		return;
+	}
+	benchmarkBrushCache(maps, threadCount);
+}
+
 int main(int argc, char** argv)
 {
 	if (argc < 2) {
-		fprintf(stderr, "No .map provided! Usage:\npolysoup <mapfile>");
+		fprintf(stderr, "No .map provided! Usage:\npolysoup <mapfile> [-valve] [-bench] [-bmap] [-stream] [-soa] [-watch] [-cull] [-bsp] [-vis] [-fastvis] [-light] [-bounces N] [-quantize] [-nav] [-export file.obj|file.glb] [-brushcache file] [-threads N] [-weld tolerance]");
 		exit(-1);
 	}
 
 	MapVersion mapVersion = QUAKE;
+	bool isValve = false;
+	bool bench = false;
+	bool useBMap = false;
+	bool stream = false;
+	bool soa = false;
+	bool watch = false;
+	bool cull = false;
+	bool bsp = false;
+	bool vis = false;
+	bool fastVis = false;
+	bool light = false;
+	int bounces = PS_LIGHT_BOUNCES;
+	bool quantize = false;
+	bool nav = false;
+	std::string brushCacheFile;
+	std::vector<std::string> exportFiles;
+	unsigned int threadCount = 0;
+	double weldTolerance = PS_WELD_TOLERANCE;
+	std::vector<std::string> mapFiles;
 
 	int arg_ = 1;
 	char** argv_ = argv + 1;
 	while (arg_ < argc) {
 		if (!strcmp("-valve", *argv_)) {
-			mapVersion = VALVE_220;
-			break;
+			isValve = true;
+		}
+		else if (!strcmp("-bench", *argv_)) {
+			bench = true;
+		}
+		else if (!strcmp("-bmap", *argv_)) {
+			useBMap = true;
+		}
+		else if (!strcmp("-stream", *argv_)) {
+			stream = true;
+		}
+		else if (!strcmp("-soa", *argv_)) {
+			soa = true;
+		}
+		else if (!strcmp("-watch", *argv_)) {
+			watch = true;
+		}
+		else if (!strcmp("-cull", *argv_)) {
+			cull = true;
+		}
+		else if (!strcmp("-bsp", *argv_)) {
+			bsp = true;
+		}
+		else if (!strcmp("-vis", *argv_)) {
+			bsp = vis = true;
+		}
+		else if (!strcmp("-fastvis", *argv_)) {
+			bsp = vis = fastVis = true;
+		}
+		else if (!strcmp("-light", *argv_)) {
+			light = true;
+		}
+		else if (!strcmp("-bounces", *argv_) && arg_ + 1 < argc) {
+			argv_++; arg_++;
+			bounces = std::max(atoi(*argv_), 0);
+		}
+		else if (!strcmp("-quantize", *argv_)) {
+			quantize = true;
+		}
+		else if (!strcmp("-nav", *argv_)) {
+			nav = true;
+		}
+		else if (!strcmp("-export", *argv_) && arg_ + 1 < argc) {
+			argv_++; arg_++;
+			if (!findExporter(*argv_)) {
+				fprintf(stderr, "Unknown export format: %s!\nExiting...", *argv_);
+				exit(-1);
+			}
+			exportFiles.push_back(*argv_);
+		}
+		else if (!strcmp("-brushcache", *argv_) && arg_ + 1 < argc) {
+			argv_++; arg_++;
+			brushCacheFile = *argv_;
+		}
+		else if (!strcmp("-threads", *argv_) && arg_ + 1 < argc) {
+			argv_++; arg_++;
+			threadCount = (unsigned int)atoi(*argv_);
+		}
+		else if (!strcmp("-weld", *argv_) && arg_ + 1 < argc) {
+			argv_++; arg_++;
+			weldTolerance = atof(*argv_);
+			if (weldTolerance <= 0.0) {
+				fprintf(stderr, "Weld tolerance must be > 0!\nExiting...");
+				exit(-1);
+			}
+		}
+		else if (**argv_ != '-') {
+			mapFiles.push_back(*argv_);
 		}
 		argv_++; arg_++;
 	}
 
-	std::string mapData = loadTextFile(argv[1]);
-	size_t inputLength = mapData.length();
-	Map map = getMap(&mapData[0], inputLength, mapVersion);	
-	std::vector<Polygon> polysoup = createPolysoup(map);
+	if (mapFiles.empty()) {
+		fprintf(stderr, "No .map provided! Usage:\npolysoup <mapfile> [-valve] [-bench] [-bmap] [-stream] [-soa] [-watch] [-cull] [-bsp] [-vis] [-fastvis] [-light] [-bounces N] [-quantize] [-nav] [-export file.obj|file.glb] [-brushcache file] [-threads N] [-weld tolerance]");
+		exit(-1);
+	}
+
+	// Like the library, the worldspawn's "mapversion" says which format a map is in.
+	// -valve is only needed for maps without it. A batch is parsed as the first map says.
+	if (isValve) {
+		mapVersion = VALVE_220;
+	}
+	else {
+		std::string mapData;
+		if (loadMapFile(mapFiles[0], &mapData)) {
+			mapVersion = getMapVersion(&mapData[0], mapData.length(), QUAKE);
+		}
+	}
+
+	if (bench && mapFiles.size() > 1) {
+		benchmarkBatch(mapFiles, mapVersion, getThreadCount(threadCount));
+		return 0;
+	}
+
+	if (bench) {
+		std::string mapData = loadTextFile(mapFiles[0]);
+		benchmarkStages(mapData, mapVersion);
+		benchmarkPolysoupThreads(mapData, mapVersion, getThreadCount(threadCount));
+		benchmarkWeld(mapData, mapVersion);
+		benchmarkExport(mapData, mapVersion);
+		benchmarkCull(mapData, mapVersion);
+		benchmarkMaterials(mapData, mapVersion);
+		benchmarkWorldMesh(mapData, mapVersion);
+		benchmarkNavMesh(mapData, mapVersion, getThreadCount(threadCount));
+		benchmarkBSP(mapData, mapVersion, getThreadCount(threadCount));
+		benchmarkHulls(mapData, mapVersion, getThreadCount(threadCount));
+		benchmarkVis(mapData, mapVersion, getThreadCount(threadCount));
+		benchmarkLight(mapData, mapVersion, getThreadCount(threadCount));
+		benchmarkParser(mapData, mapVersion, getThreadCount(threadCount));
+		benchmarkBMap(mapData, mapVersion);
+		benchmarkStreaming(mapData, mapVersion);
+		benchmarkSoA(mapData, mapVersion);
+		benchmarkArena(mapData, mapVersion);
+		benchmarkIncremental(mapData, mapVersion);
+		std::vector<Map> maps;
+		maps.push_back(getMap(&mapData[0], mapData.length(), mapVersion));
+		benchmarkBrushCache(maps, getThreadCount(threadCount));
+		return 0;
+	}
+
+	if (!brushCacheFile.empty() && stream) {
+		fprintf(stderr, "WARNING: The brush cache does not work with -stream!\n");
+	}
+
+	if (watch && cull) {
+		fprintf(stderr, "WARNING: -cull does not work with -watch, brushes are rebuilt on their own!\n");
+	}
+
+	if (watch) {
+		watchMap(mapFiles[0], mapVersion, weldTolerance);
+		return 0;
+	}
+
+	BrushCache brushCache;
+	BrushCache* cache = nullptr;
+	if (!brushCacheFile.empty() && !stream) {
+		if (!loadBrushCache(brushCacheFile.c_str(), &brushCache)) {
+			fprintf(stderr, "WARNING: Brush cache %s is damaged, starting over!\n", brushCacheFile.c_str());
+		}
+		cache = &brushCache;
+	}
+
+	std::vector<Polygon> polysoup;
+	std::vector<std::string> materials;
+	BSPTree bspTree = { };
+	WorldSolids world;
+	std::vector<LightSource> lights;
+	if (stream) {
+		std::string mapData = loadTextFile(mapFiles[0]);
+		if (!cull && !createPolysoupStreaming(&mapData[0], mapData.length(), mapVersion, &polysoup, &materials)) {
+			fprintf(stderr, "Unable to parse file: %s!\nExiting...", mapFiles[0].c_str());
+			exit(-1);
+		}
+		if (cull || bsp || light) {
+			// The streaming parser keeps no brushes or entities around, culling and the BSP need the solid brushes.
+			MapSoA mapSoA;
+			if (!getMapSoA(&mapData[0], mapData.length(), mapVersion, &mapSoA)) {
+				fprintf(stderr, "Unable to parse file: %s!\nExiting...", mapFiles[0].c_str());
+				exit(-1);
+			}
+			if (cull) {
+				polysoup = createPolysoup(getMapSoAView(mapSoA), threadCount, cull, &materials);
+			}
+			if (bsp) {
+				getWorldSolids(mapSoA, threadCount, &world);
+				bspTree = buildBSP(polysoup, world.solids, threadCount);
+			}
+			lights = getLights(mapSoA);
+		}
+	}
+	else if (soa || useBMap) {
+		MapSoA mapSoA;
+		BMap bmap = { };
+		MapSoAView view = loadMapSoA(mapFiles[0], mapVersion, useBMap, &mapSoA, &bmap);
+		polysoup = createPolysoup(view, threadCount, cull, &materials, cache);
+		if (bsp) {
+			getWorldSolids(view, threadCount, &world);
+			bspTree = buildBSP(polysoup, world.solids, threadCount);
+		}
+		lights = getLights(view);
+		closeBMap(&bmap);
+	}
+	else {
+		Map map = loadMap(mapFiles[0], mapVersion, threadCount);
+		polysoup = createPolysoup(map, threadCount, cull, &materials, cache);
+		if (bsp) {
+			getWorldSolids(map, threadCount, &world);
+			bspTree = buildBSP(polysoup, world.solids, threadCount);
+		}
+		lights = getLights(map);
+	}
+	if (cache) {
+		printf("brush cache: %zu of %zu brushes reused\n", brushCache.hitCount, brushCache.hitCount + brushCache.missCount);
+		if (brushCache.isChanged && !writeBrushCache(brushCacheFile.c_str(), brushCache)) {
+			fprintf(stderr, "WARNING: Unable to write brush cache %s!\n", brushCacheFile.c_str());
+		}
+	}
 	std::vector<Polygon> tris = triangulate(polysoup);
 	writePolys("tris.bin", tris);
 	writePolysOBJ("tris.obj", tris);
+	IndexedMesh mesh = weldTriangles(tris, weldTolerance);
+	writeIndexedMesh("mesh.bin", mesh);
+	writeIndexedMeshOBJ("mesh.obj", mesh);
+	std::vector<Polygon> materialTris = tris;
+	std::vector<MaterialRange> ranges = sortByMaterial(&materialTris);
+	writeMaterialMesh("materials.bin", materialTris, ranges, materials);
+	if (!writeWorldMesh("world.mesh", buildWorldMesh(materialTris, ranges, materials, quantize))) {
+		fprintf(stderr, "WARNING: Could not write world.mesh!\n");
+	}
+	if (nav && !writeNavMesh("navmesh.bin", buildNavMesh(tris, materials, threadCount))) {
+		fprintf(stderr, "WARNING: Could not write navmesh.bin!\n");
+	}
+	if (!exportFiles.empty()) {
+		ExportMesh exported = getExportMesh(materialTris, &ranges, &materials);
+		for (auto f = exportFiles.begin(); f != exportFiles.end(); f++) {
+			if (!exportMesh(f->c_str(), exported)) {
+				fprintf(stderr, "WARNING: Could not write %s!\n", f->c_str());
+			}
+		}
+	}
+	if (vis) {
+		computeVis(&bspTree, world.origins, threadCount, fastVis);
+	}
+	if (bsp) {
+		buildCollisionHulls(world.solids, &bspTree, threadCount);
+	}
+	if (bsp && !writeBSP("world.bsp", bspTree)) {
+		fprintf(stderr, "WARNING: Could not write world.bsp!\n");
+	}
+	if (light) {
+		if (lights.empty()) {
+			fprintf(stderr, "WARNING: Map has no lights, the lightmap is black!\n");
+		}
+		Lightmap lightmap = bakeLightmap(polysoup, lights, threadCount, bounces);
+		if (!writeLightmap("lightmap.bin", lightmap)) {
+			fprintf(stderr, "WARNING: Could not write lightmap.bin!\n");
+		}
+	}
 
 	printf("done!\n");
 
@@ -1,4 +1,48 @@
 #ifndef _POLYSOUP_H_
 #define _POLYSOUP_H_
 
-#endif
\ No newline at end of file
+#include <vector>
+#include <stdint.h>
+
+#include <glm/glm.hpp>
+
+#define PS_FLOAT_EPSILON	(0.0001)
+
+/*
+* Brush vertices are snapped to a grid of 1 / PS_SNAP_GRID units. A power of
+* two, so grid points are exact doubles and whole units stay whole units.
+*/
+#define PS_SNAP_GRID		(16384.0)
+
+/*
+* What is on a polygon: its material (index into the texture names of the map)
+* and where the texture is. Vertex p is at texel
+* ( dot(s.xyz, p) + s.w, dot(t.xyz, p) + t.w ).
+*/
+struct PolygonTexture
+{
+	uint32_t		material;
+	glm::f64vec4	s;
+	glm::f64vec4	t;
+};
+
+struct Polygon
+{
+	std::vector<glm::f64vec3>  vertices;
+	glm::f64vec3			   normal;
+	PolygonTexture			   texture;
+};
+
+struct Plane
+{
+	glm::f64vec3 n;
+	glm::f64vec3 p0;
+	double d;		// = n dot p0. Just for convenience.
+};
+
+Plane createPlane(glm::f64vec3 p0, glm::f64vec3 p1, glm::f64vec3 p2);
+void createBaseWinding(const Plane& plane, std::vector<glm::f64vec3>* winding);
+void clipWinding(const std::vector<glm::f64vec3>& in, const Plane& plane, std::vector<glm::f64vec3>* out);
+void createPlanePolys(const Plane* planes, int planeCount, std::vector<Polygon>* polys, const PolygonTexture* textures = nullptr);
+
+#endif
@@ -0,0 +1,171 @@
+/*
+* Texture coordinates and materials of the polysoup.
+*
+* Quake: the texture is projected along the world axis the face is closest
+* to (qbsp's TextureAxisFromPlane), then rotated, scaled and shifted by the
+* face's rotation, scale and offsets.
+* Valve 220: the face brings its own texture axes with offsets, only the scale
+* is applied.
+* Either way coordinates come out in texels. The texture sizes are not known
+* here (no WADs are read), whoever loads the textures divides by them.
+*
+* Materials are the texture names in the order they first appear in the map,
+* which is the order MapSoA interns them in.
+*/
+
+#ifndef _TEXTURE_H_
+#define _TEXTURE_H_
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <glm/glm.hpp>
+
+#include "parser.h"
+#include "polysoup.h"
+
+/*
+* Triangles [ first, first + count ) all have the same material.
+*/
+struct MaterialRange
+{
+	uint32_t material;
+	uint32_t first;
+	uint32_t count;
+};
+
+PolygonTexture	getQuakeTexture(const glm::f64vec3& normal, double xOffset, double yOffset, double rotation, double xScale, double yScale);
+PolygonTexture	getValveTexture(const glm::f64vec3& uAxis, double uOffset, const glm::f64vec3& vAxis, double vOffset, double xScale, double yScale);
+
+/*
+* Valve 220 if the face has texture axes, Quake otherwise. normal: of the face's plane.
+*/
+PolygonTexture	getFaceTexture(const Face& face, const glm::f64vec3& normal, uint32_t material);
+
+static inline glm::f64vec2 getTexCoord(const PolygonTexture& texture, const glm::f64vec3& p)
+{
+	return glm::f64vec2(glm::dot(glm::f64vec3(texture.s), p) + texture.s.w, glm::dot(glm::f64vec3(texture.t), p) + texture.t.w);
+}
+
+/*
+* Stable sort by material, so the polygons of every material are in one piece
+* and keep their order. Returns the ranges of the materials that have any.
+*/
+std::vector<MaterialRange>	sortByMaterial(std::vector<Polygon>* polys);
+
+
+
+/*
+*
+* IMPLEMENTATION
+*
+*/
+
+
+
+#if defined(TEXTURE_IMPLEMENTATION)
+
+#include <algorithm>
+#include <math.h>
+
+/*
+* For every direction a face can mostly point to: that direction and the two
+* texture axes. Same order and values as qbsp, ties go to the first.
+*/
+static const glm::f64vec3 quakeTextureAxes[6][3] = {
+	{ {  0.0,  0.0,  1.0 }, { 1.0, 0.0, 0.0 }, { 0.0, -1.0,  0.0 } },	// Floor
+	{ {  0.0,  0.0, -1.0 }, { 1.0, 0.0, 0.0 }, { 0.0, -1.0,  0.0 } },	// Ceiling
+	{ {  1.0,  0.0,  0.0 }, { 0.0, 1.0, 0.0 }, { 0.0,  0.0, -1.0 } },	// West wall
+	{ { -1.0,  0.0,  0.0 }, { 0.0, 1.0, 0.0 }, { 0.0,  0.0, -1.0 } },	// East wall
+	{ {  0.0,  1.0,  0.0 }, { 1.0, 0.0, 0.0 }, { 0.0,  0.0, -1.0 } },	// South wall
+	{ {  0.0, -1.0,  0.0 }, { 1.0, 0.0, 0.0 }, { 0.0,  0.0, -1.0 } }	// North wall
+};
+
+PolygonTexture getQuakeTexture(const glm::f64vec3& normal, double xOffset, double yOffset, double rotation, double xScale, double yScale)
+{
+	int best = 0;
+	double bestDot = 0.0;
+	for (int i = 0; i < 6; i++) {
+		double dot = glm::dot(normal, quakeTextureAxes[i][0]);
+		if (dot > bestDot) {
+			bestDot = dot;
+			best = i;
+		}
+	}
+	glm::f64vec3 axes[2] = { quakeTextureAxes[best][1], quakeTextureAxes[best][2] };
+
+	// Right angles exactly, so axis aligned textures stay on whole texels.
+	double sinv, cosv;
+	if (rotation == 0.0) { sinv = 0.0; cosv = 1.0; }
+	else if (rotation == 90.0) { sinv = 1.0; cosv = 0.0; }
+	else if (rotation == 180.0) { sinv = 0.0; cosv = -1.0; }
+	else if (rotation == 270.0) { sinv = -1.0; cosv = 0.0; }
+	else {
+		double angle = rotation / 180.0 * 3.14159265358979323846;
+		sinv = sin(angle);
+		cosv = cos(angle);
+	}
+
+	// The plane the axes span: sv and tv are the world axes of the s and t axis.
+	int sv = axes[0].x != 0.0 ? 0 : (axes[0].y != 0.0 ? 1 : 2);
+	int tv = axes[1].x != 0.0 ? 0 : (axes[1].y != 0.0 ? 1 : 2);
+	for (int i = 0; i < 2; i++) {
+		double ns = cosv * axes[i][sv] - sinv * axes[i][tv];
+		double nt = sinv * axes[i][sv] + cosv * axes[i][tv];
+		axes[i][sv] = ns;
+		axes[i][tv] = nt;
+	}
+
+	PolygonTexture texture = { };
+	texture.s = glm::f64vec4(axes[0] / (xScale != 0.0 ? xScale : 1.0), xOffset);
+	texture.t = glm::f64vec4(axes[1] / (yScale != 0.0 ? yScale : 1.0), yOffset);
+
+	return texture;
+}
+
+PolygonTexture getValveTexture(const glm::f64vec3& uAxis, double uOffset, const glm::f64vec3& vAxis, double vOffset, double xScale, double yScale)
+{
+	PolygonTexture texture = { };
+	texture.s = glm::f64vec4(uAxis / (xScale != 0.0 ? xScale : 1.0), uOffset);
+	texture.t = glm::f64vec4(vAxis / (yScale != 0.0 ? yScale : 1.0), vOffset);
+
+	return texture;
+}
+
+PolygonTexture getFaceTexture(const Face& face, const glm::f64vec3& normal, uint32_t material)
+{
+	PolygonTexture texture;
+	if (face.tx1 != 0.0 || face.ty1 != 0.0 || face.tz1 != 0.0) {
+		texture = getValveTexture(glm::f64vec3(face.tx1, face.ty1, face.tz1), face.tOffset1,
+			glm::f64vec3(face.tx2, face.ty2, face.tz2), face.tOffset2, face.xScale, face.yScale);
+	}
+	else {
+		texture = getQuakeTexture(normal, face.xOffset, face.yOffset, face.rotation, face.xScale, face.yScale);
+	}
+	texture.material = material;
+
+	return texture;
+}
+
+std::vector<MaterialRange> sortByMaterial(std::vector<Polygon>* polys)
+{
+	std::stable_sort(polys->begin(), polys->end(), [](const Polygon& lhs, const Polygon& rhs) {
+		return lhs.texture.material < rhs.texture.material;
+	});
+
+	std::vector<MaterialRange> ranges;
+	for (size_t i = 0; i < polys->size(); i++) {
+		uint32_t material = (*polys)[i].texture.material;
+		if (ranges.empty() || ranges.back().material != material) {
+			ranges.push_back({ material, (uint32_t)i, 0 });
+		}
+		ranges.back().count++;
+	}
+
+	return ranges;
+}
+
+#endif
+
+#endif
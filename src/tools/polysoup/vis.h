@@ -0,0 +1,676 @@
+/*
+* Potentially visible set (PVS) of every leaf of a BSP tree, the way Quake's
+* vis computes it.
+*
+* Portals: the plane of every node, cut to the node's region, is pushed down
+* both sides of the tree. Where a piece ends up between an empty leaf in front
+* and an empty leaf behind, it is a portal: a convex window from one leaf into
+* the other. Every portal is used in both directions.
+*
+* Outside: like Quake's qbsp, the leaves are flood filled through the portals
+* from the point entities. The void around a sealed map is never reached and
+* becomes solid, so nobody spends time on what can be seen out there.
+*
+* Flow, for every portal on its own:
+* - Base: flood the leaves behind the portal, but only through portals that
+*   are partly in front of it and have it partly behind them. What is not
+*   reached can not be seen through the portal no matter what.
+* - Full: walk the same leaves again, this time carrying the part of every
+*   portal on the way that can still be seen through all portals before it.
+*   Every step clips the next portal against the planes separating the source
+*   portal from the previous one (the anti-penumbra). A leaf is visible if a
+*   piece of a portal into it survives.
+* Portals that might see the fewest leaves go first. Once a portal is done,
+* later flows through it only follow what it really sees. Portals go in waves
+* of PS_VIS_WAVE_SIZE that are spread over the threads, and a wave only uses
+* the results of the waves before it, so the result does not depend on the
+* thread count.
+*
+* A leaf sees itself and everything its portals see. A row has one bit per leaf
+* and is run-length compressed: a zero byte is followed by the number of zero
+* bytes it stands for. Leaves that see the same leaves share their row.
+*/
+
+#ifndef _VIS_H_
+#define _VIS_H_
+
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "bsp.h"
+
+#define PS_VIS_EPSILON		(0.1)
+#define PS_VIS_WAVE_SIZE	(64)
+
+/*
+* Fills tree->vis and the visOffset of every empty leaf. Solid leaves get
+* BSP_NO_VIS. origins: the point entities, empty leaves none of them can reach
+* are outside of the map and made solid first. If the map leaks there is no
+* outside and only the base flood is done.
+* fast: stop after the base flood, like Quake's vis -fast.
+* Returns the number of portals (one per direction).
+*/
+size_t	computeVis(BSPTree* tree, const std::vector<glm::f64vec3>& origins, unsigned int threadCount = 1, bool fast = false);
+
+/*
+* One bit per leaf: leaf i sees leaf j if bit j of row i is set.
+*/
+void	decompressVis(const BSPTree& tree, uint32_t leaf, std::vector<uint8_t>* row);
+
+
+
+/*
+*
+* IMPLEMENTATION
+*
+*/
+
+
+
+#if defined(VIS_IMPLEMENTATION)
+
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <math.h>
+#include <stdio.h>
+
+#include "parallel.h"
+
+typedef std::vector<glm::f64vec3> VisWinding;
+typedef std::vector<uint64_t> VisBits; // One bit per leaf, 64 at a time while flowing
+
+struct VisPortal
+{
+	VisWinding				winding;
+	glm::f64vec3			n;			// Points into leaf
+	double					d;
+	uint32_t				leaf;		// The leaf the portal leads into
+	VisBits					mightSee;
+	VisBits					vis;
+	bool					isDone;		// vis is final and can stand in for mightSee
+};
+
+struct VisData
+{
+	const BSPTree*						tree;
+	std::vector<VisPortal>				portals;
+	std::vector<std::vector<uint32_t>>	leafPortals;	// Portals leading out of each leaf
+	size_t								wordCount;	// Of a VisBits
+};
+
+/*
+* One step of the flow: the leaf that is walked through and the portal it
+* was entered by, cut down to what can be seen.
+*/
+struct VisStack
+{
+	VisWinding				source;		// Part of the source portal that can see pass
+	VisWinding				pass;		// Part of the portal into leaf, empty for the source leaf
+	glm::f64vec3			n;			// Plane of that portal
+	double					d;
+	VisBits					mightSee;
+	VisWinding				clipped;	// Scratch
+};
+
+static inline bool isVisBitSet(const VisBits& bits, uint32_t leaf)
+{
+	return (bits[leaf >> 6] & (1ull << (leaf & 63))) != 0;
+}
+
+static inline int countVisBits(uint64_t bits)
+{
+	int count = 0;
+	for (; bits; bits &= bits - 1) {
+		count++;
+	}
+
+	return count;
+}
+
+static inline void setVisBit(VisBits* bits, uint32_t leaf)
+{
+	(*bits)[leaf >> 6] |= 1ull << (leaf & 63);
+}
+
+/*
+* Splits the winding at the plane. Vertices on it go to both parts. A winding
+* in the plane leaves both parts empty, one completely on a side is moved there.
+*/
+static void splitVisWinding(const VisWinding& in, const glm::f64vec3& n, double d, VisWinding* front, VisWinding* back)
+{
+	front->clear();
+	back->clear();
+
+	bool hasFront = false, hasBack = false;
+	for (auto v = in.begin(); v != in.end(); v++) {
+		double distance = glm::dot(n, *v) + d;
+		hasFront |= distance > PS_FLOAT_EPSILON;
+		hasBack |= distance < -PS_FLOAT_EPSILON;
+	}
+	if (!hasFront || !hasBack) {
+		if (hasFront) *front = in;
+		if (hasBack) *back = in;
+		return;
+	}
+
+	size_t count = in.size();
+	for (size_t i = 0; i < count; i++) {
+		const glm::f64vec3& a = in[i];
+		const glm::f64vec3& b = in[(i + 1) % count];
+		double da = glm::dot(n, a) + d;
+		double db = glm::dot(n, b) + d;
+
+		if (da >= -PS_FLOAT_EPSILON) front->push_back(a);
+		if (da <= PS_FLOAT_EPSILON) back->push_back(a);
+		if ((da > PS_FLOAT_EPSILON && db < -PS_FLOAT_EPSILON) || (da < -PS_FLOAT_EPSILON && db > PS_FLOAT_EPSILON)) {
+			glm::f64vec3 v = a + (da / (da - db)) * (b - a);
+			front->push_back(v);
+			back->push_back(v);
+		}
+	}
+}
+
+/*
+* Keeps the part of the winding in front of the plane. Returns false if
+* nothing is in front. 'out' must not be 'in'.
+*/
+static bool chopVisWinding(const VisWinding& in, const glm::f64vec3& n, double d, VisWinding* out)
+{
+	bool hasFront = false, hasBack = false;
+	for (auto v = in.begin(); v != in.end(); v++) {
+		double distance = glm::dot(n, *v) + d;
+		hasFront |= distance > PS_VIS_EPSILON;
+		hasBack |= distance < -PS_VIS_EPSILON;
+	}
+	if (!hasFront) {
+		return false;
+	}
+	if (!hasBack) {
+		*out = in;
+		return true;
+	}
+
+	out->clear();
+	size_t count = in.size();
+	for (size_t i = 0; i < count; i++) {
+		const glm::f64vec3& a = in[i];
+		const glm::f64vec3& b = in[(i + 1) % count];
+		double da = glm::dot(n, a) + d;
+		double db = glm::dot(n, b) + d;
+
+		if (da >= -PS_VIS_EPSILON) out->push_back(a);
+		if ((da > PS_VIS_EPSILON && db < -PS_VIS_EPSILON) || (da < -PS_VIS_EPSILON && db > PS_VIS_EPSILON)) {
+			out->push_back(a + (da / (da - db)) * (b - a));
+		}
+	}
+
+	return out->size() >= 3;
+}
+
+/*
+* A portal without at least three edges of some length only comes from
+* numerical noise where planes meet.
+*/
+static bool isVisWindingTiny(const VisWinding& winding)
+{
+	int edges = 0;
+	for (size_t i = 0; i < winding.size() && edges < 3; i++) {
+		if (glm::length(winding[(i + 1) % winding.size()] - winding[i]) > 2.0 * PS_VIS_EPSILON) {
+			edges++;
+		}
+	}
+
+	return edges < 3;
+}
+
+/*
+* Pushes a winding lying in the plane of a node down one side of it. dir points
+* from the plane into that side and decides where pieces in a plane go.
+*/
+static void pushVisWinding(const BSPTree& tree, int32_t child, const VisWinding& winding, const glm::f64vec3& dir,
+	std::vector<std::pair<uint32_t, VisWinding>>* leafWindings)
+{
+	if (child < 0) {
+		leafWindings->push_back({ (uint32_t)(-(child + 1)), winding });
+		return;
+	}
+
+	const BSPNode& node = tree.nodes[child];
+	const Plane& plane = tree.planes[node.plane];
+	VisWinding front, back;
+	splitVisWinding(winding, plane.n, plane.d, &front, &back);
+	if (front.empty() && back.empty()) {
+		pushVisWinding(tree, node.children[glm::dot(dir, plane.n) > 0.0 ? 0 : 1], winding, dir, leafWindings);
+		return;
+	}
+	if (front.size() >= 3) {
+		pushVisWinding(tree, node.children[0], front, dir, leafWindings);
+	}
+	if (back.size() >= 3) {
+		pushVisWinding(tree, node.children[1], back, dir, leafWindings);
+	}
+}
+
+static void addVisPortals(VisData* data, uint32_t frontLeaf, uint32_t backLeaf, const VisWinding& winding, const Plane& plane)
+{
+	if (isVisWindingTiny(winding)) {
+		return;
+	}
+
+	VisPortal portal;
+	portal.winding = winding;
+	portal.n = -plane.n;
+	portal.d = -plane.d;
+	portal.leaf = backLeaf;
+	portal.isDone = false;
+	data->leafPortals[frontLeaf].push_back((uint32_t)data->portals.size());
+	data->portals.push_back(portal);
+
+	portal.n = plane.n;
+	portal.d = plane.d;
+	portal.leaf = frontLeaf;
+	data->leafPortals[backLeaf].push_back((uint32_t)data->portals.size());
+	data->portals.push_back(portal);
+}
+
+/*
+* cell: planes around the node's region, pointing out of it.
+*/
+static void makeVisPortals(VisData* data, int32_t nodeIndex, std::vector<Plane>* cell)
+{
+	const BSPTree& tree = *data->tree;
+	const BSPNode& node = tree.nodes[nodeIndex];
+	const Plane& plane = tree.planes[node.plane];
+
+	VisWinding winding, clipped;
+	createBaseWinding(plane, &winding);
+	for (auto c = cell->begin(); c != cell->end() && winding.size() >= 3; c++) {
+		clipWinding(winding, *c, &clipped);
+		winding.swap(clipped);
+	}
+
+	if (winding.size() >= 3) {
+		std::vector<std::pair<uint32_t, VisWinding>> fronts, backs;
+		pushVisWinding(tree, node.children[0], winding, plane.n, &fronts);
+		for (auto f = fronts.begin(); f != fronts.end(); f++) {
+			if (tree.leaves[f->first].contents != BSP_EMPTY) {
+				continue;
+			}
+			backs.clear();
+			pushVisWinding(tree, node.children[1], f->second, -plane.n, &backs);
+			for (auto b = backs.begin(); b != backs.end(); b++) {
+				if (tree.leaves[b->first].contents == BSP_EMPTY) {
+					addVisPortals(data, f->first, b->first, b->second, plane);
+				}
+			}
+		}
+	}
+
+	for (int c = 0; c < 2; c++) {
+		if (node.children[c] >= 0) {
+			// The front side is in front of the plane, so the plane bounding it points the other way.
+			double sign = c == 0 ? -1.0 : 1.0;
+			cell->push_back({ sign * plane.n, plane.p0, sign * plane.d });
+			makeVisPortals(data, node.children[c], cell);
+			cell->pop_back();
+		}
+	}
+}
+
+/*
+* Can anything of 'to' be seen through 'from' at all: 'to' has to be partly
+* in front of 'from', 'from' partly behind 'to'.
+*/
+static bool isVisPortalInFront(const VisPortal& from, const VisPortal& to)
+{
+	bool isInFront = false;
+	for (auto v = to.winding.begin(); v != to.winding.end() && !isInFront; v++) {
+		isInFront = glm::dot(from.n, *v) + from.d > PS_VIS_EPSILON;
+	}
+	bool isBehind = false;
+	for (auto v = from.winding.begin(); v != from.winding.end() && !isBehind; v++) {
+		isBehind = glm::dot(to.n, *v) + to.d < -PS_VIS_EPSILON;
+	}
+
+	return isInFront && isBehind;
+}
+
+static void floodMightSee(const VisData& data, VisPortal* portal)
+{
+	portal->mightSee.assign(data.wordCount, 0);
+
+	std::vector<uint32_t> stack;
+	stack.push_back(portal->leaf);
+	setVisBit(&portal->mightSee, portal->leaf);
+	while (!stack.empty()) {
+		uint32_t leaf = stack.back();
+		stack.pop_back();
+		for (auto p = data.leafPortals[leaf].begin(); p != data.leafPortals[leaf].end(); p++) {
+			const VisPortal& next = data.portals[*p];
+			if (!isVisBitSet(portal->mightSee, next.leaf) && isVisPortalInFront(*portal, next)) {
+				setVisBit(&portal->mightSee, next.leaf);
+				stack.push_back(next.leaf);
+			}
+		}
+	}
+}
+
+/*
+* Clips target by the planes through an edge of source and a vertex of pass
+* that have source on one side and pass on the other. flip: keep the side of
+* source instead of the side of pass.
+*/
+static bool clipVisToSeparators(const VisWinding& source, const VisWinding& pass, VisWinding* target, bool flip, VisWinding* clipped)
+{
+	size_t sourceCount = source.size(), passCount = pass.size();
+	for (size_t i = 0; i < sourceCount; i++) {
+		size_t l = (i + 1) % sourceCount;
+		glm::f64vec3 edge = source[l] - source[i];
+
+		for (size_t j = 0; j < passCount; j++) {
+			glm::f64vec3 n = glm::cross(edge, pass[j] - source[i]);
+			double length = glm::length(n);
+			if (length < PS_VIS_EPSILON) {
+				continue;
+			}
+			n /= length;
+			double d = -glm::dot(pass[j], n);
+
+			// Make source end up behind the plane.
+			int sourceSide = 0;
+			for (size_t k = 0; k < sourceCount && !sourceSide; k++) {
+				if (k == i || k == l) {
+					continue;
+				}
+				double distance = glm::dot(n, source[k]) + d;
+				if (distance < -PS_VIS_EPSILON) sourceSide = -1;
+				else if (distance > PS_VIS_EPSILON) sourceSide = 1;
+			}
+			if (!sourceSide) {
+				continue; // In the plane of source
+			}
+			if (sourceSide > 0) {
+				n = -n;
+				d = -d;
+			}
+
+			// It separates if all of pass is in front.
+			bool isSeparating = true;
+			bool hasFront = false;
+			for (size_t k = 0; k < passCount && isSeparating; k++) {
+				if (k == j) {
+					continue;
+				}
+				double distance = glm::dot(n, pass[k]) + d;
+				isSeparating = distance >= -PS_VIS_EPSILON;
+				hasFront |= distance > PS_VIS_EPSILON;
+			}
+			if (!isSeparating || !hasFront) {
+				continue;
+			}
+
+			if (flip) {
+				n = -n;
+				d = -d;
+			}
+			if (!chopVisWinding(*target, n, d, clipped)) {
+				return false;
+			}
+			target->swap(*clipped);
+		}
+	}
+
+	return true;
+}
+
+/*
+* stacks[ depth ] is the leaf walked through, the ones after it are reused by
+* the deeper steps so the flow allocates nothing once they have grown. Growing
+* a deque at the end keeps the references of the steps above valid.
+*/
+static void flowVisLeaf(const VisData& data, const VisPortal& base, uint32_t leaf, std::deque<VisStack>* stacks, size_t depth, VisBits* vis)
+{
+	if (stacks->size() < depth + 2) {
+		stacks->resize(depth + 2);
+		(*stacks)[depth + 1].mightSee.resize(data.wordCount);
+	}
+	const VisStack& prev = (*stacks)[depth];
+	VisStack& stack = (*stacks)[depth + 1];
+
+	for (auto pi = data.leafPortals[leaf].begin(); pi != data.leafPortals[leaf].end(); pi++) {
+		const VisPortal& portal = data.portals[*pi];
+		if (!isVisBitSet(prev.mightSee, portal.leaf)) {
+			continue;
+		}
+
+		// Nothing new to see behind it?
+		const VisBits& test = portal.isDone ? portal.vis : portal.mightSee;
+		bool hasMore = false;
+		for (size_t i = 0; i < data.wordCount; i++) {
+			stack.mightSee[i] = prev.mightSee[i] & test[i];
+			hasMore |= (stack.mightSee[i] & ~(*vis)[i]) != 0;
+		}
+		if (!hasMore && isVisBitSet(*vis, portal.leaf)) {
+			continue;
+		}
+
+		// The part of the portal in front of the source and the part of the source behind the portal.
+		if (!chopVisWinding(portal.winding, base.n, base.d, &stack.pass)
+			|| !chopVisWinding(prev.source, -portal.n, -portal.d, &stack.source)) {
+			continue;
+		}
+		stack.n = portal.n;
+		stack.d = portal.d;
+
+		if (!prev.pass.empty()) {
+			if (!chopVisWinding(stack.pass, prev.n, prev.d, &stack.clipped)) {
+				continue;
+			}
+			stack.pass.swap(stack.clipped);
+			if (!clipVisToSeparators(stack.source, prev.pass, &stack.pass, false, &stack.clipped)
+				|| !clipVisToSeparators(prev.pass, stack.source, &stack.pass, true, &stack.clipped)) {
+				continue;
+			}
+		}
+
+		setVisBit(vis, portal.leaf);
+		flowVisLeaf(data, base, portal.leaf, stacks, depth + 1, vis);
+	}
+}
+
+static void flowVisPortal(const VisData& data, VisPortal* portal)
+{
+	portal->vis.assign(data.wordCount, 0);
+	setVisBit(&portal->vis, portal->leaf);
+
+	std::deque<VisStack> stacks(1);
+	stacks[0].source = portal->winding;
+	stacks[0].n = portal->n;
+	stacks[0].d = portal->d;
+	stacks[0].mightSee = portal->mightSee;
+	flowVisLeaf(data, *portal, portal->leaf, &stacks, 0, &portal->vis);
+}
+
+/*
+* Makes the empty leaves no origin reaches solid. Returns false if the flood
+* gets into the corner of the tree's bounds, there is only void out there.
+*/
+static bool fillVisOutside(const VisData& data, BSPTree* tree, const std::vector<glm::f64vec3>& origins)
+{
+	std::vector<bool> isReached(tree->leaves.size(), false);
+	std::vector<uint32_t> stack;
+	for (auto o = origins.begin(); o != origins.end(); o++) {
+		uint32_t leaf = findBSPLeaf(*tree, *o);
+		if (tree->leaves[leaf].contents == BSP_EMPTY && !isReached[leaf]) {
+			isReached[leaf] = true;
+			stack.push_back(leaf);
+		}
+	}
+	if (stack.empty()) {
+		return false;
+	}
+
+	while (!stack.empty()) {
+		uint32_t leaf = stack.back();
+		stack.pop_back();
+		for (auto p = data.leafPortals[leaf].begin(); p != data.leafPortals[leaf].end(); p++) {
+			uint32_t next = data.portals[*p].leaf;
+			if (!isReached[next]) {
+				isReached[next] = true;
+				stack.push_back(next);
+			}
+		}
+	}
+	if (isReached[findBSPLeaf(*tree, tree->bounds.min + glm::f64vec3(PS_VIS_EPSILON))]) {
+		return false;
+	}
+
+	for (size_t i = 0; i < tree->leaves.size(); i++) {
+		if (!isReached[i]) {
+			tree->leaves[i].contents = BSP_SOLID;
+		}
+	}
+
+	return true;
+}
+
+static void compressVisRow(const std::vector<uint8_t>& row, std::vector<uint8_t>* out)
+{
+	for (size_t i = 0; i < row.size(); i++) {
+		out->push_back(row[i]);
+		if (row[i]) {
+			continue;
+		}
+		size_t zeros = 1;
+		while (i + zeros < row.size() && zeros < 255 && !row[i + zeros]) {
+			zeros++;
+		}
+		out->push_back((uint8_t)zeros);
+		i += zeros - 1;
+	}
+}
+
+size_t computeVis(BSPTree* tree, const std::vector<glm::f64vec3>& origins, unsigned int threadCount, bool fast)
+{
+	VisData data;
+	data.tree = tree;
+	data.leafPortals.resize(tree->leaves.size());
+	data.wordCount = (tree->leaves.size() + 63) / 64;
+	if (!tree->nodes.empty()) {
+		std::vector<Plane> cell;
+		getBSPBoundsPlanes(tree->bounds, &cell);
+		makeVisPortals(&data, 0, &cell);
+
+		// Portals only connect empty leaves, so after the fill they are made again.
+		if (fillVisOutside(data, tree, origins)) {
+			data.portals.clear();
+			for (auto l = data.leafPortals.begin(); l != data.leafPortals.end(); l++) {
+				l->clear();
+			}
+			makeVisPortals(&data, 0, &cell);
+		}
+		else if (!fast) {
+			// Like Quake's vis refusing leaky maps, the full flow through all of the void would take forever.
+			fprintf(stderr, "WARNING: Map leaks or has no point entities, only the base vis is done!\n");
+			fast = true;
+		}
+	}
+
+	parallelFor(data.portals.size(), threadCount, [&data](size_t i) {
+		floodMightSee(data, &data.portals[i]);
+	});
+	if (fast) {
+		for (auto p = data.portals.begin(); p != data.portals.end(); p++) {
+			p->vis = p->mightSee;
+		}
+	}
+	else {
+		// Portals that might see little are quick and their final vis cuts the
+		// flow through them short for all later ones. Each wave only uses the
+		// waves before it, so the result does not depend on the thread count.
+		std::vector<std::pair<size_t, uint32_t>> order;
+		for (uint32_t i = 0; i < data.portals.size(); i++) {
+			size_t count = 0;
+			for (auto b = data.portals[i].mightSee.begin(); b != data.portals[i].mightSee.end(); b++) {
+				count += countVisBits(*b);
+			}
+			order.push_back({ count, i });
+		}
+		std::sort(order.begin(), order.end());
+
+		for (size_t first = 0; first < order.size(); first += PS_VIS_WAVE_SIZE) {
+			size_t count = std::min((size_t)PS_VIS_WAVE_SIZE, order.size() - first);
+			parallelFor(count, threadCount, [&](size_t i) {
+				flowVisPortal(data, &data.portals[order[first + i].second]);
+			});
+			for (size_t i = 0; i < count; i++) {
+				data.portals[order[first + i].second].isDone = true;
+			}
+		}
+	}
+
+	tree->vis.clear();
+	std::unordered_map<std::string, uint32_t> rowOffsets;
+	VisBits bits;
+	std::vector<uint8_t> row((tree->leaves.size() + 7) / 8), compressed;
+	for (uint32_t leaf = 0; leaf < tree->leaves.size(); leaf++) {
+		if (tree->leaves[leaf].contents != BSP_EMPTY) {
+			tree->leaves[leaf].visOffset = BSP_NO_VIS;
+			continue;
+		}
+
+		bits.assign(data.wordCount, 0);
+		setVisBit(&bits, leaf);
+		for (auto p = data.leafPortals[leaf].begin(); p != data.leafPortals[leaf].end(); p++) {
+			const VisBits& portalVis = data.portals[*p].vis;
+			for (size_t i = 0; i < data.wordCount; i++) {
+				bits[i] |= portalVis[i];
+			}
+		}
+		for (size_t i = 0; i < row.size(); i++) {
+			row[i] = (uint8_t)(bits[i >> 3] >> (8 * (i & 7)));
+		}
+
+		compressed.clear();
+		compressVisRow(row, &compressed);
+		std::string key(compressed.begin(), compressed.end());
+		auto offset = rowOffsets.find(key);
+		if (offset == rowOffsets.end()) {
+			offset = rowOffsets.insert({ key, (uint32_t)tree->vis.size() }).first;
+			tree->vis.insert(tree->vis.end(), compressed.begin(), compressed.end());
+		}
+		tree->leaves[leaf].visOffset = offset->second;
+	}
+
+	return data.portals.size();
+}
+
+void decompressVis(const BSPTree& tree, uint32_t leaf, std::vector<uint8_t>* row)
+{
+	size_t rowSize = (tree.leaves.size() + 7) / 8;
+	uint32_t visOffset = tree.leaves[leaf].visOffset;
+	if (visOffset == BSP_NO_VIS) {
+		row->assign(rowSize, 0xFF);
+		return;
+	}
+
+	row->assign(rowSize, 0);
+	const uint8_t* in = &tree.vis[visOffset];
+	for (size_t i = 0; i < rowSize; ) {
+		if (*in) {
+			(*row)[i++] = *in++;
+		}
+		else {
+			i += in[1];
+			in += 2;
+		}
+	}
+}
+
+#endif
+
+#endif
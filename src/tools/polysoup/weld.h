@@ -0,0 +1,144 @@
+/*
+* Turns a triangle soup into an indexed mesh by welding vertices that are
+* closer than a tolerance to each other.
+*
+* Candidates are found through a spatial hash: space is cut into cubes with
+* an edge length of 'tolerance', and every cube that holds a vertex has a
+* linked list of the vertices in it. Two vertices closer than the tolerance
+* are at most one cube apart, so the own cube and its 26 neighbours are all
+* that has to be searched. The own cube is searched first, exact duplicates
+* (the common case) are found there right away.
+*
+* The first vertex of a cluster is kept as is, so the result only depends on
+* the order of the input.
+*/
+
+#ifndef _WELD_H_
+#define _WELD_H_
+
+#include <vector>
+#include <stdint.h>
+
+#include <glm/glm.hpp>
+
+#include "polysoup.h"
+
+#define PS_WELD_TOLERANCE	(0.001)
+
+struct IndexedMesh
+{
+	std::vector<glm::f64vec3>	vertices;
+	std::vector<uint32_t>		indices;	// Three per triangle
+};
+
+/*
+* tris is what triangulate returns: polygons with three vertices each.
+* tolerance must be > 0.
+*/
+IndexedMesh		weldTriangles(const std::vector<Polygon>& tris, double tolerance = PS_WELD_TOLERANCE);
+
+
+
+/*
+*
+* IMPLEMENTATION
+*
+*/
+
+
+
+#if defined(WELD_IMPLEMENTATION)
+
+#include <unordered_map>
+#include <math.h>
+
+struct WeldGrid
+{
+	double									cellSize;
+	std::unordered_map<uint64_t, uint32_t>	cells;	// First vertex in the cell
+	std::vector<uint32_t>					next;	// Next vertex in the same cell, per vertex
+};
+
+static const uint32_t WELD_NO_VERTEX = 0xFFFFFFFF;
+
+static inline uint64_t getWeldCellKey(int64_t x, int64_t y, int64_t z)
+{
+	// Different cells may end up with the same key. That only makes a list a
+	// bit longer, the distance check sorts it out.
+	uint64_t key = (uint64_t)x * 0x9E3779B97F4A7C15ull;
+	key ^= (uint64_t)y * 0xC2B2AE3D27D4EB4Full;
+	key ^= (uint64_t)z * 0x165667B19E3779F9ull;
+
+	return key;
+}
+
+static uint32_t findWeldVertex(const WeldGrid& grid, const std::vector<glm::f64vec3>& vertices,
+	uint64_t key, const glm::f64vec3& v, double tolerance)
+{
+	auto cell = grid.cells.find(key);
+	if (cell == grid.cells.end()) {
+		return WELD_NO_VERTEX;
+	}
+
+	for (uint32_t i = cell->second; i != WELD_NO_VERTEX; i = grid.next[i]) {
+		glm::f64vec3 d = glm::abs(vertices[i] - v);
+		if (d.x <= tolerance && d.y <= tolerance && d.z <= tolerance) {
+			return i;
+		}
+	}
+
+	return WELD_NO_VERTEX;
+}
+
+static uint32_t addWeldVertex(WeldGrid* grid, std::vector<glm::f64vec3>* vertices, const glm::f64vec3& v, double tolerance)
+{
+	int64_t x = (int64_t)floor(v.x / grid->cellSize);
+	int64_t y = (int64_t)floor(v.y / grid->cellSize);
+	int64_t z = (int64_t)floor(v.z / grid->cellSize);
+	uint64_t key = getWeldCellKey(x, y, z);
+
+	uint32_t index = findWeldVertex(*grid, *vertices, key, v, tolerance);
+	for (int dz = -1; dz <= 1 && index == WELD_NO_VERTEX; dz++) {
+		for (int dy = -1; dy <= 1 && index == WELD_NO_VERTEX; dy++) {
+			for (int dx = -1; dx <= 1 && index == WELD_NO_VERTEX; dx++) {
+				if (dx || dy || dz) {
+					index = findWeldVertex(*grid, *vertices, getWeldCellKey(x + dx, y + dy, z + dz), v, tolerance);
+				}
+			}
+		}
+	}
+	if (index != WELD_NO_VERTEX) {
+		return index;
+	}
+
+	index = (uint32_t)vertices->size();
+	vertices->push_back(v);
+	auto cell = grid->cells.insert({ key, index });
+	grid->next.push_back(cell.second ? WELD_NO_VERTEX : cell.first->second);
+	cell.first->second = index;
+
+	return index;
+}
+
+IndexedMesh weldTriangles(const std::vector<Polygon>& tris, double tolerance)
+{
+	IndexedMesh mesh;
+	mesh.indices.reserve(3 * tris.size());
+
+	WeldGrid grid;
+	grid.cellSize = tolerance;
+	grid.cells.reserve(tris.size());
+	grid.next.reserve(tris.size());
+
+	for (auto t = tris.begin(); t != tris.end(); t++) {
+		for (auto v = t->vertices.begin(); v != t->vertices.end(); v++) {
+			mesh.indices.push_back(addWeldVertex(&grid, &mesh.vertices, *v, tolerance));
+		}
+	}
+
+	return mesh;
+}
+
+#endif
+
+#endif
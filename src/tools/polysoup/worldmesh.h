@@ -0,0 +1,345 @@
+/*
+* world.mesh: the triangles of the world, laid out so the engine can map the
+* file and hand the sections to the GPU as they are.
+*
+* Layout, every offset is a multiple of 16:
+*   WorldMeshHeader
+*   WorldMeshSection[ sectionCount ]
+*   the sections, in the order of the table
+*
+* Sections:
+*   WORLDMESH_VERTICES    WorldMeshVertex, or WorldMeshQuantizedVertex if the
+*                         header has WORLDMESH_QUANTIZED
+*   WORLDMESH_INDICES     uint16_t, relative to the baseVertex of their draw
+*   WORLDMESH_DRAWS       WorldMeshDraw, grouped by material
+*   WORLDMESH_MATERIALS   WorldMeshMaterial, texture names
+*
+* The indices are 16 bit, that is what VKAL's index buffer takes. A material
+* with more than 65536 distinct vertices gets more than one draw. Vertices are
+* shared within a draw if position, normal and texture coordinate are equal.
+* Each draw's triangles are in vertex cache and overdraw order and its vertices
+* in the order the indices use them (see meshopt.h).
+*
+* Quantized vertices store the position as 16 bit UNORM across the bounds of
+* the header and the normal as 8 bit SNORM: 20 bytes instead of 32. Both have
+* four components because those formats are the ones every GPU can fetch.
+*/
+
+#ifndef _WORLDMESH_H_
+#define _WORLDMESH_H_
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "meshopt.h"
+#include "polysoup.h"
+#include "texture.h"
+
+#define WORLDMESH_MAGIC			(0x48534D57) // 'WMSH'
+#define WORLDMESH_VERSION		(1)
+#define WORLDMESH_ALIGNMENT		(16)
+#define WORLDMESH_QUANTIZED		(1 << 0)
+#define WORLDMESH_MAX_VERTICES	(65536)	// Per draw, so 16 bit indices reach all of them
+#define WORLDMESH_NAME_LENGTH	(64)
+
+enum WorldMeshSectionType
+{
+	WORLDMESH_VERTICES,
+	WORLDMESH_INDICES,
+	WORLDMESH_DRAWS,
+	WORLDMESH_MATERIALS,
+	WORLDMESH_SECTION_COUNT
+};
+
+struct WorldMeshHeader
+{
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	flags;
+	uint32_t	sectionCount;
+	float		boundsMin[3];
+	uint32_t	vertexSize;		// Stride of the vertex section
+	float		boundsMax[3];
+	uint32_t	reserved;
+};
+
+struct WorldMeshSection
+{
+	uint32_t	type;
+	uint32_t	count;		// Elements
+	uint32_t	stride;		// Bytes per element
+	uint32_t	reserved;
+	uint64_t	offset;		// From the start of the file
+	uint64_t	size;		// count * stride
+};
+
+struct WorldMeshVertex
+{
+	float		pos[3];
+	float		normal[3];
+	float		uv[2];		// In texels
+};
+
+struct WorldMeshQuantizedVertex
+{
+	uint16_t	pos[4];		// UNORM across the bounds, w = 0
+	int8_t		normal[4];	// SNORM, w = 0
+	float		uv[2];		// In texels
+};
+
+struct WorldMeshDraw
+{
+	uint32_t	material;
+	uint32_t	firstIndex;
+	uint32_t	indexCount;
+	uint32_t	baseVertex;
+	float		boundsMin[3];
+	uint32_t	vertexCount;
+	float		boundsMax[3];
+	uint32_t	reserved;
+};
+
+struct WorldMeshMaterial
+{
+	char		name[WORLDMESH_NAME_LENGTH];	// Zero terminated, cut if longer
+};
+
+struct WorldMesh
+{
+	glm::vec3						boundsMin;
+	glm::vec3						boundsMax;
+	bool							isQuantized;
+	std::vector<WorldMeshVertex>	vertices;	// Always kept as floats here, quantized when written
+	std::vector<uint16_t>			indices;
+	std::vector<WorldMeshDraw>		draws;
+	std::vector<WorldMeshMaterial>	materials;
+};
+
+/*
+* tris: sorted by material (see sortByMaterial), ranges: what it returned.
+* materials: the names the materials refer to.
+* optimize: false keeps the triangles and vertices in input order.
+*/
+WorldMesh	buildWorldMesh(const std::vector<Polygon>& tris, const std::vector<MaterialRange>& ranges,
+				const std::vector<std::string>& materials, bool quantize = false, bool optimize = true);
+bool		writeWorldMesh(const char* fileName, const WorldMesh& mesh);
+
+
+
+/*
+*
+* IMPLEMENTATION
+*
+*/
+
+
+
+#if defined(WORLDMESH_IMPLEMENTATION)
+
+#include <algorithm>
+#include <unordered_map>
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+struct WorldMeshVertexHash
+{
+	size_t operator()(const WorldMeshVertex& v) const
+	{
+		uint64_t hash = 14695981039346656037ull;
+		const uint8_t* bytes = (const uint8_t*)&v;
+		for (size_t i = 0; i < sizeof(v); i++) {
+			hash = (hash ^ bytes[i]) * 1099511628211ull;
+		}
+
+		return (size_t)hash;
+	}
+};
+
+struct WorldMeshVertexEqual
+{
+	bool operator()(const WorldMeshVertex& lhs, const WorldMeshVertex& rhs) const
+	{
+		return !memcmp(&lhs, &rhs, sizeof(WorldMeshVertex));
+	}
+};
+
+/*
+* Appends a finished draw: its vertices and indices are local to it until here.
+*/
+static void addWorldMeshDraw(WorldMesh* mesh, WorldMeshDraw draw, std::vector<WorldMeshVertex>* vertices,
+	std::vector<uint32_t>* indices, bool optimize)
+{
+	if (optimize) {
+		optimizeVertexCache(indices->data(), indices->size(), vertices->size());
+		optimizeOverdraw(indices->data(), indices->size(), vertices->data()->pos, vertices->size(), sizeof(WorldMeshVertex));
+		std::vector<uint32_t> remap;
+		optimizeVertexFetch(indices->data(), indices->size(), vertices->size(), &remap);
+		std::vector<WorldMeshVertex> remapped(remap.size());
+		for (size_t i = 0; i < remap.size(); i++) {
+			remapped[i] = (*vertices)[remap[i]];
+		}
+		vertices->swap(remapped);
+	}
+
+	draw.firstIndex = (uint32_t)mesh->indices.size();
+	draw.indexCount = (uint32_t)indices->size();
+	draw.baseVertex = (uint32_t)mesh->vertices.size();
+	draw.vertexCount = (uint32_t)vertices->size();
+	for (int a = 0; a < 3; a++) {
+		draw.boundsMin[a] = FLT_MAX;
+		draw.boundsMax[a] = -FLT_MAX;
+	}
+	for (auto v = vertices->begin(); v != vertices->end(); v++) {
+		for (int a = 0; a < 3; a++) {
+			draw.boundsMin[a] = std::min(draw.boundsMin[a], v->pos[a]);
+			draw.boundsMax[a] = std::max(draw.boundsMax[a], v->pos[a]);
+		}
+	}
+	mesh->vertices.insert(mesh->vertices.end(), vertices->begin(), vertices->end());
+	for (auto i = indices->begin(); i != indices->end(); i++) {
+		mesh->indices.push_back((uint16_t)*i);
+	}
+	mesh->draws.push_back(draw);
+	vertices->clear();
+	indices->clear();
+}
+
+WorldMesh buildWorldMesh(const std::vector<Polygon>& tris, const std::vector<MaterialRange>& ranges,
+	const std::vector<std::string>& materials, bool quantize, bool optimize)
+{
+	WorldMesh mesh = { };
+	mesh.isQuantized = quantize;
+	mesh.boundsMin = glm::vec3(tris.empty() ? 0.0f : FLT_MAX);
+	mesh.boundsMax = glm::vec3(tris.empty() ? 0.0f : -FLT_MAX);
+
+	for (auto m = materials.begin(); m != materials.end(); m++) {
+		WorldMeshMaterial material = { };
+		strncpy(material.name, m->c_str(), WORLDMESH_NAME_LENGTH - 1);
+		mesh.materials.push_back(material);
+	}
+
+	std::unordered_map<WorldMeshVertex, uint32_t, WorldMeshVertexHash, WorldMeshVertexEqual> drawVertexIds;
+	std::vector<WorldMeshVertex> drawVertices;
+	std::vector<uint32_t> drawIndices;
+	for (auto r = ranges.begin(); r != ranges.end(); r++) {
+		WorldMeshDraw draw = { };
+		draw.material = r->material;
+		for (uint32_t t = r->first; t < r->first + r->count; t++) {
+			const Polygon& tri = tris[t];
+			if (drawVertices.size() + 3 > WORLDMESH_MAX_VERTICES) {
+				addWorldMeshDraw(&mesh, draw, &drawVertices, &drawIndices, optimize);
+				drawVertexIds.clear();
+			}
+
+			for (auto p = tri.vertices.begin(); p != tri.vertices.end(); p++) {
+				glm::f64vec2 uv = getTexCoord(tri.texture, *p);
+				WorldMeshVertex v = {
+					{ (float)p->x, (float)p->y, (float)p->z },
+					{ (float)tri.normal.x, (float)tri.normal.y, (float)tri.normal.z },
+					{ (float)uv.x, (float)uv.y }
+				};
+				auto found = drawVertexIds.emplace(v, (uint32_t)drawVertices.size());
+				if (found.second) {
+					drawVertices.push_back(v);
+				}
+				drawIndices.push_back(found.first->second);
+			}
+		}
+		if (!drawIndices.empty()) {
+			addWorldMeshDraw(&mesh, draw, &drawVertices, &drawIndices, optimize);
+		}
+		drawVertexIds.clear();
+	}
+
+	for (auto d = mesh.draws.begin(); d != mesh.draws.end(); d++) {
+		mesh.boundsMin = glm::min(mesh.boundsMin, glm::vec3(d->boundsMin[0], d->boundsMin[1], d->boundsMin[2]));
+		mesh.boundsMax = glm::max(mesh.boundsMax, glm::vec3(d->boundsMax[0], d->boundsMax[1], d->boundsMax[2]));
+	}
+
+	return mesh;
+}
+
+static void quantizeWorldMeshVertex(const WorldMesh& mesh, const WorldMeshVertex& v, WorldMeshQuantizedVertex* q)
+{
+	*q = { };
+	for (int a = 0; a < 3; a++) {
+		float extent = mesh.boundsMax[a] - mesh.boundsMin[a];
+		float unorm = extent > 0.0f ? (v.pos[a] - mesh.boundsMin[a]) / extent : 0.0f;
+		q->pos[a] = (uint16_t)lroundf(std::min(std::max(unorm, 0.0f), 1.0f) * 65535.0f);
+		q->normal[a] = (int8_t)lroundf(std::min(std::max(v.normal[a], -1.0f), 1.0f) * 127.0f);
+	}
+	q->uv[0] = v.uv[0];
+	q->uv[1] = v.uv[1];
+}
+
+static inline uint64_t alignWorldMesh(uint64_t offset)
+{
+	return (offset + WORLDMESH_ALIGNMENT - 1) & ~(uint64_t)(WORLDMESH_ALIGNMENT - 1);
+}
+
+bool writeWorldMesh(const char* fileName, const WorldMesh& mesh)
+{
+	std::vector<WorldMeshQuantizedVertex> quantized;
+	const void* vertices = mesh.vertices.data();
+	uint32_t vertexSize = sizeof(WorldMeshVertex);
+	if (mesh.isQuantized) {
+		quantized.resize(mesh.vertices.size());
+		for (size_t i = 0; i < mesh.vertices.size(); i++) {
+			quantizeWorldMeshVertex(mesh, mesh.vertices[i], &quantized[i]);
+		}
+		vertices = quantized.data();
+		vertexSize = sizeof(WorldMeshQuantizedVertex);
+	}
+
+	const void* sectionData[WORLDMESH_SECTION_COUNT] = { vertices, mesh.indices.data(), mesh.draws.data(), mesh.materials.data() };
+	WorldMeshSection sections[WORLDMESH_SECTION_COUNT] = {
+		{ WORLDMESH_VERTICES, (uint32_t)mesh.vertices.size(), vertexSize, 0, 0, 0 },
+		{ WORLDMESH_INDICES, (uint32_t)mesh.indices.size(), sizeof(uint16_t), 0, 0, 0 },
+		{ WORLDMESH_DRAWS, (uint32_t)mesh.draws.size(), sizeof(WorldMeshDraw), 0, 0, 0 },
+		{ WORLDMESH_MATERIALS, (uint32_t)mesh.materials.size(), sizeof(WorldMeshMaterial), 0, 0, 0 }
+	};
+	uint64_t offset = alignWorldMesh(sizeof(WorldMeshHeader) + sizeof(sections));
+	for (int s = 0; s < WORLDMESH_SECTION_COUNT; s++) {
+		sections[s].offset = offset;
+		sections[s].size = (uint64_t)sections[s].count * sections[s].stride;
+		offset = alignWorldMesh(offset + sections[s].size);
+	}
+
+	WorldMeshHeader header = { };
+	header.magic = WORLDMESH_MAGIC;
+	header.version = WORLDMESH_VERSION;
+	header.flags = mesh.isQuantized ? WORLDMESH_QUANTIZED : 0;
+	header.sectionCount = WORLDMESH_SECTION_COUNT;
+	header.vertexSize = vertexSize;
+	for (int a = 0; a < 3; a++) {
+		header.boundsMin[a] = mesh.boundsMin[a];
+		header.boundsMax[a] = mesh.boundsMax[a];
+	}
+
+	FILE* file = fopen(fileName, "wb");
+	if (!file) {
+		return false;
+	}
+	static const uint8_t padding[WORLDMESH_ALIGNMENT] = { };
+	bool isWritten = fwrite(&header, sizeof(header), 1, file) == 1;
+	isWritten &= fwrite(sections, sizeof(sections), 1, file) == 1;
+	uint64_t written = sizeof(header) + sizeof(sections);
+	for (int s = 0; s < WORLDMESH_SECTION_COUNT; s++) {
+		isWritten &= fwrite(padding, 1, sections[s].offset - written, file) == sections[s].offset - written;
+		if (sections[s].size > 0) {
+			isWritten &= fwrite(sectionData[s], 1, sections[s].size, file) == sections[s].size;
+		}
+		written = sections[s].offset + sections[s].size;
+	}
+	isWritten &= fwrite(padding, 1, offset - written, file) == offset - written;
+	fclose(file);
+
+	return isWritten;
+}
+
+#endif
+
+#endif